@@ -7,84 +7,458 @@
 // - Added manifest for crash safety
 // - Tree semantics enforcement
 
-use std::collections::{BTreeMap, HashMap};
+use std::alloc::{self, Layout};
+use std::cell::{Cell, RefCell};
+use std::collections::hash_map::RandomState;
+use std::collections::{BTreeMap, HashMap, VecDeque};
+use std::ops::Bound;
+use std::fmt;
 use std::fs::{self, File, OpenOptions};
+use std::future::Future;
+use std::hash::{BuildHasher, Hasher};
 use std::io::{self, BufRead, BufReader, Read, Seek, SeekFrom, Write};
+use std::marker::PhantomData;
 use std::path::{Path, PathBuf};
-use std::sync::{Arc, Condvar, Mutex, RwLock};
+use std::pin::Pin;
+use std::ptr;
+use std::sync::atomic::{AtomicBool, AtomicPtr, AtomicU64, AtomicUsize, Ordering};
+use std::sync::mpsc::{self, Receiver, SyncSender};
+use std::sync::{Arc, Condvar, Mutex, MutexGuard, RwLock, Weak};
+use std::task::{Context, Poll, Waker};
 use std::thread;
-use std::time::{Duration, SystemTime};
+use std::time::{Duration, Instant};
 
-const MAGIC: &[u8] = b"ELKYN03";
+const MAGIC: &[u8] = b"ELKYN07";
+const MAGIC_V6: &[u8] = b"ELKYN06";  // Still read: bloom probes spread over the whole filter
+const MAGIC_V5: &[u8] = b"ELKYN05";  // Still read: blocks without a codec byte
+const MAGIC_V4: &[u8] = b"ELKYN04";  // Still read: whole keys in blocks too
+const MAGIC_V3: &[u8] = b"ELKYN03";  // Still read: no subtomb block either
 const WAL_MAGIC: &[u8] = b"WAL2";
 const RT_SET: u8 = 1;
 const RT_DEL_POINT: u8 = 2;
 const RT_DEL_SUB: u8 = 3;
+const RT_BATCH: u8 = 4;  // WAL only: several entries under one frame and CRC
 const BLOCK_SIZE: usize = 4096;
+const RESTART_INTERVAL: usize = 16;  // Records between whole keys in a block
+const CODEC_NONE: u8 = 0;
+const CODEC_LZ4: u8 = 1;
+const BLOOM_BITS_PER_KEY: usize = 10;
+const BLOOM_BLOCK_BITS: usize = 512;  // One cache line per probe
 const MEMTABLE_THRESHOLD: usize = 256 * 1024;
 const L0_COMPACTION_THRESHOLD: usize = 4;
-const L1_COMPACTION_THRESHOLD: usize = 10;
+const L1_COMPACTION_THRESHOLD: usize = 10;  // L1 target size, in target-sized segments
 const CACHE_SIZE: usize = 32 * 1024 * 1024;
+const CACHE_SHARDS: usize = 16;
 const GROUP_COMMIT_MS: u64 = 10;
+const WAL_BUFFER_LIMIT: usize = 1024 * 1024;  // Wake the committer early past this
+const MAX_IMMUTABLE_MEMTABLES: usize = 4;
+const L0_STALL_SEGMENTS: usize = 12;
+const TARGET_SEGMENT_SIZE: usize = 8 * 1024 * 1024;
+const MANIFEST_REWRITE_EDITS: usize = 1000;
+const COMPACTION_URGENT_SCORE: f64 = 2.0;  // Flushes wake compaction at this score
+const SUBSCRIBER_QUEUE: usize = 1024;
+const HISTOGRAM_BUCKETS: usize = 256;  // Four per power of two of nanoseconds
+const SUBCOMPACTIONS: usize = 4;
+const RATE_LIMIT_BURST_DIV: u64 = 10;  // The limiter banks at most a tenth of a second of bandwidth
+const OPEN_THREADS: usize = 8;  // Most threads opening segments at startup
+const OPEN_SEGMENTS_PER_THREAD: usize = 16;  // Fewer aren't worth a thread
+const READ_THREADS: usize = 8;  // Most threads loading blocks for one multi_get
+const COLD_BLOCKS_PER_THREAD: usize = 8;  // Fewer disk reads aren't worth a thread
+const MAX_FRAME: usize = 64 * 1024 * 1024;  // Larger protocol frames are refused
+const OP_GET: u8 = 1;
+const OP_SET: u8 = 2;
+const OP_DELETE: u8 = 3;
+const OP_DELETE_SUBTREE: u8 = 4;
+const OP_SCAN: u8 = 5;
+const OP_SUBSCRIBE: u8 = 6;
+const ST_OK: u8 = 0;
+const ST_NOT_FOUND: u8 = 1;
+const ST_ERROR: u8 = 2;
+const ST_EVENT: u8 = 3;
+const INDEX_PREFIX: &str = "\0idx/";     // Secondary index entries, under the index name
+const INDEX_DEFS: &str = "\0idxdef/";    // Index name -> pattern
+
+/// Per-write durability mode.
+///
+/// - `None`: the write skips the WAL and is only durable once its memtable is flushed
+/// - `Buffered`: the record is queued for the group-commit leader, which fdatasyncs
+///   it within `GROUP_COMMIT_MS` (the default used by `set`/`delete`)
+/// - `Sync`: the caller is parked until its record has been fdatasync'd
+///
+/// Modes compare weakest first.
+#[derive(Debug, Clone, Copy, PartialEq, Eq, PartialOrd, Ord)]
+pub enum Durability {
+    None,
+    Buffered,
+    Sync,
+}
+
+/// Tuning knobs for `Store::open_with_options`; `Store::open` uses the defaults.
+#[derive(Debug, Clone)]
+pub struct Options {
+    /// Memtable size in bytes at which it is sealed and queued for flushing
+    pub memtable_size: usize,
+    /// Writers stall while this many sealed memtables are waiting to be flushed
+    pub max_immutable_memtables: usize,
+    /// Writers stall while L0 holds this many segments, until compaction catches up
+    pub l0_stall_segments: usize,
+    /// Read segments through a memory map instead of the block cache (unix only;
+    /// quietly falls back to the cache elsewhere)
+    pub use_mmap: bool,
+    /// Block cache capacity in bytes, for segments that are not mapped
+    pub cache_capacity: usize,
+    /// Compaction splits its output into segments of about this many bytes
+    pub target_segment_size: usize,
+    /// Block codec for segments written to L0, L1 and L2. Blocks that would
+    /// not shrink are stored plain whatever the setting.
+    pub compression: [Compression; 3],
+    /// Bloom filter bits per key (and per distinct path prefix) in new segments
+    pub bloom_bits_per_key: usize,
+    /// Events a subscriber may fall behind before it is dropped
+    pub subscriber_queue: usize,
+    /// Compactions split their key range into up to this many parts, merged
+    /// in parallel. Each part writes at least one target-sized segment.
+    pub subcompactions: usize,
+    /// Cap on compaction write bandwidth in bytes per second, 0 for none.
+    /// L0 to L1 compactions are charged but never wait, so L0 keeps draining
+    /// and deeper levels absorb the throttling.
+    pub compaction_rate_limit: u64,
+}
+
+/// Segment block codec, see `Options::compression`
+#[derive(Debug, Clone, Copy, PartialEq, Eq)]
+pub enum Compression {
+    None,
+    Lz4,
+}
+
+impl Default for Options {
+    fn default() -> Self {
+        Options {
+            memtable_size: MEMTABLE_THRESHOLD,
+            max_immutable_memtables: MAX_IMMUTABLE_MEMTABLES,
+            l0_stall_segments: L0_STALL_SEGMENTS,
+            use_mmap: true,
+            cache_capacity: CACHE_SIZE,
+            target_segment_size: TARGET_SEGMENT_SIZE,
+            compression: [Compression::None, Compression::Lz4, Compression::Lz4],
+            bloom_bits_per_key: BLOOM_BITS_PER_KEY,
+            subscriber_queue: SUBSCRIBER_QUEUE,
+            subcompactions: SUBCOMPACTIONS,
+            compaction_rate_limit: 0,
+        }
+    }
+}
+
+/// Writes applied together by `Store::write`: they get consecutive seqs and go
+/// to the WAL as one framed, CRC'd record, so after a crash either all of them
+/// are replayed or none are. Ops apply in the order they were added.
+#[derive(Debug, Clone, Default)]
+pub struct WriteBatch {
+    ops: Vec<BatchOp>,
+}
+
+#[derive(Debug, Clone)]
+enum BatchOp {
+    Set(String, String, bool),
+    Delete(String),
+    DeleteSubtree(String),
+}
+
+impl WriteBatch {
+    pub fn new() -> Self {
+        WriteBatch::default()
+    }
+    
+    /// Same as `Store::set`
+    pub fn set(&mut self, path: &str, value: &str, replace_subtree: bool) -> &mut Self {
+        self.ops.push(BatchOp::Set(path.to_string(), value.to_string(), replace_subtree));
+        self
+    }
+    
+    pub fn delete(&mut self, path: &str) -> &mut Self {
+        self.ops.push(BatchOp::Delete(path.to_string()));
+        self
+    }
+    
+    pub fn delete_subtree(&mut self, prefix: &str) -> &mut Self {
+        self.ops.push(BatchOp::DeleteSubtree(subtree_prefix(prefix)));
+        self
+    }
+    
+    pub fn len(&self) -> usize {
+        self.ops.len()
+    }
+    
+    pub fn is_empty(&self) -> bool {
+        self.ops.is_empty()
+    }
+    
+    pub fn clear(&mut self) {
+        self.ops.clear();
+    }
+}
 
 #[derive(Debug, Clone)]
 pub struct Store {
     dir: PathBuf,
-    inner: Arc<RwLock<StoreInner>>,
+    version: Arc<VersionSlot>,
     wal: Arc<GroupCommitWAL>,
     cache: Arc<BlockCache>,
     manifest: Arc<Mutex<Manifest>>,
-    compaction_shutdown: Arc<(Mutex<bool>, Condvar)>,
+    options: Options,
+    flush_lock: Arc<Mutex<()>>,  // One memtable flush at a time
+    compaction_locks: Arc<[Mutex<()>; 2]>,  // One L0->L1 and one L1->L2 compaction at a time
+    compacting: Arc<(Mutex<Vec<u64>>, Condvar)>,  // Ids of segments running compactions will replace
+    limiter: Arc<RateLimiter>,  // Compaction write bandwidth
+    compact_pointer: Arc<Mutex<String>>,  // Where the next L1 compaction starts
+    flusher: Arc<(Mutex<FlushSignal>, Condvar)>,
+    stall: Arc<(Mutex<()>, Condvar)>,  // Stalled writers wait here for a flush or compaction
+    compaction_shutdown: Arc<(Mutex<bool>, Condvar)>,  // Also notified to wake compaction early
+    metrics: Arc<Metrics>,
+    indexes: Arc<Indexes>,
+}
+
+// Secondary indexes. A record at <parent>/<field> that an index covers has
+// an entry at \0idx/<name>/<value>/<parent>, written in the same WAL record
+// as the record itself. Writes skip the lock while there are none.
+#[derive(Debug, Default)]
+struct Indexes {
+    count: AtomicUsize,
+    defs: RwLock<Vec<IndexDef>>,
 }
 
 #[derive(Debug)]
+struct IndexDef {
+    name: String,
+    glob: Glob,
+    field: String,  // Literal last component of the pattern
+    depth: usize,   // Slashes in the pattern; '*' may not match across one
+}
+
+impl IndexDef {
+    // Whether the index covers `path`: like orderByChild, only the field of
+    // a direct child at the pattern's depth, never one nested deeper
+    fn covers(&self, path: &str) -> bool {
+        path.len() > self.field.len() && self.glob.matches(path.as_bytes()) && index_depth(path) == self.depth
+    }
+}
+
+#[derive(Debug, Default)]
+struct FlushSignal {
+    pending: bool,   // A memtable was sealed since the flush thread last looked
+    shutdown: bool,
+}
+
+// An immutable view of the store. Changes build a modified copy and publish it
+// through the VersionSlot; readers keep whatever version they loaded.
+#[derive(Debug, Clone)]
 struct StoreInner {
-    seq: u64,
-    memtable: BTreeMap<String, MemValue>,
-    memtable_size: usize,
+    mem: Arc<MemTable>,              // Active memtable, newest data
+    imm: Vec<(Arc<MemTable>, u64)>,  // Sealed memtables awaiting flush with their last seq, oldest first
     segments_l0: Vec<Arc<Segment>>,
     segments_l1: Vec<Arc<Segment>>,
     segments_l2: Vec<Arc<Segment>>,
-    subtombs: HashMap<String, u64>,
+    subtombs: Arc<SubtombIndex>,
+    read_seq: u64,  // Newest seq reads may see: u64::MAX, or a snapshot's seq
 }
 
-#[derive(Debug, Clone)]
-enum MemValue {
-    Scalar(String, u64),
-    PointTomb(u64),
+/// A consistent point-in-time view from `Store::snapshot`: reads see every
+/// write up to `seq()` and nothing after, without holding any store lock.
+/// Holding one pins its memtables and segment files, compacted away or not,
+/// so long-lived snapshots cost memory and disk until dropped.
+pub struct Snapshot<'a> {
+    store: &'a Store,
+    inner: Arc<StoreInner>,
+}
+
+// Live subtree tombstones by prefix. Prefixes end in '/', so whether a key is
+// covered takes one lookup per path component of the key rather than a scan
+// of every subtomb.
+#[derive(Debug, Clone, Default)]
+struct SubtombIndex {
+    prefixes: BTreeMap<String, Subtomb>,
+}
+
+#[derive(Debug, Clone, Copy)]
+struct Subtomb {
+    seq: u64,
+    persisted: bool,  // Written to a segment; until then only the WAL has it
 }
 
+// Current StoreInner plus a version number, so readers can reuse a thread-local
+// copy without locking as long as the number hasn't moved
+#[derive(Debug)]
+struct VersionSlot {
+    number: AtomicU64,
+    current: Mutex<Arc<StoreInner>>,
+}
+
+// Group commit: writers serialize records into a shared buffer and get back an
+// LSN. Whoever needs durability first becomes the leader, writes the whole buffer
+// with one write + fdatasync, and wakes every waiter its batch covered.
 #[derive(Debug)]
 struct GroupCommitWAL {
-    path: PathBuf,
-    buffer: Mutex<Vec<WALEntry>>,
-    // sync_interval: Duration, // Currently using const GROUP_COMMIT_MS
+    file: Mutex<WalFile>,    // Only touched by the current commit leader
+    state: Mutex<WalState>,
+    durable: Condvar,        // Signalled whenever a commit finishes
+    work: Condvar,           // Wakes the background committer early
     shutdown: Arc<(Mutex<bool>, Condvar)>,
+    feed: Arc<ChangeFeed>,   // Subscribers, fed as seqs are assigned
+    inflight: [AtomicUsize; 2],  // Writes between seq assignment and insert, by epoch
+    snapshots: Mutex<()>,        // One read point capture at a time
+    syncs: Histogram,
+}
+
+/// A change at or below a subscribed path. `value` is None for deletes; for
+/// a subtree delete `key` is the removed prefix, ending in '/'.
+#[derive(Debug, Clone, PartialEq, Eq)]
+pub struct Event {
+    pub seq: u64,
+    pub key: String,
+    pub value: Option<String>,
+}
+
+/// Events for one path from `Store::subscribe`, in seq order. Iterating
+/// blocks for the next event and ends if the subscriber fell more than
+/// `Options::subscriber_queue` events behind: it is dropped rather than stall writers,
+/// and can resume with `Store::subscribe_from` at the last seq it saw.
+pub struct Subscription {
+    backlog: VecDeque<Event>,  // Replayed from the WAL, delivered before live events
+    rx: Receiver<Event>,
+    id: u64,
+    path: Vec<String>,
+    feed: Arc<ChangeFeed>,
+}
+
+// Subscribers in a trie of path components, so an event only visits the
+// nodes along its key (and, for subtree deletes, the subtree below it)
+#[derive(Debug, Default)]
+struct ChangeFeed {
+    queue: usize,
+    count: AtomicUsize,  // Lets writes skip the lock while nobody listens
+    next_id: AtomicU64,
+    root: Mutex<FeedNode>,
+}
+
+#[derive(Debug, Default)]
+struct FeedNode {
+    children: HashMap<String, FeedNode>,
+    subscribers: Vec<(u64, SyncSender<Event>)>,
+}
+
+/// A connection to a store served by `Store::serve`. Requests sent together
+/// through `pipeline` go out in one write and are answered in order; the
+/// server groups runs of writes into one `WriteBatch` and runs of gets onto
+/// one version.
+pub struct Client {
+    reader: BufReader<Box<dyn Read + Send>>,
+    writer: Box<dyn Write + Send>,
+    durability: Durability,  // Sent with every write
+    buf: Vec<u8>,
+}
+
+/// One request in a `Client::pipeline`
+#[derive(Debug, Clone, PartialEq, Eq)]
+pub enum Request {
+    Get(String),
+    Set(String, String, bool),
+    Delete(String),
+    DeleteSubtree(String),
+    Scan(String, String, usize),  // start, end, limit
+}
+
+/// The answer to a `Request`, in the same position of the pipeline
+#[derive(Debug, Clone, PartialEq, Eq)]
+pub enum Response {
+    Value(Option<String>),
+    Done,
+    Pairs(Vec<(String, String)>),
+    Error(String),
+}
+
+/// Events from `Client::subscribe`, which hands the connection over to them
+pub struct RemoteSubscription {
+    reader: BufReader<Box<dyn Read + Send>>,
+    buf: Vec<u8>,
+}
+
+#[derive(Debug)]
+struct WalFile {
+    dir: PathBuf,
+    file: File,
+    len: u64,        // Bytes known to be written, used to roll back a failed write
+    synced: bool,    // The header and directory entry are durable
+    sealed: Vec<File>,  // Earlier files with unsynced tails, synced by the next commit
+}
+
+#[derive(Debug)]
+struct WalState {
+    buffer: Vec<u8>,     // Framed records not yet handed to the OS
+    spare: Vec<u8>,      // Recycled buffer swapped in by the leader
+    appended_lsn: u64,   // LSN of the last record in `buffer`
+    durable_lsn: u64,    // Every record up to this LSN has been fdatasync'd
+    committing: bool,    // A leader is currently writing a batch
+    last_seq: u64,       // Seqs are assigned here so WAL order matches seq order
+    mem: Arc<MemTable>,  // Memtable that newly assigned seqs belong to
+    epoch: usize,        // Slot of `inflight` that new writes count in
+    wakers: Vec<(u64, Waker)>,  // DurableWrite futures waiting for their LSN
+    failed: Option<(u64, io::ErrorKind, String)>,  // Last failed commit and the LSN it covered
+}
+
+/// Completes once a write from `Store::write_deferred` has been fdatasync'd
+/// by the group-commit leader, without parking a thread meanwhile.
+pub struct DurableWrite {
+    wal: Arc<GroupCommitWAL>,
+    lsn: u64,
 }
 
 #[derive(Debug)]
-struct WALEntry {
+struct WALEntry<'a> {
     seq: u64,
     kind: u8,
-    key: String,
-    value: Option<String>,
+    key: &'a str,
+    value: Option<&'a str>,
 }
 
 #[derive(Debug)]
 struct Segment {
+    id: u64,  // Process-unique, keys this segment's blocks in the cache
     path: PathBuf,
-    // seq_low: u64,     // Not currently used but may be useful for compaction
+    file: File,  // Kept open for positional reads; stays valid after the file is unlinked
+    seq_low: u64,  // Range over records; subtomb seqs are not included
     seq_high: u64,
     // key_count: usize, // Not currently used but may be useful for stats
     bloom: Option<BloomFilter>,
-    index: Vec<(String, u64)>,
-    index_start: u64,  // FIXED: Store where blocks end
+    index: BlockIndex,
+    blocks_end: u64,  // FIXED: Store where blocks end
+    delta_keys: bool,  // Blocks are prefix compressed with restart points (ELKYN05)
+    framed: bool,      // Blocks start with their codec byte (ELKYN06)
+    mmap: Option<Mmap>,  // Whole file mapped; blocks are then slices of it
+    subtombs: Vec<(String, u64)>,  // Subtree tombstones stored with this segment, by prefix
+    min_key: String,  // Covers records and subtomb prefixes; both empty when there are none
+    max_key: String,
+    size: u64,  // File length, for level sizing
+}
+
+// First key and file offset of every block, kept as the index block itself,
+// klen(4) | offset(8) | key per block, plus where each entry starts: two
+// allocations per segment, and searching allocates nothing. A mapped
+// segment's index stays in the mapping.
+#[derive(Debug, Default)]
+struct BlockIndex {
+    data: Vec<u8>,                  // Empty when `mapped` is set
+    mapped: Option<(usize, usize)>, // Range of the index block in the mapping
+    starts: Vec<u32>,
 }
 
 #[derive(Debug)]
 struct Manifest {
     path: PathBuf,
     entries: Vec<ManifestEntry>,
+    checkpoint: u64,  // Highest seq whose data is guaranteed to be in segments
+    next_file: u64,   // Numbers compaction outputs so names are never reused
+    edits: usize,     // Lines in the log; it is rewritten past MANIFEST_REWRITE_EDITS
 }
 
 #[derive(Debug, Clone)]
@@ -94,18 +468,127 @@ struct ManifestEntry {
     filename: String,
 }
 
+// From ELKYN07 a key's probes all land in one 64-byte block picked by its
+// xxh64 hash, with the bits inside it from double hashing. Older segments
+// spread `hash_count` separate hash passes over the whole filter.
 #[derive(Debug)]
 struct BloomFilter {
     bits: Vec<u8>,
     bit_count: usize,
     hash_count: usize,  // FIXED: Store hash count
+    blocked: bool,
+}
+
+/// Block cache counters, see `Store::cache_stats`
+#[derive(Debug, Clone, Default, PartialEq, Eq)]
+pub struct CacheStats {
+    pub hits: u64,
+    pub misses: u64,
+    pub evictions: u64,
+    pub size_bytes: usize,
+    pub capacity_bytes: usize,
+}
+
+/// Latency of one instrumented operation, see `Stats`. Percentiles are
+/// accurate to within a fifth of their value.
+#[derive(Debug, Clone, Default, PartialEq, Eq)]
+pub struct LatencyStats {
+    pub count: u64,
+    pub sum_ns: u64,
+    pub p50_ns: u64,
+    pub p99_ns: u64,
+    pub max_ns: u64,
+}
+
+/// Counters and latencies since open, see `Store::stats`
+#[derive(Debug, Clone, Default, PartialEq)]
+pub struct Stats {
+    pub writes: LatencyStats,       // set, delete and batch writes, stalls included
+    pub gets: LatencyStats,
+    pub flushes: LatencyStats,      // Memtable to L0 segment
+    pub compactions: LatencyStats,
+    pub wal_syncs: LatencyStats,    // Group commit write and fdatasync
+    pub cache_loads: LatencyStats,  // Block reads on a cache miss
+    pub cache: CacheStats,
+    pub segments: [usize; 3],
+    pub immutable_memtables: usize,
+    pub write_stalls: u64,
+    pub write_stall_ns: u64,
+    pub segment_gets: u64,          // Point reads that got past the memtables
+    pub segment_probes: u64,        // Segments those reads searched
+    pub bloom_negatives: u64,       // Segments skipped by key range or bloom
+    pub bloom_false_positives: u64, // Segments searched without finding the key
+    pub flush_errors: u64,
+    pub compaction_errors: u64,
+    pub last_background_error: Option<String>,
 }
 
+// Blocks keyed by (segment id, offset), spread over independently locked
+// shards. Each shard evicts with CLOCK: hits only set a reference bit under
+// the read lock, and the hand gives referenced blocks a second chance.
 #[derive(Debug)]
 struct BlockCache {
-    cache: RwLock<HashMap<(PathBuf, u64), Arc<Vec<u8>>>>,
-    size: RwLock<usize>,
-    max_size: usize,
+    shards: Vec<RwLock<CacheShard>>,
+    hits: AtomicU64,
+    misses: AtomicU64,
+    evictions: AtomicU64,
+    loads: Histogram,
+    capacity: usize,
+}
+
+#[derive(Debug)]
+struct CacheShard {
+    map: HashMap<(u64, u64), usize>,  // Key -> index into `slots`
+    slots: Vec<CacheSlot>,
+    hand: usize,
+    size: usize,
+    capacity: usize,
+}
+
+#[derive(Debug)]
+struct CacheSlot {
+    key: (u64, u64),
+    data: Arc<Vec<u8>>,
+    referenced: AtomicBool,
+}
+
+impl<'a> Snapshot<'a> {
+    /// Seq of the newest write this view sees
+    pub fn seq(&self) -> u64 {
+        self.inner.read_seq
+    }
+    
+    pub fn get(&self, path: &str) -> io::Result<Option<String>> {
+        self.store.get_in(&self.inner, path)
+    }
+    
+    pub fn get_range(&self, start: &str, end: &str) -> io::Result<Vec<(String, String)>> {
+        self.get_range_limit(start, end, usize::MAX)
+    }
+    
+    pub fn get_range_limit(&self, start: &str, end: &str, limit: usize) -> io::Result<Vec<(String, String)>> {
+        self.iter_range(start, end)?.take(limit).collect()
+    }
+    
+    pub fn iter_range(&self, start: &str, end: &str) -> io::Result<RangeIter> {
+        self.store.scan(&self.inner, start, ScanStop::End(end.to_string()))
+    }
+    
+    pub fn scan_prefix(&self, prefix: &str, limit: usize) -> io::Result<Vec<(String, String)>> {
+        self.store.scan(&self.inner, prefix, ScanStop::Prefix(prefix.to_string()))?.take(limit).collect()
+    }
+    
+    pub fn get_pattern(&self, pattern: &str) -> io::Result<Vec<(String, String)>> {
+        self.store.scan_pattern(&self.inner, pattern)?.collect()
+    }
+    
+    pub fn get_subtree_to<W: Write>(&self, prefix: &str, out: &mut W) -> io::Result<bool> {
+        self.get_subtree_to_depth(prefix, usize::MAX, out)
+    }
+    
+    pub fn get_subtree_to_depth<W: Write>(&self, prefix: &str, depth: usize, out: &mut W) -> io::Result<bool> {
+        self.store.write_subtree(&self.inner, &subtree_prefix(prefix), depth.max(1), out)
+    }
 }
 
 impl Drop for Store {
@@ -116,6 +599,12 @@ impl Drop for Store {
         *shutdown = true;
         cvar.notify_all();
         
+        // Signal flush thread shutdown; sealed memtables left behind are
+        // still in the WAL and get replayed on the next open
+        let (flush_lock, flush_cvar) = &*self.flusher;
+        flush_lock.lock().unwrap().shutdown = true;
+        flush_cvar.notify_all();
+        
         // Signal compaction thread shutdown
         let (comp_lock, comp_cvar) = &*self.compaction_shutdown;
         let mut comp_shutdown = comp_lock.lock().unwrap();
@@ -129,47 +618,40 @@ impl Drop for Store {
 
 impl Store {
     pub fn open(dir: &Path) -> io::Result<Self> {
+        Self::open_with_options(dir, Options::default())
+    }
+    
+    pub fn open_with_options(dir: &Path, mut options: Options) -> io::Result<Self> {
         fs::create_dir_all(dir)?;
         
-        let wal_path = dir.join("wal.log");
+        // Compaction only starts at L0_COMPACTION_THRESHOLD segments, so a lower
+        // stall limit would never clear
+        options.l0_stall_segments = options.l0_stall_segments.max(L0_COMPACTION_THRESHOLD + 1);
+        options.max_immutable_memtables = options.max_immutable_memtables.max(1);
+        options.subscriber_queue = options.subscriber_queue.max(1);  // 0 would be a rendezvous channel
+        
         let manifest_path = dir.join("manifest.log");
         
         // Load manifest
         let manifest = Arc::new(Mutex::new(Manifest::load(&manifest_path)?));
         
-        // Create WAL with background flusher
-        let wal = Arc::new(GroupCommitWAL::new(&wal_path)?);
-        
-        // Start background WAL flusher thread
-        let wal_clone = wal.clone();
-        thread::spawn(move || {
-            loop {
-                thread::sleep(Duration::from_millis(GROUP_COMMIT_MS));
-                // Silently ignore sync errors - WAL will retry on next interval
-                let _ = wal_clone.sync_now();
-                
-                let shutdown = wal_clone.shutdown.0.lock().unwrap();
-                if *shutdown {
-                    break;
-                }
-            }
-        });
-        
         let mut inner = StoreInner {
-            seq: 0,
-            memtable: BTreeMap::new(),
-            memtable_size: 0,
+            mem: Arc::new(MemTable::new()),
+            imm: Vec::new(),
             segments_l0: Vec::new(),
             segments_l1: Vec::new(),
             segments_l2: Vec::new(),
-            subtombs: HashMap::new(),
+            subtombs: Arc::new(SubtombIndex::default()),
+            read_seq: u64::MAX,
         };
+        let mut last_seq = 0;
         
         // Load segments from manifest
         let manifest_lock = manifest.lock().unwrap();
-        for entry in &manifest_lock.entries {
-            let seg_path = dir.join(&entry.filename);
-            if let Ok(seg) = Segment::open(&seg_path) {
+        let checkpoint = manifest_lock.checkpoint;
+        let opened = open_segments(dir, &manifest_lock.entries, options.use_mmap);
+        for (entry, seg) in manifest_lock.entries.iter().zip(opened) {
+            if let Ok(seg) = seg {
                 let seq_high = seg.seq_high;
                 match entry.level {
                     0 => inner.segments_l0.push(Arc::new(seg)),
@@ -177,1230 +659,3109 @@ impl Store {
                     2 => inner.segments_l2.push(Arc::new(seg)),
                     _ => {}
                 }
-                if seq_high > inner.seq {
-                    inner.seq = seq_high;
+                if seq_high > last_seq {
+                    last_seq = seq_high;
                 }
             }
         }
         drop(manifest_lock);
         
-        // Replay WAL
-        inner.replay_wal(&wal_path)?;
+        // Subtombs persisted with segments; the WAL only holds newer ones
+        {
+            let subtombs = Arc::make_mut(&mut inner.subtombs);
+            for seg in inner.segments_l0.iter().chain(&inner.segments_l1).chain(&inner.segments_l2) {
+                for (prefix, seq) in &seg.subtombs {
+                    subtombs.insert(prefix, *seq, true);
+                }
+            }
+        }
+        
+        // Levels below L0 are kept sorted by key range. A level whose ranges
+        // overlap, as written before compaction was leveled, is searched as
+        // L0 until compaction sorts it out. Levels above it go with it so L0
+        // still holds the newest data, and L0 stays ordered oldest first.
+        let disjoint = |level: &Vec<Arc<Segment>>| {
+            let mut sorted = level.clone();
+            sort_level(&mut sorted);
+            level_disjoint(&sorted)
+        };
+        let l2_overlaps = !disjoint(&inner.segments_l2);
+        if l2_overlaps || !disjoint(&inner.segments_l1) {
+            let l0 = std::mem::replace(&mut inner.segments_l0, Vec::new());
+            if l2_overlaps {
+                inner.segments_l0.append(&mut inner.segments_l2);
+            }
+            inner.segments_l0.append(&mut inner.segments_l1);
+            inner.segments_l0.extend(l0);
+        }
+        sort_level(&mut inner.segments_l1);
+        sort_level(&mut inner.segments_l2);
+        
+        if checkpoint > last_seq {
+            last_seq = checkpoint;
+        }
+        
+        // Replay WAL files. A file is covered by the checkpoint when the next
+        // file starts at or below checkpoint + 1; its data is already in segments.
+        let wal_files = list_wal_files(dir)?;
+        let mut last_valid_len = None;
+        for (i, (_, path)) in wal_files.iter().enumerate() {
+            let covered = wal_files.get(i + 1)
+                .map_or(false, |(next_start, _)| *next_start <= checkpoint + 1);
+            if covered {
+                let _ = fs::remove_file(path);
+                continue;
+            }
+            last_valid_len = Some(inner.replay_wal(path, checkpoint, &mut last_seq)?);
+        }
+        
+        // Append to wal_<seq+1>.log. If that file already exists it is the newest
+        // one, so trim any torn tail left by a crash before appending to it.
+        let start_seq = last_seq + 1;
+        let reuse_len = match wal_files.last() {
+            Some((start, _)) if *start == start_seq => last_valid_len,
+            _ => None,
+        };
+        let wal = Arc::new(GroupCommitWAL::open(dir, start_seq, reuse_len, inner.mem.clone(), options.subscriber_queue)?);
+        
+        // Start background WAL committer thread
+        let wal_clone = wal.clone();
+        thread::spawn(move || {
+            wal_clone.committer_thread();
+        });
         
         let compaction_shutdown = Arc::new((Mutex::new(false), Condvar::new()));
         
         let store = Store {
             dir: dir.to_path_buf(),
-            inner: Arc::new(RwLock::new(inner)),
+            version: Arc::new(VersionSlot::new(inner)),
             wal,
-            cache: Arc::new(BlockCache::new(CACHE_SIZE)),
+            cache: Arc::new(BlockCache::new(options.cache_capacity)),
+            limiter: Arc::new(RateLimiter::new(options.compaction_rate_limit)),
             manifest,
+            options,
+            flush_lock: Arc::new(Mutex::new(())),
+            compaction_locks: Arc::new([Mutex::new(()), Mutex::new(())]),
+            compacting: Arc::new((Mutex::new(Vec::new()), Condvar::new())),
+            compact_pointer: Arc::new(Mutex::new(String::new())),
+            flusher: Arc::new((Mutex::new(FlushSignal::default()), Condvar::new())),
+            stall: Arc::new((Mutex::new(()), Condvar::new())),
             compaction_shutdown: compaction_shutdown.clone(),
+            metrics: Arc::new(Metrics::default()),
+            indexes: Arc::new(Indexes::default()),
         };
         
-        // Start compaction thread
+        for (key, pattern) in store.scan_prefix(INDEX_DEFS, usize::MAX)? {
+            store.add_index(&key[INDEX_DEFS.len()..], &pattern)?;
+        }
+        
+        // Start flush thread
         let store_clone = store.clone();
         thread::spawn(move || {
-            store_clone.compaction_thread();
+            store_clone.flush_thread();
         });
         
+        // Start compaction threads: L0->L1 gets its own, so it never queues
+        // behind a long L1->L2 merge
+        for level in 0..2 {
+            let store_clone = store.clone();
+            thread::spawn(move || {
+                store_clone.compaction_thread(level);
+            });
+        }
+        
         Ok(store)
     }
     
     pub fn set(&self, path: &str, value: &str, replace_subtree: bool) -> io::Result<()> {
-        // Check parent isn't a scalar (tree semantics)
-        if let Some(parent) = parent_path(path) {
-            if self.get(&parent)?.is_some() {
-                return Err(io::Error::new(
-                    io::ErrorKind::InvalidInput,
-                    "Cannot write under scalar parent"
-                ));
-            }
-        }
-        
-        let mut inner = self.inner.write().unwrap();
-        inner.seq += 1;
-        let seq = inner.seq;
-        
+        self.set_with(path, value, replace_subtree, Durability::Buffered)
+    }
+    
+    pub fn set_with(&self, path: &str, value: &str, replace_subtree: bool, durability: Durability) -> io::Result<()> {
+        let inner = self.version.load();
+        self.check_ancestors(&inner, path)?;
+        let mut updates = Vec::new();
+        self.index_updates(path, Some(value), || self.get_in(&inner, path), &mut updates)?;
+        drop(inner);
+        
+        let prefix = format!("{}/", path);
+        let mut entries = Vec::with_capacity(2 + updates.len());
         if replace_subtree {
-            // Emit subtomb for prefix
-            let prefix = format!("{}/", path);
-            self.wal.append(&WALEntry {
-                seq,
-                kind: RT_DEL_SUB,
-                key: prefix.clone(),
-                value: None,
-            })?;
-            inner.subtombs.insert(prefix, seq);
-            
-            // Emit point tombstone for the node itself (if it was scalar)
-            self.wal.append(&WALEntry {
-                seq,
-                kind: RT_DEL_POINT,
-                key: path.to_string(),
-                value: None,
-            })?;
-            inner.memtable.insert(path.to_string(), MemValue::PointTomb(seq));
+            // Emit subtomb for prefix. It gets its own seq just below the value's,
+            // so the value itself is never covered by it.
+            entries.push(WALEntry { seq: 0, kind: RT_DEL_SUB, key: &prefix, value: None });
         }
+        entries.push(WALEntry { seq: 0, kind: RT_SET, key: path, value: Some(value) });
+        push_index_updates(&mut entries, &updates);
         
-        // Set the scalar value
-        self.wal.append(&WALEntry {
-            seq,
-            kind: RT_SET,
-            key: path.to_string(),
-            value: Some(value.to_string()),
-        })?;
-        
-        inner.memtable.insert(path.to_string(), MemValue::Scalar(value.to_string(), seq));
-        inner.memtable_size += path.len() + value.len() + 16;
-        
-        if inner.memtable_size >= MEMTABLE_THRESHOLD {
-            self.flush_memtable_locked(&mut inner)?;
+        self.write_entries(&mut entries, durability)
+    }
+    
+    pub fn write(&self, batch: &WriteBatch) -> io::Result<()> {
+        self.write_with(batch, Durability::Buffered)
+    }
+    
+    /// Apply every op of `batch` atomically. Fails without writing anything if
+    /// a set would land under a scalar, judged against the store as modified by
+    /// the ops before it in the batch.
+    pub fn write_with(&self, batch: &WriteBatch, durability: Durability) -> io::Result<()> {
+        let started = Instant::now();
+        let lsn = self.apply_batch(batch, durability != Durability::None)?;
+        if durability == Durability::Sync {
+            self.wal.commit(lsn)?;
         }
-        
+        self.metrics.writes.record(started);
         Ok(())
     }
     
-    pub fn get(&self, path: &str) -> io::Result<Option<String>> {
-        let inner = self.inner.read().unwrap();
-        
-        // Check if this is a subtree query
-        if path.ends_with('/') {
-            return self.get_subtree(&inner, path);
+    /// Apply `batch` as `write_with(batch, Durability::Sync)` would, but return
+    /// once it is visible. The future completes when its WAL record is durable.
+    pub fn write_deferred(&self, batch: &WriteBatch) -> io::Result<DurableWrite> {
+        let started = Instant::now();
+        let lsn = self.apply_batch(batch, true)?;
+        self.metrics.writes.record(started);
+        Ok(DurableWrite { wal: self.wal.clone(), lsn })
+    }
+    
+    // Validate and apply `batch`, returning the LSN of its WAL record (0 for an
+    // empty batch, which writes nothing)
+    fn apply_batch(&self, batch: &WriteBatch, log: bool) -> io::Result<u64> {
+        self.apply_batch_checked(batch, log)?
+    }
+    
+    // As apply_batch, but the outer error means the batch was rejected before
+    // any of it was applied, and the inner one that applying it failed
+    fn apply_batch_checked(&self, batch: &WriteBatch, log: bool) -> io::Result<io::Result<u64>> {
+        if batch.is_empty() {
+            return Ok(Ok(0));
         }
         
-        // Check memtable
-        if let Some(mv) = inner.memtable.get(path) {
-            match mv {
-                MemValue::Scalar(v, seq) if !self.covered_by_subtomb(&inner, path, *seq) => {
-                    return Ok(Some(v.clone()));
+        // Child prefixes of replacing sets, in op order
+        let prefixes: Vec<String> = batch.ops.iter()
+            .filter_map(|op| match op {
+                BatchOp::Set(path, _, true) => Some(format!("{}/", path)),
+                _ => None,
+            })
+            .collect();
+        let mut prefixes = prefixes.iter();
+        
+        let inner = self.version.load();
+        
+        // What the batch itself has done to a path so far: Some(true) once it
+        // set a scalar there, Some(false) once it removed it
+        let mut local: HashMap<&str, bool> = HashMap::new();
+        let mut removed: Vec<&str> = Vec::new();
+        let mut entries = Vec::with_capacity(batch.ops.len() + 1);
+        
+        // Index entries need each path's old value the same way: what the
+        // ops before left there, else the store's
+        let mut updates = Vec::new();
+        let mut staged: HashMap<&str, Option<&str>> = HashMap::new();
+        let mut cleared: Vec<&str> = Vec::new();
+        
+        for op in &batch.ops {
+            match op {
+                BatchOp::Set(path, value, replace_subtree) => {
+                    for (i, _) in path.match_indices('/').filter(|&(i, _)| i > 0) {
+                        let ancestor = &path[..i];
+                        let scalar = match local.get(ancestor) {
+                            Some(&scalar) => scalar,
+                            None => {
+                                let gone = removed.iter().any(|prefix| ancestor.starts_with(prefix));
+                                !gone && self.is_scalar(&inner, ancestor)?
+                            }
+                        };
+                        if scalar {
+                            return Err(scalar_parent_error());
+                        }
+                    }
+                    
+                    let old = staged_value(&staged, &cleared, path);
+                    self.index_updates(path, Some(value), || old.map_or_else(|| self.get_in(&inner, path), Ok), &mut updates)?;
+                    staged.insert(path.as_str(), Some(value.as_str()));
+                    
+                    if *replace_subtree {
+                        let prefix = prefixes.next().unwrap();
+                        entries.push(WALEntry { seq: 0, kind: RT_DEL_SUB, key: prefix, value: None });
+                        staged.retain(|staged, _| !staged.starts_with(prefix.as_str()));
+                        cleared.push(prefix);
+                    }
+                    entries.push(WALEntry { seq: 0, kind: RT_SET, key: path, value: Some(value) });
+                    local.insert(path, true);
                 }
-                _ => return Ok(None),
-            }
-        }
-        
-        // Check segments
-        let mut result: Option<(Option<String>, u64)> = None;
-        
-        for seg in inner.segments_l0.iter()
-            .chain(inner.segments_l1.iter())
-            .chain(inner.segments_l2.iter())
-        {
-            if let Some(bloom) = &seg.bloom {
-                if !bloom.might_contain(path) {
-                    continue;
+                BatchOp::Delete(path) => {
+                    let old = staged_value(&staged, &cleared, path);
+                    self.index_updates(path, None, || old.map_or_else(|| self.get_in(&inner, path), Ok), &mut updates)?;
+                    staged.insert(path.as_str(), None);
+                    
+                    entries.push(WALEntry { seq: 0, kind: RT_DEL_POINT, key: path, value: None });
+                    local.insert(path, false);
                 }
-            }
-            
-            if let Some((val_opt, seq)) = self.get_from_segment(seg, path)? {
-                if !self.covered_by_subtomb(&inner, path, seq) {
-                    if result.is_none() || seq > result.as_ref().unwrap().1 {
-                        result = Some((val_opt, seq));
+                BatchOp::DeleteSubtree(prefix) => {
+                    entries.push(WALEntry { seq: 0, kind: RT_DEL_SUB, key: prefix, value: None });
+                    for (path, scalar) in local.iter_mut() {
+                        if path.starts_with(prefix.as_str()) {
+                            *scalar = false;
+                        }
                     }
+                    removed.push(prefix);
+                    staged.retain(|staged, _| !staged.starts_with(prefix.as_str()));
+                    cleared.push(prefix);
                 }
             }
         }
         
-        // Handle the result - None in value means tombstone
-        match result {
-            Some((Some(v), _)) => Ok(Some(v)),
-            Some((None, _)) => Ok(None), // Tombstone
-            None => Ok(None), // Not found
-        }
+        push_index_updates(&mut entries, &updates);
+        Ok(self.apply_entries(&mut entries, log))
     }
     
-    fn get_subtree(&self, inner: &std::sync::RwLockReadGuard<StoreInner>, prefix: &str) -> io::Result<Option<String>> {
-        let mut tree = BTreeMap::new();
+    fn write_entries(&self, entries: &mut [WALEntry], durability: Durability) -> io::Result<()> {
+        let started = Instant::now();
+        let lsn = self.apply_entries(entries, durability != Durability::None)?;
         
-        // Collect from memtable
-        for (k, v) in &inner.memtable {
-            if k.starts_with(prefix) {
-                if let MemValue::Scalar(val, seq) = v {
-                    if !self.covered_by_subtomb(inner, k, *seq) {
-                        tree.insert(k.clone(), (val.clone(), *seq));
-                    }
-                }
-            }
+        // Wait outside any lock so concurrent writers join the same commit
+        if durability == Durability::Sync {
+            self.wal.commit(lsn)?;
         }
         
-        // Collect from segments
-        for seg in inner.segments_l0.iter()
-            .chain(inner.segments_l1.iter())
-            .chain(inner.segments_l2.iter())
-        {
-            for (k, v, seq) in self.scan_segment(seg, prefix, &format!("{}~", prefix))? {
-                if !self.covered_by_subtomb(inner, &k, seq) {
-                    if !tree.contains_key(&k) || tree[&k].1 < seq {
-                        tree.insert(k, (v, seq));
+        self.metrics.writes.record(started);
+        Ok(())
+    }
+    
+    // Common write path: assign seqs and log, install subtombs, then insert into
+    // the pinned memtable. None of it takes a store-wide lock; only subtombs
+    // republish the version. Returns the LSN to commit for durability.
+    fn apply_entries(&self, entries: &mut [WALEntry], log: bool) -> io::Result<u64> {
+        self.wait_for_room();
+        
+        // Subtombs go in first so a reader never sees a replacing value while
+        // the children it replaced are still visible
+        let version = &self.version;
+        let (lsn, pin) = self.wal.append(entries, log, |entries| {
+            if entries.iter().any(|e| e.kind == RT_DEL_SUB) {
+                version.update(|inner| {
+                    let subtombs = Arc::make_mut(&mut inner.subtombs);
+                    for entry in entries.iter().filter(|e| e.kind == RT_DEL_SUB) {
+                        subtombs.insert(entry.key, entry.seq, false);
                     }
-                }
+                });
             }
+        });
+        
+        for entry in entries.iter().filter(|e| e.kind != RT_DEL_SUB) {
+            pin.mem.insert(entry.seq, entry.kind, entry.key, entry.value.unwrap_or(""));
         }
         
-        if tree.is_empty() {
-            return Ok(None);
+        let mem = pin.mem.clone();
+        drop(pin);
+        
+        // Whoever fills the memtable seals it and hands it to the flush thread
+        if mem.approximate_size() >= self.options.memtable_size {
+            self.seal_memtable(Some(&mem))?;
+            
+            let (lock, cvar) = &*self.flusher;
+            let mut signal = lock.lock().unwrap();
+            if signal.shutdown {
+                // No flush thread left to hand it to
+                drop(signal);
+                self.flush_immutables()?;
+            } else {
+                signal.pending = true;
+                cvar.notify_one();
+            }
         }
         
-        // Convert to nested JSON
-        Ok(Some(self.tree_to_json(&tree, prefix)))
+        Ok(lsn)
     }
     
-    fn tree_to_json(&self, tree: &BTreeMap<String, (String, u64)>, prefix: &str) -> String {
-        use std::collections::BTreeMap as TreeMap;
-        
-        #[derive(Debug)]
-        enum JsonNode {
-            Value(String),
-            Object(TreeMap<String, JsonNode>),
+    // Write stall: block while too many sealed memtables or L0 segments are
+    // queued, so flushing and compaction can catch up. Never stalls once the
+    // background threads have shut down.
+    fn wait_for_room(&self) {
+        if !self.write_would_stall() {
+            return;
         }
         
-        fn insert_path(root: &mut TreeMap<String, JsonNode>, parts: &[&str], value: String) {
-            if parts.is_empty() {
-                return;
-            }
-            
-            if parts.len() == 1 {
-                root.insert(parts[0].to_string(), JsonNode::Value(value));
-            } else {
-                let entry = root.entry(parts[0].to_string())
-                    .or_insert_with(|| JsonNode::Object(TreeMap::new()));
-                
-                if let JsonNode::Object(obj) = entry {
-                    insert_path(obj, &parts[1..], value);
-                }
-            }
+        let started = Instant::now();
+        let (lock, cvar) = &*self.stall;
+        let mut guard = lock.lock().unwrap();
+        while self.write_would_stall() && !self.flusher.0.lock().unwrap().shutdown {
+            guard = cvar.wait_timeout(guard, Duration::from_millis(GROUP_COMMIT_MS)).unwrap().0;
+        }
+        self.metrics.write_stalls.fetch_add(1, Ordering::Relaxed);
+        self.metrics.write_stall_ns.fetch_add(started.elapsed().as_nanos() as u64, Ordering::Relaxed);
+    }
+    
+    /// Whether a write issued now would wait for flushing or compaction to
+    /// catch up
+    pub fn write_would_stall(&self) -> bool {
+        let inner = self.version.load();
+        inner.imm.len() >= self.options.max_immutable_memtables
+            || inner.segments_l0.len() >= self.options.l0_stall_segments
+    }
+    
+    /// Whether `batch` would apply without touching disk: no stall, no
+    /// memtable to seal, and every ancestor and old value it reads already in
+    /// memory, as `get_if_resident` sees it
+    pub fn write_is_resident(&self, batch: &WriteBatch) -> bool {
+        if self.write_would_stall() {
+            return false;
         }
         
-        // Build hierarchical structure
-        let mut root = TreeMap::new();
+        // Memtable bytes the batch adds, as MemTable::insert counts them; with
+        // indexes, room for an old and a new index entry per op as well
+        let indexed = self.indexes.count.load(Ordering::Acquire) > 0;
+        let added: usize = batch.ops.iter()
+            .map(|op| match op {
+                BatchOp::Set(path, value, _) => 2 * path.len() + value.len() + 32,
+                BatchOp::Delete(path) | BatchOp::DeleteSubtree(path) => path.len() + 16,
+            })
+            .sum::<usize>() * if indexed { 3 } else { 1 };
+        if self.version.load().mem.approximate_size() + added >= self.options.memtable_size {
+            return false;
+        }
         
-        for (full_path, (value, _)) in tree {
-            let relative = &full_path[prefix.len()..];
-            let parts: Vec<&str> = relative.split('/').filter(|s| !s.is_empty()).collect();
-            
-            if parts.is_empty() {
-                continue;
+        let resident = |path: &str| self.resident_get(path).is_some();
+        batch.ops.iter().all(|op| match op {
+            BatchOp::Set(path, _, _) => {
+                path.match_indices('/').all(|(i, _)| i == 0 || resident(&path[..i]))
+                    && (!indexed || resident(path))
             }
-            
-            // Insert into tree structure
-            insert_path(&mut root, &parts, value.clone());
+            BatchOp::Delete(path) => !indexed || resident(path),
+            BatchOp::DeleteSubtree(_) => true,
+        })
+    }
+    
+    // Wake stalled writers after a flush or compaction changed the version
+    fn release_stalled(&self) {
+        let (lock, cvar) = &*self.stall;
+        let _guard = lock.lock().unwrap();
+        cvar.notify_all();
+    }
+    
+    pub fn get(&self, path: &str) -> io::Result<Option<String>> {
+        let started = Instant::now();
+        let result = self.get_in(&self.version.load(), path);
+        self.metrics.gets.record(started);
+        result
+    }
+    
+    fn get_in(&self, inner: &StoreInner, path: &str) -> io::Result<Option<String>> {
+        // Check if this is a subtree query
+        if path.ends_with('/') {
+            return self.get_subtree(inner, path);
         }
         
-        // Convert to JSON string
-        fn node_to_json(node: &JsonNode) -> String {
-            match node {
-                JsonNode::Value(s) => {
-                    format!("\"{}\"", s.replace('\\', "\\\\").replace('"', "\\\""))
-                }
-                JsonNode::Object(map) => {
-                    if map.is_empty() {
-                        return "{}".to_string();
-                    }
-                    
-                    let items: Vec<String> = map.iter().map(|(k, v)| {
-                        format!("\"{}\":{}", 
-                            k.replace('"', "\\\""),
-                            node_to_json(v))
-                    }).collect();
-                    
-                    format!("{{{}}}", items.join(","))
+        // Check memtables, newest first
+        for mem in inner.memtables() {
+            if let Some(entry) = mem.get_at(path, inner.read_seq) {
+                if entry.kind == RT_SET && !inner.subtombs.covers(path, entry.seq) {
+                    return Ok(Some(entry.value.to_string()));
                 }
+                return Ok(None);
             }
         }
         
-        node_to_json(&JsonNode::Object(root))
+        self.get_from_segments(inner, path)
     }
     
-    fn covered_by_subtomb(&self, inner: &std::sync::RwLockReadGuard<StoreInner>, key: &str, seq: u64) -> bool {
-        for (prefix, tomb_seq) in &inner.subtombs {
-            if key.starts_with(prefix) && *tomb_seq >= seq {  // FIXED: >= not >
-                return true;
-            }
+    /// A point-in-time view for reads that must agree with each other, such
+    /// as an export running next to live writes
+    pub fn snapshot(&self) -> Snapshot<'_> {
+        let (seq, live) = self.wal.read_point(|| self.version.load());
+        let mut inner = (*live).clone();
+        inner.read_seq = seq;
+        Snapshot { store: self, inner: Arc::new(inner) }
+    }
+    
+    /// `get` for callers that must not block on disk: `None` when the answer
+    /// needs a block that is neither mapped nor cached, or the path is a
+    /// subtree. Mapped pages are taken to be resident.
+    pub fn get_if_resident(&self, path: &str) -> Option<io::Result<Option<String>>> {
+        let started = Instant::now();
+        let result = self.resident_get(path);
+        if result.is_some() {
+            self.metrics.gets.record(started);
         }
-        false
+        result
     }
     
-    fn get_from_segment(&self, seg: &Arc<Segment>, key: &str) -> io::Result<Option<(Option<String>, u64)>> {
-        // Returns Some((Some(value), seq)) for RT_SET
-        // Returns Some((None, seq)) for RT_DEL_POINT
-        // Returns None for not found
-        // Binary search index
-        let idx = match seg.index.binary_search_by_key(&key.to_string(), |(k, _)| k.clone()) {
-            Ok(i) => i,
-            Err(i) if i > 0 => i - 1,
-            _ => return Ok(None),
-        };
-        
-        let (_, offset) = &seg.index[idx];
-        let next_offset = if idx + 1 < seg.index.len() {
-            seg.index[idx + 1].1
-        } else {
-            seg.index_start  // FIXED: Use index_start, not file len
-        };
-        
-        let block_data = self.cache.get_or_load(&seg.path, *offset, (next_offset - offset) as usize)?;
-        
-        // Parse block
-        let mut pos = 0;
-        while pos + 8 < block_data.len() {
-            let mut seq_bytes = [0u8; 8];
-            seq_bytes.copy_from_slice(&block_data[pos..pos + 8]);
-            let seq = u64::from_le_bytes(seq_bytes);
-            pos += 8;
-            
-            if pos >= block_data.len() {
-                break;
-            }
-            
-            let rec_type = block_data[pos];
-            pos += 1;
-            
-            if pos + 4 > block_data.len() {
-                break;
-            }
-            
-            let mut klen_bytes = [0u8; 4];
-            klen_bytes.copy_from_slice(&block_data[pos..pos + 4]);
-            let klen = u32::from_le_bytes(klen_bytes) as usize;
-            pos += 4;
-            
-            // FIXED: Consistent ordering - klen, vlen, key, value
-            if pos + 4 > block_data.len() {
-                break;
-            }
-            
-            let mut vlen_bytes = [0u8; 4];
-            vlen_bytes.copy_from_slice(&block_data[pos..pos + 4]);
-            let vlen = u32::from_le_bytes(vlen_bytes) as usize;
-            pos += 4;
-            
-            if pos + klen > block_data.len() {
-                break;
-            }
-            
-            let k = String::from_utf8_lossy(&block_data[pos..pos + klen]);
-            pos += klen;
-            
-            if k == key {
-                if rec_type == RT_SET {
-                    if pos + vlen > block_data.len() {
-                        break;
-                    }
-                    let v = String::from_utf8_lossy(&block_data[pos..pos + vlen]);
-                    return Ok(Some((Some(v.to_string()), seq)));
-                } else if rec_type == RT_DEL_POINT {
-                    // Return tombstone marker
-                    return Ok(Some((None, seq)));
-                }
+    fn resident_get(&self, path: &str) -> Option<io::Result<Option<String>>> {
+        if path.ends_with('/') {
+            return None;
+        }
+        let inner = self.version.load();
+        for mem in inner.memtables() {
+            if let Some(entry) = mem.get(path) {
+                let visible = entry.kind == RT_SET && !inner.subtombs.covers(path, entry.seq);
+                return Some(Ok(if visible { Some(entry.value.to_string()) } else { None }));
             }
-            
-            pos += vlen;
         }
         
-        Ok(None)
+        // Every block the segment lookup could touch must be in memory already
+        let l0 = inner.segments_l0.iter();
+        let deeper = [&inner.segments_l1, &inner.segments_l2].iter()
+            .filter_map(|level| level_segment(level, path))
+            .collect::<Vec<_>>();
+        let resident = l0.chain(deeper)
+            .filter(|seg| seg.may_contain(path))
+            .all(|seg| seg.block_for(path).map_or(true, |idx| seg.block_resident(idx, &self.cache)));
+        if !resident {
+            return None;
+        }
+        Some(self.get_from_segments(&inner, path))
     }
     
-    fn scan_segment(&self, seg: &Arc<Segment>, start: &str, end: &str) -> io::Result<Vec<(String, String, u64)>> {
-        let mut results = Vec::new();
+    // Newest live value of `path` among the segments
+    fn get_from_segments(&self, inner: &StoreInner, path: &str) -> io::Result<Option<String>> {
+        // L0 segments overlap, so take the newest version among them
+        let mut result: Option<(Option<String>, u64)> = None;
+        let metrics = &self.metrics;
+        metrics.segment_gets.fetch_add(1, Ordering::Relaxed);
         
-        for (idx_key, offset) in &seg.index {
-            if idx_key.as_str() >= start && idx_key.as_str() < end {
-                let next_offset = seg.index.iter()
-                    .find(|(k, _)| k > idx_key)
-                    .map(|(_, o)| *o)
-                    .unwrap_or(seg.index_start);  // FIXED: Use index_start
-                
-                let block_data = self.cache.get_or_load(&seg.path, *offset, (next_offset - offset) as usize)?;
-                
-                let mut pos = 0;
-                while pos + 8 < block_data.len() {
-                    let mut seq_bytes = [0u8; 8];
-                    seq_bytes.copy_from_slice(&block_data[pos..pos + 8]);
-                    let seq = u64::from_le_bytes(seq_bytes);
-                    pos += 8;
-                    
-                    if pos >= block_data.len() {
-                        break;
-                    }
-                    
-                    let rec_type = block_data[pos];
-                    pos += 1;
-                    
-                    if pos + 8 > block_data.len() {
-                        break;
-                    }
-                    
-                    let mut klen_bytes = [0u8; 4];
-                    klen_bytes.copy_from_slice(&block_data[pos..pos + 4]);
-                    let klen = u32::from_le_bytes(klen_bytes) as usize;
-                    pos += 4;
-                    
-                    let mut vlen_bytes = [0u8; 4];
-                    vlen_bytes.copy_from_slice(&block_data[pos..pos + 4]);
-                    let vlen = u32::from_le_bytes(vlen_bytes) as usize;
-                    pos += 4;
-                    
-                    if pos + klen + vlen > block_data.len() {
-                        break;
-                    }
-                    
-                    let k = String::from_utf8_lossy(&block_data[pos..pos + klen]);
-                    pos += klen;
-                    
-                    if k.as_ref() >= start && k.as_ref() < end && rec_type == RT_SET {
-                        let v = String::from_utf8_lossy(&block_data[pos..pos + vlen]);
-                        results.push((k.to_string(), v.to_string(), seq));
-                    }
-                    
-                    pos += vlen;
+        for seg in &inner.segments_l0 {
+            if !metrics.filter(seg.may_contain(path)) {
+                continue;
+            }
+            
+            if let Some((val_opt, seq)) = metrics.probed(self.get_from_segment(seg, path)?) {
+                if result.is_none() || seq > result.as_ref().unwrap().1 {
+                    result = Some((val_opt, seq));
                 }
             }
         }
         
-        Ok(results)
-    }
-    
-    fn flush_memtable_locked(&self, inner: &mut StoreInner) -> io::Result<()> {
-        if inner.memtable.is_empty() {
-            return Ok(());
-        }
-        
-        let filename = format!("l0_{:010}.seg", inner.seq);
-        let path = self.dir.join(&filename);
-        
-        let mut writer = SegmentWriter::new(&path)?;
-        
-        for (k, v) in &inner.memtable {
-            match v {
-                MemValue::Scalar(val, seq) => {
-                    writer.add(RT_SET, k, Some(val), *seq)?;
-                }
-                MemValue::PointTomb(seq) => {
-                    writer.add(RT_DEL_POINT, k, None, *seq)?;
+        // Deeper levels hold disjoint ranges of older data: one segment per
+        // level can have the key, and the first hit is the newest
+        if result.is_none() {
+            for level in [&inner.segments_l1, &inner.segments_l2].iter() {
+                let seg = match level_segment(level, path) {
+                    Some(seg) if metrics.filter(seg.may_contain(path)) => seg,
+                    _ => continue,
+                };
+                
+                result = metrics.probed(self.get_from_segment(seg, path)?);
+                if result.is_some() {
+                    break;
                 }
             }
         }
         
-        let seg = writer.finish()?;
-        
-        // Update manifest
-        {
-            let mut manifest = self.manifest.lock().unwrap();
-            manifest.add_entry(ManifestEntry {
-                seq_high: seg.seq_high,
-                level: 0,
-                filename,
-            })?;
+        // Handle the result - None in value means tombstone. Older versions
+        // are covered by a subtomb whenever the newest one is.
+        match result {
+            Some((Some(v), seq)) if !inner.subtombs.covers(path, seq) => Ok(Some(v)),
+            Some(_) => Ok(None), // Tombstone
+            None => Ok(None), // Not found
         }
-        
-        inner.segments_l0.push(Arc::new(seg));
-        inner.memtable.clear();
-        inner.memtable_size = 0;
-        
-        self.wal.sync_now()?;
-        
-        Ok(())
-    }
-    
-    pub fn flush(&self) -> io::Result<()> {
-        let mut inner = self.inner.write().unwrap();
-        self.flush_memtable_locked(&mut inner)?;
-        self.wal.sync_now()?;
-        Ok(())
-    }
-    
-    pub fn delete(&self, path: &str) -> io::Result<()> {
-        let mut inner = self.inner.write().unwrap();
-        inner.seq += 1;
-        let seq = inner.seq;
-        
-        self.wal.append(&WALEntry {
-            seq,
-            kind: RT_DEL_POINT,
-            key: path.to_string(),
-            value: None,
-        })?;
-        
-        inner.memtable.insert(path.to_string(), MemValue::PointTomb(seq));
-        Ok(())
     }
     
-    pub fn segment_counts(&self) -> (usize, usize, usize) {
-        let inner = self.inner.read().unwrap();
-        (inner.segments_l0.len(), inner.segments_l1.len(), inner.segments_l2.len())
+    /// `get` for many paths against one version, answered in the order of
+    /// `paths`. The paths are sorted so each segment's blooms are checked in
+    /// one pass and the survivors fall into runs sharing a block: every block
+    /// is fetched and searched once for all the paths it may hold, and blocks
+    /// that have to come off disk are loaded in parallel.
+    pub fn multi_get(&self, paths: &[&str]) -> io::Result<Vec<Option<String>>> {
+        self.multi_get_in(&self.version.load(), paths)
     }
     
-    pub fn get_range(&self, start: &str, end: &str) -> io::Result<Vec<(String, String)>> {
-        self.get_range_limit(start, end, usize::MAX)
+    // One gets sample per path, each the batch's time split evenly
+    fn multi_get_in(&self, inner: &StoreInner, paths: &[&str]) -> io::Result<Vec<Option<String>>> {
+        let started = Instant::now();
+        let result = self.lookup_many(inner, paths);
+        self.metrics.gets.record_each(started, paths.len());
+        result
     }
     
-    pub fn get_range_limit(&self, start: &str, end: &str, limit: usize) -> io::Result<Vec<(String, String)>> {
-        let inner = self.inner.read().unwrap();
-        let mut results = BTreeMap::new();
-        
-        // Collect from memtable
-        for (k, v) in &inner.memtable {
-            if k.as_str() >= start && k.as_str() < end {
-                match v {
-                    MemValue::Scalar(val, seq) => {
-                        if !self.covered_by_subtomb(&inner, k, *seq) {
-                            results.insert(k.clone(), (val.clone(), *seq));
-                        }
-                    }
-                    MemValue::PointTomb(seq) => {
-                        // Mark as tombstone
-                        results.insert(k.clone(), (String::new(), *seq | (1u64 << 63)));
-                    }
-                }
+    fn lookup_many(&self, inner: &StoreInner, paths: &[&str]) -> io::Result<Vec<Option<String>>> {
+        let mut results = vec![None; paths.len()];
+        
+        // Distinct point paths in order, each with the inputs it answers
+        let mut order: Vec<usize> = (0..paths.len()).collect();
+        order.sort_by_key(|&i| paths[i]);
+        let mut lookups: Vec<PendingGet> = Vec::new();
+        for (n, &i) in order.iter().enumerate() {
+            let path = paths[i];
+            if path.ends_with('/') {
+                results[i] = self.get_subtree(inner, path)?;
+                continue;
+            }
+            match lookups.last_mut() {
+                Some(last) if last.path == path => last.inputs.end = n + 1,
+                _ => lookups.push(PendingGet { path, inputs: n..n + 1, found: None, settled: false }),
             }
         }
         
-        // Collect from all segments
-        for segment in inner.segments_l0.iter()
-            .chain(inner.segments_l1.iter())
-            .chain(inner.segments_l2.iter())
-        {
-            self.collect_range_from_segment(segment, start, end, &mut results)?;
+        // Memtables, newest first: a hit there settles the path
+        for lookup in &mut lookups {
+            if let Some(entry) = inner.memtables().find_map(|mem| mem.get_at(lookup.path, inner.read_seq)) {
+                let value = if entry.kind == RT_SET { Some(entry.value.to_string()) } else { None };
+                lookup.found = Some((value, entry.seq));
+                lookup.settled = true;
+            }
         }
         
-        // Filter out tombstones and apply limit
-        let mut final_results = Vec::new();
-        for (key, (value, seq)) in results {
-            if seq & (1u64 << 63) == 0 {  // Not a tombstone marker
-                final_results.push((key, value));
-                if final_results.len() >= limit {
-                    break;
-                }
-            }
+        let metrics = &self.metrics;
+        let pending: Vec<usize> = (0..lookups.len()).filter(|&li| !lookups[li].settled).collect();
+        metrics.segment_gets.fetch_add(pending.len() as u64, Ordering::Relaxed);
+        
+        // L0 segments overlap, so every one may hold a newer version
+        let mut probes = Vec::new();
+        for seg in &inner.segments_l0 {
+            probes.extend(pending.iter().copied()
+                .filter(|&li| metrics.filter(seg.may_contain(lookups[li].path)))
+                .map(|li| (seg, li)));
+        }
+        self.probe_blocks(&mut lookups, &probes)?;
+        
+        // Deeper levels hold disjoint ranges of older data: one segment per
+        // level for the paths still missing, and the first hit is the newest
+        for level in [&inner.segments_l1, &inner.segments_l2].iter() {
+            let probes: Vec<_> = pending.iter().copied()
+                .filter(|&li| lookups[li].found.is_none())
+                .filter_map(|li| match level_segment(level, lookups[li].path) {
+                    Some(seg) if metrics.filter(seg.may_contain(lookups[li].path)) => Some((seg, li)),
+                    _ => None,
+                })
+                .collect();
+            self.probe_blocks(&mut lookups, &probes)?;
         }
         
-        Ok(final_results)
-    }
-    
-    pub fn scan_prefix(&self, prefix: &str, limit: usize) -> io::Result<Vec<(String, String)>> {
-        // Use max char as end bound for prefix scan
-        let end = format!("{}~", prefix);  // ~ comes after most chars
-        self.get_range_limit(prefix, &end, limit)
+        for lookup in lookups {
+            let value = match lookup.found {
+                Some((Some(v), seq)) if !inner.subtombs.covers(lookup.path, seq) => Some(v),
+                _ => None,
+            };
+            for &i in &order[lookup.inputs] {
+                results[i] = value.clone();
+            }
+        }
+        Ok(results)
     }
     
-    fn collect_range_from_segment(&self, seg: &Arc<Segment>, start: &str, end: &str, 
-                                   results: &mut BTreeMap<String, (String, u64)>) -> io::Result<()> {
-        // Find starting position in index
-        let start_idx = match seg.index.binary_search_by_key(&start.to_string(), |(k, _)| k.clone()) {
-            Ok(i) => i,
-            Err(i) => i.saturating_sub(1),  // Include the block before start
-        };
-        
-        // Iterate through relevant index entries
-        for idx in start_idx..seg.index.len() {
-            let (block_key, offset) = &seg.index[idx];
-            
-            // Skip if we're past the end
-            if block_key.as_str() >= end {
-                break;
-            }
-            
-            // Read the block
-            let next_offset = if idx + 1 < seg.index.len() {
-                seg.index[idx + 1].1
-            } else {
-                seg.index_start
-            };
-            
-            let block_data = self.cache.get_or_load(&seg.path, *offset, (next_offset - offset) as usize)?;
-            
-            // Parse all records in block
-            let mut pos = 0;
-            while pos + 8 < block_data.len() {
-                let mut seq_bytes = [0u8; 8];
-                seq_bytes.copy_from_slice(&block_data[pos..pos + 8]);
-                let seq = u64::from_le_bytes(seq_bytes);
-                pos += 8;
-                
-                if pos >= block_data.len() {
-                    break;
-                }
-                
-                let rec_type = block_data[pos];
-                pos += 1;
-                
-                if pos + 8 > block_data.len() {
-                    break;
-                }
-                
-                let mut klen_bytes = [0u8; 4];
-                klen_bytes.copy_from_slice(&block_data[pos..pos + 4]);
-                let klen = u32::from_le_bytes(klen_bytes) as usize;
-                pos += 4;
-                
-                let mut vlen_bytes = [0u8; 4];
-                vlen_bytes.copy_from_slice(&block_data[pos..pos + 4]);
-                let vlen = u32::from_le_bytes(vlen_bytes) as usize;
-                pos += 4;
-                
-                if pos + klen + vlen > block_data.len() {
-                    break;
+    // Search segments for lookups, keeping the newest version each turns up.
+    // `probes` come in path order per segment, so the paths that share a
+    // block are adjacent and the block is loaded once for all of them.
+    fn probe_blocks(&self, lookups: &mut [PendingGet], probes: &[(&Arc<Segment>, usize)]) -> io::Result<()> {
+        let mut groups: Vec<(&Arc<Segment>, usize, Vec<usize>)> = Vec::new();
+        for &(seg, li) in probes {
+            let idx = match seg.block_for(lookups[li].path) {
+                Some(idx) => idx,
+                None => {
+                    self.metrics.probed(None::<()>);
+                    continue;
                 }
-                
-                let k = String::from_utf8_lossy(&block_data[pos..pos + klen]).to_string();
-                pos += klen;
-                
-                // Check if key is in range
-                if k.as_str() >= start && k.as_str() < end {
-                    // Don't check subtombs here - will be checked at higher level
-                    {
-                        match rec_type {
-                            RT_SET => {
-                                let v = String::from_utf8_lossy(&block_data[pos..pos + vlen]).to_string();
-                                // Only update if newer
-                                if let Some((_, existing_seq)) = results.get(&k) {
-                                    if seq > (*existing_seq & !(1u64 << 63)) {
-                                        results.insert(k, (v, seq));
-                                    }
-                                } else {
-                                    results.insert(k, (v, seq));
-                                }
-                            }
-                            RT_DEL_POINT => {
-                                // Mark as tombstone with high bit set
-                                if let Some((_, existing_seq)) = results.get(&k) {
-                                    if seq > (*existing_seq & !(1u64 << 63)) {
-                                        results.insert(k, (String::new(), seq | (1u64 << 63)));
-                                    }
-                                } else {
-                                    results.insert(k, (String::new(), seq | (1u64 << 63)));
-                                }
-                            }
-                            _ => {}
-                        }
+            };
+            match groups.last_mut() {
+                Some((last, block, members)) if Arc::ptr_eq(last, seg) && *block == idx => members.push(li),
+                _ => groups.push((seg, idx, vec![li])),
+            }
+        }
+        
+        let blocks = self.load_blocks(&groups)?;
+        for ((seg, _, members), block) in groups.iter().zip(&blocks) {
+            let mut cursor = BlockCursor::new(block, seg.delta_keys);
+            for &li in members {
+                let lookup = &mut lookups[li];
+                if let Some((value, seq)) = self.metrics.probed(block_record(&mut cursor, block, lookup.path)) {
+                    if lookup.found.as_ref().map_or(true, |found| seq > found.1) {
+                        lookup.found = Some((value, seq));
                     }
                 }
-                
-                pos += vlen;
             }
         }
-        
         Ok(())
     }
     
-    // Wildcard pattern matching - supports * (zero or more chars) and ? (single char)
-    pub fn get_pattern(&self, pattern: &str) -> io::Result<Vec<(String, String)>> {
-        let inner = self.inner.read().unwrap();
-        let mut results = BTreeMap::new();
-        
-        // Check memtable
-        for (key, value) in &inner.memtable {
-            if Self::matches_pattern(key, pattern) {
-                match value {
-                    MemValue::Scalar(v, seq) => {
-                        if !self.covered_by_subtomb(&inner, key, *seq) {
-                            results.insert(key.clone(), Some(v.clone()));
-                        } else {
-                            results.insert(key.clone(), None);
-                        }
-                    }
-                    MemValue::PointTomb(_) => {
-                        results.insert(key.clone(), None);
-                    }
-                }
-            }
+    // The blocks of `groups`, in order. Once enough of them would come off
+    // disk they are spread over a few threads.
+    fn load_blocks<'a>(&self, groups: &[(&'a Arc<Segment>, usize, Vec<usize>)]) -> io::Result<Vec<BlockRef<'a>>> {
+        let load = |(seg, idx, _): &(&'a Arc<Segment>, usize, Vec<usize>)| seg.block(*idx, Some(&self.cache));
+        let threads = thread::available_parallelism().map_or(1, |n| n.get()).min(READ_THREADS);
+        let cold = groups.iter().filter(|(seg, idx, _)| !seg.block_resident(*idx, &self.cache)).count();
+        if threads == 1 || cold < 2 * COLD_BLOCKS_PER_THREAD {
+            return groups.iter().map(load).collect();
         }
         
-        // Check all segments
-        for segment in inner.segments_l0.iter()
-            .chain(inner.segments_l1.iter())
-            .chain(inner.segments_l2.iter())
-        {
-            self.collect_pattern_from_segment(segment, pattern, &mut results)?;
+        let chunk = ((groups.len() + threads - 1) / threads).max(COLD_BLOCKS_PER_THREAD);
+        thread::scope(|scope| {
+            let loads: Vec<_> = groups.chunks(chunk)
+                .map(|part| scope.spawn(move || part.iter().map(load).collect::<Vec<_>>()))
+                .collect();
+            loads.into_iter().flat_map(|part| part.join().unwrap()).collect()
+        })
+    }
+    
+    // Whether `path` holds a live scalar. Most parents hold nothing, which the
+    // memtables and the segments' key ranges and blooms settle in memory;
+    // blocks are only read when a bloom says the path might be there.
+    fn is_scalar(&self, inner: &StoreInner, path: &str) -> io::Result<bool> {
+        for mem in inner.memtables() {
+            if let Some(entry) = mem.get(path) {
+                return Ok(entry.kind == RT_SET && !inner.subtombs.covers(path, entry.seq));
+            }
         }
         
-        // Filter out tombstones
-        Ok(results.into_iter()
-            .filter_map(|(k, v)| v.map(|val| (k, val)))
-            .collect())
+        let maybe = inner.segments_l0.iter().any(|seg| seg.may_contain(path))
+            || [&inner.segments_l1, &inner.segments_l2].iter()
+                .any(|level| level_segment(level, path).map_or(false, |seg| seg.may_contain(path)));
+        if !maybe {
+            return Ok(false);
+        }
+        Ok(self.get_from_segments(inner, path)?.is_some())
     }
     
-    fn collect_pattern_from_segment(&self, seg: &Arc<Segment>, pattern: &str, 
-                                     results: &mut BTreeMap<String, Option<String>>) -> io::Result<()> {
-        // Read through entire segment looking for pattern matches
-        for idx in 0..seg.index.len() {
-            let (_block_key, offset) = &seg.index[idx];
-            
-            // Read the block
-            let next_offset = if idx + 1 < seg.index.len() {
-                seg.index[idx + 1].1
-            } else {
-                seg.index_start
-            };
-            
-            let block_data = self.cache.get_or_load(&seg.path, *offset, (next_offset - offset) as usize)?;
-            
-            // Parse all records in block
-            let mut pos = 0;
-            while pos + 8 < block_data.len() {
-                let mut seq_bytes = [0u8; 8];
-                seq_bytes.copy_from_slice(&block_data[pos..pos + 8]);
-                let seq = u64::from_le_bytes(seq_bytes);
-                pos += 8;
-                
-                if pos >= block_data.len() {
-                    break;
-                }
-                
-                let rec_type = block_data[pos];
-                pos += 1;
-                
-                if pos + 8 > block_data.len() {
-                    break;
-                }
-                
-                let mut klen_bytes = [0u8; 4];
-                klen_bytes.copy_from_slice(&block_data[pos..pos + 4]);
-                let klen = u32::from_le_bytes(klen_bytes) as usize;
-                pos += 4;
-                
-                let mut vlen_bytes = [0u8; 4];
-                vlen_bytes.copy_from_slice(&block_data[pos..pos + 4]);
-                let vlen = u32::from_le_bytes(vlen_bytes) as usize;
-                pos += 4;
-                
-                if pos + klen + vlen > block_data.len() {
-                    break;
-                }
-                
-                let k = String::from_utf8_lossy(&block_data[pos..pos + klen]).to_string();
-                pos += klen;
-                
-                // Check if key matches pattern
-                if Self::matches_pattern(&k, pattern) && !results.contains_key(&k) {
-                    let inner = self.inner.read().unwrap();
-                    match rec_type {
-                        RT_SET => {
-                            let v = String::from_utf8_lossy(&block_data[pos..pos + vlen]).to_string();
-                            if !self.covered_by_subtomb(&inner, &k, seq) {
-                                results.insert(k, Some(v));
-                            } else {
-                                results.insert(k, None);
-                            }
-                        }
-                        RT_DEL_POINT => {
-                            results.insert(k, None);
-                        }
-                        _ => {}
-                    }
-                }
-                
-                pos += vlen;
+    // Tree semantics: nothing can be written under a scalar, at any depth
+    fn check_ancestors(&self, inner: &StoreInner, path: &str) -> io::Result<()> {
+        for (i, _) in path.match_indices('/') {
+            if i > 0 && self.is_scalar(inner, &path[..i])? {
+                return Err(scalar_parent_error());
             }
         }
-        
         Ok(())
     }
     
-    // Delete all keys matching a wildcard pattern
-    pub fn delete_pattern(&self, pattern: &str) -> io::Result<usize> {
-        let matches = self.get_pattern(pattern)?;
-        let count = matches.len();
-        
-        for (key, _) in matches {
-            self.delete(&key)?;
+    fn get_subtree(&self, inner: &StoreInner, prefix: &str) -> io::Result<Option<String>> {
+        let mut json = Vec::new();
+        if !self.write_subtree(inner, prefix, usize::MAX, &mut json)? {
+            return Ok(None);
         }
-        
-        Ok(count)
+        // Built from UTF-8 keys and values
+        Ok(Some(String::from_utf8(json).unwrap()))
+    }
+    
+    /// Streams the subtree under `prefix` to `out` as nested JSON, the same
+    /// document `get("prefix/")` returns, without holding it in memory.
+    /// Returns false, having written nothing, when the subtree is empty.
+    /// Output goes out in small pieces, so wrap files and sockets in a `BufWriter`.
+    pub fn get_subtree_to<W: Write>(&self, prefix: &str, out: &mut W) -> io::Result<bool> {
+        self.get_subtree_to_depth(prefix, usize::MAX, out)
     }
     
-    // Helper: Check if a key matches a wildcard pattern
-    fn matches_pattern(key: &str, pattern: &str) -> bool {
-        Self::matches_pattern_recursive(key.chars().collect::<Vec<_>>().as_slice(), 
-                                         pattern.chars().collect::<Vec<_>>().as_slice())
+    /// Like `get_subtree_to`, but objects `depth` levels below `prefix` are
+    /// written as `true`; depth 1 is Firebase's `shallow=true`.
+    pub fn get_subtree_to_depth<W: Write>(&self, prefix: &str, depth: usize, out: &mut W) -> io::Result<bool> {
+        let prefix = subtree_prefix(prefix);
+        let inner = self.version.load();
+        self.write_subtree(&inner, &prefix, depth.max(1), out)
     }
     
-    fn matches_pattern_recursive(key: &[char], pattern: &[char]) -> bool {
-        match (pattern.first(), key.first()) {
-            (None, None) => true,  // Both exhausted
-            (None, Some(_)) => false,  // Pattern exhausted but key has more
-            (Some('*'), _) => {
-                // * matches zero or more characters
-                // Try matching with 0 chars (skip *)
-                if Self::matches_pattern_recursive(key, &pattern[1..]) {
-                    return true;
+    // One pass over the merged scan: the keys come sorted, so each object's
+    // members are contiguous and objects can be opened and closed as the
+    // path components change
+    fn write_subtree<W: Write>(&self, inner: &StoreInner, prefix: &str, depth: usize, out: &mut W) -> io::Result<bool> {
+        let mut open: Vec<String> = Vec::new();  // Objects open below the root
+        let mut stub: Option<String> = None;     // Last object cut off at `depth`
+        let mut started = false;
+        let mut comma = false;
+        
+        for item in self.scan(inner, prefix, ScanStop::Prefix(prefix.to_string()))? {
+            let (key, value) = item?;
+            let parts: Vec<&str> = key[prefix.len()..].split('/').filter(|s| !s.is_empty()).collect();
+            if parts.is_empty() {
+                continue;
+            }
+            let (path, value) = if parts.len() > depth {
+                let cut = parts[..depth].join("/");
+                if stub.as_ref() == Some(&cut) {
+                    continue;
                 }
-                // Try matching with 1+ chars (consume one char and keep *)
-                if !key.is_empty() && Self::matches_pattern_recursive(&key[1..], pattern) {
-                    return true;
+                stub = Some(cut);
+                (&parts[..depth], None)
+            } else {
+                (&parts[..], Some(value))
+            };
+            
+            if !started {
+                out.write_all(b"{")?;
+                started = true;
+            }
+            let (name, dirs) = path.split_last().unwrap();
+            let common = open.iter().zip(dirs.iter()).take_while(|(a, b)| a == b).count();
+            while open.len() > common {
+                out.write_all(b"}")?;
+                open.pop();
+            }
+            for dir in &dirs[common..] {
+                if comma {
+                    out.write_all(b",")?;
                 }
-                false
+                write_json_str(out, dir)?;
+                out.write_all(b":{")?;
+                open.push(dir.to_string());
+                comma = false;
             }
-            (Some('?'), None) => false,  // ? needs exactly one char but key is empty
-            (Some('?'), Some(_)) => {
-                // ? matches exactly one character
-                Self::matches_pattern_recursive(&key[1..], &pattern[1..])
+            if comma {
+                out.write_all(b",")?;
             }
-            (Some(&p), None) => false,  // Pattern has more but key is exhausted
-            (Some(&p), Some(&k)) => {
-                // Regular character must match exactly
-                p == k && Self::matches_pattern_recursive(&key[1..], &pattern[1..])
+            write_json_str(out, name)?;
+            out.write_all(b":")?;
+            match value {
+                Some(value) => write_json_str(out, &value)?,
+                None => out.write_all(b"true")?,
             }
+            comma = true;
         }
+        
+        if started {
+            for _ in 0..open.len() + 1 {
+                out.write_all(b"}")?;
+            }
+        }
+        Ok(started)
     }
     
-    pub fn delete_subtree(&self, prefix: &str) -> io::Result<()> {
-        let mut inner = self.inner.write().unwrap();
-        inner.seq += 1;
-        let seq = inner.seq;
-        
-        let prefix = if prefix.ends_with('/') {
-            prefix.to_string()
-        } else {
-            format!("{}/", prefix)
+    fn get_from_segment(&self, seg: &Arc<Segment>, key: &str) -> io::Result<Option<(Option<String>, u64)>> {
+        // Returns Some((Some(value), seq)) for RT_SET
+        // Returns Some((None, seq)) for RT_DEL_POINT
+        // Returns None for not found
+        let idx = match seg.block_for(key) {
+            Some(idx) => idx,
+            None => return Ok(None),
         };
         
-        self.wal.append(&WALEntry {
-            seq,
-            kind: RT_DEL_SUB,
-            key: prefix.clone(),
-            value: None,
-        })?;
-        
-        inner.subtombs.insert(prefix, seq);
-        Ok(())
+        let block = seg.block(idx, Some(&self.cache))?;
+        Ok(block_record(&mut BlockCursor::new(&block, seg.delta_keys), &block, key))
     }
     
-    fn compaction_thread(&self) {
+    // Seal the active memtable if it is still `expected` (or, for None, if it
+    // holds anything) and queue it for flushing. Reads keep consulting it until
+    // its segment is installed.
+    fn seal_memtable(&self, expected: Option<&Arc<MemTable>>) -> io::Result<()> {
+        let version = &self.version;
+        self.wal.switch_memtable(expected, |sealed, fresh, last_seq| {
+            version.update(|inner| {
+                inner.imm.push((sealed.clone(), last_seq));
+                inner.mem = fresh.clone();
+            });
+        })
+    }
+    
+    // Write every sealed memtable out as an L0 segment, oldest first. A failed
+    // flush leaves its memtable queued, so the next attempt retries it before
+    // the checkpoint can move past its data.
+    fn flush_immutables(&self) -> io::Result<()> {
+        let _flush = self.flush_lock.lock().unwrap();
+        
         loop {
-            // Sleep for a bit between compaction checks
-            thread::sleep(Duration::from_secs(5));
-            
-            // Check for shutdown
-            let (lock, _cvar) = &*self.compaction_shutdown;
-            let shutdown = lock.lock().unwrap();
-            if *shutdown {
-                break;
-            }
-            drop(shutdown);
-            
-            // Check if L0 compaction is needed
-            let needs_l0_compaction = {
-                let inner = self.inner.read().unwrap();
-                inner.segments_l0.len() >= L0_COMPACTION_THRESHOLD
+            let (mem, checkpoint) = match self.version.load().imm.first() {
+                Some((mem, last_seq)) => (mem.clone(), *last_seq),
+                None => return Ok(()),
             };
-            
-            if needs_l0_compaction {
-                if let Err(e) = self.compact_l0_to_l1() {
-                    // Log error but continue
-                    // eprintln!("L0 compaction error: {}", e);
-                    let _ = e; // Suppress warning
+            self.flush_sealed(&mem, checkpoint)?;
+        }
+    }
+    
+    fn flush_thread(&self) {
+        let (lock, cvar) = &*self.flusher;
+        loop {
+            {
+                let mut signal = lock.lock().unwrap();
+                while !signal.pending && !signal.shutdown {
+                    signal = cvar.wait(signal).unwrap();
+                }
+                if signal.shutdown {
+                    break;
                 }
+                signal.pending = false;
             }
             
-            // Check if L1 compaction is needed
-            let needs_l1_compaction = {
-                let inner = self.inner.read().unwrap();
-                inner.segments_l1.len() >= L1_COMPACTION_THRESHOLD
-            };
-            
-            if needs_l1_compaction {
-                if let Err(e) = self.compact_l1_to_l2() {
-                    // Log error but continue
-                    let _ = e; // Suppress warning
-                }
+            if let Err(e) = self.flush_immutables() {
+                self.metrics.background_error(&self.metrics.flush_errors, &e);
+                // Sealed memtables stay queued and readable; retry shortly
+                thread::sleep(Duration::from_millis(100));
+                lock.lock().unwrap().pending = true;
             }
         }
     }
     
-    fn compact_l0_to_l1(&self) -> io::Result<()> {
-        // Take segments to compact
-        let segments_to_compact = {
-            let mut inner = self.inner.write().unwrap();
-            if inner.segments_l0.len() < L0_COMPACTION_THRESHOLD {
-                return Ok(());
-            }
-            
-            // Take the oldest L0 segments
-            let mut to_compact = Vec::new();
-            for _ in 0..L0_COMPACTION_THRESHOLD {
-                if let Some(seg) = inner.segments_l0.first() {
-                    to_compact.push(seg.clone());
-                    inner.segments_l0.remove(0);
-                }
-            }
-            to_compact
-        };
-        
-        if segments_to_compact.is_empty() {
-            return Ok(());
+    fn flush_sealed(&self, mem: &Arc<MemTable>, checkpoint: u64) -> io::Result<()> {
+        // Let writers that were handed this memtable finish their inserts
+        while mem.writers.load(Ordering::Acquire) != 0 {
+            thread::yield_now();
         }
+        let started = Instant::now();
         
-        // Create new L1 segment
-        let filename = format!("l1_{:010}.seg", SystemTime::now()
-            .duration_since(SystemTime::UNIX_EPOCH)
-            .unwrap()
-            .as_secs());
-        let new_path = self.dir.join(&filename);
+        let filename = format!("l0_{:010}.seg", checkpoint);
+        let path = self.dir.join(&filename);
         
-        // Merge segments
-        let merged_segment = self.merge_segments(&segments_to_compact, &new_path, 1)?;
+        let mut writer = SegmentWriter::new(&path, self.options.compression[0], self.options.bloom_bits_per_key)?;
         
-        // Update state
-        {
-            let mut inner = self.inner.write().unwrap();
-            inner.segments_l1.push(Arc::new(merged_segment));
+        for entry in mem.iter() {
+            let value = if entry.kind == RT_SET { Some(entry.value) } else { None };
+            writer.add(entry.kind, entry.key, value, entry.seq)?;
         }
         
-        // Update manifest
+        // Subtombs this checkpoint covers that only the WAL has so far go into
+        // the segment, so the WAL files can be dropped
+        let subtombs: Vec<(String, u64)> = self.version.load().subtombs.iter()
+            .filter(|(_, tomb)| !tomb.persisted && tomb.seq <= checkpoint)
+            .map(|(prefix, tomb)| (prefix.to_string(), tomb.seq))
+            .collect();
+        for (prefix, seq) in &subtombs {
+            writer.add_subtomb(prefix, *seq);
+        }
+        
+        let seg = self.finish_segment(writer)?;
+        
+        // Update manifest; the checkpoint lets replay skip the sealed WAL files
         {
             let mut manifest = self.manifest.lock().unwrap();
-            manifest.add_entry(ManifestEntry {
-                seq_high: segments_to_compact.iter()
-                    .map(|s| s.seq_high)
-                    .max()
-                    .unwrap_or(0),
-                level: 1,
-                filename,
+            manifest.log_edit(VersionEdit {
+                added: vec![ManifestEntry {
+                    seq_high: seg.seq_high,
+                    level: 0,
+                    filename,
+                }],
+                removed: Vec::new(),
+                checkpoint: Some(checkpoint),
             })?;
         }
         
-        // Delete old segment files
-        for seg in segments_to_compact {
-            let _ = fs::remove_file(&seg.path);
+        let seg = Arc::new(seg);
+        self.version.update(|inner| {
+            inner.imm.retain(|(m, _)| !Arc::ptr_eq(m, mem));
+            inner.segments_l0.push(seg.clone());
+            if !subtombs.is_empty() {
+                let index = Arc::make_mut(&mut inner.subtombs);
+                for (prefix, seq) in &subtombs {
+                    index.mark_persisted(prefix, *seq);
+                }
+            }
+        });
+        self.release_stalled();
+        
+        // Writers are about to stall on L0, or a level is well past due; don't
+        // leave it to the next timer tick
+        let inner = self.version.load();
+        if inner.segments_l0.len() >= self.options.l0_stall_segments
+            || inner.compaction_score(&self.options).0 >= COMPACTION_URGENT_SCORE
+        {
+            let (lock, cvar) = &*self.compaction_shutdown;
+            let _guard = lock.lock().unwrap();
+            cvar.notify_all();
         }
         
+        // Older WAL files are now fully covered by segments
+        self.wal.remove_files_before(checkpoint + 1);
+        
+        self.metrics.flushes.record(started);
         Ok(())
     }
     
-    fn compact_l1_to_l2(&self) -> io::Result<()> {
-        // Similar to L0->L1 but for L1->L2
-        let segments_to_compact = {
-            let mut inner = self.inner.write().unwrap();
-            if inner.segments_l1.len() < L1_COMPACTION_THRESHOLD {
-                return Ok(());
+    // Seal the memtable and wait until it and everything queued before it
+    // is in L0
+    pub fn flush(&self) -> io::Result<()> {
+        self.seal_memtable(None)?;
+        self.flush_immutables()?;
+        self.wal.sync_now()?;
+        Ok(())
+    }
+    
+    pub fn delete(&self, path: &str) -> io::Result<()> {
+        self.delete_with(path, Durability::Buffered)
+    }
+    
+    pub fn delete_with(&self, path: &str, durability: Durability) -> io::Result<()> {
+        let mut updates = Vec::new();
+        self.index_updates(path, None, || self.get_in(&self.version.load(), path), &mut updates)?;
+        
+        let mut entries = vec![WALEntry {
+            seq: 0,
+            kind: RT_DEL_POINT,
+            key: path,
+            value: None,
+        }];
+        push_index_updates(&mut entries, &updates);
+        self.write_entries(&mut entries, durability)
+    }
+    
+    pub fn cache_stats(&self) -> CacheStats {
+        self.cache.stats()
+    }
+    
+    /// Counters and latency percentiles since open. Every instrumented path
+    /// only bumps atomics, so this is cheap enough to poll.
+    pub fn stats(&self) -> Stats {
+        let inner = self.version.load();
+        let metrics = &self.metrics;
+        let count = |counter: &AtomicU64| counter.load(Ordering::Relaxed);
+        Stats {
+            writes: metrics.writes.summary(),
+            gets: metrics.gets.summary(),
+            flushes: metrics.flushes.summary(),
+            compactions: metrics.compactions.summary(),
+            wal_syncs: self.wal.syncs.summary(),
+            cache_loads: self.cache.loads.summary(),
+            cache: self.cache.stats(),
+            segments: [inner.segments_l0.len(), inner.segments_l1.len(), inner.segments_l2.len()],
+            immutable_memtables: inner.imm.len(),
+            write_stalls: count(&metrics.write_stalls),
+            write_stall_ns: count(&metrics.write_stall_ns),
+            segment_gets: count(&metrics.segment_gets),
+            segment_probes: count(&metrics.segment_probes),
+            bloom_negatives: count(&metrics.bloom_negatives),
+            bloom_false_positives: count(&metrics.bloom_false_positives),
+            flush_errors: count(&metrics.flush_errors),
+            compaction_errors: count(&metrics.compaction_errors),
+            last_background_error: metrics.last_error.lock().unwrap().clone(),
+        }
+    }
+    
+    // Compact until no level is due
+    pub fn compact(&self) -> io::Result<()> {
+        while self.run_compaction()? {}
+        Ok(())
+    }
+    
+    /// Bulk load `items`, which must be in strictly ascending key order,
+    /// skipping the WAL and memtables: they are written straight into
+    /// segments, each placed in the deepest level nothing above overlaps, and
+    /// registered in one manifest edit. Tree rules are checked as the items
+    /// stream by, against each other and the store. Returns the number loaded.
+    ///
+    /// The load takes effect as one write ordered after everything before the
+    /// call. Subscribers see no events for it.
+    pub fn ingest_sorted<I, K, V>(&self, items: I) -> io::Result<usize>
+    where
+        I: IntoIterator<Item = (K, V)>,
+        K: AsRef<str>,
+        V: AsRef<str>,
+    {
+        let seq = self.wal.reserve_seq();
+        let mut outputs = Vec::new();
+        let result = self.write_ingest(items, seq, &mut outputs)
+            .and_then(|count| self.install_ingest(&mut outputs).map(|_| count));
+        if result.is_err() {
+            for (_, seg) in &outputs {
+                let _ = fs::remove_file(&seg.path);
             }
-            
-            // Take the oldest L1 segments
-            let mut to_compact = Vec::new();
-            for _ in 0..L1_COMPACTION_THRESHOLD {
-                if let Some(seg) = inner.segments_l1.first() {
-                    to_compact.push(seg.clone());
-                    inner.segments_l1.remove(0);
+        }
+        result
+    }
+    
+    // Validate and write the items, cutting segments at the target size.
+    // Returns the number written.
+    fn write_ingest<I, K, V>(&self, items: I, seq: u64, outputs: &mut Vec<(String, Segment)>) -> io::Result<usize>
+    where
+        I: IntoIterator<Item = (K, V)>,
+        K: AsRef<str>,
+        V: AsRef<str>,
+    {
+        let inner = self.version.load();
+        let mut writer: Option<(String, SegmentWriter)> = None;
+        let mut count = 0;
+        let mut last = String::new();
+        // Lengths of earlier items that are string prefixes of the current
+        // one; any that ends at a '/' in it would be its scalar parent
+        let mut prefixes: Vec<usize> = Vec::new();
+        
+        let write = || -> io::Result<()> {
+            for (key, value) in items {
+                let (key, value) = (key.as_ref(), value.as_ref());
+                if key.is_empty() || key.ends_with('/') || (count > 0 && key <= last.as_str()) {
+                    return Err(io::Error::new(io::ErrorKind::InvalidInput,
+                                              "Ingested keys must be non-empty paths in strictly ascending order"));
+                }
+                
+                while prefixes.last().map_or(false, |&len| !key.starts_with(&last[..len])) {
+                    prefixes.pop();
+                }
+                for (i, _) in key.match_indices('/').filter(|&(i, _)| i > 0) {
+                    if prefixes.contains(&i) {
+                        return Err(scalar_parent_error());
+                    }
+                    // The previous item had this ancestor too, so it was checked then
+                    let seen = count > 0 && last.len() > i && last.as_bytes()[..=i] == key.as_bytes()[..=i];
+                    if !seen && self.is_scalar(&inner, &key[..i])? {
+                        return Err(scalar_parent_error());
+                    }
                 }
+                prefixes.push(key.len());
+                last.clear();
+                last.push_str(key);
+                
+                let full = writer.as_ref()
+                    .map_or(false, |(_, w)| w.written >= self.options.target_segment_size as u64);
+                if full {
+                    let (filename, w) = writer.take().unwrap();
+                    outputs.push((filename, self.finish_segment(w)?));
+                }
+                if writer.is_none() {
+                    let number = self.manifest.lock().unwrap().next_file_number();
+                    let filename = format!("ingest_{:010}.seg", number);
+                    let w = SegmentWriter::new(
+                        &self.dir.join(&filename), self.options.compression[2], self.options.bloom_bits_per_key)?;
+                    writer = Some((filename, w));
+                }
+                writer.as_mut().unwrap().1.add(RT_SET, key, Some(value), seq)?;
+                count += 1;
+            }
+            if let Some((filename, w)) = writer.take() {
+                outputs.push((filename, self.finish_segment(w)?));
             }
-            to_compact
+            Ok(())
         };
+        let result = write();
         
-        if segments_to_compact.is_empty() {
-            return Ok(());
+        if let Some((_, w)) = &writer {
+            let _ = fs::remove_file(&w.path);
         }
+        result.map(|_| count)
+    }
+    
+    // Place each ingested segment in the deepest level where nothing at or
+    // above it overlaps, so lookups that stop at the first level holding a
+    // key still find the newest version
+    fn install_ingest(&self, outputs: &mut Vec<(String, Segment)>) -> io::Result<()> {
+        let (start, end) = match (outputs.first(), outputs.last()) {
+            (Some((_, first)), Some((_, last))) => (first.min_key.clone(), last.max_key.clone()),
+            _ => return Ok(()),
+        };
         
-        // Create new L2 segment
-        let filename = format!("l2_{:010}.seg", SystemTime::now()
-            .duration_since(SystemTime::UNIX_EPOCH)
-            .unwrap()
-            .as_secs());
-        let new_path = self.dir.join(&filename);
-        
-        // Merge segments with more aggressive tombstone removal
-        let merged_segment = self.merge_segments(&segments_to_compact, &new_path, 2)?;
-        
-        // Update state
-        {
-            let mut inner = self.inner.write().unwrap();
-            inner.segments_l2.push(Arc::new(merged_segment));
+        // Memtables are read before any segment, so older writes to these
+        // keys must be flushed first. Writes after the reserved seq are newer
+        // and may stay.
+        let (_, inner) = self.wal.read_point(|| self.version.load());
+        let overlapping = inner.memtables()
+            .any(|mem| mem.iter_from(&start).next().map_or(false, |entry| entry.key <= end.as_str()));
+        drop(inner);
+        if overlapping {
+            self.flush()?;
         }
         
-        // Update manifest
-        {
-            let mut manifest = self.manifest.lock().unwrap();
-            manifest.add_entry(ManifestEntry {
-                seq_high: segments_to_compact.iter()
-                    .map(|s| s.seq_high)
-                    .max()
-                    .unwrap_or(0),
-                level: 2,
-                filename,
-            })?;
-        }
+        // Levels hold still while we pick
+        let _l0 = self.compaction_locks[0].lock().unwrap();
+        let _l1 = self.compaction_locks[1].lock().unwrap();
+        let inner = self.version.load();
+        let levels = [&inner.segments_l0, &inner.segments_l1, &inner.segments_l2];
+        let placed: Vec<usize> = outputs.iter()
+            .map(|(_, seg)| (0..3).rev()
+                .find(|&level| levels[..=level].iter()
+                    .all(|segments| !segments.iter().any(|s| s.overlaps(&seg.min_key, &seg.max_key))))
+                .unwrap_or(0))
+            .collect();
+        drop(inner);
+        
+        self.manifest.lock().unwrap().log_edit(VersionEdit {
+            added: outputs.iter().zip(&placed)
+                .map(|((filename, seg), &level)| ManifestEntry { seq_high: seg.seq_high, level, filename: filename.clone() })
+                .collect(),
+            removed: Vec::new(),
+            checkpoint: None,
+        })?;
         
-        // Delete old segment files
-        for seg in segments_to_compact {
-            let _ = fs::remove_file(&seg.path);
-        }
+        let segments: Vec<(Arc<Segment>, usize)> = outputs.drain(..)
+            .zip(placed)
+            .map(|((_, seg), level)| (Arc::new(seg), level))
+            .collect();
+        self.version.update(|inner| {
+            for (seg, level) in &segments {
+                match level {
+                    0 => inner.segments_l0.push(seg.clone()),
+                    1 => inner.segments_l1.push(seg.clone()),
+                    _ => inner.segments_l2.push(seg.clone()),
+                }
+            }
+            sort_level(&mut inner.segments_l1);
+            sort_level(&mut inner.segments_l2);
+        });
         
+        if segments.iter().any(|&(_, level)| level == 0) {
+            let (lock, cvar) = &*self.compaction_shutdown;
+            let _guard = lock.lock().unwrap();
+            cvar.notify_all();
+        }
         Ok(())
     }
     
-    fn merge_segments(&self, segments: &[Arc<Segment>], output_path: &Path, level: usize) -> io::Result<Segment> {
-        let mut writer = SegmentWriter::new(output_path)?;
+    /// Write a consistent copy of the store into `dest`, which must be empty
+    /// or not exist, without pausing writers. Live segments are hard-linked
+    /// (copied across filesystems) and only WAL records not yet in segments
+    /// are copied. `dest` opens as a store holding every write up to the
+    /// returned seq; an `ingest_sorted` still running is left out.
+    pub fn checkpoint(&self, dest: &Path) -> io::Result<u64> {
+        fs::create_dir_all(dest)?;
+        if fs::read_dir(dest)?.next().is_some() {
+            return Err(io::Error::new(io::ErrorKind::AlreadyExists, "checkpoint directory is not empty"));
+        }
+        self.ship_to(dest).map(|(seq, _)| seq)
+    }
+    
+    /// Bring a standby made by `checkpoint` up to date by shipping the WAL
+    /// records appended since it was last shipped to. Records a flush moved
+    /// into a segment meanwhile arrive as that segment's link instead, and
+    /// files the store has retired are dropped, so the standby stays a valid
+    /// checkpoint. Returns the bytes copied. Open the standby only once
+    /// shipping to it has stopped; opening starts a WAL file of its own.
+    pub fn ship_wal(&self, standby: &Path) -> io::Result<u64> {
+        if !standby.join("manifest.log").exists() {
+            return Err(io::Error::new(io::ErrorKind::NotFound, "standby has no manifest; take a checkpoint first"));
+        }
+        self.ship_to(standby).map(|(_, bytes)| bytes)
+    }
+    
+    // Make `dest` the current manifest version plus the WAL past its
+    // checkpoint, reusing whatever `dest` already has. Returns the last seq
+    // `dest` holds if it started empty, and the bytes copied.
+    fn ship_to(&self, dest: &Path) -> io::Result<(u64, u64)> {
+        // Anything acknowledged is in the files before we look
+        self.wal.sync_now()?;
         
-        // Collect all records from segments
-        let mut all_records: BTreeMap<String, (u8, Option<String>, u64)> = BTreeMap::new();
+        // Segments and uncovered WAL files are only deleted after an edit
+        // retires them, so holding the manifest keeps this version's files
+        // in place. Flushes and compactions wait at their next edit.
+        let manifest = self.manifest.lock().unwrap();
+        let mut keep = vec!["manifest.log".to_string()];
+        let mut last_seq = manifest.checkpoint;
+        let mut bytes = 0;
+        for entry in &manifest.entries {
+            let target = dest.join(&entry.filename);
+            if !target.exists() {
+                link_or_copy(&self.dir.join(&entry.filename), &target)?;
+                bytes += fs::metadata(&target)?.len();
+            }
+            last_seq = last_seq.max(entry.seq_high);
+            keep.push(entry.filename.clone());
+        }
         
-        for segment in segments {
-            // Read all records from segment
-            for (key, offset) in &segment.index {
-                // Read block containing this key
-                let next_offset = segment.index.iter()
-                    .find(|(k, _)| k > key)
-                    .map(|(_, o)| *o)
-                    .unwrap_or(segment.index_start);
-                
-                let block_size = (next_offset - offset) as usize;
-                let mut file = File::open(&segment.path)?;
-                file.seek(SeekFrom::Start(*offset))?;
-                
-                let mut block_data = vec![0u8; block_size];
-                file.read_exact(&mut block_data)?;
-                
-                // Parse records from block
-                let mut pos = 0;
-                while pos + 8 < block_data.len() {
-                    let mut seq_bytes = [0u8; 8];
-                    seq_bytes.copy_from_slice(&block_data[pos..pos + 8]);
-                    let seq = u64::from_le_bytes(seq_bytes);
-                    pos += 8;
-                    
-                    if pos >= block_data.len() {
-                        break;
-                    }
-                    
-                    let rec_type = block_data[pos];
-                    pos += 1;
-                    
-                    if pos + 8 > block_data.len() {
-                        break;
-                    }
-                    
-                    let mut klen_bytes = [0u8; 4];
-                    klen_bytes.copy_from_slice(&block_data[pos..pos + 4]);
-                    let klen = u32::from_le_bytes(klen_bytes) as usize;
-                    pos += 4;
-                    
-                    let mut vlen_bytes = [0u8; 4];
-                    vlen_bytes.copy_from_slice(&block_data[pos..pos + 4]);
-                    let vlen = u32::from_le_bytes(vlen_bytes) as usize;
-                    pos += 4;
-                    
-                    if pos + klen + vlen > block_data.len() {
-                        break;
-                    }
-                    
-                    let k = String::from_utf8_lossy(&block_data[pos..pos + klen]).to_string();
-                    pos += klen;
-                    
-                    let value = if rec_type == RT_SET && vlen > 0 {
-                        Some(String::from_utf8_lossy(&block_data[pos..pos + vlen]).to_string())
-                    } else {
-                        None
-                    };
-                    pos += vlen;
-                    
-                    // Keep only the newest version of each key
-                    if let Some(existing) = all_records.get(&k) {
-                        if seq > existing.2 {
-                            all_records.insert(k, (rec_type, value, seq));
-                        }
-                    } else {
-                        all_records.insert(k, (rec_type, value, seq));
-                    }
-                }
+        let wal_files = list_wal_files(&self.dir)?;
+        for (i, (_, path)) in wal_files.iter().enumerate() {
+            let covered = wal_files.get(i + 1)
+                .map_or(false, |(next_start, _)| *next_start <= manifest.checkpoint + 1);
+            let name = match path.file_name().and_then(|n| n.to_str()) {
+                Some(name) if !covered => name.to_string(),
+                _ => continue,
+            };
+            let (seq, shipped) = ship_wal_tail(path, &dest.join(&name))?;
+            last_seq = last_seq.max(seq);
+            bytes += shipped;
+            keep.push(name);
+        }
+        
+        let mut copy = Manifest {
+            path: dest.join("manifest.log"),
+            entries: manifest.entries.clone(),
+            checkpoint: manifest.checkpoint,
+            next_file: manifest.next_file,
+            edits: 0,
+        };
+        drop(manifest);
+        copy.rewrite()?;
+        
+        // Only now that the new manifest is in place can files it no longer
+        // names go
+        for entry in fs::read_dir(dest)? {
+            let path = entry?.path();
+            let stale = match path.file_name().and_then(|n| n.to_str()) {
+                Some(name) => (name.ends_with(".seg") || name.starts_with("wal")) && !keep.iter().any(|k| k == name),
+                None => false,
+            };
+            if stale {
+                let _ = fs::remove_file(&path);
             }
         }
+        Ok((last_seq, bytes))
+    }
+    
+    /// Index the records `pattern` matches by value, for `query_index`. The
+    /// pattern's last component must be a literal field name, as in
+    /// `users/*/role`; what `*` stands for is the record's parent. Existing
+    /// records are indexed before this returns, and the index is kept, and
+    /// reloaded on open, until `drop_index`. Returns the entries written.
+    ///
+    /// Sets, deletes, batches and `delete_pattern` update entries in the
+    /// same WAL record as the write; subtree deletes and `ingest_sorted` do
+    /// not, so queries check each hit against the record it points at.
+    pub fn create_index(&self, name: &str, pattern: &str) -> io::Result<usize> {
+        self.add_index(name, pattern)?;
+        if let Err(e) = self.set_with(&format!("{}{}", INDEX_DEFS, name), pattern, false, Durability::Sync) {
+            let mut defs = self.indexes.defs.write().unwrap();
+            defs.retain(|def| def.name != name);
+            self.indexes.count.store(defs.len(), Ordering::Release);
+            return Err(e);
+        }
         
-        // Write merged records to new segment
-        for (key, (rec_type, value, seq)) in all_records {
-            // In L2, skip tombstones entirely (they've done their job)
-            if level >= 2 && rec_type != RT_SET {
+        // Writes from here on keep the index up to date; records already
+        // in the snapshot get their entries now. One that changes meanwhile
+        // may be left a stale entry, which queries skip.
+        let snapshot = self.snapshot();
+        let field_len = pattern.len() - pattern.rfind('/').unwrap_or(0);
+        let depth = index_depth(pattern);
+        let mut keys = Vec::new();
+        let mut count = 0;
+        for item in self.scan_pattern(&snapshot.inner, pattern)? {
+            let (key, value) = item?;
+            if key.starts_with('\0') || key.len() <= field_len || index_depth(&key) != depth {
                 continue;
             }
-            
-            // In L0/L1, preserve tombstones to shadow older data
-            writer.add(rec_type, &key, value.as_deref(), seq)?;
+            keys.push(index_key(name, &value, &key[..key.len() - field_len]));
+            if keys.len() == 1024 {
+                count += self.write_index_entries(&keys)?;
+                keys.clear();
+            }
+        }
+        count += self.write_index_entries(&keys)?;
+        Ok(count)
+    }
+    
+    /// Remove an index made by `create_index` and all of its entries
+    pub fn drop_index(&self, name: &str) -> io::Result<()> {
+        {
+            let mut defs = self.indexes.defs.write().unwrap();
+            let before = defs.len();
+            defs.retain(|def| def.name != name);
+            if defs.len() == before {
+                return Err(io::Error::new(io::ErrorKind::NotFound, "no such index"));
+            }
+            self.indexes.count.store(defs.len(), Ordering::Release);
         }
+        let mut batch = WriteBatch::new();
+        batch.delete(&format!("{}{}", INDEX_DEFS, name));
+        batch.delete_subtree(&format!("{}{}", INDEX_PREFIX, name));
+        self.write_with(&batch, Durability::Sync)
+    }
+    
+    /// Parents of the records index `name` covers whose field is `value`, in
+    /// key order: with an index on `users/*/role`, `query_index("role",
+    /// "admin")` returns `users/alice` and any other admins. A prefix scan of
+    /// the index entries plus one point read per hit, on one snapshot.
+    pub fn query_index(&self, name: &str, value: &str) -> io::Result<Vec<String>> {
+        let field = match self.indexes.defs.read().unwrap().iter().find(|def| def.name == name) {
+            Some(def) => def.field.clone(),
+            None => return Err(io::Error::new(io::ErrorKind::NotFound, "no such index")),
+        };
         
-        writer.finish()
+        let snapshot = self.snapshot();
+        let prefix = index_key(name, value, "");
+        let mut parents = Vec::new();
+        for item in self.scan(&snapshot.inner, &prefix, ScanStop::Prefix(prefix.clone()))? {
+            let parent = &item?.0[prefix.len()..];
+            if snapshot.get(&format!("{}/{}", parent, field))?.as_deref() == Some(value) {
+                parents.push(parent.to_string());
+            }
+        }
+        Ok(parents)
     }
-}
-
-impl StoreInner {
-    fn replay_wal(&mut self, path: &Path) -> io::Result<()> {
-        if !path.exists() {
+    
+    // Register an index in memory, so writes start maintaining it
+    fn add_index(&self, name: &str, pattern: &str) -> io::Result<()> {
+        let field = pattern.rsplit('/').next().unwrap_or("");
+        if name.is_empty() || name.contains('/') || !pattern.contains('/')
+            || field.is_empty() || field.contains(|c| c == '*' || c == '?')
+        {
+            return Err(io::Error::new(io::ErrorKind::InvalidInput,
+                                      "index needs a name without '/' and a pattern ending in a literal field"));
+        }
+        let mut defs = self.indexes.defs.write().unwrap();
+        if defs.iter().any(|def| def.name == name) {
+            return Err(io::Error::new(io::ErrorKind::AlreadyExists, "index already exists"));
+        }
+        defs.push(IndexDef {
+            name: name.to_string(),
+            glob: Glob::new(pattern),
+            field: field.to_string(),
+            depth: index_depth(pattern),
+        });
+        self.indexes.count.store(defs.len(), Ordering::Release);
+        Ok(())
+    }
+    
+    fn write_index_entries(&self, keys: &[String]) -> io::Result<usize> {
+        if keys.is_empty() {
+            return Ok(0);
+        }
+        let mut entries: Vec<WALEntry> = keys.iter()
+            .map(|key| WALEntry { seq: 0, kind: RT_SET, key: key, value: Some("") })
+            .collect();
+        self.write_entries(&mut entries, Durability::Buffered)?;
+        Ok(keys.len())
+    }
+    
+    // Index entries to write along with setting `path` to `value` (None for
+    // a delete): the entry for the old value goes, one for the new comes.
+    // `old` is only called when some index covers the path.
+    fn index_updates<F>(&self, path: &str, value: Option<&str>, old: F, out: &mut Vec<(u8, String)>) -> io::Result<()>
+    where
+        F: FnOnce() -> io::Result<Option<String>>,
+    {
+        if self.indexes.count.load(Ordering::Acquire) == 0 || path.starts_with('\0') {
             return Ok(());
         }
-        
-        let file = File::open(path)?;
-        let mut reader = BufReader::new(file);
-        
-        let mut magic_buf = [0u8; 4];
-        if reader.read_exact(&mut magic_buf).is_err() {
+        let defs = self.indexes.defs.read().unwrap();
+        let mut covering = defs.iter()
+            .filter(|def| def.covers(path))
+            .peekable();
+        if covering.peek().is_none() {
             return Ok(());
         }
-        
-        if &magic_buf != WAL_MAGIC {
+        let old = old()?;
+        if old.as_deref() == value {
             return Ok(());
         }
-        
-        loop {
-            let mut len_buf = [0u8; 4];
-            if reader.read_exact(&mut len_buf).is_err() {
-                break;
+        for def in covering {
+            let parent = &path[..path.len() - def.field.len() - 1];
+            if let Some(old) = &old {
+                out.push((RT_DEL_POINT, index_key(&def.name, old, parent)));
             }
-            
-            let len = u32::from_le_bytes(len_buf) as usize;
-            let mut record = vec![0u8; len];
-            
-            if reader.read_exact(&mut record).is_err() {
-                break;
-            }
-            
-            let mut crc_buf = [0u8; 4];
-            if reader.read_exact(&mut crc_buf).is_err() {
-                break;
-            }
-            
-            let expected_crc = u32::from_le_bytes(crc_buf);
-            if crc32(&record) != expected_crc {
-                break;
-            }
-            
-            // Parse record
-            if record.len() < 13 {
-                continue;
+            if let Some(value) = value {
+                out.push((RT_SET, index_key(&def.name, value, parent)));
             }
-            
-            let mut seq_bytes = [0u8; 8];
-            seq_bytes.copy_from_slice(&record[0..8]);
-            let seq = u64::from_le_bytes(seq_bytes);
-            
-            let kind = record[8];
-            
-            let mut klen_bytes = [0u8; 4];
-            klen_bytes.copy_from_slice(&record[9..13]);
-            let klen = u32::from_le_bytes(klen_bytes) as usize;
-            
-            if record.len() < 13 + klen {
+        }
+        Ok(())
+    }
+    
+    /// Subscribe to changes at `path` and everything below it, matched by
+    /// whole path components. Events are published as writes get their seqs,
+    /// before they are durable.
+    pub fn subscribe(&self, path: &str) -> Subscription {
+        self.wal.subscribe(path).0
+    }
+    
+    /// `subscribe`, but first replaying the changes after `seq` from the WAL
+    /// so a reconnecting client only catches up on what it missed. Fails with
+    /// NotFound once a flush has retired the WAL holding them; writes made with
+    /// `Durability::None` are never replayed.
+    pub fn subscribe_from(&self, path: &str, seq: u64) -> io::Result<Subscription> {
+        let (mut subscription, upto) = self.wal.subscribe(path);
+        if seq >= upto {
+            return Ok(subscription);
+        }
+        let retired = || io::Error::new(io::ErrorKind::NotFound, "Changes after seq are no longer in the WAL");
+        
+        // Everything logged up to `upto` is in the files once committed
+        self.wal.sync_now()?;
+        let files = list_wal_files(&self.dir)?;
+        if files.first().map_or(true, |&(start, _)| start > seq + 1) {
+            return Err(retired());
+        }
+        
+        let path: Vec<&str> = path_components(path).collect();
+        for (i, (_, file)) in files.iter().enumerate() {
+            // Skip files that end before the resume point
+            if files.get(i + 1).map_or(false, |&(next, _)| next <= seq + 1) {
                 continue;
             }
-            
-            let key = String::from_utf8_lossy(&record[13..13 + klen]).to_string();
-            
-            match kind {
-                RT_SET => {
-                    if record.len() >= 17 + klen {
-                        let mut vlen_bytes = [0u8; 4];
-                        vlen_bytes.copy_from_slice(&record[13 + klen..17 + klen]);
-                        let vlen = u32::from_le_bytes(vlen_bytes) as usize;
-                        
-                        if record.len() >= 17 + klen + vlen {
-                            let val = String::from_utf8_lossy(&record[17 + klen..17 + klen + vlen]).to_string();
-                            self.memtable.insert(key.clone(), MemValue::Scalar(val.clone(), seq));
-                            self.memtable_size += key.len() + val.len() + 16;
-                        }
+            let backlog = &mut subscription.backlog;
+            let read = read_wal_records(file, |record| {
+                for (s, kind, key, value) in decode_wal_record(record).unwrap_or_default() {
+                    if s <= seq || s > upto {
+                        continue;
+                    }
+                    let key = String::from_utf8_lossy(key);
+                    if feed_matches(&path, &key, kind == RT_DEL_SUB) {
+                        let value = if kind == RT_SET { Some(String::from_utf8_lossy(value).into_owned()) } else { None };
+                        backlog.push_back(Event { seq: s, key: key.into_owned(), value });
                     }
                 }
-                RT_DEL_POINT => {
-                    self.memtable.insert(key, MemValue::PointTomb(seq));
-                }
-                RT_DEL_SUB => {
-                    self.subtombs.insert(key, seq);
-                }
-                _ => {}
-            }
-            
-            if seq > self.seq {
-                self.seq = seq;
+            });
+            match read {
+                Ok(_) => {}
+                Err(e) if e.kind() == io::ErrorKind::NotFound => return Err(retired()),
+                Err(e) => return Err(e),
             }
         }
-        
-        Ok(())
+        Ok(subscription)
     }
-}
-
-impl GroupCommitWAL {
-    fn new(path: &Path) -> io::Result<Self> {
-        Ok(GroupCommitWAL {
-            path: path.to_path_buf(),
-            buffer: Mutex::new(Vec::new()),
-            // sync_interval: Duration::from_millis(GROUP_COMMIT_MS),
-            shutdown: Arc::new((Mutex::new(false), Condvar::new())),
-        })
+    
+    pub fn segment_counts(&self) -> (usize, usize, usize) {
+        let inner = self.version.load();
+        (inner.segments_l0.len(), inner.segments_l1.len(), inner.segments_l2.len())
     }
     
-    fn append(&self, entry: &WALEntry) -> io::Result<()> {
-        let mut buffer = self.buffer.lock().unwrap();
-        buffer.push(WALEntry {
-            seq: entry.seq,
-            kind: entry.kind,
-            key: entry.key.clone(),
-            value: entry.value.clone(),
-        });
+    pub fn get_range(&self, start: &str, end: &str) -> io::Result<Vec<(String, String)>> {
+        self.get_range_limit(start, end, usize::MAX)
+    }
+    
+    pub fn get_range_limit(&self, start: &str, end: &str, limit: usize) -> io::Result<Vec<(String, String)>> {
+        self.iter_range(start, end)?.take(limit).collect()
+    }
+    
+    /// Live keys in [start, end) in key order, read lazily. Holding the cursor
+    /// pins the memtables and segments it reads from, so page through it
+    /// rather than keeping it around.
+    pub fn iter_range(&self, start: &str, end: &str) -> io::Result<RangeIter> {
+        let inner = self.version.load();
+        self.scan(&inner, start, ScanStop::End(end.to_string()))
+    }
+    
+    pub fn scan_prefix(&self, prefix: &str, limit: usize) -> io::Result<Vec<(String, String)>> {
+        let inner = self.version.load();
+        self.scan(&inner, prefix, ScanStop::Prefix(prefix.to_string()))?.take(limit).collect()
+    }
+    
+    // Merge cursor over every memtable and the segments that overlap the
+    // range, each positioned at `start`
+    fn scan(&self, inner: &StoreInner, start: &str, stop: ScanStop) -> io::Result<RangeIter> {
+        let last = match &stop {
+            ScanStop::End(end) => end.clone(),
+            ScanStop::Prefix(prefix) => format!("{}\u{10ffff}", prefix),
+        };
         
-        // Optionally sync immediately for critical operations
-        if buffer.len() > 100 {
-            drop(buffer);
-            self.sync_now()?;
+        let mut cursors: Vec<ScanCursor> = inner.memtables()
+            .map(|mem| ScanCursor::Mem(MemCursor::new(mem.clone(), start, inner.read_seq)))
+            .collect();
+        for segment in inner.segments_overlapping(start, &last) {
+            if let ScanStop::Prefix(prefix) = &stop {
+                if !segment.may_contain_prefix(prefix) {
+                    continue;
+                }
+            }
+            if let Some(cursor) = SegmentCursor::new(segment.clone(), Some(self.cache.clone()), start)? {
+                cursors.push(ScanCursor::Segment(cursor));
+            }
         }
         
-        Ok(())
+        Ok(RangeIter {
+            heap: MergeHeap::new(cursors),
+            subtombs: inner.subtombs.clone(),
+            stop,
+            glob: None,
+            last_key: Vec::new(),
+            done: false,
+        })
     }
     
-    fn sync_now(&self) -> io::Result<()> {
-        let mut buffer = self.buffer.lock().unwrap();
-        if buffer.is_empty() {
-            return Ok(());
-        }
-        
-        let mut file = OpenOptions::new()
-            .create(true)
-            .append(true)
-            .open(&self.path)?;
-        
-        // Write magic if new file
-        if file.metadata()?.len() == 0 {
-            file.write_all(WAL_MAGIC)?;
+    // Wildcard pattern matching - supports * (zero or more chars) and ? (single char).
+    // Only keys under the pattern's literal prefix are read.
+    pub fn get_pattern(&self, pattern: &str) -> io::Result<Vec<(String, String)>> {
+        self.scan_pattern(&self.version.load(), pattern)?.collect()
+    }
+    
+    fn scan_pattern(&self, inner: &StoreInner, pattern: &str) -> io::Result<RangeIter> {
+        let glob = Glob::new(pattern);
+        let stop = ScanStop::Prefix(glob.prefix().to_string());
+        Ok(self.scan(inner, glob.prefix(), stop)?.matching(glob))
+    }
+    
+    // Delete all keys matching a wildcard pattern, as one WAL group
+    pub fn delete_pattern(&self, pattern: &str) -> io::Result<usize> {
+        let matches = self.get_pattern(pattern)?;
+        let mut updates = Vec::new();
+        for (key, value) in &matches {
+            self.index_updates(key, None, || Ok(Some(value.clone())), &mut updates)?;
         }
-        
-        for entry in buffer.drain(..) {
-            let mut record = Vec::new();
-            record.extend_from_slice(&entry.seq.to_le_bytes());
-            record.push(entry.kind);
-            record.extend_from_slice(&(entry.key.len() as u32).to_le_bytes());
-            record.extend_from_slice(entry.key.as_bytes());
-            
-            if let Some(val) = &entry.value {
-                record.extend_from_slice(&(val.len() as u32).to_le_bytes());
-                record.extend_from_slice(val.as_bytes());
-            }
-            
-            file.write_all(&(record.len() as u32).to_le_bytes())?;
-            file.write_all(&record)?;
-            file.write_all(&crc32(&record).to_le_bytes())?;
+        let mut entries: Vec<WALEntry> = matches.iter()
+            .map(|(key, _)| WALEntry { seq: 0, kind: RT_DEL_POINT, key: key, value: None })
+            .collect();
+        push_index_updates(&mut entries, &updates);
+        if !entries.is_empty() {
+            self.write_entries(&mut entries, Durability::Buffered)?;
         }
         
-        file.sync_all()?;
-        Ok(())
+        Ok(matches.len())
     }
-}
-
-impl Segment {
-    fn open(path: &Path) -> io::Result<Self> {
-        let mut file = File::open(path)?;
+    
+    pub fn delete_subtree(&self, prefix: &str) -> io::Result<()> {
+        let prefix = subtree_prefix(prefix);
+        self.write_entries(&mut [WALEntry {
+            seq: 0,
+            kind: RT_DEL_SUB,
+            key: &prefix,
+            value: None,
+        }], Durability::Buffered)
+    }
+    
+    fn compaction_thread(&self, level: usize) {
+        let mut wait = true;
+        loop {
+            // Sleep between compaction checks unless the last round made progress.
+            // Flushes wake us early once a level falls well behind.
+            {
+                let (lock, cvar) = &*self.compaction_shutdown;
+                let mut shutdown = lock.lock().unwrap();
+                if wait && !*shutdown {
+                    shutdown = cvar.wait_timeout(shutdown, Duration::from_secs(5)).unwrap().0;
+                }
+                if *shutdown {
+                    break;
+                }
+            }
+            
+            wait = match self.compact_level(level) {
+                Ok(progress) => !progress,
+                // Counted in stats; the next tick retries
+                Err(e) => {
+                    self.metrics.background_error(&self.metrics.compaction_errors, &e);
+                    true
+                }
+            };
+        }
+    }
+    
+    // Compact L0 if it is due, else L1. Returns whether anything was compacted.
+    fn run_compaction(&self) -> io::Result<bool> {
+        Ok(self.compact_level(0)? || self.compact_level(1)?)
+    }
+    
+    // Compact `level` into the next one if its score says it is due
+    fn compact_level(&self, level: usize) -> io::Result<bool> {
+        if self.version.load().level_score(&self.options, level) < 1.0 {
+            return Ok(false);
+        }
+        match level {
+            0 => self.compact_l0_to_l1()?,
+            _ => self.compact_l1_to_l2()?,
+        }
+        Ok(true)
+    }
+    
+    fn compact_l0_to_l1(&self) -> io::Result<()> {
+        let _guard = self.compaction_locks[0].lock().unwrap();
+        
+        // All of L0, since its segments overlap, plus every L1 segment in
+        // their key range. They stay readable until the merged segments
+        // replace them. An L1 segment already headed for L2 has to get
+        // there first; that merge is one L1 segment's worth.
+        let (lock, released) = &*self.compacting;
+        let mut claimed = lock.lock().unwrap();
+        let segments_to_compact: Vec<Arc<Segment>> = loop {
+            let inner = self.version.load();
+            let mut inputs = inner.segments_l0.clone();
+            let keyed = || inner.segments_l0.iter().filter(|seg| !seg.index.is_empty());
+            let start = keyed().map(|seg| seg.min_key.as_str()).min();
+            let end = keyed().map(|seg| seg.max_key.as_str()).max();
+            if let (Some(start), Some(end)) = (start, end) {
+                inputs.extend(inner.segments_l1.iter().filter(|seg| seg.overlaps(start, end)).cloned());
+            }
+            if !inputs.iter().any(|seg| claimed.contains(&seg.id)) {
+                break inputs;
+            }
+            claimed = released.wait(claimed).unwrap();
+        };
+        let _claim = Claim::new(self, claimed, &segments_to_compact);
+        
+        self.compact_segments(segments_to_compact, 1)?;
+        self.release_stalled();
+        Ok(())
+    }
+    
+    fn compact_l1_to_l2(&self) -> io::Result<()> {
+        let _guard = self.compaction_locks[1].lock().unwrap();
+        
+        // One L1 segment plus the L2 segments it overlaps. Successive rounds
+        // walk the L1 key space round-robin so every range gets pushed down.
+        // Segments an L0 compaction is merging are passed over.
+        let claimed = self.compacting.0.lock().unwrap();
+        let segments_to_compact: Vec<Arc<Segment>> = {
+            let inner = self.version.load();
+            let mut pointer = self.compact_pointer.lock().unwrap();
+            let free = || inner.segments_l1.iter().filter(|seg| !claimed.contains(&seg.id));
+            let seg = match free().find(|seg| seg.min_key > *pointer).or_else(|| free().next()) {
+                Some(seg) => seg.clone(),
+                None => return Ok(()),
+            };
+            *pointer = seg.max_key.clone();
+            
+            let mut inputs = vec![seg.clone()];
+            inputs.extend(inner.segments_l2.iter().filter(|s| s.overlaps(&seg.min_key, &seg.max_key)).cloned());
+            inputs
+        };
+        let _claim = Claim::new(self, claimed, &segments_to_compact);
+        
+        // L2 is the bottom level and holds every older version of these
+        // keys, so the merge can drop tombstones
+        self.compact_segments(segments_to_compact, 2)
+    }
+    
+    // Merge the inputs into new segments at `level` and swap them in. The
+    // manifest records the whole swap as one edit.
+    fn compact_segments(&self, inputs: Vec<Arc<Segment>>, level: usize) -> io::Result<()> {
+        if inputs.is_empty() {
+            return Ok(());
+        }
+        
+        let started = Instant::now();
+        let inner = self.version.load();
+        let collect = collectable_subtombs(&inner, &inputs);
+        let outputs = self.subcompact(&inputs, level, &inner.subtombs, &collect)?;
+        drop(inner);
+        
+        // Update manifest
+        {
+            let edit = VersionEdit {
+                added: outputs.iter()
+                    .map(|(filename, seg)| ManifestEntry {
+                        seq_high: seg.seq_high,
+                        level,
+                        filename: filename.clone(),
+                    })
+                    .collect(),
+                removed: inputs.iter()
+                    .filter_map(|seg| seg.path.file_name())
+                    .map(|name| name.to_string_lossy().into_owned())
+                    .collect(),
+                checkpoint: None,
+            };
+            self.manifest.lock().unwrap().log_edit(edit)?;
+        }
+        
+        // Update state
+        let outputs: Vec<Arc<Segment>> = outputs.into_iter().map(|(_, seg)| Arc::new(seg)).collect();
+        self.version.update(|inner| {
+            for segments in [&mut inner.segments_l0, &mut inner.segments_l1, &mut inner.segments_l2].iter_mut() {
+                segments.retain(|seg| !inputs.iter().any(|old| Arc::ptr_eq(old, seg)));
+            }
+            let target = match level {
+                1 => &mut inner.segments_l1,
+                _ => &mut inner.segments_l2,
+            };
+            target.extend(outputs.iter().cloned());
+            sort_level(target);
+            
+            if !collect.is_empty() {
+                let index = Arc::make_mut(&mut inner.subtombs);
+                for (prefix, seq) in &collect {
+                    index.remove(prefix, *seq);
+                }
+            }
+        });
+        
+        // Delete old segment files
+        for seg in inputs {
+            let _ = fs::remove_file(&seg.path);
+        }
+        
+        self.metrics.compactions.record(started);
+        Ok(())
+    }
+    
+    // Split the merge into disjoint key ranges cut at block boundaries of
+    // the inputs and merge them in parallel. Outputs come back in key order.
+    fn subcompact(&self, segments: &[Arc<Segment>], level: usize, subtombs: &SubtombIndex,
+                  collect: &[(String, u64)]) -> io::Result<Vec<(String, Segment)>> {
+        let ranges = subcompaction_ranges(segments, self.options.subcompactions, self.options.target_segment_size);
+        if ranges.len() == 1 {
+            return self.merge_segments(segments, level, subtombs, collect, &ranges[0]);
+        }
+        
+        let results: Vec<io::Result<Vec<(String, Segment)>>> = thread::scope(|scope| {
+            let merges: Vec<_> = ranges.iter()
+                .map(|range| scope.spawn(move || self.merge_segments(segments, level, subtombs, collect, range)))
+                .collect();
+            merges.into_iter().map(|merge| merge.join().unwrap()).collect()
+        });
+        
+        // Either every range lands or none: drop the finished parts on failure
+        let mut outputs = Vec::new();
+        let mut error = None;
+        for result in results {
+            match result {
+                Ok(parts) => outputs.extend(parts),
+                Err(e) => { error.get_or_insert(e); }
+            }
+        }
+        if let Some(e) = error {
+            for (_, seg) in outputs {
+                let _ = fs::remove_file(&seg.path);
+            }
+            return Err(e);
+        }
+        Ok(outputs)
+    }
+    
+    // Streaming k-way merge of the inputs' records in `range`, keeping only
+    // the newest version of each key. Output is cut into segments of about
+    // target_segment_size bytes and memory stays at one block per input.
+    // Records under a subtomb are dropped; the inputs' subtombs in the range
+    // are carried over unless in `collect`.
+    fn merge_segments(&self, segments: &[Arc<Segment>], level: usize, subtombs: &SubtombIndex,
+                      collect: &[(String, u64)], range: &(String, Option<String>)) -> io::Result<Vec<(String, Segment)>> {
+        let (start, end) = (range.0.as_str(), range.1.as_ref().map(|end| end.as_bytes()));
+        let mut outputs = Vec::new();
+        let mut writer: Option<(String, SegmentWriter)> = None;
+        let mut cursors = Vec::with_capacity(segments.len());
+        for segment in segments {
+            cursors.extend(SegmentCursor::new(segment.clone(), None, start)?);
+        }
+        let mut heap = MergeHeap::new(cursors);
+        let mut last_key: Option<Vec<u8>> = None;
+        
+        // Live subtombs go to whichever output the merge is writing when it
+        // passes their prefix, keeping levels disjoint
+        let mut carried: Vec<(String, u64)> = segments.iter()
+            .flat_map(|seg| seg.subtombs.iter().cloned())
+            .filter(|(prefix, seq)| subtombs.contains(prefix, *seq) && !collect.iter().any(|(p, s)| p == prefix && s == seq))
+            .filter(|(prefix, _)| prefix.as_str() >= start && end.map_or(true, |end| prefix.as_bytes() < end))
+            .collect();
+        carried.sort();
+        carried.dedup();
+        let mut carried = carried.into_iter().peekable();
+        
+        while let Some(record) = heap.peek() {
+            if end.map_or(false, |end| record.key >= end) {
+                break;
+            }
+            while carried.peek().map_or(false, |(prefix, _)| prefix.as_bytes() <= record.key) {
+                let (prefix, seq) = carried.next().unwrap();
+                self.output_writer(&mut writer, &mut outputs, level)?.add_subtomb(&prefix, seq);
+            }
+            
+            // Older versions of a key follow its newest one
+            if last_key.as_ref().map_or(false, |last| &last[..] == record.key) {
+                heap.advance()?;
+                continue;
+            }
+            let mut key = last_key.take().unwrap_or_default();
+            key.clear();
+            key.extend_from_slice(record.key);
+            last_key = Some(key);
+            
+            // In L2, skip tombstones entirely (they've done their job).
+            // In L0/L1, preserve tombstones to shadow older data.
+            let key = record.key_str();
+            let dead = subtombs.covers(&key, record.seq);
+            if !dead && (level < 2 || record.kind == RT_SET) {
+                let value = if record.kind == RT_SET { Some(record.value_str()) } else { None };
+                self.output_writer(&mut writer, &mut outputs, level)?
+                    .add(record.kind, &key, value.as_ref().map(|v| v.as_ref()), record.seq)?;
+            }
+            heap.advance()?;
+        }
+        
+        for (prefix, seq) in carried {
+            self.output_writer(&mut writer, &mut outputs, level)?.add_subtomb(&prefix, seq);
+        }
+        
+        if let Some((filename, w)) = writer {
+            outputs.push((filename, self.finish_segment(w)?));
+        }
+        Ok(outputs)
+    }
+    
+    // The writer for the next merge output, cutting over to a new segment once
+    // the current one reaches the target size
+    fn output_writer<'w>(&self, writer: &'w mut Option<(String, SegmentWriter)>,
+                         outputs: &mut Vec<(String, Segment)>, level: usize) -> io::Result<&'w mut SegmentWriter> {
+        let full = writer.as_ref()
+            .map_or(false, |(_, w)| w.written >= self.options.target_segment_size as u64);
+        if full {
+            let (filename, w) = writer.take().unwrap();
+            outputs.push((filename, self.finish_segment(w)?));
+        }
+        if writer.is_none() {
+            let number = self.manifest.lock().unwrap().next_file_number();
+            let filename = format!("l{}_{:010}.seg", level, number);
+            let mut w = SegmentWriter::new(
+                &self.dir.join(&filename), self.options.compression[level.min(2)], self.options.bloom_bits_per_key)?;
+            let priority = if level == 1 { Priority::High } else { Priority::Low };
+            w.throttle = Some((self.limiter.clone(), priority));
+            *writer = Some((filename, w));
+        }
+        Ok(&mut writer.as_mut().unwrap().1)
+    }
+    
+    fn finish_segment(&self, writer: SegmentWriter) -> io::Result<Segment> {
+        let seg = writer.finish()?;
+        if self.options.use_mmap {
+            seg.map()
+        } else {
+            Ok(seg)
+        }
+    }
+}
+
+impl StoreInner {
+    // Active memtable first, then sealed ones from newest to oldest
+    fn memtables(&self) -> impl Iterator<Item = &Arc<MemTable>> {
+        std::iter::once(&self.mem).chain(self.imm.iter().rev().map(|(mem, _)| mem))
+    }
+    
+    // Segments that may hold keys in [start, end], L0 first
+    fn segments_overlapping<'a>(&'a self, start: &'a str, end: &'a str) -> impl Iterator<Item = &'a Arc<Segment>> + 'a {
+        self.segments_l0.iter()
+            .chain(self.segments_l1.iter())
+            .chain(self.segments_l2.iter())
+            .filter(move |seg| seg.overlaps(start, end))
+    }
+    
+    // The level that most needs compacting and its score, due at 1.0. L0 is
+    // scored by segment count since each one costs every lookup a probe, L1 by
+    // bytes against its target. L2 is the bottom and only receives data.
+    fn compaction_score(&self, options: &Options) -> (f64, usize) {
+        let (l0, l1) = (self.level_score(options, 0), self.level_score(options, 1));
+        if l0 >= l1 { (l0, 0) } else { (l1, 1) }
+    }
+    
+    fn level_score(&self, options: &Options, level: usize) -> f64 {
+        match level {
+            0 => self.segments_l0.len() as f64 / L0_COMPACTION_THRESHOLD as f64,
+            _ => {
+                let l1_bytes: u64 = self.segments_l1.iter().map(|seg| seg.size).sum();
+                l1_bytes as f64 / (L1_COMPACTION_THRESHOLD * options.target_segment_size) as f64
+            }
+        }
+    }
+    
+    // Replay one WAL file into the memtable, skipping records the checkpoint
+    // already covers. Subtombs at or below it are still applied: they must
+    // keep covering records in segments older than the checkpoint. Those a
+    // subtomb loaded from the segments already covers are skipped. Returns
+    // the length of the valid prefix.
+    fn replay_wal(&mut self, path: &Path, checkpoint: u64, last_seq: &mut u64) -> io::Result<u64> {
+        if !path.exists() {
+            return Ok(0);
+        }
+        
+        read_wal_records(path, |record| {
+            // A batch is one record, so it is applied whole or not at all
+            let entries = match decode_wal_record(record) {
+                Some(entries) => entries,
+                None => return,
+            };
+            for (seq, kind, key, value) in entries {
+                if seq > *last_seq {
+                    *last_seq = seq;
+                }
+                if seq <= checkpoint && kind != RT_DEL_SUB {
+                    continue;
+                }
+                
+                let key = String::from_utf8_lossy(key);
+                match kind {
+                    RT_SET => self.mem.insert(seq, RT_SET, &key, &String::from_utf8_lossy(value)),
+                    RT_DEL_POINT => self.mem.insert(seq, RT_DEL_POINT, &key, ""),
+                    RT_DEL_SUB => {
+                        if !self.subtombs.covers(&key, seq) {
+                            Arc::make_mut(&mut self.subtombs).insert(&key, seq, false);
+                        }
+                    }
+                    _ => {}
+                }
+            }
+        })
+    }
+}
+
+impl SubtombIndex {
+    // Whether a subtomb at or above `key` deletes a record with this seq
+    fn covers(&self, key: &str, seq: u64) -> bool {
+        key.match_indices('/').any(|(i, _)| {
+            self.prefixes.get(&key[..=i]).map_or(false, |tomb| tomb.seq >= seq)  // FIXED: >= not >
+        })
+    }
+    
+    // Newest wins for a prefix. Subtombs nested under it with older seqs add
+    // nothing and are dropped.
+    fn insert(&mut self, prefix: &str, seq: u64, persisted: bool) {
+        if self.covers(prefix, seq) {
+            return;
+        }
+        let nested: Vec<String> = self.prefixes.range::<str, _>((Bound::Included(prefix), Bound::Unbounded))
+            .take_while(|(p, _)| p.starts_with(prefix))
+            .filter(|(_, tomb)| tomb.seq <= seq)
+            .map(|(p, _)| p.clone())
+            .collect();
+        for p in nested {
+            self.prefixes.remove(&p);
+        }
+        self.prefixes.insert(prefix.to_string(), Subtomb { seq, persisted });
+    }
+    
+    // Remove a subtomb unless a newer one replaced it meanwhile
+    fn remove(&mut self, prefix: &str, seq: u64) {
+        if self.prefixes.get(prefix).map_or(false, |tomb| tomb.seq == seq) {
+            self.prefixes.remove(prefix);
+        }
+    }
+    
+    fn mark_persisted(&mut self, prefix: &str, seq: u64) {
+        if let Some(tomb) = self.prefixes.get_mut(prefix) {
+            if tomb.seq == seq {
+                tomb.persisted = true;
+            }
+        }
+    }
+    
+    fn contains(&self, prefix: &str, seq: u64) -> bool {
+        self.prefixes.get(prefix).map_or(false, |tomb| tomb.seq == seq)
+    }
+    
+    fn iter(&self) -> impl Iterator<Item = (&str, &Subtomb)> {
+        self.prefixes.iter().map(|(p, tomb)| (p.as_str(), tomb))
+    }
+}
+
+impl VersionSlot {
+    fn new(inner: StoreInner) -> Self {
+        VersionSlot {
+            number: AtomicU64::new(0),
+            current: Mutex::new(Arc::new(inner)),
+        }
+    }
+    
+    // Current version. Each thread caches the last version it saw per store and
+    // only takes the mutex once the version number has moved on.
+    fn load(self: &Arc<Self>) -> Arc<StoreInner> {
+        thread_local! {
+            static CACHE: RefCell<Vec<(Weak<VersionSlot>, u64, Arc<StoreInner>)>> = RefCell::new(Vec::new());
+        }
+        
+        let number = self.number.load(Ordering::Acquire);
+        CACHE.with(|cache| {
+            let mut cache = cache.borrow_mut();
+            let slot = Arc::as_ptr(self);
+            
+            if let Some((_, cached, inner)) = cache.iter().find(|(s, _, _)| s.as_ptr() == slot) {
+                if *cached == number {
+                    return inner.clone();
+                }
+            }
+            
+            let (number, inner) = {
+                let current = self.current.lock().unwrap();
+                (self.number.load(Ordering::Relaxed), current.clone())
+            };
+            
+            // Drop entries for stores that have since been closed
+            cache.retain(|(s, _, _)| s.strong_count() > 0 && s.as_ptr() != slot);
+            cache.push((Arc::downgrade(self), number, inner.clone()));
+            inner
+        })
+    }
+    
+    // Publish a modified copy of the current version
+    fn update<F: FnOnce(&mut StoreInner)>(&self, f: F) {
+        let mut current = self.current.lock().unwrap();
+        let mut next = (**current).clone();
+        f(&mut next);
+        *current = Arc::new(next);
+        self.number.fetch_add(1, Ordering::Release);
+    }
+}
+
+impl GroupCommitWAL {
+    // Open wal_<start_seq>.log for appending. `reuse_len` is the valid length of
+    // an existing file with that name; anything past it is a torn tail.
+    fn open(dir: &Path, start_seq: u64, reuse_len: Option<u64>, mem: Arc<MemTable>, queue: usize) -> io::Result<Self> {
+        let mut wal_file = WalFile::create(dir, start_seq, reuse_len)?;
+        wal_file.sync_pending()?;
+        
+        Ok(GroupCommitWAL {
+            file: Mutex::new(wal_file),
+            state: Mutex::new(WalState {
+                buffer: Vec::with_capacity(64 * 1024),
+                spare: Vec::with_capacity(64 * 1024),
+                appended_lsn: 0,
+                durable_lsn: 0,
+                committing: false,
+                last_seq: start_seq - 1,
+                mem,
+                epoch: 0,
+                wakers: Vec::new(),
+                failed: None,
+            }),
+            durable: Condvar::new(),
+            work: Condvar::new(),
+            shutdown: Arc::new((Mutex::new(false), Condvar::new())),
+            feed: Arc::new(ChangeFeed { queue, ..ChangeFeed::default() }),
+            inflight: [AtomicUsize::new(0), AtomicUsize::new(0)],
+            snapshots: Mutex::new(()),
+            syncs: Histogram::default(),
+        })
+    }
+    
+    // Assign the next seqs to `entries`, serialize them into the shared buffer
+    // (unless `log` is false), publish them to subscribers, run `install` and
+    // pin the memtable they belong to. Nothing is written to the file here;
+    // see `commit`.
+    fn append<F: FnOnce(&[WALEntry])>(&self, entries: &mut [WALEntry], log: bool, install: F) -> (u64, MemPin<'_>) {
+        let mut state = self.state.lock().unwrap();
+        for entry in entries.iter_mut() {
+            state.last_seq += 1;
+            entry.seq = state.last_seq;
+        }
+        if log {
+            encode_wal_record(&mut state.buffer, entries);
+            state.appended_lsn += 1;
+        }
+        // Still under the state lock, so every subscriber sees seq order
+        self.feed.publish(entries);
+        
+        if state.buffer.len() >= WAL_BUFFER_LIMIT {
+            self.work.notify_one();
+        }
+        
+        // Also under the lock, so a read point never sees half of what a seq range installs
+        install(entries);
+        
+        let inflight = &self.inflight[state.epoch];
+        inflight.fetch_add(1, Ordering::Relaxed);
+        state.mem.writers.fetch_add(1, Ordering::Relaxed);
+        (state.appended_lsn, MemPin { mem: state.mem.clone(), inflight })
+    }
+    
+    // The last assigned seq and whatever `load` returns, taken together under
+    // the state lock, once every write up to that seq has been applied.
+    // Writers count themselves in the slot of the current epoch; flipping it
+    // here means only writes that started before the capture are waited for.
+    fn read_point<T, F: FnOnce() -> T>(&self, load: F) -> (u64, T) {
+        let _serial = self.snapshots.lock().unwrap();
+        let (seq, loaded, slot) = {
+            let mut state = self.state.lock().unwrap();
+            let slot = state.epoch;
+            state.epoch ^= 1;
+            (state.last_seq, load(), slot)
+        };
+        while self.inflight[slot].load(Ordering::Acquire) != 0 {
+            thread::yield_now();
+        }
+        (seq, loaded)
+    }
+    
+    // Block until every record up to `lsn` is durable. The first caller to find
+    // no commit in flight becomes the leader and syncs the whole buffer on
+    // behalf of everyone else waiting.
+    fn commit(&self, lsn: u64) -> io::Result<()> {
+        let mut state = self.state.lock().unwrap();
+        
+        while state.durable_lsn < lsn {
+            if state.committing {
+                state = self.durable.wait(state).unwrap();
+                continue;
+            }
+            
+            state.committing = true;
+            let target = state.appended_lsn;
+            let spare = std::mem::take(&mut state.spare);
+            let mut batch = std::mem::replace(&mut state.buffer, spare);
+            drop(state);
+            
+            let result = self.write_batch(&batch);
+            
+            state = self.state.lock().unwrap();
+            state.committing = false;
+            match result {
+                Ok(()) => {
+                    state.durable_lsn = target;
+                    state.failed = None;
+                    batch.clear();
+                    state.spare = batch;
+                    wake_durable(&mut state.wakers, target);
+                    self.durable.notify_all();
+                }
+                Err(e) => {
+                    // Put the batch back in front of anything appended meanwhile
+                    // so a later leader retries it in order
+                    batch.extend_from_slice(&state.buffer);
+                    state.buffer = batch;
+                    state.failed = Some((target, e.kind(), e.to_string()));
+                    wake_durable(&mut state.wakers, target);
+                    self.durable.notify_all();
+                    return Err(e);
+                }
+            }
+        }
+        
+        Ok(())
+    }
+    
+    fn write_batch(&self, batch: &[u8]) -> io::Result<()> {
+        let mut wal_file = self.file.lock().unwrap();
+        wal_file.sync_pending()?;
+        if batch.is_empty() {
+            return Ok(());
+        }
+        
+        let started = Instant::now();
+        let result = wal_file.file.write_all(batch)
+            .and_then(|_| wal_file.file.sync_data());
+        self.syncs.record(started);
+        
+        match result {
+            Ok(()) => {
+                wal_file.len += batch.len() as u64;
+                Ok(())
+            }
+            Err(e) => {
+                // Drop any partial record so replay doesn't stop at a torn frame
+                let len = wal_file.len;
+                let _ = wal_file.file.set_len(len);
+                Err(e)
+            }
+        }
+    }
+    
+    fn sync_now(&self) -> io::Result<()> {
+        let lsn = self.state.lock().unwrap().appended_lsn;
+        self.commit(lsn)
+    }
+    
+    // Take a seq for data that goes straight into segments
+    fn reserve_seq(&self) -> u64 {
+        let mut state = self.state.lock().unwrap();
+        state.last_seq += 1;
+        state.last_seq
+    }
+    
+    // Register a subscriber for `path`, returning it with the last seq it
+    // will not see live
+    fn subscribe(&self, path: &str) -> (Subscription, u64) {
+        let state = self.state.lock().unwrap();
+        (self.feed.subscribe(&self.feed, path), state.last_seq)
+    }
+    
+    // Seal the active memtable together with the WAL file: every seq assigned
+    // after this goes to a fresh memtable and wal_<last_seq+1>.log. `publish`
+    // runs before any writer can pin the fresh memtable, so no acknowledged
+    // write is ever invisible to readers. Nothing is fsync'd here; the next
+    // commit leader syncs the sealed file and the new directory entry. Does
+    // nothing if the active memtable is empty or is no longer `expected`.
+    fn switch_memtable<F>(&self, expected: Option<&Arc<MemTable>>, publish: F) -> io::Result<()>
+    where
+        F: FnOnce(&Arc<MemTable>, &Arc<MemTable>, u64),
+    {
+        let mut state = self.state.lock().unwrap();
+        while state.committing {
+            state = self.durable.wait(state).unwrap();
+        }
+        
+        let stale = match expected {
+            Some(mem) => !Arc::ptr_eq(mem, &state.mem),
+            None => state.mem.is_empty(),
+        };
+        if stale {
+            return Ok(());
+        }
+        
+        let last_seq = state.last_seq;
+        
+        // Hand what is buffered to the old file before swapping in the new one
+        {
+            let mut wal_file = self.file.lock().unwrap();
+            if !state.buffer.is_empty() {
+                wal_file.file.write_all(&state.buffer)?;
+                wal_file.len += state.buffer.len() as u64;
+                state.buffer.clear();
+            }
+            
+            let next = WalFile::create(&wal_file.dir, last_seq + 1, None)?;
+            let old = std::mem::replace(&mut *wal_file, next);
+            wal_file.sealed = old.sealed;
+            wal_file.sealed.push(old.file);
+        }
+        
+        // Records drained above are not durable yet, so make sure the next
+        // sync_now has an LSN to commit even if nothing else gets appended
+        state.appended_lsn += 1;
+        
+        let fresh = Arc::new(MemTable::new());
+        let sealed = std::mem::replace(&mut state.mem, fresh.clone());
+        publish(&sealed, &fresh, last_seq);
+        Ok(())
+    }
+    
+    // Delete WAL files that a checkpoint has made redundant
+    fn remove_files_before(&self, start_seq: u64) {
+        let dir = self.file.lock().unwrap().dir.clone();
+        if let Ok(files) = list_wal_files(&dir) {
+            for (start, path) in files {
+                if start < start_seq {
+                    let _ = fs::remove_file(path);
+                }
+            }
+        }
+    }
+    
+    fn committer_thread(&self) {
+        loop {
+            {
+                let state = self.state.lock().unwrap();
+                if state.buffer.len() < WAL_BUFFER_LIMIT && state.wakers.is_empty() {
+                    let _ = self.work.wait_timeout(state, Duration::from_millis(GROUP_COMMIT_MS)).unwrap();
+                }
+            }
+            
+            // Silently ignore sync errors - WAL will retry on next interval
+            let _ = self.sync_now();
+            
+            let shutdown = self.shutdown.0.lock().unwrap();
+            if *shutdown {
+                break;
+            }
+        }
+    }
+}
+
+// Wake the futures whose records are covered by a commit up to `lsn`
+fn wake_durable(wakers: &mut Vec<(u64, Waker)>, lsn: u64) {
+    let mut i = 0;
+    while i < wakers.len() {
+        if wakers[i].0 <= lsn {
+            wakers.swap_remove(i).1.wake();
+        } else {
+            i += 1;
+        }
+    }
+}
+
+impl Future for DurableWrite {
+    type Output = io::Result<()>;
+    
+    // Register with the WAL and kick the background committer, which leads
+    // the next commit and wakes us from it
+    fn poll(self: Pin<&mut Self>, cx: &mut Context<'_>) -> Poll<io::Result<()>> {
+        let mut state = self.wal.state.lock().unwrap();
+        if state.durable_lsn >= self.lsn {
+            return Poll::Ready(Ok(()));
+        }
+        if let Some((target, kind, message)) = &state.failed {
+            if self.lsn <= *target {
+                return Poll::Ready(Err(io::Error::new(*kind, message.clone())));
+            }
+        }
+        
+        let lsn = self.lsn;
+        if !state.wakers.iter().any(|(l, w)| *l == lsn && w.will_wake(cx.waker())) {
+            state.wakers.push((lsn, cx.waker().clone()));
+        }
+        self.wal.work.notify_one();
+        Poll::Pending
+    }
+}
+
+impl ChangeFeed {
+    fn subscribe(&self, feed: &Arc<ChangeFeed>, path: &str) -> Subscription {
+        let (tx, rx) = mpsc::sync_channel(self.queue);
+        let id = self.next_id.fetch_add(1, Ordering::Relaxed);
+        let path: Vec<String> = path_components(path).map(|c| c.to_string()).collect();
+        
+        let mut node = &mut *self.root.lock().unwrap();
+        for component in &path {
+            node = node.children.entry(component.clone()).or_default();
+        }
+        node.subscribers.push((id, tx));
+        self.count.fetch_add(1, Ordering::Relaxed);
+        
+        Subscription { backlog: VecDeque::new(), rx, id, path, feed: feed.clone() }
+    }
+    
+    fn publish(&self, entries: &[WALEntry]) {
+        if self.count.load(Ordering::Relaxed) == 0 {
+            return;
+        }
+        let mut root = self.root.lock().unwrap();
+        for entry in entries {
+            let event = Event {
+                seq: entry.seq,
+                key: entry.key.to_string(),
+                value: entry.value.filter(|_| entry.kind == RT_SET).map(|v| v.to_string()),
+            };
+            let dropped = root.dispatch(path_components(entry.key), entry.kind == RT_DEL_SUB, &event);
+            self.count.fetch_sub(dropped, Ordering::Relaxed);
+        }
+    }
+    
+    fn unsubscribe(&self, path: &[String], id: u64) {
+        if self.root.lock().unwrap().remove(path, id) {
+            self.count.fetch_sub(1, Ordering::Relaxed);
+        }
+    }
+}
+
+impl FeedNode {
+    // Send `event` to the subscribers on the way down `path`, and below its
+    // end for a subtree delete. Returns how many were dropped as full or gone.
+    fn dispatch<'a, I: Iterator<Item = &'a str>>(&mut self, mut path: I, subtree: bool, event: &Event) -> usize {
+        let mut dropped = self.send(event);
+        match path.next() {
+            Some(component) => {
+                if let Some(child) = self.children.get_mut(component) {
+                    dropped += child.dispatch(path, subtree, event);
+                }
+            }
+            None if subtree => {
+                for child in self.children.values_mut() {
+                    dropped += child.send_all(event);
+                }
+            }
+            None => {}
+        }
+        dropped
+    }
+    
+    fn send_all(&mut self, event: &Event) -> usize {
+        let mut dropped = self.send(event);
+        for child in self.children.values_mut() {
+            dropped += child.send_all(event);
+        }
+        dropped
+    }
+    
+    fn send(&mut self, event: &Event) -> usize {
+        let before = self.subscribers.len();
+        self.subscribers.retain(|(_, tx)| tx.try_send(event.clone()).is_ok());
+        before - self.subscribers.len()
+    }
+    
+    // Remove subscriber `id` at `path`, pruning nodes left empty
+    fn remove(&mut self, path: &[String], id: u64) -> bool {
+        match path.split_first() {
+            None => {
+                let before = self.subscribers.len();
+                self.subscribers.retain(|(sub, _)| *sub != id);
+                self.subscribers.len() < before
+            }
+            Some((component, rest)) => {
+                let child = match self.children.get_mut(component) {
+                    Some(child) => child,
+                    None => return false,
+                };
+                let removed = child.remove(rest, id);
+                if child.subscribers.is_empty() && child.children.is_empty() {
+                    self.children.remove(component);
+                }
+                removed
+            }
+        }
+    }
+}
+
+impl Subscription {
+    /// The next event if one is ready; None when there is none yet or the
+    /// subscription has ended
+    pub fn try_next(&mut self) -> Option<Event> {
+        self.backlog.pop_front().or_else(|| self.rx.try_recv().ok())
+    }
+    
+    /// Like `next`, giving up after `timeout`
+    pub fn next_timeout(&mut self, timeout: Duration) -> Option<Event> {
+        self.backlog.pop_front().or_else(|| self.rx.recv_timeout(timeout).ok())
+    }
+}
+
+impl Iterator for Subscription {
+    type Item = Event;
+    
+    fn next(&mut self) -> Option<Event> {
+        self.backlog.pop_front().or_else(|| self.rx.recv().ok())
+    }
+}
+
+impl Drop for Subscription {
+    fn drop(&mut self) {
+        self.feed.unsubscribe(&self.path, self.id);
+    }
+}
+
+// Non-empty components of a path, the unit subscriptions match on
+fn path_components(path: &str) -> impl Iterator<Item = &str> {
+    path.split('/').filter(|c| !c.is_empty())
+}
+
+// Whether a subscriber at `path` hears about `key`: a change at or below the
+// path, or a subtree delete enclosing it. The WAL replay twin of `dispatch`.
+fn feed_matches(path: &[&str], key: &str, subtree: bool) -> bool {
+    let mut key = path_components(key);
+    for component in path {
+        match key.next() {
+            Some(c) if c == *component => {}
+            Some(_) => return false,
+            None => return subtree,
+        }
+    }
+    true
+}
+
+impl WalFile {
+    fn create(dir: &Path, start_seq: u64, reuse_len: Option<u64>) -> io::Result<Self> {
+        let path = dir.join(format!("wal_{:010}.log", start_seq));
+        let mut file = OpenOptions::new()
+            .create(true)
+            .append(true)
+            .open(&path)?;
+        
+        // Keep the valid prefix of a reused file, start anything else fresh
+        let mut len = match reuse_len {
+            Some(len) if len >= WAL_MAGIC.len() as u64 => len,
+            _ => 0,
+        };
+        file.set_len(len)?;
+        
+        if len == 0 {
+            file.write_all(WAL_MAGIC)?;
+            len = WAL_MAGIC.len() as u64;
+        }
+        
+        Ok(WalFile {
+            dir: dir.to_path_buf(),
+            file,
+            len,
+            synced: false,
+            sealed: Vec::new(),
+        })
+    }
+    
+    // Sync the tails of sealed files, then this file's header and directory
+    // entry, before anything written to it may be reported durable
+    fn sync_pending(&mut self) -> io::Result<()> {
+        if self.synced {
+            return Ok(());
+        }
+        
+        for sealed in &self.sealed {
+            sealed.sync_data()?;
+        }
+        self.sealed.clear();
+        self.file.sync_data()?;
+        File::open(&self.dir)?.sync_all()?;
+        self.synced = true;
+        Ok(())
+    }
+}
+
+// A writer's hold on the memtable its seqs belong to. Flushing a sealed
+// memtable, and capturing a read point, wait until the pin is dropped.
+struct MemPin<'a> {
+    mem: Arc<MemTable>,
+    inflight: &'a AtomicUsize,
+}
+
+impl<'a> Drop for MemPin<'a> {
+    fn drop(&mut self) {
+        self.mem.writers.fetch_sub(1, Ordering::Release);
+        self.inflight.fetch_sub(1, Ordering::Release);
+    }
+}
+
+// Call `f` with each intact record of a WAL file, stopping at the first torn
+// or corrupt frame. Returns the length of the valid part.
+fn read_wal_records<F: FnMut(&[u8])>(path: &Path, f: F) -> io::Result<u64> {
+    read_wal_records_from(path, 0, f)
+}
+
+// The same, starting at `offset`, which must be 0 or the end of a frame
+fn read_wal_records_from<F: FnMut(&[u8])>(path: &Path, offset: u64, mut f: F) -> io::Result<u64> {
+    let mut file = File::open(path)?;
+    let mut valid_len = offset;
+    if offset > 0 {
+        file.seek(SeekFrom::Start(offset))?;
+    }
+    let mut reader = BufReader::new(file);
+    
+    if offset == 0 {
+        let mut magic_buf = [0u8; 4];
+        if reader.read_exact(&mut magic_buf).is_err() {
+            return Ok(0);
+        }
+        
+        if &magic_buf != WAL_MAGIC {
+            return Ok(0);
+        }
+        valid_len = WAL_MAGIC.len() as u64;
+    }
+    
+    let mut record = Vec::new();
+    
+    loop {
+        let mut len_buf = [0u8; 4];
+        if reader.read_exact(&mut len_buf).is_err() {
+            break;
+        }
+        
+        let len = u32::from_le_bytes(len_buf) as usize;
+        record.resize(len, 0);
+        
+        if reader.read_exact(&mut record).is_err() {
+            break;
+        }
+        
+        let mut crc_buf = [0u8; 4];
+        if reader.read_exact(&mut crc_buf).is_err() {
+            break;
+        }
+        
+        let expected_crc = u32::from_le_bytes(crc_buf);
+        if crc32(&record) != expected_crc {
+            break;
+        }
+        
+        valid_len += 8 + len as u64;
+        f(&record);
+    }
+    
+    Ok(valid_len)
+}
+
+// Append the intact records of WAL file `src` that `dst` doesn't have yet.
+// `dst` only ever holds a prefix of `src`; if `src` is now shorter it was
+// rewritten, and is shipped again whole. Returns the last seq shipped (0 if
+// none) and the bytes written.
+fn ship_wal_tail(src: &Path, dst: &Path) -> io::Result<(u64, u64)> {
+    let mut from = fs::metadata(dst).map(|m| m.len()).unwrap_or(0);
+    if from > fs::metadata(src)?.len() {
+        from = 0;
+    }
+    
+    let mut last_seq = 0;
+    let end = read_wal_records_from(src, from, |record| {
+        if let Some(&(seq, _, _, _)) = decode_wal_record(record).as_ref().and_then(|e| e.last()) {
+            last_seq = seq;
+        }
+    })?;
+    if end <= from {
+        return Ok((0, 0));
+    }
+    
+    let mut input = File::open(src)?;
+    input.seek(SeekFrom::Start(from))?;
+    let mut output = OpenOptions::new().create(true).write(true).open(dst)?;
+    output.set_len(from)?;
+    output.seek(SeekFrom::Start(from))?;
+    io::copy(&mut input.take(end - from), &mut output)?;
+    output.sync_data()?;
+    Ok((last_seq, end - from))
+}
+
+// Components below the root: an indexed path has exactly as many as its
+// pattern
+fn index_depth(path: &str) -> usize {
+    path.matches('/').count()
+}
+
+// Key of an index entry. The value is one path component of it, so '/' in
+// it is escaped, and '%' so the escape stays unambiguous.
+fn index_key(name: &str, value: &str, parent: &str) -> String {
+    format!("{}{}/{}/{}", INDEX_PREFIX, name, value.replace('%', "%25").replace('/', "%2F"), parent)
+}
+
+// What earlier ops of a batch left at `path`, if they touched it
+fn staged_value(staged: &HashMap<&str, Option<&str>>, cleared: &[&str], path: &str) -> Option<Option<String>> {
+    match staged.get(path) {
+        Some(value) => Some(value.map(str::to_string)),
+        None if cleared.iter().any(|prefix| path.starts_with(prefix)) => Some(None),
+        None => None,
+    }
+}
+
+fn push_index_updates<'a>(entries: &mut Vec<WALEntry<'a>>, updates: &'a [(u8, String)]) {
+    for (kind, key) in updates {
+        let value = if *kind == RT_SET { Some("") } else { None };
+        entries.push(WALEntry { seq: 0, kind: *kind, key: key, value });
+    }
+}
+
+// Open the segments `entries` name on a few threads: each open reads the
+// footer, index, bloom and last block, so a big store is mostly waiting on
+// disk. Results come back in entry order.
+fn open_segments(dir: &Path, entries: &[ManifestEntry], use_mmap: bool) -> Vec<io::Result<Segment>> {
+    let threads = thread::available_parallelism().map_or(1, |n| n.get()).min(OPEN_THREADS);
+    let chunk = ((entries.len() + threads - 1) / threads).max(OPEN_SEGMENTS_PER_THREAD);
+    if entries.len() <= chunk {
+        return entries.iter().map(|entry| Segment::open(&dir.join(&entry.filename), use_mmap)).collect();
+    }
+    
+    thread::scope(|scope| {
+        let opens: Vec<_> = entries.chunks(chunk)
+            .map(|part| scope.spawn(move || part.iter()
+                .map(|entry| Segment::open(&dir.join(&entry.filename), use_mmap))
+                .collect::<Vec<_>>()))
+            .collect();
+        opens.into_iter().flat_map(|open| open.join().unwrap()).collect()
+    })
+}
+
+// Segments never change once written, so a link is as good as a copy
+fn link_or_copy(src: &Path, dst: &Path) -> io::Result<()> {
+    if fs::hard_link(src, dst).is_ok() {
+        return Ok(());
+    }
+    fs::copy(src, dst)?;
+    File::open(dst)?.sync_all()
+}
+
+// WAL files sorted by start seq. A pre-rotation `wal.log` sorts first.
+fn list_wal_files(dir: &Path) -> io::Result<Vec<(u64, PathBuf)>> {
+    let mut files = Vec::new();
+    
+    for entry in fs::read_dir(dir)? {
+        let path = entry?.path();
+        let name = match path.file_name().and_then(|n| n.to_str()) {
+            Some(name) => name,
+            None => continue,
+        };
+        
+        if name == "wal.log" {
+            files.push((0, path));
+        } else if let Some(start) = name.strip_prefix("wal_")
+            .and_then(|n| n.strip_suffix(".log"))
+            .and_then(|n| n.parse::<u64>().ok())
+        {
+            files.push((start, path));
+        }
+    }
+    
+    files.sort();
+    Ok(files)
+}
+
+// Frame: len(4) | record | crc(4), where the record is either one entry,
+//   seq(8) | kind(1) | klen(4) | key | [vlen(4) | value]
+// or several entries with consecutive seqs from the first,
+//   seq(8) | RT_BATCH(1) | count(4) | (kind(1) | klen(4) | key | [vlen(4) | value])*
+// Only RT_SET entries carry a value.
+fn encode_wal_record(buf: &mut Vec<u8>, entries: &[WALEntry]) {
+    let frame_start = buf.len();
+    buf.extend_from_slice(&[0u8; 4]);
+    
+    let record_start = buf.len();
+    buf.extend_from_slice(&entries[0].seq.to_le_bytes());
+    if entries.len() > 1 {
+        buf.push(RT_BATCH);
+        buf.extend_from_slice(&(entries.len() as u32).to_le_bytes());
+    }
+    for (i, entry) in entries.iter().enumerate() {
+        debug_assert_eq!(entry.seq, entries[0].seq + i as u64);
+        buf.push(entry.kind);
+        buf.extend_from_slice(&(entry.key.len() as u32).to_le_bytes());
+        buf.extend_from_slice(entry.key.as_bytes());
+        if entry.kind == RT_SET {
+            let val = entry.value.unwrap_or("");
+            buf.extend_from_slice(&(val.len() as u32).to_le_bytes());
+            buf.extend_from_slice(val.as_bytes());
+        }
+    }
+    
+    let record_len = (buf.len() - record_start) as u32;
+    buf[frame_start..record_start].copy_from_slice(&record_len.to_le_bytes());
+    let crc = crc32(&buf[record_start..]);
+    buf.extend_from_slice(&crc.to_le_bytes());
+}
+
+// Entries of a record that passed its CRC as (seq, kind, key, value). None if
+// it is malformed, so a batch is never applied in part.
+fn decode_wal_record(record: &[u8]) -> Option<Vec<(u64, u8, &[u8], &[u8])>> {
+    if record.len() < 9 {
+        return None;
+    }
+    let seq = le_u64(&record[0..8]);
+    let (count, mut pos) = if record[8] == RT_BATCH {
+        if record.len() < 13 {
+            return None;
+        }
+        (le_u32(&record[9..13]) as usize, 13)
+    } else {
+        (1, 8)
+    };
+    
+    let mut entries = Vec::with_capacity(count.min(1024));
+    for i in 0..count {
+        if pos + 5 > record.len() {
+            return None;
+        }
+        let kind = record[pos];
+        let klen = le_u32(&record[pos + 1..pos + 5]) as usize;
+        pos += 5;
+        if pos + klen > record.len() {
+            return None;
+        }
+        let key = &record[pos..pos + klen];
+        pos += klen;
+        
+        let mut value: &[u8] = &[];
+        if kind == RT_SET {
+            if pos + 4 > record.len() {
+                return None;
+            }
+            let vlen = le_u32(&record[pos..pos + 4]) as usize;
+            pos += 4;
+            if pos + vlen > record.len() {
+                return None;
+            }
+            value = &record[pos..pos + vlen];
+            pos += vlen;
+        }
+        entries.push((seq + i as u64, kind, key, value));
+    }
+    Some(entries)
+}
+
+// Memtable: an insert-only skiplist over arena memory. Every write inserts a new
+// (key, seq) node, ordered by key ascending then seq descending, so the newest
+// version of a key is always the first node for it. Inserts link nodes in with
+// CAS and readers never lock; nodes are freed only when the memtable is dropped.
+const MEMTABLE_MAX_HEIGHT: usize = 12;
+const ARENA_BLOCK_SIZE: usize = 64 * 1024;
+
+struct ArenaBlock {
+    ptr: *mut u8,
+    cap: usize,
+    used: AtomicUsize,
+}
+
+impl ArenaBlock {
+    fn new(cap: usize) -> Box<ArenaBlock> {
+        let layout = Layout::from_size_align(cap, 8).unwrap();
+        let ptr = unsafe { alloc::alloc(layout) };
+        if ptr.is_null() {
+            alloc::handle_alloc_error(layout);
+        }
+        Box::new(ArenaBlock { ptr, cap, used: AtomicUsize::new(0) })
+    }
+}
+
+impl Drop for ArenaBlock {
+    fn drop(&mut self) {
+        unsafe { alloc::dealloc(self.ptr, Layout::from_size_align(self.cap, 8).unwrap()) };
+    }
+}
+
+// Bump allocator: allocation is a fetch_add on the current block, the mutex is
+// only taken to install a fresh block once it fills up
+struct Arena {
+    current: AtomicPtr<ArenaBlock>,
+    blocks: Mutex<Vec<Box<ArenaBlock>>>,
+}
+
+impl Arena {
+    fn new() -> Self {
+        let first = ArenaBlock::new(ARENA_BLOCK_SIZE);
+        let current = &*first as *const ArenaBlock as *mut ArenaBlock;
+        Arena {
+            current: AtomicPtr::new(current),
+            blocks: Mutex::new(vec![first]),
+        }
+    }
+    
+    // 8-byte aligned, uninitialized memory that lives as long as the arena
+    fn alloc(&self, size: usize) -> *mut u8 {
+        let size = (size + 7) & !7;
+        
+        if size > ARENA_BLOCK_SIZE / 4 {
+            // Large records get their own block instead of wasting the current one
+            let block = ArenaBlock::new(size);
+            let ptr = block.ptr;
+            self.blocks.lock().unwrap().push(block);
+            return ptr;
+        }
+        
+        loop {
+            let block_ptr = self.current.load(Ordering::Acquire);
+            let block = unsafe { &*block_ptr };
+            let offset = block.used.fetch_add(size, Ordering::Relaxed);
+            if offset + size <= block.cap {
+                return unsafe { block.ptr.add(offset) };
+            }
+            
+            let mut blocks = self.blocks.lock().unwrap();
+            if self.current.load(Ordering::Acquire) == block_ptr {
+                let fresh = ArenaBlock::new(ARENA_BLOCK_SIZE);
+                self.current.store(&*fresh as *const ArenaBlock as *mut ArenaBlock, Ordering::Release);
+                blocks.push(fresh);
+            }
+        }
+    }
+}
+
+// Node header; followed in arena memory by `height` links, the key and the value
+#[repr(C)]
+struct Node {
+    seq: u64,
+    key_len: u32,
+    value_len: u32,
+    kind: u8,
+    height: u8,
+}
+
+const NODE_HEADER: usize = (std::mem::size_of::<Node>() + 7) & !7;
+
+fn node_link<'a>(node: *const Node, level: usize) -> &'a AtomicPtr<Node> {
+    unsafe { &*((node as *const u8).add(NODE_HEADER) as *const AtomicPtr<Node>).add(level) }
+}
+
+fn node_key<'a>(node: *const Node) -> &'a [u8] {
+    unsafe {
+        let n = &*node;
+        let key = (node as *const u8).add(NODE_HEADER + n.height as usize * 8);
+        std::slice::from_raw_parts(key, n.key_len as usize)
+    }
+}
+
+fn node_value<'a>(node: *const Node) -> &'a [u8] {
+    unsafe {
+        let n = &*node;
+        let value = (node as *const u8).add(NODE_HEADER + n.height as usize * 8 + n.key_len as usize);
+        std::slice::from_raw_parts(value, n.value_len as usize)
+    }
+}
+
+// True if `node` sorts strictly before (key, seq)
+fn node_before(node: *const Node, key: &[u8], seq: u64) -> bool {
+    match node_key(node).cmp(key) {
+        std::cmp::Ordering::Less => true,
+        std::cmp::Ordering::Equal => unsafe { (*node).seq > seq },
+        std::cmp::Ordering::Greater => false,
+    }
+}
+
+fn random_height() -> usize {
+    thread_local! {
+        static RNG: Cell<u64> = Cell::new(RandomState::new().build_hasher().finish() | 1);
+    }
+    
+    RNG.with(|rng| {
+        let mut height = 1;
+        let mut x = rng.get();
+        while height < MEMTABLE_MAX_HEIGHT {
+            x ^= x << 13;
+            x ^= x >> 7;
+            x ^= x << 17;
+            if x & 3 != 0 {
+                break;
+            }
+            height += 1;
+        }
+        rng.set(x);
+        height
+    })
+}
+
+struct MemTable {
+    arena: Arena,
+    head: *mut Node,
+    height: AtomicUsize,
+    size: AtomicUsize,     // Approximate bytes, compared against MEMTABLE_THRESHOLD
+    writers: AtomicUsize,  // Writes pinned to this memtable but not yet inserted
+}
+
+unsafe impl Send for MemTable {}
+unsafe impl Sync for MemTable {}
+
+impl fmt::Debug for MemTable {
+    fn fmt(&self, f: &mut fmt::Formatter<'_>) -> fmt::Result {
+        f.debug_struct("MemTable")
+            .field("size", &self.approximate_size())
+            .finish()
+    }
+}
+
+// One version of a key as stored in a memtable
+#[derive(Debug, Clone, Copy)]
+struct MemEntry<'a> {
+    key: &'a str,
+    seq: u64,
+    kind: u8,
+    value: &'a str,
+}
+
+impl<'a> MemEntry<'a> {
+    fn from_node(node: *const Node) -> Self {
+        // Keys and values only ever come from &str, so they are valid UTF-8
+        unsafe {
+            MemEntry {
+                key: std::str::from_utf8_unchecked(node_key(node)),
+                seq: (*node).seq,
+                kind: (*node).kind,
+                value: std::str::from_utf8_unchecked(node_value(node)),
+            }
+        }
+    }
+}
+
+impl MemTable {
+    fn new() -> Self {
+        let arena = Arena::new();
+        let head = Self::alloc_node(&arena, MEMTABLE_MAX_HEIGHT, 0, 0, b"", b"");
+        MemTable {
+            arena,
+            head,
+            height: AtomicUsize::new(1),
+            size: AtomicUsize::new(0),
+            writers: AtomicUsize::new(0),
+        }
+    }
+    
+    fn alloc_node(arena: &Arena, height: usize, seq: u64, kind: u8, key: &[u8], value: &[u8]) -> *mut Node {
+        let size = NODE_HEADER + height * 8 + key.len() + value.len();
+        let node = arena.alloc(size) as *mut Node;
+        unsafe {
+            node.write(Node {
+                seq,
+                key_len: key.len() as u32,
+                value_len: value.len() as u32,
+                kind,
+                height: height as u8,
+            });
+            for level in 0..height {
+                let link = (node as *mut u8).add(NODE_HEADER) as *mut AtomicPtr<Node>;
+                link.add(level).write(AtomicPtr::new(ptr::null_mut()));
+            }
+            let data = (node as *mut u8).add(NODE_HEADER + height * 8);
+            ptr::copy_nonoverlapping(key.as_ptr(), data, key.len());
+            ptr::copy_nonoverlapping(value.as_ptr(), data.add(key.len()), value.len());
+        }
+        node
+    }
+    
+    fn insert(&self, seq: u64, kind: u8, key: &str, value: &str) {
+        let key_bytes = key.as_bytes();
+        let height = random_height();
+        let node = Self::alloc_node(&self.arena, height, seq, kind, key_bytes, value.as_bytes());
+        
+        let mut list_height = self.height.load(Ordering::Relaxed);
+        while height > list_height {
+            match self.height.compare_exchange_weak(list_height, height, Ordering::Relaxed, Ordering::Relaxed) {
+                Ok(_) => break,
+                Err(current) => list_height = current,
+            }
+        }
+        
+        // Find the splice at every level, top down
+        let mut prev = [self.head; MEMTABLE_MAX_HEIGHT];
+        let mut next = [ptr::null_mut(); MEMTABLE_MAX_HEIGHT];
+        let mut x = self.head;
+        for level in (0..MEMTABLE_MAX_HEIGHT).rev() {
+            let (p, n) = Self::find_splice(x, level, key_bytes, seq);
+            prev[level] = p;
+            next[level] = n;
+            x = p;
+        }
+        
+        // Link bottom up. Level 0 publishes the node; a lost race only means
+        // re-finding the splice at that level from the last known predecessor.
+        for level in 0..height {
+            loop {
+                node_link(node, level).store(next[level], Ordering::Relaxed);
+                match node_link(prev[level], level).compare_exchange(
+                    next[level], node, Ordering::Release, Ordering::Acquire)
+                {
+                    Ok(_) => break,
+                    Err(_) => {
+                        let (p, n) = Self::find_splice(prev[level], level, key_bytes, seq);
+                        prev[level] = p;
+                        next[level] = n;
+                    }
+                }
+            }
+        }
+        
+        self.size.fetch_add(key.len() + value.len() + 16, Ordering::Relaxed);
+    }
+    
+    fn find_splice(start: *mut Node, level: usize, key: &[u8], seq: u64) -> (*mut Node, *mut Node) {
+        let mut x = start;
+        loop {
+            let next = node_link(x, level).load(Ordering::Acquire);
+            if !next.is_null() && node_before(next, key, seq) {
+                x = next;
+            } else {
+                return (x, next);
+            }
+        }
+    }
+    
+    // First node at or after (key, seq)
+    fn seek(&self, key: &[u8], seq: u64) -> *const Node {
+        let mut x = self.head;
+        let mut level = self.height.load(Ordering::Acquire) - 1;
+        loop {
+            let next = node_link(x, level).load(Ordering::Acquire);
+            if !next.is_null() && node_before(next, key, seq) {
+                x = next;
+            } else if level == 0 {
+                return next;
+            } else {
+                level -= 1;
+            }
+        }
+    }
+    
+    // Newest version of `key`, including point tombstones
+    fn get(&self, key: &str) -> Option<MemEntry<'_>> {
+        self.get_at(key, u64::MAX)
+    }
+    
+    // Newest version of `key` with a seq of at most `seq`
+    fn get_at(&self, key: &str, seq: u64) -> Option<MemEntry<'_>> {
+        let node = self.seek(key.as_bytes(), seq);
+        if !node.is_null() && node_key(node) == key.as_bytes() {
+            Some(MemEntry::from_node(node))
+        } else {
+            None
+        }
+    }
+    
+    // Newest version of every key >= start, in key order
+    fn iter_from(&self, start: &str) -> MemIter<'_> {
+        MemIter {
+            node: self.seek(start.as_bytes(), u64::MAX),
+            _mem: PhantomData,
+        }
+    }
+    
+    fn iter(&self) -> MemIter<'_> {
+        self.iter_from("")
+    }
+    
+    fn is_empty(&self) -> bool {
+        node_link(self.head, 0).load(Ordering::Acquire).is_null()
+    }
+    
+    fn approximate_size(&self) -> usize {
+        self.size.load(Ordering::Relaxed)
+    }
+}
+
+struct MemIter<'a> {
+    node: *const Node,
+    _mem: PhantomData<&'a MemTable>,
+}
+
+impl<'a> Iterator for MemIter<'a> {
+    type Item = MemEntry<'a>;
+    
+    fn next(&mut self) -> Option<MemEntry<'a>> {
+        if self.node.is_null() {
+            return None;
+        }
+        
+        let node = self.node;
+        self.node = next_key_node(node);
+        Some(MemEntry::from_node(node))
+    }
+}
+
+// First node past every version of `node`'s key
+fn next_key_node(node: *const Node) -> *const Node {
+    let key = node_key(node);
+    let mut next = node_link(node, 0).load(Ordering::Acquire) as *const Node;
+    while !next.is_null() && node_key(next) == key {
+        next = node_link(next, 0).load(Ordering::Acquire);
+    }
+    next
+}
+
+impl Segment {
+    fn open(path: &Path, use_mmap: bool) -> io::Result<Self> {
+        let mut file = File::open(path)?;
         let file_len = file.metadata()?.len();
         
         // Read header
         let mut magic_buf = [0u8; 7];
         file.read_exact(&mut magic_buf)?;
-        if &magic_buf != MAGIC {
+        // ELKYN03 segments have no subtomb block and a 32 byte footer. Blocks
+        // before ELKYN05 store whole keys, and before ELKYN06 have no codec byte.
+        // ELKYN07 blooms are blocked and also hold path prefixes.
+        let (footer_len, delta_keys, framed, blocked): (i64, bool, bool, bool) = if &magic_buf == MAGIC {
+            (36, true, true, true)
+        } else if &magic_buf == MAGIC_V6 {
+            (36, true, true, false)
+        } else if &magic_buf == MAGIC_V5 {
+            (36, true, false, false)
+        } else if &magic_buf == MAGIC_V4 {
+            (36, false, false, false)
+        } else if &magic_buf == MAGIC_V3 {
+            (32, false, false, false)
+        } else {
             return Err(io::Error::new(io::ErrorKind::InvalidData, "Bad magic"));
-        }
+        };
         
         // Read footer from end
-        file.seek(SeekFrom::End(-32))?;
-        let mut footer = [0u8; 32];
-        file.read_exact(&mut footer)?;
+        file.seek(SeekFrom::End(-footer_len))?;
+        let mut footer = [0u8; 36];
+        file.read_exact(&mut footer[..footer_len as usize])?;
         
-        // seq_low stored in footer but not currently used
-        // let mut seq_low_bytes = [0u8; 8];
-        // seq_low_bytes.copy_from_slice(&footer[0..8]);
-        // let seq_low = u64::from_le_bytes(seq_low_bytes);
+        let seq_low = le_u64(&footer[0..8]);
         
         let mut seq_high_bytes = [0u8; 8];
         seq_high_bytes.copy_from_slice(&footer[8..16]);
@@ -1423,12 +3784,15 @@ impl Segment {
         hash_count_bytes.copy_from_slice(&footer[28..32]);
         let hash_count = u32::from_le_bytes(hash_count_bytes) as usize;
         
-        // Calculate index start position
-        let index_start = file_len - 32 - index_size as u64 - bloom_size as u64;
+        let subtomb_size = if footer_len == 36 { le_u32(&footer[32..36]) as u64 } else { 0 };
+        
+        // Calculate index start position; the subtomb block sits right before it
+        let index_start = file_len - footer_len as u64 - index_size as u64 - bloom_size as u64;
+        let blocks_end = index_start - subtomb_size;
         
         // Read bloom filter
         let bloom = if bloom_size > 0 {
-            file.seek(SeekFrom::End(-(32 + bloom_size as i64)))?;
+            file.seek(SeekFrom::End(-(footer_len + bloom_size as i64)))?;
             let mut bloom_data = vec![0u8; bloom_size];
             file.read_exact(&mut bloom_data)?;
             
@@ -1436,53 +3800,1012 @@ impl Segment {
                 bits: bloom_data,
                 bit_count: bloom_size * 8,
                 hash_count,
+                blocked,
             })
         } else {
-            None
-        };
+            None
+        };
+        
+        // Read index, or find it in the mapping
+        let mmap = if use_mmap { Mmap::map(&file).ok() } else { None };
+        let mut index = BlockIndex::default();
+        let index_range = (index_start as usize, index_start as usize + index_size);
+        let index_data = match &mmap {
+            Some(mmap) => {
+                index.mapped = Some(index_range);
+                &mmap.as_slice()[index_range.0..index_range.1]
+            }
+            None => {
+                index.data = vec![0u8; index_size];
+                file.seek(SeekFrom::Start(index_start))?;
+                file.read_exact(&mut index.data)?;
+                &index.data[..]
+            }
+        };
+        
+        let mut starts = Vec::new();
+        let mut pos = 0;
+        while pos + 12 <= index_data.len() {
+            let klen = le_u32(&index_data[pos..pos + 4]) as usize;
+            if pos + 12 + klen > index_data.len() {
+                break;
+            }
+            starts.push(pos as u32);
+            pos += 12 + klen;
+        }
+        index.starts = starts;
+        
+        // Subtombs, in the same record format as a block
+        let mut subtombs = Vec::new();
+        if subtomb_size > 0 {
+            let mut block = vec![0u8; subtomb_size as usize];
+            file.seek(SeekFrom::Start(blocks_end))?;
+            file.read_exact(&mut block)?;
+            for record in BlockIter::new(&block).filter(|r| r.kind == RT_DEL_SUB) {
+                subtombs.push((record.key_str().into_owned(), record.seq));
+            }
+        }
+        
+        // Key range: the first index key, and the last record of the last
+        // block, widened to take in subtomb prefixes
+        let index_bytes = match &mmap {
+            Some(mmap) => &mmap.as_slice()[index_range.0..index_range.1],
+            None => &index.data[..],
+        };
+        let mut min_key = if index.is_empty() {
+            None
+        } else {
+            Some(String::from_utf8_lossy(index.key(index_bytes, 0)).into_owned())
+        };
+        let mut max_key = match index.len().checked_sub(1).map(|last| index.offset(index_bytes, last)) {
+            Some(offset) => {
+                let mut block = vec![0u8; (blocks_end - offset) as usize];
+                file.seek(SeekFrom::Start(offset))?;
+                file.read_exact(&mut block)?;
+                if framed {
+                    block = decode_block(&block)?;
+                }
+                let mut cursor = BlockCursor::new(&block, delta_keys);
+                let mut last = None;
+                while cursor.advance(&block) {
+                    last = Some(String::from_utf8_lossy(&cursor.key).into_owned());
+                }
+                last
+            }
+            None => None,
+        };
+        for (prefix, _) in &subtombs {
+            widen_range(&mut min_key, &mut max_key, prefix);
+        }
+        
+        Ok(Segment {
+            id: next_segment_id(),
+            path: path.to_path_buf(),
+            file,
+            seq_low,
+            seq_high,
+            // key_count,
+            bloom,
+            index,
+            blocks_end,
+            delta_keys,
+            framed,
+            mmap,
+            subtombs,
+            min_key: min_key.unwrap_or_default(),
+            max_key: max_key.unwrap_or_default(),
+            size: file_len,
+        })
+    }
+    
+    fn is_empty(&self) -> bool {
+        self.index.is_empty() && self.subtombs.is_empty()
+    }
+    
+    // The index block's bytes, wherever they live
+    fn index_data(&self) -> &[u8] {
+        match (self.index.mapped, &self.mmap) {
+            (Some((start, end)), Some(mmap)) => &mmap.as_slice()[start..end],
+            _ => &self.index.data,
+        }
+    }
+    
+    fn index_key(&self, idx: usize) -> &[u8] {
+        self.index.key(self.index_data(), idx)
+    }
+    
+    // Binary search of the block first keys, like `slice::binary_search`
+    fn search_index(&self, key: &[u8]) -> Result<usize, usize> {
+        let data = self.index_data();
+        self.index.starts.binary_search_by(|&start| index_entry_key(data, start as usize).cmp(key))
+    }
+    
+    // Whether `key` might have a record here, from the key range and bloom
+    fn may_contain(&self, key: &str) -> bool {
+        !self.index.is_empty()
+            && self.min_key.as_str() <= key && key <= self.max_key.as_str()
+            && self.bloom.as_ref().map_or(true, |bloom| bloom.might_contain(key))
+    }
+    
+    // Whether keys starting with `prefix` might be here. Blocked blooms hold
+    // every '/'-terminated prefix of their keys, so the deepest one in
+    // `prefix` is probed; older blooms cannot tell.
+    fn may_contain_prefix(&self, prefix: &str) -> bool {
+        let probe = match prefix.rfind('/') {
+            Some(i) => &prefix[..=i],
+            None => return true,
+        };
+        match &self.bloom {
+            Some(bloom) if bloom.blocked => bloom.might_contain(probe),
+            _ => true,
+        }
+    }
+    
+    // Whether the segment may hold keys or subtombs in [start, end]
+    fn overlaps(&self, start: &str, end: &str) -> bool {
+        !self.is_empty() && self.min_key.as_str() <= end && self.max_key.as_str() >= start
+    }
+    
+    // Map a freshly written segment; keeps using the cache if mapping fails
+    fn map(mut self) -> io::Result<Self> {
+        self.mmap = Mmap::map(&self.file).ok();
+        Ok(self)
+    }
+    
+    // Bytes of block `idx`. Mapped segments hand out a slice of the mapping;
+    // otherwise the block is read through `cache`, or straight from the file
+    // when there is no cache (compaction, so it doesn't evict hot blocks).
+    fn block(&self, idx: usize, cache: Option<&BlockCache>) -> io::Result<BlockRef<'_>> {
+        Ok(match self.block_source(idx, cache)? {
+            CursorBlock::Mapped(start, end) => BlockRef::Mapped(&self.mmap.as_ref().unwrap().as_slice()[start..end]),
+            CursorBlock::Loaded(data) => BlockRef::Cached(data),
+        })
+    }
+    
+    // Where the bytes of block `idx` live. Compressed blocks are decoded once
+    // and the cache keeps the result, mapped or not.
+    fn block_source(&self, idx: usize, cache: Option<&BlockCache>) -> io::Result<CursorBlock> {
+        let (offset, end) = self.block_bounds(idx);
+        if let Some(mmap) = &self.mmap {
+            if !self.framed {
+                return Ok(CursorBlock::Mapped(offset as usize, end as usize));
+            }
+            if mmap.as_slice()[offset as usize] == CODEC_NONE {
+                return Ok(CursorBlock::Mapped(offset as usize + 1, end as usize));
+            }
+        }
+        
+        let load = || match &self.mmap {
+            Some(mmap) => decode_block(&mmap.as_slice()[offset as usize..end as usize]),
+            None => {
+                let frame = self.read_at(offset, (end - offset) as usize)?;
+                if self.framed { decode_block(&frame) } else { Ok(frame) }
+            }
+        };
+        Ok(CursorBlock::Loaded(match cache {
+            Some(cache) => cache.get_or_load((self.id, offset), load)?,
+            None => Arc::new(load()?),
+        }))
+    }
+    
+    // The block that would hold `key`, by binary search of the index
+    fn block_for(&self, key: &str) -> Option<usize> {
+        match self.search_index(key.as_bytes()) {
+            Ok(i) => Some(i),
+            Err(i) if i > 0 => Some(i - 1),
+            _ => None,
+        }
+    }
+    
+    // Whether reading block `idx` through `block_source` needs no disk read
+    fn block_resident(&self, idx: usize, cache: &BlockCache) -> bool {
+        let (offset, _) = self.block_bounds(idx);
+        if let Some(mmap) = &self.mmap {
+            if !self.framed || mmap.as_slice()[offset as usize] == CODEC_NONE {
+                return true;
+            }
+        }
+        cache.contains((self.id, offset))
+    }
+    
+    // File offsets [start, end) of block `idx`
+    fn block_bounds(&self, idx: usize) -> (u64, u64) {
+        let data = self.index_data();
+        let offset = self.index.offset(data, idx);
+        let end = if idx + 1 < self.index.len() {
+            self.index.offset(data, idx + 1)
+        } else {
+            self.blocks_end  // FIXED: Use blocks_end, not file len
+        };
+        (offset, end)
+    }
+    
+    // Positional read on the shared handle, so concurrent readers never race
+    // on a file offset
+    #[cfg(unix)]
+    fn read_at(&self, offset: u64, size: usize) -> io::Result<Vec<u8>> {
+        use std::os::unix::fs::FileExt;
+        
+        let mut data = vec![0u8; size];
+        self.file.read_exact_at(&mut data, offset)?;
+        Ok(data)
+    }
+    
+    #[cfg(windows)]
+    fn read_at(&self, offset: u64, size: usize) -> io::Result<Vec<u8>> {
+        use std::os::windows::fs::FileExt;
+        
+        let mut data = vec![0u8; size];
+        let mut done = 0;
+        while done < size {
+            match self.file.seek_read(&mut data[done..], offset + done as u64)? {
+                0 => return Err(io::Error::new(io::ErrorKind::UnexpectedEof, "Short block read")),
+                n => done += n,
+            }
+        }
+        Ok(data)
+    }
+}
+
+enum BlockRef<'a> {
+    Mapped(&'a [u8]),
+    Cached(Arc<Vec<u8>>),
+}
+
+impl<'a> std::ops::Deref for BlockRef<'a> {
+    type Target = [u8];
+    
+    fn deref(&self) -> &[u8] {
+        match self {
+            BlockRef::Mapped(data) => data,
+            BlockRef::Cached(data) => data,
+        }
+    }
+}
+
+// One segment record, borrowed from its block
+#[derive(Debug, Clone, Copy)]
+struct Record<'a> {
+    seq: u64,
+    kind: u8,
+    key: &'a [u8],
+    value: &'a [u8],
+}
+
+impl<'a> Record<'a> {
+    // Borrowed unless the bytes are not valid UTF-8
+    fn key_str(&self) -> std::borrow::Cow<'a, str> {
+        String::from_utf8_lossy(self.key)
+    }
+    
+    fn value_str(&self) -> std::borrow::Cow<'a, str> {
+        String::from_utf8_lossy(self.value)
+    }
+}
+
+// Body of a framed block: codec(1) | body, where an LZ4 body is raw_len(4) | data
+fn decode_block(frame: &[u8]) -> io::Result<Vec<u8>> {
+    let corrupt = || io::Error::new(io::ErrorKind::InvalidData, "Corrupt segment block");
+    match frame.first() {
+        Some(&CODEC_NONE) => Ok(frame[1..].to_vec()),
+        Some(&CODEC_LZ4) if frame.len() >= 5 => {
+            lz4_decompress(&frame[5..], le_u32(&frame[1..5]) as usize).ok_or_else(corrupt)
+        }
+        _ => Err(corrupt()),
+    }
+}
+
+// Walks the records of a block without copying:
+// seq(8) | kind(1) | klen(4) | vlen(4) | key | value
+// Stops at the first truncated record.
+struct BlockIter<'a> {
+    data: &'a [u8],
+    pos: usize,
+}
+
+impl<'a> BlockIter<'a> {
+    fn new(data: &'a [u8]) -> Self {
+        BlockIter { data, pos: 0 }
+    }
+}
+
+impl<'a> Iterator for BlockIter<'a> {
+    type Item = Record<'a>;
+    
+    fn next(&mut self) -> Option<Record<'a>> {
+        let data = self.data;
+        let pos = self.pos;
+        if pos + 17 > data.len() {
+            return None;
+        }
+        
+        let seq = le_u64(&data[pos..pos + 8]);
+        let kind = data[pos + 8];
+        let klen = le_u32(&data[pos + 9..pos + 13]) as usize;
+        let vlen = le_u32(&data[pos + 13..pos + 17]) as usize;
+        
+        let key_start = pos + 17;
+        if key_start + klen + vlen > data.len() {
+            self.pos = data.len();
+            return None;
+        }
+        
+        self.pos = key_start + klen + vlen;
+        Some(Record {
+            seq,
+            kind,
+            key: &data[key_start..key_start + klen],
+            value: &data[key_start + klen..self.pos],
+        })
+    }
+}
+
+// Position inside one data block. ELKYN05 blocks store each key as the number
+// of bytes it shares with the key before it plus the rest, with varints:
+//   shared | unshared | vlen | seq | kind(1) | key suffix | value
+// Every RESTART_INTERVAL records the whole key is stored (shared = 0). The
+// block ends with the restart offsets (u32 each) and their count (u32), so a
+// seek binary-searches the restarts and then decodes at most one run. Older
+// blocks use BlockIter's fixed layout and are walked from the start.
+struct BlockCursor {
+    delta: bool,
+    next: usize,  // Offset of the record after the current one
+    end: usize,   // End of the records, where the restart array begins
+    key: Vec<u8>,
+    seq: u64,
+    kind: u8,
+    value: (usize, usize),
+    valid: bool,
+}
+
+impl BlockCursor {
+    // Before the first record; `advance` or `seek` to position it
+    fn new(data: &[u8], delta: bool) -> Self {
+        let end = if delta { restarts_start(data).unwrap_or(0) } else { data.len() };
+        BlockCursor {
+            delta,
+            next: 0,
+            end,
+            key: Vec::new(),
+            seq: 0,
+            kind: 0,
+            value: (0, 0),
+            valid: false,
+        }
+    }
+    
+    fn record<'a>(&'a self, data: &'a [u8]) -> Option<Record<'a>> {
+        if !self.valid {
+            return None;
+        }
+        Some(Record {
+            seq: self.seq,
+            kind: self.kind,
+            key: &self.key,
+            value: &data[self.value.0..self.value.1],
+        })
+    }
+    
+    // Step to the next record. False at the end of the block or at the first
+    // truncated record.
+    fn advance(&mut self, data: &[u8]) -> bool {
+        self.valid = self.next < self.end && self.decode(data).is_some();
+        if !self.valid {
+            self.next = self.end;
+        }
+        self.valid
+    }
+    
+    fn decode(&mut self, data: &[u8]) -> Option<()> {
+        let data = &data[..self.end];
+        let mut pos = self.next;
+        let (shared, unshared, vlen);
+        if self.delta {
+            shared = read_varint(data, &mut pos)? as usize;
+            unshared = read_varint(data, &mut pos)? as usize;
+            vlen = read_varint(data, &mut pos)? as usize;
+            self.seq = read_varint(data, &mut pos)?;
+            self.kind = *data.get(pos)?;
+            pos += 1;
+        } else {
+            if pos + 17 > data.len() {
+                return None;
+            }
+            self.seq = le_u64(&data[pos..pos + 8]);
+            self.kind = data[pos + 8];
+            shared = 0;
+            unshared = le_u32(&data[pos + 9..pos + 13]) as usize;
+            vlen = le_u32(&data[pos + 13..pos + 17]) as usize;
+            pos += 17;
+        }
         
-        // Read index
-        file.seek(SeekFrom::End(-(32 + bloom_size as i64 + index_size as i64)))?;
-        let mut index_data = vec![0u8; index_size];
-        file.read_exact(&mut index_data)?;
+        if shared > self.key.len() || pos + unshared + vlen > data.len() {
+            return None;
+        }
+        self.key.truncate(shared);
+        self.key.extend_from_slice(&data[pos..pos + unshared]);
+        pos += unshared;
+        self.value = (pos, pos + vlen);
+        self.next = pos + vlen;
+        Some(())
+    }
+    
+    // Position at the first record with key >= target. False if there is none.
+    fn seek(&mut self, data: &[u8], target: &[u8]) -> bool {
+        self.next = 0;
+        self.key.clear();
+        if self.delta {
+            // Last restart whose key is below the target; the run from it holds
+            // the answer, or the next restart starts it
+            let count = restart_count(data);
+            let (mut lo, mut hi) = (0, count);
+            while lo < hi {
+                let mid = (lo + hi) / 2;
+                match restart_key(data, restart_offset(data, mid), self.end) {
+                    Some(key) if key < target => lo = mid + 1,
+                    _ => hi = mid,
+                }
+            }
+            if lo > 0 {
+                self.next = restart_offset(data, lo - 1);
+            }
+        }
         
-        let mut index = Vec::new();
-        let mut pos = 0;
+        while self.advance(data) {
+            if &self.key[..] >= target {
+                return true;
+            }
+        }
+        false
+    }
+}
+
+// The version of `key` in `block`: Some((Some(value), seq)) for a set,
+// Some((None, seq)) for a point tombstone, None when it isn't there. Keys
+// looked up in order walk forward from the cursor while that is shorter
+// than a seek.
+fn block_record(cursor: &mut BlockCursor, block: &[u8], key: &str) -> Option<(Option<String>, u64)> {
+    let target = key.as_bytes();
+    let mut steps = 0;
+    if cursor.valid && &cursor.key[..] <= target {
+        while cursor.valid && &cursor.key[..] < target && steps < RESTART_INTERVAL {
+            cursor.advance(block);
+            steps += 1;
+        }
+    }
+    let positioned = cursor.valid && &cursor.key[..] >= target && steps < RESTART_INTERVAL;
+    if !positioned && !cursor.seek(block, target) || &cursor.key[..] != target {
+        return None;
+    }
+    
+    let record = cursor.record(block).unwrap();
+    if record.kind == RT_SET {
+        Some((Some(String::from_utf8_lossy(record.value).into_owned()), record.seq))
+    } else if record.kind == RT_DEL_POINT {
+        Some((None, record.seq))
+    } else {
+        None
+    }
+}
+
+fn restart_count(data: &[u8]) -> usize {
+    if data.len() < 4 { 0 } else { le_u32(&data[data.len() - 4..]) as usize }
+}
+
+fn restarts_start(data: &[u8]) -> Option<usize> {
+    let count = restart_count(data);
+    data.len().checked_sub(4 + 4 * count)
+}
+
+fn restart_offset(data: &[u8], i: usize) -> usize {
+    let start = data.len() - 4 - 4 * restart_count(data) + 4 * i;
+    le_u32(&data[start..start + 4]) as usize
+}
+
+// The whole key stored at a restart point
+fn restart_key(data: &[u8], offset: usize, end: usize) -> Option<&[u8]> {
+    let data = &data[..end];
+    let mut pos = offset;
+    read_varint(data, &mut pos)?;
+    let unshared = read_varint(data, &mut pos)? as usize;
+    read_varint(data, &mut pos)?;
+    read_varint(data, &mut pos)?;
+    pos += 1;
+    data.get(pos..pos + unshared)
+}
+
+// A sorted stream of records the merge heap pulls from: key ascending, then
+// newest version first
+trait RecordCursor {
+    fn current(&self) -> Option<Record<'_>>;
+    
+    // Step past the current record. Returns false at the end of the stream.
+    fn advance(&mut self) -> io::Result<bool>;
+}
+
+// A block held by a cursor: a range of the segment's mapping, or its own copy
+enum CursorBlock {
+    Mapped(usize, usize),
+    Loaded(Arc<Vec<u8>>),
+}
+
+// Walks the records of a segment from a start key on, holding one block at a
+// time. Owns its segment so it can outlive the version it came from.
+struct SegmentCursor {
+    segment: Arc<Segment>,
+    cache: Option<Arc<BlockCache>>,  // None bypasses the cache, as compaction does
+    next_block: usize,
+    block: CursorBlock,
+    cursor: BlockCursor,
+}
+
+impl BlockIndex {
+    fn len(&self) -> usize {
+        self.starts.len()
+    }
+    
+    fn is_empty(&self) -> bool {
+        self.starts.is_empty()
+    }
+    
+    // Entry `idx`, given the index block from `Segment::index_data`
+    fn key<'a>(&self, data: &'a [u8], idx: usize) -> &'a [u8] {
+        index_entry_key(data, self.starts[idx] as usize)
+    }
+    
+    fn offset(&self, data: &[u8], idx: usize) -> u64 {
+        let start = self.starts[idx] as usize;
+        le_u64(&data[start + 4..start + 12])
+    }
+    
+    // Entries are only added in key order, as blocks are cut
+    fn push(&mut self, key: &str, offset: u64) {
+        self.starts.push(self.data.len() as u32);
+        self.data.extend_from_slice(&(key.len() as u32).to_le_bytes());
+        self.data.extend_from_slice(&offset.to_le_bytes());
+        self.data.extend_from_slice(key.as_bytes());
+    }
+}
+
+fn index_entry_key(data: &[u8], start: usize) -> &[u8] {
+    let klen = le_u32(&data[start..start + 4]) as usize;
+    &data[start + 12..start + 12 + klen]
+}
+
+impl SegmentCursor {
+    // None when the segment has no records at or past `start`
+    fn new(segment: Arc<Segment>, cache: Option<Arc<BlockCache>>, start: &str) -> io::Result<Option<Self>> {
+        // The block before `start` may hold keys past it
+        let next_block = match segment.search_index(start.as_bytes()) {
+            Ok(i) => i,
+            Err(i) => i.saturating_sub(1),
+        };
+        let delta = segment.delta_keys;
+        let mut cursor = SegmentCursor {
+            segment,
+            cache,
+            next_block,
+            block: CursorBlock::Loaded(Arc::new(Vec::new())),
+            cursor: BlockCursor::new(&[], delta),
+        };
         
-        while pos < index_data.len() {
-            if pos + 12 > index_data.len() {
+        // Later blocks start past `start`, so only the first needs a seek
+        if cursor.next_block < cursor.segment.index.len() {
+            cursor.load_next()?;
+            cursor.cursor.seek(block_data(&cursor.segment, &cursor.block), start.as_bytes());
+        }
+        if !cursor.settle()? {
+            return Ok(None);
+        }
+        Ok(Some(cursor))
+    }
+    
+    fn load_next(&mut self) -> io::Result<()> {
+        self.block = self.segment.block_source(self.next_block, self.cache.as_ref().map(|c| &**c))?;
+        self.next_block += 1;
+        self.cursor = BlockCursor::new(block_data(&self.segment, &self.block), self.segment.delta_keys);
+        Ok(())
+    }
+    
+    // Load blocks until the cursor is on a record
+    fn settle(&mut self) -> io::Result<bool> {
+        while !self.cursor.valid {
+            if self.next_block >= self.segment.index.len() {
+                return Ok(false);
+            }
+            self.load_next()?;
+            self.cursor.advance(block_data(&self.segment, &self.block));
+        }
+        Ok(true)
+    }
+}
+
+fn block_data<'a>(segment: &'a Segment, block: &'a CursorBlock) -> &'a [u8] {
+    match block {
+        CursorBlock::Mapped(start, end) => match &segment.mmap {
+            Some(mmap) => &mmap.as_slice()[*start..*end],
+            None => &[],
+        },
+        CursorBlock::Loaded(data) => data,
+    }
+}
+
+impl RecordCursor for SegmentCursor {
+    fn current(&self) -> Option<Record<'_>> {
+        self.cursor.record(block_data(&self.segment, &self.block))
+    }
+    
+    fn advance(&mut self) -> io::Result<bool> {
+        self.cursor.advance(block_data(&self.segment, &self.block));
+        self.settle()
+    }
+}
+
+// Walks the newest version of each key in a memtable from a start key on
+struct MemCursor {
+    _mem: Arc<MemTable>,
+    node: *const Node,
+    at: u64,  // Versions newer than this are skipped
+}
+
+// Linked nodes are never modified or freed while the memtable is alive, and
+// the cursor keeps it alive
+unsafe impl Send for MemCursor {}
+
+impl MemCursor {
+    fn new(mem: Arc<MemTable>, start: &str, at: u64) -> Self {
+        let node = mem.seek(start.as_bytes(), at);
+        let mut cursor = MemCursor { _mem: mem, node, at };
+        cursor.skip_newer();
+        cursor
+    }
+    
+    // Versions of a key run newest first, so walking on from a too-new one
+    // reaches the newest visible version, or the next key
+    fn skip_newer(&mut self) {
+        while !self.node.is_null() && unsafe { (*self.node).seq } > self.at {
+            self.node = node_link(self.node, 0).load(Ordering::Acquire);
+        }
+    }
+}
+
+impl RecordCursor for MemCursor {
+    fn current(&self) -> Option<Record<'_>> {
+        if self.node.is_null() {
+            return None;
+        }
+        let entry = MemEntry::from_node(self.node);
+        Some(Record {
+            seq: entry.seq,
+            kind: entry.kind,
+            key: entry.key.as_bytes(),
+            value: entry.value.as_bytes(),
+        })
+    }
+    
+    fn advance(&mut self) -> io::Result<bool> {
+        if !self.node.is_null() {
+            self.node = next_key_node(self.node);
+            self.skip_newer();
+        }
+        Ok(!self.node.is_null())
+    }
+}
+
+// The sources of a scan
+enum ScanCursor {
+    Mem(MemCursor),
+    Segment(SegmentCursor),
+}
+
+impl RecordCursor for ScanCursor {
+    fn current(&self) -> Option<Record<'_>> {
+        match self {
+            ScanCursor::Mem(cursor) => cursor.current(),
+            ScanCursor::Segment(cursor) => cursor.current(),
+        }
+    }
+    
+    fn advance(&mut self) -> io::Result<bool> {
+        match self {
+            ScanCursor::Mem(cursor) => cursor.advance(),
+            ScanCursor::Segment(cursor) => cursor.advance(),
+        }
+    }
+}
+
+// Binary min-heap of cursors ordered by their current record: key ascending,
+// newest version first. Exhausted cursors are dropped.
+struct MergeHeap<C: RecordCursor> {
+    cursors: Vec<C>,
+}
+
+impl<C: RecordCursor> MergeHeap<C> {
+    fn new(cursors: Vec<C>) -> Self {
+        let mut heap = MergeHeap { cursors: Vec::with_capacity(cursors.len()) };
+        for cursor in cursors {
+            if cursor.current().is_some() {
+                heap.cursors.push(cursor);
+                let last = heap.cursors.len() - 1;
+                heap.sift_up(last);
+            }
+        }
+        heap
+    }
+    
+    fn peek(&self) -> Option<Record<'_>> {
+        self.cursors.first().and_then(|cursor| cursor.current())
+    }
+    
+    // Move past the smallest record
+    fn advance(&mut self) -> io::Result<()> {
+        if self.cursors.is_empty() {
+            return Ok(());
+        }
+        if !self.cursors[0].advance()? {
+            self.cursors.swap_remove(0);
+        }
+        self.sift_down(0);
+        Ok(())
+    }
+    
+    fn less(&self, a: usize, b: usize) -> bool {
+        match (self.cursors[a].current(), self.cursors[b].current()) {
+            (Some(x), Some(y)) => x.key.cmp(y.key).then(y.seq.cmp(&x.seq)) == std::cmp::Ordering::Less,
+            _ => false,
+        }
+    }
+    
+    fn sift_up(&mut self, mut i: usize) {
+        while i > 0 {
+            let parent = (i - 1) / 2;
+            if !self.less(i, parent) {
                 break;
             }
-            
-            let mut klen_bytes = [0u8; 4];
-            klen_bytes.copy_from_slice(&index_data[pos..pos + 4]);
-            let klen = u32::from_le_bytes(klen_bytes) as usize;
-            pos += 4;
-            
-            let mut offset_bytes = [0u8; 8];
-            offset_bytes.copy_from_slice(&index_data[pos..pos + 8]);
-            let offset = u64::from_le_bytes(offset_bytes);
-            pos += 8;
-            
-            if pos + klen > index_data.len() {
+            self.cursors.swap(i, parent);
+            i = parent;
+        }
+    }
+    
+    fn sift_down(&mut self, mut i: usize) {
+        loop {
+            let mut smallest = i;
+            for child in [2 * i + 1, 2 * i + 2].iter().cloned() {
+                if child < self.cursors.len() && self.less(child, smallest) {
+                    smallest = child;
+                }
+            }
+            if smallest == i {
                 break;
             }
+            self.cursors.swap(i, smallest);
+            i = smallest;
+        }
+    }
+}
+
+// Compiled wildcard pattern: `*` matches any run of characters, `/` included,
+// and `?` exactly one. Matching walks the bytes with a single backtrack point
+// and never allocates. The literal text before the first wildcard bounds the
+// scan, and the literal tail after the last `*` rejects most keys up front.
+#[derive(Debug)]
+struct Glob {
+    pattern: String,
+    prefix_len: usize,
+    suffix_start: usize,  // pattern.len() when there is no usable tail
+}
+
+impl Glob {
+    fn new(pattern: &str) -> Self {
+        let bytes = pattern.as_bytes();
+        let prefix_len = bytes.iter().position(|&b| b == b'*' || b == b'?').unwrap_or(bytes.len());
+        let suffix_start = match bytes.iter().rposition(|&b| b == b'*') {
+            Some(star) if !bytes[star + 1..].contains(&b'?') => star + 1,
+            _ => bytes.len(),
+        };
+        Glob { pattern: pattern.to_string(), prefix_len, suffix_start }
+    }
+    
+    fn prefix(&self) -> &str {
+        &self.pattern[..self.prefix_len]
+    }
+    
+    fn matches(&self, key: &[u8]) -> bool {
+        let p = self.pattern.as_bytes();
+        if !key.starts_with(&p[..self.prefix_len]) || !key.ends_with(&p[self.suffix_start..]) {
+            return false;
+        }
+        
+        // Length in bytes of the UTF-8 character starting with `b`
+        fn char_len(b: u8) -> usize {
+            match b {
+                0xF0..=0xFF => 4,
+                0xE0..=0xEF => 3,
+                0xC0..=0xDF => 2,
+                _ => 1,
+            }
+        }
+        
+        // On a mismatch, let the last `*` swallow one more character and retry
+        let (mut pi, mut ki) = (self.prefix_len, self.prefix_len);
+        let mut star: Option<(usize, usize)> = None;
+        while ki < key.len() {
+            if pi < p.len() && p[pi] == b'*' {
+                pi += 1;
+                star = Some((pi, ki));
+            } else if pi < p.len() && p[pi] == b'?' {
+                pi += 1;
+                ki += char_len(key[ki]);
+            } else if pi < p.len() && p[pi] == key[ki] {
+                pi += 1;
+                ki += 1;
+            } else if let Some((star_pi, star_ki)) = star {
+                let next = star_ki + char_len(key[star_ki]);
+                star = Some((star_pi, next));
+                pi = star_pi;
+                ki = next;
+            } else {
+                return false;
+            }
+        }
+        
+        while pi < p.len() && p[pi] == b'*' {
+            pi += 1;
+        }
+        ki == key.len() && pi == p.len()
+    }
+}
+
+// Where a scan stops
+enum ScanStop {
+    End(String),     // first key past the range
+    Prefix(String),  // first key without the prefix
+}
+
+/// Cursor over the live keys of a range, in key order. Created by
+/// `Store::iter_range`; records are merged lazily from the memtables and the
+/// segments of the version current at creation, so later writes are not seen
+/// and stopping early costs nothing.
+pub struct RangeIter {
+    heap: MergeHeap<ScanCursor>,
+    subtombs: Arc<SubtombIndex>,
+    stop: ScanStop,
+    glob: Option<Glob>,
+    last_key: Vec<u8>,
+    done: bool,
+}
+
+impl RangeIter {
+    // Only yield keys matching `glob`
+    fn matching(mut self, glob: Glob) -> Self {
+        self.glob = Some(glob);
+        self
+    }
+    
+    // Next record to hand out, or None past the range. Every version of a
+    // key after its newest is skipped, and so are keys that are deleted.
+    fn step(&mut self) -> io::Result<Option<(String, String)>> {
+        loop {
+            let item = match self.heap.peek() {
+                None => return Ok(None),
+                Some(record) => {
+                    let past = match &self.stop {
+                        ScanStop::End(end) => record.key >= end.as_bytes(),
+                        ScanStop::Prefix(prefix) => !record.key.starts_with(prefix.as_bytes()),
+                    };
+                    if past {
+                        return Ok(None);
+                    }
+                    
+                    if record.key == &self.last_key[..] || (record.kind != RT_SET && record.kind != RT_DEL_POINT) {
+                        None
+                    } else {
+                        self.last_key.clear();
+                        self.last_key.extend_from_slice(record.key);
+                        let key = record.key_str();
+                        let wanted = self.glob.as_ref().map_or(true, |glob| glob.matches(record.key));
+                        if wanted && record.kind == RT_SET && !self.subtombs.covers(&key, record.seq) {
+                            Some((key.into_owned(), record.value_str().into_owned()))
+                        } else {
+                            None
+                        }
+                    }
+                }
+            };
             
-            let key = String::from_utf8_lossy(&index_data[pos..pos + klen]).to_string();
-            pos += klen;
-            
-            index.push((key, offset));
+            self.heap.advance()?;
+            if item.is_some() {
+                return Ok(item);
+            }
+        }
+    }
+}
+
+impl Iterator for RangeIter {
+    type Item = io::Result<(String, String)>;
+    
+    fn next(&mut self) -> Option<io::Result<(String, String)>> {
+        if self.done {
+            return None;
+        }
+        match self.step() {
+            Ok(Some(item)) => Some(Ok(item)),
+            Ok(None) => {
+                self.done = true;
+                None
+            }
+            Err(e) => {
+                self.done = true;
+                Some(Err(e))
+            }
+        }
+    }
+}
+
+// Read-only mapping of a whole file, unmapped on drop
+struct Mmap {
+    ptr: *mut u8,
+    len: usize,
+}
+
+unsafe impl Send for Mmap {}
+unsafe impl Sync for Mmap {}
+
+impl fmt::Debug for Mmap {
+    fn fmt(&self, f: &mut fmt::Formatter<'_>) -> fmt::Result {
+        f.debug_struct("Mmap").field("len", &self.len).finish()
+    }
+}
+
+#[cfg(all(unix, target_pointer_width = "64"))]
+mod sys {
+    use std::os::raw::{c_int, c_void};
+    
+    pub const PROT_READ: c_int = 1;
+    pub const MAP_PRIVATE: c_int = 2;
+    
+    extern "C" {
+        pub fn mmap(addr: *mut c_void, len: usize, prot: c_int, flags: c_int, fd: c_int, offset: i64) -> *mut c_void;
+        pub fn munmap(addr: *mut c_void, len: usize) -> c_int;
+    }
+}
+
+impl Mmap {
+    #[cfg(all(unix, target_pointer_width = "64"))]
+    fn map(file: &File) -> io::Result<Mmap> {
+        use std::os::unix::io::AsRawFd;
+        
+        let len = file.metadata()?.len() as usize;
+        if len == 0 {
+            return Err(io::Error::new(io::ErrorKind::InvalidInput, "Cannot map an empty file"));
         }
         
-        Ok(Segment {
-            path: path.to_path_buf(),
-            // seq_low,
-            seq_high,
-            // key_count,
-            bloom,
-            index,
-            index_start,  // Store for block boundary calculation
-        })
+        let ptr = unsafe {
+            sys::mmap(ptr::null_mut(), len, sys::PROT_READ, sys::MAP_PRIVATE, file.as_raw_fd(), 0)
+        };
+        if ptr as isize == -1 {
+            return Err(io::Error::last_os_error());
+        }
+        
+        Ok(Mmap { ptr: ptr as *mut u8, len })
+    }
+    
+    #[cfg(not(all(unix, target_pointer_width = "64")))]
+    fn map(_file: &File) -> io::Result<Mmap> {
+        Err(io::Error::new(io::ErrorKind::Other, "mmap not supported on this platform"))
+    }
+    
+    fn as_slice(&self) -> &[u8] {
+        unsafe { std::slice::from_raw_parts(self.ptr, self.len) }
+    }
+}
+
+impl Drop for Mmap {
+    fn drop(&mut self) {
+        #[cfg(all(unix, target_pointer_width = "64"))]
+        unsafe {
+            sys::munmap(self.ptr as *mut std::os::raw::c_void, self.len);
+        }
     }
 }
 
@@ -1493,13 +4816,22 @@ struct SegmentWriter {
     seq_high: u64,
     key_count: usize,
     current_block: Vec<u8>,
-    index: Vec<(String, u64)>,
-    bloom: BloomFilter,
+    codec: Compression,
+    frame: Vec<u8>,  // Scratch for the framed, maybe compressed, block
+    restarts: Vec<u32>,  // Offsets of whole-key records in current_block
+    block_records: usize,
+    index: BlockIndex,
+    hashes: Vec<u64>,  // Bloom hashes of keys and their new path prefixes
+    bits_per_key: usize,
     written: u64,
+    last_key: String,
+    subtombs: Vec<u8>,  // Encoded like a block, written after the last one
+    subtomb_range: (Option<String>, Option<String>),
+    throttle: Option<(Arc<RateLimiter>, Priority)>,  // Charged per block written
 }
 
 impl SegmentWriter {
-    fn new(path: &Path) -> io::Result<Self> {
+    fn new(path: &Path, codec: Compression, bits_per_key: usize) -> io::Result<Self> {
         let file = OpenOptions::new()
             .create(true)
             .write(true)
@@ -1513,9 +4845,18 @@ impl SegmentWriter {
             seq_high: 0,
             key_count: 0,
             current_block: Vec::new(),
-            index: Vec::new(),
-            bloom: BloomFilter::new(10000, 7),  // Fixed params for now
+            codec,
+            frame: Vec::new(),
+            restarts: Vec::new(),
+            block_records: 0,
+            index: BlockIndex::default(),
+            hashes: Vec::new(),
+            bits_per_key,
             written: 0,
+            last_key: String::new(),
+            subtombs: Vec::new(),
+            subtomb_range: (None, None),
+            throttle: None,
         };
         
         writer.file.write_all(MAGIC)?;
@@ -1525,7 +4866,13 @@ impl SegmentWriter {
     }
     
     fn add(&mut self, rec_type: u8, key: &str, value: Option<&str>, seq: u64) -> io::Result<()> {
-        self.bloom.add(key);
+        // Keys arrive sorted, so only prefixes past the one shared with the
+        // previous key are new
+        let common = key.bytes().zip(self.last_key.bytes()).take_while(|(a, b)| a == b).count();
+        self.hashes.push(bloom_hash(key));
+        for (i, _) in key.match_indices('/').filter(|&(i, _)| i >= common) {
+            self.hashes.push(bloom_hash(&key[..=i]));
+        }
         
         if seq < self.seq_low {
             self.seq_low = seq;
@@ -1534,39 +4881,83 @@ impl SegmentWriter {
             self.seq_high = seq;
         }
         
-        // Build record with FIXED consistent order
-        let mut record = Vec::new();
-        record.extend_from_slice(&seq.to_le_bytes());
-        record.push(rec_type);
-        record.extend_from_slice(&(key.len() as u32).to_le_bytes());
-        record.extend_from_slice(&(value.as_ref().map_or(0, |v| v.len()) as u32).to_le_bytes());
-        record.extend_from_slice(key.as_bytes());
-        if let Some(v) = value {
-            record.extend_from_slice(v.as_bytes());
-        }
-        
-        if self.current_block.len() + record.len() > BLOCK_SIZE {
+        // Cut the block if the record might not fit with its restart slot
+        let value = value.unwrap_or("");
+        let worst = 4 * 10 + 1 + key.len() + value.len();
+        if !self.current_block.is_empty()
+            && self.current_block.len() + worst + 4 * (self.restarts.len() + 2) > BLOCK_SIZE {
             self.flush_block()?;
         }
         
         if self.current_block.is_empty() {
-            self.index.push((key.to_string(), self.written));
+            self.index.push(key, self.written);
         }
         
-        self.current_block.extend_from_slice(&record);
+        let shared = if self.block_records % RESTART_INTERVAL == 0 {
+            self.restarts.push(self.current_block.len() as u32);
+            0
+        } else {
+            common
+        };
+        let block = &mut self.current_block;
+        put_varint(block, shared as u64);
+        put_varint(block, (key.len() - shared) as u64);
+        put_varint(block, value.len() as u64);
+        put_varint(block, seq);
+        block.push(rec_type);
+        block.extend_from_slice(&key.as_bytes()[shared..]);
+        block.extend_from_slice(value.as_bytes());
+        self.block_records += 1;
         self.key_count += 1;
+        self.last_key.clear();
+        self.last_key.push_str(key);
         
         Ok(())
     }
     
+    // Subtombs may be added at any point; they are kept apart from the records
+    fn add_subtomb(&mut self, prefix: &str, seq: u64) {
+        self.subtombs.extend_from_slice(&seq.to_le_bytes());
+        self.subtombs.push(RT_DEL_SUB);
+        self.subtombs.extend_from_slice(&(prefix.len() as u32).to_le_bytes());
+        self.subtombs.extend_from_slice(&0u32.to_le_bytes());
+        self.subtombs.extend_from_slice(prefix.as_bytes());
+        widen_range(&mut self.subtomb_range.0, &mut self.subtomb_range.1, prefix);
+    }
+    
     fn flush_block(&mut self) -> io::Result<()> {
         if self.current_block.is_empty() {
             return Ok(());
         }
         
-        self.file.write_all(&self.current_block)?;
-        self.written += self.current_block.len() as u64;
+        for offset in &self.restarts {
+            self.current_block.extend_from_slice(&offset.to_le_bytes());
+        }
+        self.current_block.extend_from_slice(&(self.restarts.len() as u32).to_le_bytes());
+        
+        // Keep the compressed form only when it saves something worth a decode
+        self.frame.clear();
+        if self.codec == Compression::Lz4 {
+            let compressed = lz4_compress(&self.current_block);
+            if compressed.len() + 5 < self.current_block.len() * 7 / 8 {
+                self.frame.push(CODEC_LZ4);
+                self.frame.extend_from_slice(&(self.current_block.len() as u32).to_le_bytes());
+                self.frame.extend_from_slice(&compressed);
+            }
+        }
+        if self.frame.is_empty() {
+            self.frame.push(CODEC_NONE);
+            self.frame.extend_from_slice(&self.current_block);
+        }
+        
+        self.file.write_all(&self.frame)?;
+        self.written += self.frame.len() as u64;
+        if let Some((limiter, priority)) = &self.throttle {
+            limiter.request(self.frame.len() as u64, *priority);
+        }
         self.current_block.clear();
+        self.restarts.clear();
+        self.block_records = 0;
         
         Ok(())
     }
@@ -1574,181 +4965,909 @@ impl SegmentWriter {
     fn finish(mut self) -> io::Result<Segment> {
         self.flush_block()?;
         
-        let index_start = self.written;
+        let blocks_end = self.written;
+        self.file.write_all(&self.subtombs)?;
+        self.written += self.subtombs.len() as u64;
         
-        // Write index
-        let mut index_data = Vec::new();
-        for (k, offset) in &self.index {
-            index_data.extend_from_slice(&(k.len() as u32).to_le_bytes());
-            index_data.extend_from_slice(&offset.to_le_bytes());
-            index_data.extend_from_slice(k.as_bytes());
-        }
-        self.file.write_all(&index_data)?;
+        // Write index, which is already in its on-disk form
+        self.file.write_all(&self.index.data)?;
+        let index_size = self.index.data.len();
         
-        // Write bloom filter
-        self.file.write_all(&self.bloom.bits)?;
+        // Write bloom filter, sized now that the key count is known
+        let bloom = BloomFilter::build(&mut self.hashes, self.bits_per_key);
+        self.file.write_all(&bloom.bits)?;
         
         // Write footer
         let mut footer = Vec::new();
         footer.extend_from_slice(&self.seq_low.to_le_bytes());
         footer.extend_from_slice(&self.seq_high.to_le_bytes());
         footer.extend_from_slice(&(self.key_count as u32).to_le_bytes());
-        footer.extend_from_slice(&(index_data.len() as u32).to_le_bytes());
-        footer.extend_from_slice(&(self.bloom.bits.len() as u32).to_le_bytes());
-        footer.extend_from_slice(&(self.bloom.hash_count as u32).to_le_bytes());
+        footer.extend_from_slice(&(index_size as u32).to_le_bytes());
+        footer.extend_from_slice(&(bloom.bits.len() as u32).to_le_bytes());
+        footer.extend_from_slice(&(bloom.hash_count as u32).to_le_bytes());
+        footer.extend_from_slice(&(self.subtombs.len() as u32).to_le_bytes());
         self.file.write_all(&footer)?;
         
         self.file.sync_all()?;
         
+        // The writer's handle is write-only; readers get their own
+        let file = File::open(&self.path)?;
+        let size = self.written + index_size as u64 + bloom.bits.len() as u64 + footer.len() as u64;
+        let mut min_key = if self.index.is_empty() {
+            None
+        } else {
+            Some(String::from_utf8_lossy(self.index.key(&self.index.data, 0)).into_owned())
+        };
+        let mut max_key = if self.key_count > 0 { Some(self.last_key) } else { None };
+        for key in [&self.subtomb_range.0, &self.subtomb_range.1].iter().filter_map(|k| k.as_ref()) {
+            widen_range(&mut min_key, &mut max_key, key);
+        }
+        let subtombs = BlockIter::new(&self.subtombs)
+            .map(|r| (r.key_str().into_owned(), r.seq))
+            .collect();
+        
         Ok(Segment {
+            id: next_segment_id(),
+            file,
             path: self.path,
-            // seq_low: self.seq_low,
+            seq_low: self.seq_low,
             seq_high: self.seq_high,
             // key_count: self.key_count,
-            bloom: Some(self.bloom),
+            bloom: Some(bloom),
             index: self.index,
-            index_start,
+            blocks_end,
+            delta_keys: true,
+            framed: true,
+            mmap: None,
+            subtombs,
+            min_key: min_key.unwrap_or_default(),
+            max_key: max_key.unwrap_or_default(),
+            size,
         })
     }
 }
 
 impl BloomFilter {
-    fn new(bit_count: usize, hash_count: usize) -> Self {
-        BloomFilter {
-            bits: vec![0u8; (bit_count + 7) / 8],
-            bit_count,
+    // Blocked filter over `hashes` (deduplicated here) at `bits_per_key`
+    fn build(hashes: &mut Vec<u64>, bits_per_key: usize) -> Self {
+        hashes.sort_unstable();
+        hashes.dedup();
+        let blocks = ((hashes.len() * bits_per_key + BLOOM_BLOCK_BITS - 1) / BLOOM_BLOCK_BITS).max(1);
+        // k = ln 2 * bits per key minimises false positives
+        let hash_count = ((bits_per_key as f64 * 0.69).round() as usize).max(1).min(16);
+        let mut bloom = BloomFilter {
+            bits: vec![0u8; blocks * BLOOM_BLOCK_BITS / 8],
+            bit_count: blocks * BLOOM_BLOCK_BITS,
             hash_count,
+            blocked: true,
+        };
+        for &hash in hashes.iter() {
+            let (base, mut h, delta) = bloom.probes(hash);
+            for _ in 0..bloom.hash_count {
+                let bit = base + (h as usize % BLOOM_BLOCK_BITS);
+                bloom.bits[bit / 8] |= 1 << (bit % 8);
+                h = h.wrapping_add(delta);
+            }
         }
+        bloom
     }
     
-    fn add(&mut self, key: &str) {
-        for i in 0..self.hash_count {
-            let hash = xxhash(key.as_bytes(), i as u64) as usize % self.bit_count;
-            self.bits[hash / 8] |= 1 << (hash % 8);
-        }
+    // First bit of the hash's block, then the double hashing start and step
+    fn probes(&self, hash: u64) -> (usize, u32, u32) {
+        let blocks = (self.bit_count / BLOOM_BLOCK_BITS) as u64;
+        let block = (((hash >> 32) * blocks) >> 32) as usize;
+        let h = hash as u32;
+        (block * BLOOM_BLOCK_BITS, h, h.rotate_right(17) | 1)
     }
     
     fn might_contain(&self, key: &str) -> bool {
+        if !self.blocked {
+            return self.might_contain_legacy(key);
+        }
+        let (base, mut h, delta) = self.probes(bloom_hash(key));
+        for _ in 0..self.hash_count {
+            let bit = base + (h as usize % BLOOM_BLOCK_BITS);
+            if self.bits[bit / 8] & (1 << (bit % 8)) == 0 {
+                return false;
+            }
+            h = h.wrapping_add(delta);
+        }
+        true
+    }
+    
+    fn might_contain_legacy(&self, key: &str) -> bool {
         for i in 0..self.hash_count {
             let hash = xxhash(key.as_bytes(), i as u64) as usize % self.bit_count;
             if self.bits[hash / 8] & (1 << (hash % 8)) == 0 {
                 return false;
             }
         }
-        true
+        true
+    }
+}
+
+impl BlockCache {
+    fn new(max_size: usize) -> Self {
+        BlockCache {
+            shards: (0..CACHE_SHARDS).map(|_| RwLock::new(CacheShard {
+                map: HashMap::new(),
+                slots: Vec::new(),
+                hand: 0,
+                size: 0,
+                capacity: max_size / CACHE_SHARDS,
+            })).collect(),
+            hits: AtomicU64::new(0),
+            misses: AtomicU64::new(0),
+            evictions: AtomicU64::new(0),
+            loads: Histogram::default(),
+            capacity: max_size,
+        }
+    }
+    
+    fn shard(&self, key: (u64, u64)) -> &RwLock<CacheShard> {
+        // Mix so consecutive blocks of one segment land on different shards
+        let hash = (key.0 ^ key.1.rotate_left(32)).wrapping_mul(0x9E37_79B9_7F4A_7C15);
+        &self.shards[(hash >> 32) as usize % CACHE_SHARDS]
+    }
+    
+    fn contains(&self, key: (u64, u64)) -> bool {
+        self.shard(key).read().unwrap().map.contains_key(&key)
+    }
+    
+    fn get_or_load<F>(&self, key: (u64, u64), load: F) -> io::Result<Arc<Vec<u8>>>
+    where
+        F: FnOnce() -> io::Result<Vec<u8>>,
+    {
+        let shard = self.shard(key);
+        
+        {
+            let shard = shard.read().unwrap();
+            if let Some(&slot) = shard.map.get(&key) {
+                let slot = &shard.slots[slot];
+                slot.referenced.store(true, Ordering::Relaxed);
+                self.hits.fetch_add(1, Ordering::Relaxed);
+                return Ok(slot.data.clone());
+            }
+        }
+        
+        // Load from disk without holding the shard lock
+        self.misses.fetch_add(1, Ordering::Relaxed);
+        let started = Instant::now();
+        let data = Arc::new(load()?);
+        self.loads.record(started);
+        
+        let mut shard = shard.write().unwrap();
+        if data.len() > shard.capacity || shard.map.contains_key(&key) {
+            // Too big to cache, or another reader got here first
+            return Ok(data);
+        }
+        
+        while shard.size + data.len() > shard.capacity && !shard.slots.is_empty() {
+            shard.evict_one();
+            self.evictions.fetch_add(1, Ordering::Relaxed);
+        }
+        
+        shard.size += data.len();
+        let slot = shard.slots.len();
+        shard.map.insert(key, slot);
+        shard.slots.push(CacheSlot {
+            key,
+            data: data.clone(),
+            referenced: AtomicBool::new(false),
+        });
+        
+        Ok(data)
+    }
+    
+    fn stats(&self) -> CacheStats {
+        CacheStats {
+            hits: self.hits.load(Ordering::Relaxed),
+            misses: self.misses.load(Ordering::Relaxed),
+            evictions: self.evictions.load(Ordering::Relaxed),
+            size_bytes: self.shards.iter().map(|s| s.read().unwrap().size).sum(),
+            capacity_bytes: self.capacity,
+        }
+    }
+}
+
+impl CacheShard {
+    // Advance the clock hand to the first unreferenced block and drop it,
+    // clearing reference bits on the way
+    fn evict_one(&mut self) {
+        loop {
+            if self.hand >= self.slots.len() {
+                self.hand = 0;
+            }
+            
+            let slot = &self.slots[self.hand];
+            if slot.referenced.swap(false, Ordering::Relaxed) {
+                self.hand += 1;
+                continue;
+            }
+            
+            let victim = self.slots.swap_remove(self.hand);
+            self.map.remove(&victim.key);
+            self.size -= victim.data.len();
+            if let Some(moved) = self.slots.get(self.hand) {
+                self.map.insert(moved.key, self.hand);
+            }
+            return;
+        }
+    }
+}
+
+// Store-wide counters behind `Store::stats`. The WAL and block cache keep
+// their own histograms next to the code they time.
+#[derive(Debug, Default)]
+struct Metrics {
+    writes: Histogram,
+    gets: Histogram,
+    flushes: Histogram,
+    compactions: Histogram,
+    write_stalls: AtomicU64,
+    write_stall_ns: AtomicU64,
+    segment_gets: AtomicU64,
+    segment_probes: AtomicU64,
+    bloom_negatives: AtomicU64,
+    bloom_false_positives: AtomicU64,
+    flush_errors: AtomicU64,
+    compaction_errors: AtomicU64,
+    last_error: Mutex<Option<String>>,
+}
+
+impl Metrics {
+    // Count a segment's key range and bloom check, passing its verdict through
+    fn filter(&self, may_contain: bool) -> bool {
+        if !may_contain {
+            self.bloom_negatives.fetch_add(1, Ordering::Relaxed);
+        }
+        may_contain
+    }
+    
+    // Count a segment search, and a false positive if it came up empty
+    fn probed<T>(&self, found: Option<T>) -> Option<T> {
+        self.segment_probes.fetch_add(1, Ordering::Relaxed);
+        if found.is_none() {
+            self.bloom_false_positives.fetch_add(1, Ordering::Relaxed);
+        }
+        found
+    }
+    
+    fn background_error(&self, counter: &AtomicU64, e: &io::Error) {
+        counter.fetch_add(1, Ordering::Relaxed);
+        *self.last_error.lock().unwrap() = Some(e.to_string());
+    }
+}
+
+#[derive(Debug, Clone, Copy, PartialEq, Eq)]
+enum Priority {
+    High,  // Charged, but never waits
+    Low,
+}
+
+// Token bucket over bytes. Callers take their bytes up front and sleep off
+// any debt, so concurrent writers share the rate; high priority writes add to
+// the debt low priority ones wait for.
+#[derive(Debug)]
+struct RateLimiter {
+    bytes_per_sec: u64,  // 0 is unlimited
+    bucket: Mutex<(f64, Instant)>,  // Tokens, possibly negative, and when last refilled
+}
+
+impl RateLimiter {
+    fn new(bytes_per_sec: u64) -> Self {
+        RateLimiter { bytes_per_sec, bucket: Mutex::new((0.0, Instant::now())) }
+    }
+    
+    fn request(&self, bytes: u64, priority: Priority) {
+        if self.bytes_per_sec == 0 {
+            return;
+        }
+        let rate = self.bytes_per_sec as f64;
+        let debt = {
+            let mut bucket = self.bucket.lock().unwrap();
+            let now = Instant::now();
+            let burst = (self.bytes_per_sec / RATE_LIMIT_BURST_DIV) as f64;
+            bucket.0 = (bucket.0 + now.duration_since(bucket.1).as_secs_f64() * rate).min(burst);
+            bucket.1 = now;
+            bucket.0 -= bytes as f64;
+            -bucket.0
+        };
+        if priority == Priority::Low && debt > 0.0 {
+            thread::sleep(Duration::from_secs_f64(debt / rate));
+        }
+    }
+}
+
+// Lock-free latency histogram in nanoseconds: four buckets per power of two,
+// so recording is a few relaxed adds and percentiles land within 20%
+struct Histogram {
+    buckets: [AtomicU64; HISTOGRAM_BUCKETS],
+    count: AtomicU64,
+    sum: AtomicU64,
+    max: AtomicU64,
+}
+
+impl Default for Histogram {
+    fn default() -> Self {
+        const ZERO: AtomicU64 = AtomicU64::new(0);
+        Histogram { buckets: [ZERO; HISTOGRAM_BUCKETS], count: ZERO, sum: ZERO, max: ZERO }
+    }
+}
+
+impl fmt::Debug for Histogram {
+    fn fmt(&self, f: &mut fmt::Formatter) -> fmt::Result {
+        write!(f, "{:?}", self.summary())
+    }
+}
+
+impl Histogram {
+    fn record(&self, started: Instant) {
+        self.record_each(started, 1);
+    }
+    
+    // `n` samples sharing the time since `started` evenly
+    fn record_each(&self, started: Instant, n: usize) {
+        if n == 0 {
+            return;
+        }
+        let ns = started.elapsed().as_nanos().min(u64::MAX as u128) as u64;
+        let each = ns / n as u64;
+        self.buckets[histogram_bucket(each)].fetch_add(n as u64, Ordering::Relaxed);
+        self.count.fetch_add(n as u64, Ordering::Relaxed);
+        self.sum.fetch_add(ns, Ordering::Relaxed);
+        self.max.fetch_max(each, Ordering::Relaxed);
+    }
+    
+    fn summary(&self) -> LatencyStats {
+        let counts: Vec<u64> = self.buckets.iter().map(|b| b.load(Ordering::Relaxed)).collect();
+        let total: u64 = counts.iter().sum();
+        let max = self.max.load(Ordering::Relaxed);
+        // Upper edge of the bucket holding the q-th sample
+        let quantile = |q: f64| {
+            let rank = ((total as f64 * q).ceil() as u64).max(1);
+            let mut seen = 0;
+            for (i, &n) in counts.iter().enumerate() {
+                seen += n;
+                if seen >= rank {
+                    return histogram_bucket_max(i).min(max);
+                }
+            }
+            max
+        };
+        LatencyStats {
+            count: self.count.load(Ordering::Relaxed),
+            sum_ns: self.sum.load(Ordering::Relaxed),
+            p50_ns: if total == 0 { 0 } else { quantile(0.5) },
+            p99_ns: if total == 0 { 0 } else { quantile(0.99) },
+            max_ns: max,
+        }
+    }
+}
+
+// Values below 4 get a bucket each; above, the exponent picks a group of
+// four and the two bits after the leading one pick within it
+fn histogram_bucket(ns: u64) -> usize {
+    if ns < 4 {
+        return ns as usize;
+    }
+    let exp = 63 - ns.leading_zeros() as usize;
+    (exp - 1) * 4 + ((ns >> (exp - 2)) & 3) as usize
+}
+
+fn histogram_bucket_max(idx: usize) -> u64 {
+    if idx < 4 {
+        return idx as u64;
+    }
+    let shift = idx / 4 - 1;
+    let low = (4 + (idx % 4) as u64) << shift;
+    low + ((1u64 << shift) - 1)
+}
+
+impl Stats {
+    /// Segments searched per point read that reached them
+    pub fn read_amplification(&self) -> f64 {
+        if self.segment_gets == 0 {
+            return 0.0;
+        }
+        self.segment_probes as f64 / self.segment_gets as f64
+    }
+    
+    /// The stats in the Prometheus text exposition format, for a `/metrics`
+    /// endpoint. Latencies are summaries in seconds.
+    pub fn to_prometheus(&self) -> String {
+        let mut out = String::new();
+        let latencies = [
+            ("write", &self.writes), ("get", &self.gets), ("flush", &self.flushes),
+            ("compaction", &self.compactions), ("wal_sync", &self.wal_syncs),
+            ("cache_load", &self.cache_loads),
+        ];
+        for &(name, stats) in latencies.iter() {
+            let secs = |ns: u64| ns as f64 / 1e9;
+            out.push_str(&format!("# TYPE antler_{}_seconds summary\n", name));
+            out.push_str(&format!("antler_{}_seconds{{quantile=\"0.5\"}} {}\n", name, secs(stats.p50_ns)));
+            out.push_str(&format!("antler_{}_seconds{{quantile=\"0.99\"}} {}\n", name, secs(stats.p99_ns)));
+            out.push_str(&format!("antler_{}_seconds{{quantile=\"1\"}} {}\n", name, secs(stats.max_ns)));
+            out.push_str(&format!("antler_{}_seconds_sum {}\n", name, secs(stats.sum_ns)));
+            out.push_str(&format!("antler_{}_seconds_count {}\n", name, stats.count));
+        }
+        
+        let counters = [
+            ("cache_hits", self.cache.hits), ("cache_misses", self.cache.misses),
+            ("cache_evictions", self.cache.evictions), ("write_stalls", self.write_stalls),
+            ("segment_gets", self.segment_gets), ("segment_probes", self.segment_probes),
+            ("bloom_negatives", self.bloom_negatives), ("bloom_false_positives", self.bloom_false_positives),
+            ("flush_errors", self.flush_errors), ("compaction_errors", self.compaction_errors),
+        ];
+        for &(name, value) in counters.iter() {
+            out.push_str(&format!("# TYPE antler_{}_total counter\nantler_{}_total {}\n", name, name, value));
+        }
+        out.push_str(&format!("# TYPE antler_write_stall_seconds_total counter\nantler_write_stall_seconds_total {}\n",
+                              self.write_stall_ns as f64 / 1e9));
+        
+        out.push_str("# TYPE antler_cache_bytes gauge\n");
+        out.push_str(&format!("antler_cache_bytes {}\n", self.cache.size_bytes));
+        out.push_str("# TYPE antler_segments gauge\n");
+        for (level, count) in self.segments.iter().enumerate() {
+            out.push_str(&format!("antler_segments{{level=\"{}\"}} {}\n", level, count));
+        }
+        out.push_str(&format!("# TYPE antler_immutable_memtables gauge\nantler_immutable_memtables {}\n",
+                              self.immutable_memtables));
+        out
+    }
+}
+
+impl Manifest {
+    fn load(path: &Path) -> io::Result<Self> {
+        let mut manifest = Manifest {
+            path: path.to_path_buf(),
+            entries: Vec::new(),
+            checkpoint: 0,
+            next_file: 1,
+            edits: 0,
+        };
+        
+        if !path.exists() {
+            return Ok(manifest);
+        }
+        
+        let file = File::open(path)?;
+        let mut reader = BufReader::new(file);
+        let mut line = String::new();
+        let mut valid_len = 0;
+        
+        while reader.read_line(&mut line)? > 0 {
+            if line.ends_with('\n') {
+                valid_len += line.len() as u64;
+            }
+            
+            // Edits are edit|crc|body. Older stores wrote seq_high|level|filename
+            // and checkpoint|seq lines, which are still read.
+            let parts: Vec<&str> = line.trim().splitn(3, '|').collect();
+            if parts.len() == 3 && parts[0] == "edit" {
+                // A torn or corrupt edit is dropped whole
+                if line.ends_with('\n') && u32::from_str_radix(parts[1], 16).ok() == Some(crc32(parts[2].as_bytes())) {
+                    if let Some(edit) = VersionEdit::decode(parts[2], &mut manifest.next_file) {
+                        manifest.apply(edit);
+                    }
+                }
+            } else if parts.len() == 2 && parts[0] == "checkpoint" {
+                if let Ok(seq) = parts[1].parse::<u64>() {
+                    manifest.checkpoint = manifest.checkpoint.max(seq);
+                }
+            } else if parts.len() == 3 {
+                if let Ok(seq_high) = parts[0].parse::<u64>() {
+                    if let Ok(level) = parts[1].parse::<usize>() {
+                        manifest.entries.push(ManifestEntry {
+                            seq_high,
+                            level,
+                            filename: parts[2].to_string(),
+                        });
+                    }
+                }
+            }
+            manifest.edits += 1;
+            line.clear();
+        }
+        
+        // Cut a torn last line so the next edit starts on a line of its own
+        if valid_len < fs::metadata(path)?.len() {
+            OpenOptions::new().write(true).open(path)?.set_len(valid_len)?;
+        }
+        
+        // Names look like l1_0000000042.seg
+        for entry in &manifest.entries {
+            let number = entry.filename.split(|c| c == '_' || c == '.').nth(1)
+                .and_then(|n| n.parse::<u64>().ok());
+            if let Some(number) = number {
+                manifest.next_file = manifest.next_file.max(number + 1);
+            }
+        }
+        
+        Ok(manifest)
+    }
+    
+    fn next_file_number(&mut self) -> u64 {
+        let number = self.next_file;
+        self.next_file += 1;
+        number
+    }
+    
+    fn apply(&mut self, edit: VersionEdit) {
+        self.entries.retain(|entry| !edit.removed.contains(&entry.filename));
+        self.entries.extend(edit.added);
+        if let Some(checkpoint) = edit.checkpoint {
+            self.checkpoint = self.checkpoint.max(checkpoint);
+        }
+    }
+    
+    // Append one edit as a single checksummed line, so after a crash it is
+    // either fully there or ignored
+    fn log_edit(&mut self, edit: VersionEdit) -> io::Result<()> {
+        let mut file = OpenOptions::new()
+            .create(true)
+            .append(true)
+            .open(&self.path)?;
+        
+        file.write_all(edit.encode(None).as_bytes())?;
+        file.sync_all()?;
+        
+        self.apply(edit);
+        self.edits += 1;
+        if self.edits >= MANIFEST_REWRITE_EDITS {
+            self.rewrite()?;
+        }
+        Ok(())
+    }
+    
+    // Replace the log with a single edit describing the current version
+    fn rewrite(&mut self) -> io::Result<()> {
+        let snapshot = VersionEdit {
+            added: self.entries.clone(),
+            removed: Vec::new(),
+            checkpoint: Some(self.checkpoint),
+        };
+        
+        let tmp = self.path.with_extension("tmp");
+        {
+            let mut file = File::create(&tmp)?;
+            file.write_all(snapshot.encode(Some(self.next_file)).as_bytes())?;
+            file.sync_all()?;
+        }
+        fs::rename(&tmp, &self.path)?;
+        if let Some(dir) = self.path.parent() {
+            File::open(dir)?.sync_all()?;
+        }
+        
+        self.edits = 1;
+        Ok(())
+    }
+}
+
+// One atomic change to the set of live segments
+#[derive(Debug, Default)]
+struct VersionEdit {
+    added: Vec<ManifestEntry>,
+    removed: Vec<String>,  // File names
+    checkpoint: Option<u64>,
+}
+
+impl VersionEdit {
+    // Line format: edit|crc|items, with space separated items
+    // +level:seq_high:filename, -filename, checkpoint:seq and next:file_number
+    fn encode(&self, next_file: Option<u64>) -> String {
+        let mut items = Vec::new();
+        for entry in &self.added {
+            items.push(format!("+{}:{}:{}", entry.level, entry.seq_high, entry.filename));
+        }
+        for filename in &self.removed {
+            items.push(format!("-{}", filename));
+        }
+        if let Some(checkpoint) = self.checkpoint {
+            items.push(format!("checkpoint:{}", checkpoint));
+        }
+        if let Some(next) = next_file {
+            items.push(format!("next:{}", next));
+        }
+        let body = items.join(" ");
+        format!("edit|{:08x}|{}\n", crc32(body.as_bytes()), body)
+    }
+    
+    fn decode(body: &str, next_file: &mut u64) -> Option<Self> {
+        let mut edit = VersionEdit::default();
+        for item in body.split(' ').filter(|item| !item.is_empty()) {
+            if item.starts_with('+') {
+                let fields: Vec<&str> = item[1..].splitn(3, ':').collect();
+                if fields.len() != 3 {
+                    return None;
+                }
+                edit.added.push(ManifestEntry {
+                    level: fields[0].parse().ok()?,
+                    seq_high: fields[1].parse().ok()?,
+                    filename: fields[2].to_string(),
+                });
+            } else if item.starts_with('-') {
+                edit.removed.push(item[1..].to_string());
+            } else if item.starts_with("checkpoint:") {
+                edit.checkpoint = Some(item["checkpoint:".len()..].parse().ok()?);
+            } else if item.starts_with("next:") {
+                *next_file = (*next_file).max(item["next:".len()..].parse().ok()?);
+            } else {
+                return None;
+            }
+        }
+        Some(edit)
+    }
+}
+
+// Helper functions
+
+// One distinct path of a multi_get, with the run of the sorted inputs it
+// answers and the newest version found so far. Settled paths were answered
+// by a memtable.
+struct PendingGet<'a> {
+    path: &'a str,
+    inputs: std::ops::Range<usize>,
+    found: Option<(Option<String>, u64)>,
+    settled: bool,
+}
+
+// The one segment of a sorted, disjoint level whose range can hold `key`
+fn level_segment<'a>(level: &'a [Arc<Segment>], key: &str) -> Option<&'a Arc<Segment>> {
+    let idx = level.partition_point(|seg| seg.max_key.as_str() < key);
+    level.get(idx).filter(|seg| seg.min_key.as_str() <= key)
+}
+
+// A running compaction's hold on its input segments, taken while the claim
+// lock is held so the other level's compaction cannot pick them too
+struct Claim<'a> {
+    store: &'a Store,
+    ids: Vec<u64>,
+}
+
+impl<'a> Claim<'a> {
+    fn new(store: &'a Store, mut claimed: MutexGuard<Vec<u64>>, inputs: &[Arc<Segment>]) -> Self {
+        let ids: Vec<u64> = inputs.iter().map(|seg| seg.id).collect();
+        claimed.extend_from_slice(&ids);
+        Claim { store, ids }
+    }
+}
+
+impl<'a> Drop for Claim<'a> {
+    fn drop(&mut self) {
+        let (lock, released) = &*self.store.compacting;
+        lock.lock().unwrap().retain(|id| !self.ids.contains(id));
+        released.notify_all();
+    }
+}
+
+// Key ranges [start, end) for the parts of a merge of `inputs`, cut at block
+// first keys so each part has about the same number of input blocks. Parts
+// are kept to at least one target-sized segment of input; the first range
+// starts at "" and the last is open.
+fn subcompaction_ranges(inputs: &[Arc<Segment>], parts: usize, target_size: usize) -> Vec<(String, Option<String>)> {
+    let bytes: u64 = inputs.iter().map(|seg| seg.size).sum();
+    let mut keys: Vec<&str> = inputs.iter()
+        .flat_map(|seg| (0..seg.index.len()).filter_map(move |i| std::str::from_utf8(seg.index_key(i)).ok()))
+        .collect();
+    let parts = parts.min((bytes / target_size.max(1) as u64) as usize).min(keys.len()).max(1);
+    keys.sort_unstable();
+    
+    let mut cuts: Vec<&str> = (1..parts).map(|i| keys[i * keys.len() / parts]).collect();
+    cuts.dedup();
+    cuts.retain(|cut| !cut.is_empty());
+    
+    let mut ranges = Vec::with_capacity(cuts.len() + 1);
+    let mut start = String::new();
+    for cut in cuts {
+        ranges.push((start, Some(cut.to_string())));
+        start = cut.to_string();
+    }
+    ranges.push((start, None));
+    ranges
+}
+
+// Subtombs with nothing older left below them once a merge of `inputs` drops
+// the records they cover: no memtable has such a key, and no other segment
+// that overlaps the prefix has records that old
+fn collectable_subtombs(inner: &StoreInner, inputs: &[Arc<Segment>]) -> Vec<(String, u64)> {
+    inner.subtombs.iter()
+        .filter(|(prefix, tomb)| {
+            let end = format!("{}\u{10ffff}", prefix);
+            let in_segments = inner.segments_l0.iter()
+                .chain(inner.segments_l1.iter())
+                .chain(inner.segments_l2.iter())
+                .filter(|seg| !inputs.iter().any(|input| Arc::ptr_eq(input, seg)))
+                .any(|seg| seg.seq_low <= tomb.seq && seg.overlaps(prefix, &end));
+            let in_memtables = inner.memtables().any(|mem| {
+                mem.iter_from(prefix)
+                    .take_while(|entry| entry.key.starts_with(*prefix))
+                    .any(|entry| entry.seq < tomb.seq)
+            });
+            !in_segments && !in_memtables
+        })
+        .map(|(prefix, tomb)| (prefix.to_string(), tomb.seq))
+        .collect()
+}
+
+fn widen_range(min_key: &mut Option<String>, max_key: &mut Option<String>, key: &str) {
+    if min_key.as_ref().map_or(true, |min| key < min.as_str()) {
+        *min_key = Some(key.to_string());
+    }
+    if max_key.as_ref().map_or(true, |max| key > max.as_str()) {
+        *max_key = Some(key.to_string());
+    }
+}
+
+fn sort_level(level: &mut Vec<Arc<Segment>>) {
+    level.sort_by(|a, b| a.min_key.cmp(&b.min_key));
+}
+
+fn level_disjoint(level: &[Arc<Segment>]) -> bool {
+    let keyed: Vec<&Arc<Segment>> = level.iter().filter(|seg| !seg.is_empty()).collect();
+    keyed.windows(2).all(|pair| pair[0].max_key < pair[1].min_key)
+}
+
+// `prefix` with the trailing '/' a subtomb is keyed by
+fn subtree_prefix(prefix: &str) -> String {
+    if prefix.ends_with('/') {
+        prefix.to_string()
+    } else {
+        format!("{}/", prefix)
+    }
+}
+
+fn scalar_parent_error() -> io::Error {
+    io::Error::new(io::ErrorKind::InvalidInput, "Cannot write under scalar parent")
+}
+
+fn next_segment_id() -> u64 {
+    static NEXT_SEGMENT_ID: AtomicU64 = AtomicU64::new(1);
+    NEXT_SEGMENT_ID.fetch_add(1, Ordering::Relaxed)
+}
+
+// LZ4 block format: sequences of token | [literal length bytes] | literals |
+// offset(2) | [match length bytes], the last one holding literals only. The
+// compressor is the greedy single-probe kind: one hash table of last positions,
+// no chains, which keeps it fast enough to run inline on flush.
+const LZ4_MIN_MATCH: usize = 4;
+const LZ4_HASH_LOG: usize = 12;
+
+fn lz4_compress(src: &[u8]) -> Vec<u8> {
+    let mut out = Vec::with_capacity(src.len() / 2 + 16);
+    let mut table = [0u32; 1 << LZ4_HASH_LOG];  // Position + 1, 0 when empty
+    let mut anchor = 0;
+    let mut i = 0;
+    
+    // The format wants the last match to start 12 bytes before the end and the
+    // last 5 bytes to be literals
+    let limit = src.len().saturating_sub(12);
+    while i < limit {
+        let word = le_u32(&src[i..]);
+        let slot = (word.wrapping_mul(2654435761) >> (32 - LZ4_HASH_LOG)) as usize;
+        let candidate = table[slot] as usize;
+        table[slot] = (i + 1) as u32;
+        
+        if candidate > 0 && i - (candidate - 1) <= 0xffff && le_u32(&src[candidate - 1..]) == word {
+            let start = candidate - 1;
+            let max = src.len() - 5 - i;
+            let mut len = LZ4_MIN_MATCH;
+            while len < max && src[start + len] == src[i + len] {
+                len += 1;
+            }
+            
+            lz4_sequence(&mut out, &src[anchor..i], Some(((i - start) as u16, len)));
+            i += len;
+            anchor = i;
+        } else {
+            i += 1;
+        }
     }
+    lz4_sequence(&mut out, &src[anchor..], None);
+    out
 }
 
-impl BlockCache {
-    fn new(max_size: usize) -> Self {
-        BlockCache {
-            cache: RwLock::new(HashMap::new()),
-            size: RwLock::new(0),
-            max_size,
+fn lz4_sequence(out: &mut Vec<u8>, literals: &[u8], matched: Option<(u16, usize)>) {
+    fn put_len(out: &mut Vec<u8>, mut n: usize) {
+        while n >= 255 {
+            out.push(255);
+            n -= 255;
         }
+        out.push(n as u8);
     }
     
-    fn get_or_load(&self, path: &Path, offset: u64, size: usize) -> io::Result<Arc<Vec<u8>>> {
-        let key = (path.to_path_buf(), offset);
-        
-        {
-            let cache = self.cache.read().unwrap();
-            if let Some(data) = cache.get(&key) {
-                return Ok(data.clone());
-            }
-        }
-        
-        // Load from disk
-        let mut file = File::open(path)?;
-        file.seek(SeekFrom::Start(offset))?;
-        
-        let mut data = vec![0u8; size];
-        file.read_exact(&mut data)?;
-        
-        let data = Arc::new(data);
-        
-        // Add to cache
-        let mut cache = self.cache.write().unwrap();
-        let mut size = self.size.write().unwrap();
-        
-        *size += data.len();
-        cache.insert(key, data.clone());
-        
-        // Simple eviction if over limit
-        while *size > self.max_size && !cache.is_empty() {
-            if let Some((k, v)) = cache.iter().next() {
-                let k = k.clone();
-                let v_size = v.len();
-                cache.remove(&k);
-                *size -= v_size;
-            }
+    let match_len = matched.map_or(0, |(_, len)| len - LZ4_MIN_MATCH);
+    out.push((literals.len().min(15) << 4 | match_len.min(15)) as u8);
+    if literals.len() >= 15 {
+        put_len(out, literals.len() - 15);
+    }
+    out.extend_from_slice(literals);
+    if let Some((offset, _)) = matched {
+        out.extend_from_slice(&offset.to_le_bytes());
+        if match_len >= 15 {
+            put_len(out, match_len - 15);
         }
-        
-        Ok(data)
     }
 }
 
-impl Manifest {
-    fn load(path: &Path) -> io::Result<Self> {
-        let mut manifest = Manifest {
-            path: path.to_path_buf(),
-            entries: Vec::new(),
-        };
-        
-        if !path.exists() {
-            return Ok(manifest);
-        }
-        
-        let file = File::open(path)?;
-        let mut reader = BufReader::new(file);
-        let mut line = String::new();
-        
-        while reader.read_line(&mut line)? > 0 {
-            // Simple format: seq_high|level|filename
-            let parts: Vec<&str> = line.trim().split('|').collect();
-            if parts.len() == 3 {
-                if let Ok(seq_high) = parts[0].parse::<u64>() {
-                    if let Ok(level) = parts[1].parse::<usize>() {
-                        manifest.entries.push(ManifestEntry {
-                            seq_high,
-                            level,
-                            filename: parts[2].to_string(),
-                        });
-                    }
+// None if the input is not a valid encoding of exactly `raw_len` bytes
+fn lz4_decompress(src: &[u8], raw_len: usize) -> Option<Vec<u8>> {
+    fn get_len(src: &[u8], pos: &mut usize, mut n: usize) -> Option<usize> {
+        if n == 15 {
+            loop {
+                let byte = *src.get(*pos)?;
+                *pos += 1;
+                n += byte as usize;
+                if byte != 255 {
+                    break;
                 }
             }
-            line.clear();
         }
-        
-        Ok(manifest)
+        Some(n)
     }
     
-    fn add_entry(&mut self, entry: ManifestEntry) -> io::Result<()> {
-        self.entries.push(entry.clone());
-        
-        let mut file = OpenOptions::new()
-            .create(true)
-            .append(true)
-            .open(&self.path)?;
-        
-        writeln!(file, "{}|{}|{}", entry.seq_high, entry.level, entry.filename)?;
-        file.sync_all()?;
+    let mut out = Vec::with_capacity(raw_len);
+    let mut pos = 0;
+    while pos < src.len() {
+        let token = src[pos];
+        pos += 1;
+        
+        let literals = get_len(src, &mut pos, (token >> 4) as usize)?;
+        out.extend_from_slice(src.get(pos..pos + literals)?);
+        pos += literals;
+        if pos == src.len() {
+            break;
+        }
         
-        Ok(())
+        let offset = u16::from_le_bytes([*src.get(pos)?, *src.get(pos + 1)?]) as usize;
+        pos += 2;
+        let len = get_len(src, &mut pos, (token & 15) as usize)? + LZ4_MIN_MATCH;
+        if offset == 0 || offset > out.len() || out.len() + len > raw_len {
+            return None;
+        }
+        // Byte by byte, since a match may overlap what it is copying
+        let start = out.len() - offset;
+        for k in start..start + len {
+            let byte = out[k];
+            out.push(byte);
+        }
     }
+    
+    if out.len() == raw_len { Some(out) } else { None }
 }
 
-// Helper functions
-fn parent_path(path: &str) -> Option<String> {
-    if let Some(idx) = path.rfind('/') {
-        if idx > 0 {
-            Some(path[..idx].to_string())
-        } else {
-            None
+// LEB128: seven bits per byte, low bits first
+fn put_varint(buf: &mut Vec<u8>, mut v: u64) {
+    while v >= 0x80 {
+        buf.push(v as u8 | 0x80);
+        v >>= 7;
+    }
+    buf.push(v as u8);
+}
+
+fn read_varint(data: &[u8], pos: &mut usize) -> Option<u64> {
+    let mut v = 0u64;
+    for shift in (0..64).step_by(7) {
+        let byte = *data.get(*pos)?;
+        *pos += 1;
+        v |= ((byte & 0x7f) as u64) << shift;
+        if byte < 0x80 {
+            return Some(v);
         }
-    } else {
-        None
     }
+    None
+}
+
+fn le_u32(bytes: &[u8]) -> u32 {
+    let mut buf = [0u8; 4];
+    buf.copy_from_slice(&bytes[..4]);
+    u32::from_le_bytes(buf)
+}
+
+fn le_u64(bytes: &[u8]) -> u64 {
+    let mut buf = [0u8; 8];
+    buf.copy_from_slice(&bytes[..8]);
+    u64::from_le_bytes(buf)
 }
 
 fn crc32(data: &[u8]) -> u32 {
@@ -1766,8 +5885,104 @@ fn crc32(data: &[u8]) -> u32 {
     crc ^ 0xffffffff
 }
 
+// JSON string literal, escaping quotes, backslashes and control characters
+fn write_json_str<W: Write>(out: &mut W, s: &str) -> io::Result<()> {
+    out.write_all(b"\"")?;
+    let mut plain = 0;
+    for (i, b) in s.bytes().enumerate() {
+        let escape: &[u8] = match b {
+            b'"' => b"\\\"",
+            b'\\' => b"\\\\",
+            b'\n' => b"\\n",
+            b'\r' => b"\\r",
+            b'\t' => b"\\t",
+            0..=0x1f => b"",
+            _ => continue,
+        };
+        out.write_all(&s.as_bytes()[plain..i])?;
+        if escape.is_empty() {
+            write!(out, "\\u{:04x}", b)?;
+        } else {
+            out.write_all(escape)?;
+        }
+        plain = i + 1;
+    }
+    out.write_all(&s.as_bytes()[plain..])?;
+    out.write_all(b"\"")
+}
+
+fn bloom_hash(key: &str) -> u64 {
+    xxh64(key.as_bytes(), 0)
+}
+
+// XXH64, the bloom hash from ELKYN07
+const XXH_P1: u64 = 0x9E3779B185EBCA87;
+const XXH_P2: u64 = 0xC2B2AE3D27D4EB4F;
+const XXH_P3: u64 = 0x165667B19E3779F9;
+const XXH_P4: u64 = 0x85EBCA77C2B2AE63;
+const XXH_P5: u64 = 0x27D4EB2F165667C5;
+
+fn xxh64(data: &[u8], seed: u64) -> u64 {
+    fn round(acc: u64, input: u64) -> u64 {
+        acc.wrapping_add(input.wrapping_mul(XXH_P2)).rotate_left(31).wrapping_mul(XXH_P1)
+    }
+    fn merge(acc: u64, lane: u64) -> u64 {
+        (acc ^ round(0, lane)).wrapping_mul(XXH_P1).wrapping_add(XXH_P4)
+    }
+    
+    let len = data.len();
+    let mut i = 0;
+    let mut h = if len >= 32 {
+        let mut v = [
+            seed.wrapping_add(XXH_P1).wrapping_add(XXH_P2),
+            seed.wrapping_add(XXH_P2),
+            seed,
+            seed.wrapping_sub(XXH_P1),
+        ];
+        while i + 32 <= len {
+            for (lane, acc) in v.iter_mut().enumerate() {
+                *acc = round(*acc, le_u64(&data[i + lane * 8..]));
+            }
+            i += 32;
+        }
+        let mut h = v[0].rotate_left(1)
+            .wrapping_add(v[1].rotate_left(7))
+            .wrapping_add(v[2].rotate_left(12))
+            .wrapping_add(v[3].rotate_left(18));
+        for &lane in &v {
+            h = merge(h, lane);
+        }
+        h
+    } else {
+        seed.wrapping_add(XXH_P5)
+    };
+    
+    h = h.wrapping_add(len as u64);
+    while i + 8 <= len {
+        h ^= round(0, le_u64(&data[i..]));
+        h = h.rotate_left(27).wrapping_mul(XXH_P1).wrapping_add(XXH_P4);
+        i += 8;
+    }
+    if i + 4 <= len {
+        h ^= (le_u32(&data[i..]) as u64).wrapping_mul(XXH_P1);
+        h = h.rotate_left(23).wrapping_mul(XXH_P2).wrapping_add(XXH_P3);
+        i += 4;
+    }
+    while i < len {
+        h ^= (data[i] as u64).wrapping_mul(XXH_P5);
+        h = h.rotate_left(11).wrapping_mul(XXH_P1);
+        i += 1;
+    }
+    
+    h ^= h >> 33;
+    h = h.wrapping_mul(XXH_P2);
+    h ^= h >> 29;
+    h = h.wrapping_mul(XXH_P3);
+    h ^ (h >> 32)
+}
+
 fn xxhash(data: &[u8], seed: u64) -> u64 {
-    // Simplified xxhash for bloom filter
+    // Simplified xxhash, the bloom hash of segments before ELKYN07
     let mut h = seed.wrapping_add(data.len() as u64);
     for chunk in data.chunks(8) {
         let mut val = 0u64;
@@ -1782,10 +5997,539 @@ fn xxhash(data: &[u8], seed: u64) -> u64 {
 
 // Simple pipe-delimited manifest format (no serde dependency)
 
+// Wire protocol for `Store::serve` and `Client`. Every message is a frame,
+// len(4) | body, with strings as len(4) | UTF-8 bytes. Requests are
+//   GET(1) key | SET(2) flags key value | DELETE(3) flags key
+//   DELETE_SUBTREE(4) key | SCAN(5) start end limit(4)
+//   SUBSCRIBE(6) path from(8), u64::MAX for live events only
+// where flags holds replace_subtree in bit 0 and the durability (0 None,
+// 1 Buffered, 2 Sync) in bits 1-2. Each gets one response in order,
+//   OK(0) [value | count(4) (key value)*] | NOT_FOUND(1) | ERROR(2) message
+// and a subscription then streams EVENT(3) seq(8) key has_value(1) [value]
+// frames until the connection closes.
+
+impl Store {
+    /// Serve the binary protocol on `addr`, `unix:<path>` for a Unix socket
+    /// or `host:port` for TCP, to any number of processes, with one thread
+    /// per connection. Only returns if the listener fails.
+    pub fn serve(&self, addr: &str) -> io::Result<()> {
+        if let Some(path) = addr.strip_prefix("unix:") {
+            #[cfg(unix)]
+            {
+                let _ = fs::remove_file(path);  // Left by an earlier server
+                return self.serve_unix(std::os::unix::net::UnixListener::bind(path)?);
+            }
+            #[cfg(not(unix))]
+            return Err(io::Error::new(io::ErrorKind::Unsupported, format!("no Unix sockets for {}", path)));
+        }
+        self.serve_tcp(std::net::TcpListener::bind(addr)?)
+    }
+    
+    pub fn serve_tcp(&self, listener: std::net::TcpListener) -> io::Result<()> {
+        for stream in listener.incoming() {
+            let stream = stream?;
+            let _ = stream.set_nodelay(true);
+            let reader = stream.try_clone()?;
+            self.spawn_connection(Box::new(reader), Box::new(stream));
+        }
+        Ok(())
+    }
+    
+    #[cfg(unix)]
+    pub fn serve_unix(&self, listener: std::os::unix::net::UnixListener) -> io::Result<()> {
+        for stream in listener.incoming() {
+            let stream = stream?;
+            let reader = stream.try_clone()?;
+            self.spawn_connection(Box::new(reader), Box::new(stream));
+        }
+        Ok(())
+    }
+    
+    fn spawn_connection(&self, reader: Box<dyn Read + Send>, writer: Box<dyn Write + Send>) {
+        let store = self.clone();
+        thread::spawn(move || {
+            // A client that hangs up or sends garbage only ends its own connection
+            let _ = store.serve_connection(reader, writer);
+        });
+    }
+    
+    // Answer requests until the client hangs up. Whatever a pipelining
+    // client has already sent is taken as one round and answered with one
+    // write.
+    fn serve_connection(&self, reader: Box<dyn Read + Send>, mut writer: Box<dyn Write + Send>) -> io::Result<()> {
+        let mut reader = BufReader::with_capacity(64 * 1024, reader);
+        let mut frame = Vec::new();
+        let mut out = Vec::new();
+        loop {
+            let mut round = Vec::new();
+            if !read_frame(&mut reader, &mut frame)? {
+                return Ok(());
+            }
+            round.push(decode_request(&frame)?);
+            while frame_buffered(reader.buffer()) {
+                read_frame(&mut reader, &mut frame)?;
+                round.push(decode_request(&frame)?);
+            }
+            
+            out.clear();
+            let subscribe = self.answer_round(&round, &mut out);
+            writer.write_all(&out)?;
+            writer.flush()?;
+            
+            if let Some((path, from)) = subscribe {
+                return self.stream_events(&path, from, writer);
+            }
+        }
+    }
+    
+    // Encode the responses to `round` into `out`. Runs of writes go in as one
+    // batch and runs of gets read one version. Stops at a subscribe, which
+    // is returned once everything before it is answered.
+    fn answer_round(&self, round: &[(ServerOp, Durability)], out: &mut Vec<u8>) -> Option<(String, u64)> {
+        let mut i = 0;
+        while i < round.len() {
+            match &round[i].0 {
+                ServerOp::Request(Request::Get(_)) => {
+                    let mut keys = Vec::new();
+                    while let Some((ServerOp::Request(Request::Get(key)), _)) = round.get(i) {
+                        keys.push(key.as_str());
+                        i += 1;
+                    }
+                    
+                    // A failed lookup fails the whole run; retry the keys one
+                    // by one so each gets its own answer
+                    let inner = self.version.load();
+                    let answers: Vec<io::Result<Option<String>>> = match self.multi_get_in(&inner, &keys) {
+                        Ok(values) => values.into_iter().map(Ok).collect(),
+                        Err(_) => keys.iter().map(|key| self.get_in(&inner, key)).collect(),
+                    };
+                    for answer in answers {
+                        match answer {
+                            Ok(Some(value)) => encode_frame(out, ST_OK, |body| put_str(body, &value)),
+                            Ok(None) => encode_frame(out, ST_NOT_FOUND, |_| {}),
+                            Err(e) => encode_error(out, &e),
+                        }
+                    }
+                }
+                ServerOp::Request(Request::Scan(start, end, limit)) => {
+                    match self.get_range_limit(start, end, *limit) {
+                        Ok(pairs) => encode_frame(out, ST_OK, |body| {
+                            body.extend_from_slice(&(pairs.len() as u32).to_le_bytes());
+                            for (key, value) in &pairs {
+                                put_str(body, key);
+                                put_str(body, value);
+                            }
+                        }),
+                        Err(e) => encode_error(out, &e),
+                    }
+                    i += 1;
+                }
+                ServerOp::Subscribe(path, from) => return Some((path.clone(), *from)),
+                ServerOp::Request(_) => {
+                    let start = i;
+                    let mut batch = WriteBatch::new();
+                    let mut durability = Durability::None;
+                    while let Some((ServerOp::Request(request), wanted)) = round.get(i) {
+                        match request {
+                            Request::Set(key, value, replace) => batch.set(key, value, *replace),
+                            Request::Delete(key) => batch.delete(key),
+                            Request::DeleteSubtree(key) => batch.delete_subtree(key),
+                            _ => break,
+                        };
+                        durability = durability.max(*wanted);
+                        i += 1;
+                    }
+                    
+                    // One bad write would fail the whole batch; if it was
+                    // rejected before anything was applied, its neighbours are
+                    // retried one by one so each gets its own answer. Once it
+                    // is applied, a failure is every op's answer.
+                    let started = Instant::now();
+                    let written = match self.apply_batch_checked(&batch, durability != Durability::None) {
+                        Err(_) if i - start > 1 => {
+                            for op in &batch.ops {
+                                let single = WriteBatch { ops: vec![op.clone()] };
+                                match self.write_with(&single, durability) {
+                                    Ok(()) => encode_frame(out, ST_OK, |_| {}),
+                                    Err(e) => encode_error(out, &e),
+                                }
+                            }
+                            continue;
+                        }
+                        Err(e) => Err(e),
+                        Ok(applied) => applied.and_then(|lsn| match durability {
+                            Durability::Sync => self.wal.commit(lsn),
+                            _ => Ok(()),
+                        }),
+                    };
+                    if written.is_ok() {
+                        self.metrics.writes.record(started);
+                    }
+                    for _ in start..i {
+                        match &written {
+                            Ok(()) => encode_frame(out, ST_OK, |_| {}),
+                            Err(e) => encode_error(out, e),
+                        }
+                    }
+                }
+            }
+        }
+        None
+    }
+    
+    // Hand the connection over to a subscription: confirm it, then write
+    // each event as it arrives. A closed connection is noticed at the next
+    // event.
+    fn stream_events(&self, path: &str, from: u64, mut writer: Box<dyn Write + Send>) -> io::Result<()> {
+        let subscription = if from == u64::MAX {
+            Ok(self.subscribe(path))
+        } else {
+            self.subscribe_from(path, from)
+        };
+        let mut out = Vec::new();
+        let subscription = match subscription {
+            Ok(subscription) => {
+                encode_frame(&mut out, ST_OK, |_| {});
+                subscription
+            }
+            Err(e) => {
+                encode_error(&mut out, &e);
+                return writer.write_all(&out);
+            }
+        };
+        writer.write_all(&out)?;
+        writer.flush()?;
+        
+        for event in subscription {
+            out.clear();
+            encode_frame(&mut out, ST_EVENT, |body| {
+                body.extend_from_slice(&event.seq.to_le_bytes());
+                put_str(body, &event.key);
+                match &event.value {
+                    Some(value) => {
+                        body.push(1);
+                        put_str(body, value);
+                    }
+                    None => body.push(0),
+                }
+            });
+            writer.write_all(&out)?;
+            writer.flush()?;
+        }
+        Ok(())
+    }
+}
+
+// What a request frame asks of the server
+enum ServerOp {
+    Request(Request),
+    Subscribe(String, u64),
+}
+
+impl Client {
+    /// Connect to `Store::serve` at `unix:<path>` or `host:port`
+    pub fn connect(addr: &str) -> io::Result<Client> {
+        let (reader, writer): (Box<dyn Read + Send>, Box<dyn Write + Send>) = match addr.strip_prefix("unix:") {
+            #[cfg(unix)]
+            Some(path) => {
+                let stream = std::os::unix::net::UnixStream::connect(path)?;
+                (Box::new(stream.try_clone()?), Box::new(stream))
+            }
+            #[cfg(not(unix))]
+            Some(path) => return Err(io::Error::new(io::ErrorKind::Unsupported, format!("no Unix sockets for {}", path))),
+            None => {
+                let stream = std::net::TcpStream::connect(addr)?;
+                stream.set_nodelay(true)?;
+                (Box::new(stream.try_clone()?), Box::new(stream))
+            }
+        };
+        Ok(Client {
+            reader: BufReader::with_capacity(64 * 1024, reader),
+            writer,
+            durability: Durability::Buffered,
+            buf: Vec::new(),
+        })
+    }
+    
+    /// Durability of the writes this client sends from now on
+    pub fn set_durability(&mut self, durability: Durability) {
+        self.durability = durability;
+    }
+    
+    /// Send every request in one write, then read their responses
+    pub fn pipeline(&mut self, requests: &[Request]) -> io::Result<Vec<Response>> {
+        let mut out = Vec::new();
+        for request in requests {
+            encode_request(&mut out, request, self.durability);
+        }
+        self.writer.write_all(&out)?;
+        self.writer.flush()?;
+        
+        let mut responses = Vec::with_capacity(requests.len());
+        for request in requests {
+            if !read_frame(&mut self.reader, &mut self.buf)? {
+                return Err(io::Error::new(io::ErrorKind::UnexpectedEof, "server closed the connection"));
+            }
+            responses.push(decode_response(&self.buf, request)?);
+        }
+        Ok(responses)
+    }
+    
+    pub fn get(&mut self, path: &str) -> io::Result<Option<String>> {
+        match self.call(Request::Get(path.to_string()))? {
+            Response::Value(value) => Ok(value),
+            _ => Err(protocol_error()),
+        }
+    }
+    
+    pub fn set(&mut self, path: &str, value: &str, replace_subtree: bool) -> io::Result<()> {
+        self.call(Request::Set(path.to_string(), value.to_string(), replace_subtree)).map(|_| ())
+    }
+    
+    pub fn delete(&mut self, path: &str) -> io::Result<()> {
+        self.call(Request::Delete(path.to_string())).map(|_| ())
+    }
+    
+    pub fn delete_subtree(&mut self, prefix: &str) -> io::Result<()> {
+        self.call(Request::DeleteSubtree(prefix.to_string())).map(|_| ())
+    }
+    
+    pub fn get_range_limit(&mut self, start: &str, end: &str, limit: usize) -> io::Result<Vec<(String, String)>> {
+        match self.call(Request::Scan(start.to_string(), end.to_string(), limit))? {
+            Response::Pairs(pairs) => Ok(pairs),
+            _ => Err(protocol_error()),
+        }
+    }
+    
+    /// Turn the connection into a stream of events at or below `path`, as
+    /// `Store::subscribe`, or `Store::subscribe_from` when `from` is given
+    pub fn subscribe(mut self, path: &str, from: Option<u64>) -> io::Result<RemoteSubscription> {
+        let mut out = Vec::new();
+        encode_frame_raw(&mut out, |body| {
+            body.push(OP_SUBSCRIBE);
+            put_str(body, path);
+            body.extend_from_slice(&from.unwrap_or(u64::MAX).to_le_bytes());
+        });
+        self.writer.write_all(&out)?;
+        self.writer.flush()?;
+        
+        if !read_frame(&mut self.reader, &mut self.buf)? {
+            return Err(io::Error::new(io::ErrorKind::UnexpectedEof, "server closed the connection"));
+        }
+        match self.buf.first() {
+            Some(&ST_OK) => Ok(RemoteSubscription { reader: self.reader, buf: self.buf }),
+            _ => Err(response_error(&self.buf)),
+        }
+    }
+    
+    // One request, with errors the server reported turned into io errors
+    fn call(&mut self, request: Request) -> io::Result<Response> {
+        match self.pipeline(&[request])?.pop() {
+            Some(Response::Error(message)) => Err(io::Error::new(io::ErrorKind::Other, message)),
+            Some(response) => Ok(response),
+            None => Err(protocol_error()),
+        }
+    }
+}
+
+impl Iterator for RemoteSubscription {
+    type Item = Event;
+    
+    // Ends when the connection does, as a local subscription ends when it
+    // falls behind
+    fn next(&mut self) -> Option<Event> {
+        if !read_frame(&mut self.reader, &mut self.buf).ok()? {
+            return None;
+        }
+        let mut body = FrameReader::new(&self.buf);
+        if body.u8().ok()? != ST_EVENT {
+            return None;
+        }
+        let seq = body.u64().ok()?;
+        let key = body.str().ok()?;
+        let value = match body.u8().ok()? {
+            0 => None,
+            _ => Some(body.str().ok()?),
+        };
+        Some(Event { seq, key, value })
+    }
+}
+
+// Reads the fields of one frame body in order
+struct FrameReader<'a> {
+    data: &'a [u8],
+    pos: usize,
+}
+
+impl<'a> FrameReader<'a> {
+    fn new(data: &'a [u8]) -> Self {
+        FrameReader { data, pos: 0 }
+    }
+    
+    fn take(&mut self, len: usize) -> io::Result<&'a [u8]> {
+        if self.data.len() - self.pos < len {
+            return Err(protocol_error());
+        }
+        self.pos += len;
+        Ok(&self.data[self.pos - len..self.pos])
+    }
+    
+    fn u8(&mut self) -> io::Result<u8> {
+        Ok(self.take(1)?[0])
+    }
+    
+    fn u32(&mut self) -> io::Result<u32> {
+        Ok(le_u32(self.take(4)?))
+    }
+    
+    fn u64(&mut self) -> io::Result<u64> {
+        Ok(le_u64(self.take(8)?))
+    }
+    
+    fn str(&mut self) -> io::Result<String> {
+        let len = self.u32()? as usize;
+        String::from_utf8(self.take(len)?.to_vec()).map_err(|_| protocol_error())
+    }
+}
+
+fn protocol_error() -> io::Error {
+    io::Error::new(io::ErrorKind::InvalidData, "malformed protocol frame")
+}
+
+// Read one frame body into `buf`. False on a clean end of stream.
+fn read_frame<R: Read>(reader: &mut R, buf: &mut Vec<u8>) -> io::Result<bool> {
+    let mut len = [0u8; 4];
+    match reader.read_exact(&mut len) {
+        Ok(()) => {}
+        Err(e) if e.kind() == io::ErrorKind::UnexpectedEof => return Ok(false),
+        Err(e) => return Err(e),
+    }
+    let len = u32::from_le_bytes(len) as usize;
+    if len > MAX_FRAME {
+        return Err(io::Error::new(io::ErrorKind::InvalidData, "protocol frame too large"));
+    }
+    buf.resize(len, 0);
+    reader.read_exact(buf)?;
+    Ok(true)
+}
+
+// Whether `buffered` starts with a whole frame, so reading it won't block
+fn frame_buffered(buffered: &[u8]) -> bool {
+    buffered.len() >= 4 && buffered.len() - 4 >= le_u32(&buffered[..4]) as usize
+}
+
+fn put_str(body: &mut Vec<u8>, s: &str) {
+    body.extend_from_slice(&(s.len() as u32).to_le_bytes());
+    body.extend_from_slice(s.as_bytes());
+}
+
+// Append a frame whose body `fill` writes, patching in its length after
+fn encode_frame_raw<F: FnOnce(&mut Vec<u8>)>(out: &mut Vec<u8>, fill: F) {
+    let start = out.len();
+    out.extend_from_slice(&[0; 4]);
+    fill(out);
+    let len = (out.len() - start - 4) as u32;
+    out[start..start + 4].copy_from_slice(&len.to_le_bytes());
+}
+
+fn encode_frame<F: FnOnce(&mut Vec<u8>)>(out: &mut Vec<u8>, status: u8, fill: F) {
+    encode_frame_raw(out, |body| {
+        body.push(status);
+        fill(body);
+    });
+}
+
+fn encode_error(out: &mut Vec<u8>, e: &io::Error) {
+    encode_frame(out, ST_ERROR, |body| put_str(body, &e.to_string()));
+}
+
+fn encode_request(out: &mut Vec<u8>, request: &Request, durability: Durability) {
+    let flags = |replace: bool| replace as u8 | (durability as u8) << 1;
+    encode_frame_raw(out, |body| match request {
+        Request::Get(key) => {
+            body.push(OP_GET);
+            put_str(body, key);
+        }
+        Request::Set(key, value, replace) => {
+            body.extend_from_slice(&[OP_SET, flags(*replace)]);
+            put_str(body, key);
+            put_str(body, value);
+        }
+        Request::Delete(key) => {
+            body.extend_from_slice(&[OP_DELETE, flags(false)]);
+            put_str(body, key);
+        }
+        Request::DeleteSubtree(key) => {
+            body.extend_from_slice(&[OP_DELETE_SUBTREE, flags(false)]);
+            put_str(body, key);
+        }
+        Request::Scan(start, end, limit) => {
+            body.push(OP_SCAN);
+            put_str(body, start);
+            put_str(body, end);
+            body.extend_from_slice(&((*limit).min(u32::MAX as usize) as u32).to_le_bytes());
+        }
+    });
+}
+
+fn decode_request(frame: &[u8]) -> io::Result<(ServerOp, Durability)> {
+    let mut body = FrameReader::new(frame);
+    let op = body.u8()?;
+    let flags = if op == OP_SET || op == OP_DELETE || op == OP_DELETE_SUBTREE { body.u8()? } else { 0 };
+    let durability = match (flags >> 1) & 3 {
+        0 => Durability::None,
+        1 => Durability::Buffered,
+        _ => Durability::Sync,
+    };
+    let request = match op {
+        OP_GET => Request::Get(body.str()?),
+        OP_SET => Request::Set(body.str()?, body.str()?, flags & 1 != 0),
+        OP_DELETE => Request::Delete(body.str()?),
+        OP_DELETE_SUBTREE => Request::DeleteSubtree(body.str()?),
+        OP_SCAN => Request::Scan(body.str()?, body.str()?, body.u32()? as usize),
+        OP_SUBSCRIBE => return Ok((ServerOp::Subscribe(body.str()?, body.u64()?), durability)),
+        _ => return Err(protocol_error()),
+    };
+    Ok((ServerOp::Request(request), durability))
+}
+
+fn response_error(frame: &[u8]) -> io::Error {
+    let mut body = FrameReader::new(frame);
+    match (body.u8(), body.str()) {
+        (Ok(ST_ERROR), Ok(message)) => io::Error::new(io::ErrorKind::Other, message),
+        _ => protocol_error(),
+    }
+}
+
+fn decode_response(frame: &[u8], request: &Request) -> io::Result<Response> {
+    let mut body = FrameReader::new(frame);
+    Ok(match (body.u8()?, request) {
+        (ST_ERROR, _) => Response::Error(body.str()?),
+        (ST_NOT_FOUND, Request::Get(_)) => Response::Value(None),
+        (ST_OK, Request::Get(_)) => Response::Value(Some(body.str()?)),
+        (ST_OK, Request::Scan(..)) => {
+            let count = body.u32()? as usize;
+            let mut pairs = Vec::with_capacity(count.min(1024));
+            for _ in 0..count {
+                pairs.push((body.str()?, body.str()?));
+            }
+            Response::Pairs(pairs)
+        }
+        (ST_OK, _) => Response::Done,
+        _ => return Err(protocol_error()),
+    })
+}
+
 fn main() -> io::Result<()> {
     let args: Vec<String> = std::env::args().collect();
+    if args.len() == 4 && args[1] == "serve" {
+        let store = Store::open(Path::new(&args[2]))?;
+        eprintln!("Serving {} on {}", args[2], args[3]);
+        return store.serve(&args[3]);
+    }
     if args.len() != 2 {
         eprintln!("Usage: {} <directory>", args[0]);
+        eprintln!("       {} serve <directory> <unix:path | host:port>", args[0]);
         std::process::exit(1);
     }
     
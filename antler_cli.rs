@@ -186,11 +186,31 @@ fn main() -> io::Result<()> {
             }
             
             "stats" => {
-                let (l0, l1, l2) = store.segment_counts();
-                println!("Segment counts:");
-                println!("  L0: {} segments", l0);
-                println!("  L1: {} segments", l1);
-                println!("  L2: {} segments", l2);
+                let stats = store.stats();
+                if parts.get(1) == Some(&"prom") {
+                    print!("{}", stats.to_prometheus());
+                } else {
+                    print_stats(&stats);
+                }
+            }
+            
+            "checkpoint" | "ship" => {
+                if parts.len() < 2 {
+                    println!("Usage: {} <dir>", parts[0]);
+                    continue;
+                }
+                let dest = std::path::Path::new(parts[1]);
+                if parts[0] == "checkpoint" {
+                    match store.checkpoint(dest) {
+                        Ok(seq) => println!("✓ Checkpoint at seq {} in {}", seq, parts[1]),
+                        Err(e) => println!("✗ Error: {}", e),
+                    }
+                } else {
+                    match store.ship_wal(dest) {
+                        Ok(bytes) => println!("✓ Shipped {} bytes to {}", bytes, parts[1]),
+                        Err(e) => println!("✗ Error: {}", e),
+                    }
+                }
             }
             
             "bench" => {
@@ -267,7 +287,9 @@ fn print_help() {
     println!();
     println!("  Management:");
     println!("    flush                         - Flush memtable to disk");
-    println!("    stats                         - Show segment statistics");
+    println!("    stats [prom]                  - Show store statistics (prom: Prometheus text)");
+    println!("    checkpoint <dir>              - Write a consistent backup to an empty dir");
+    println!("    ship <dir>                    - Ship new WAL records to a checkpoint dir");
     println!("    bench                         - Run performance benchmark");
     println!("    load <prefix> [count]         - Load test data");
     println!("    tree <prefix>                 - Show tree structure");
@@ -280,6 +302,36 @@ fn print_help() {
     println!("  Shortcuts: s=set, g=get, d=delete, p=pattern, r=range, f=flush, q=quit");
 }
 
+fn print_stats(stats: &antler_store::Stats) {
+    let latency = |name: &str, l: &antler_store::LatencyStats| {
+        let us = |ns: u64| ns as f64 / 1000.0;
+        println!("  {:<12} {:>9} ops  p50 {:>9.1}µs  p99 {:>9.1}µs  max {:>9.1}µs",
+                 name, l.count, us(l.p50_ns), us(l.p99_ns), us(l.max_ns));
+    };
+    println!("Latency:");
+    latency("write", &stats.writes);
+    latency("get", &stats.gets);
+    latency("wal sync", &stats.wal_syncs);
+    latency("flush", &stats.flushes);
+    latency("compaction", &stats.compactions);
+    latency("cache load", &stats.cache_loads);
+    
+    let cache = &stats.cache;
+    let lookups = (cache.hits + cache.misses).max(1);
+    println!("Block cache: {:.1}% hit rate, {} evictions, {}/{} KB",
+             cache.hits as f64 * 100.0 / lookups as f64, cache.evictions,
+             cache.size_bytes / 1024, cache.capacity_bytes / 1024);
+    println!("Segments: L0 {}, L1 {}, L2 {}; {} sealed memtables",
+             stats.segments[0], stats.segments[1], stats.segments[2], stats.immutable_memtables);
+    println!("Reads: {:.2} segments searched per read, {} skipped by filters, {} bloom false positives",
+             stats.read_amplification(), stats.bloom_negatives, stats.bloom_false_positives);
+    println!("Write stalls: {} ({:.1} ms)", stats.write_stalls, stats.write_stall_ns as f64 / 1e6);
+    println!("Background errors: {} flush, {} compaction", stats.flush_errors, stats.compaction_errors);
+    if let Some(error) = &stats.last_background_error {
+        println!("  last: {}", error);
+    }
+}
+
 fn truncate(s: &str, max_len: usize) -> String {
     if s.len() <= max_len {
         s.to_string()
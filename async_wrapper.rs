@@ -1,8 +1,13 @@
 // Async wrapper for Antler Store
-// Provides non-blocking operations using tokio::task::spawn_blocking
+// Reads and writes answered from memory run inline on the calling task;
+// anything that has to touch disk goes to a small dedicated I/O pool
 
-use std::sync::Arc;
+use std::sync::atomic::{AtomicU64, Ordering};
+use std::sync::mpsc;
+use std::sync::{Arc, Mutex};
 use std::io;
+use std::thread;
+use tokio::sync::oneshot;
 use tokio::task;
 
 // Include the sync implementation with module isolation
@@ -10,13 +15,65 @@ mod sync_store {
     include!("antler.rs");
 }
 
-use sync_store::Store;
+// The sync API is offered as is next to AsyncStore
+pub use sync_store::{
+    CacheStats, Client, Compression, Durability, DurableWrite, Event, LatencyStats, Options,
+    RangeIter, RemoteSubscription, Request, Response, Snapshot, Stats, Store, Subscription,
+    WriteBatch,
+};
 use std::path::{Path, PathBuf};
 
-/// Async wrapper around the synchronous Store
-/// Uses tokio::task::spawn_blocking to run sync operations in a thread pool
+const IO_POOL_THREADS: usize = 4;
+
+type Job = Box<dyn FnOnce() + Send>;
+
+// Threads that run store calls which may block on disk: cache misses, scans,
+// flushes and writes that stall, seal or read blocks. Kept apart from tokio's
+// blocking pool so they never queue behind unrelated blocking work.
+struct IoPool {
+    jobs: Mutex<mpsc::Sender<Job>>,
+    offloaded: AtomicU64,
+}
+
+impl IoPool {
+    fn new(threads: usize) -> Self {
+        let (tx, rx) = mpsc::channel::<Job>();
+        let rx = Arc::new(Mutex::new(rx));
+        for _ in 0..threads {
+            let rx = rx.clone();
+            // Workers exit once the pool, and with it the sender, is dropped
+            thread::spawn(move || loop {
+                let job = match rx.lock().unwrap().recv() {
+                    Ok(job) => job,
+                    Err(_) => break,
+                };
+                job();
+            });
+        }
+        IoPool { jobs: Mutex::new(tx), offloaded: AtomicU64::new(0) }
+    }
+    
+    async fn run<T, F>(&self, op: F) -> io::Result<T>
+    where
+        F: FnOnce() -> io::Result<T> + Send + 'static,
+        T: Send + 'static,
+    {
+        self.offloaded.fetch_add(1, Ordering::Relaxed);
+        let (tx, rx) = oneshot::channel();
+        let job: Job = Box::new(move || {
+            let _ = tx.send(op());
+        });
+        self.jobs.lock().unwrap().send(job)
+            .map_err(|_| io::Error::new(io::ErrorKind::Other, "I/O pool stopped"))?;
+        rx.await.map_err(|_| io::Error::new(io::ErrorKind::Other, "I/O pool job panicked"))?
+    }
+}
+
+/// Async wrapper around the synchronous Store. Memtable and resident-block
+/// reads and unstalled writes run inline; the rest goes to an I/O pool.
 pub struct AsyncStore {
     inner: Arc<Store>,
+    pool: IoPool,
     _path: PathBuf,
 }
 
@@ -31,157 +88,179 @@ impl AsyncStore {
         
         Ok(AsyncStore {
             inner: Arc::new(store),
+            pool: IoPool::new(IO_POOL_THREADS),
             _path: path.to_path_buf(),
         })
     }
     
+    // Run `op` on the I/O pool
+    async fn offload<T, F>(&self, op: F) -> io::Result<T>
+    where
+        F: FnOnce(&Store) -> io::Result<T> + Send + 'static,
+        T: Send + 'static,
+    {
+        let store = self.inner.clone();
+        self.pool.run(move || op(&store)).await
+    }
+    
+    /// Calls that had to go to the I/O pool so far, for monitoring
+    pub fn offloaded_ops(&self) -> u64 {
+        self.pool.offloaded.load(Ordering::Relaxed)
+    }
+    
     /// Set a key-value pair asynchronously
     pub async fn set(&self, key: &str, value: &str, replace_subtree: bool) -> io::Result<()> {
-        let store = self.inner.clone();
+        self.set_with(key, value, replace_subtree, Durability::Buffered).await
+    }
+    
+    /// Set with an explicit durability mode. A `Sync` write is applied right
+    /// away and its ack is a future the group-commit leader completes.
+    pub async fn set_with(&self, key: &str, value: &str, replace_subtree: bool, durability: Durability) -> io::Result<()> {
+        let mut batch = WriteBatch::new();
+        batch.set(key, value, replace_subtree);
+        if durability == Durability::Sync {
+            return self.write_with(batch, durability).await;
+        }
+        if self.inner.write_is_resident(&batch) {
+            return self.inner.set_with(key, value, replace_subtree, durability);
+        }
+        
         let key = key.to_string();
         let value = value.to_string();
-        
-        task::spawn_blocking(move || {
-            store.set(&key, &value, replace_subtree)
-        }).await
-        .map_err(|e| io::Error::new(io::ErrorKind::Other, e))?
+        self.offload(move |store| store.set_with(&key, &value, replace_subtree, durability)).await
     }
     
     /// Get a value by key asynchronously
     pub async fn get(&self, key: &str) -> io::Result<Option<String>> {
-        let store = self.inner.clone();
-        let key = key.to_string();
+        if let Some(result) = self.inner.get_if_resident(key) {
+            return result;
+        }
         
-        task::spawn_blocking(move || {
-            store.get(&key)
-        }).await
-        .map_err(|e| io::Error::new(io::ErrorKind::Other, e))?
+        let key = key.to_string();
+        self.offload(move |store| store.get(&key)).await
     }
     
     /// Delete a key asynchronously
     pub async fn delete(&self, key: &str) -> io::Result<()> {
-        let store = self.inner.clone();
-        let key = key.to_string();
+        if self.inner.write_is_resident(WriteBatch::new().delete(key)) {
+            return self.inner.delete(key);
+        }
         
-        task::spawn_blocking(move || {
-            store.delete(&key)
-        }).await
-        .map_err(|e| io::Error::new(io::ErrorKind::Other, e))?
+        let key = key.to_string();
+        self.offload(move |store| store.delete(&key)).await
     }
     
     /// Delete an entire subtree asynchronously
     pub async fn delete_subtree(&self, prefix: &str) -> io::Result<()> {
-        let store = self.inner.clone();
-        let prefix = prefix.to_string();
+        if self.inner.write_is_resident(WriteBatch::new().delete_subtree(prefix)) {
+            return self.inner.delete_subtree(prefix);
+        }
         
-        task::spawn_blocking(move || {
-            store.delete_subtree(&prefix)
-        }).await
-        .map_err(|e| io::Error::new(io::ErrorKind::Other, e))?
+        let prefix = prefix.to_string();
+        self.offload(move |store| store.delete_subtree(&prefix)).await
     }
     
     /// Flush memtable to disk asynchronously
     pub async fn flush(&self) -> io::Result<()> {
-        let store = self.inner.clone();
-        
-        task::spawn_blocking(move || {
-            store.flush()
-        }).await
-        .map_err(|e| io::Error::new(io::ErrorKind::Other, e))?
+        self.offload(|store| store.flush()).await
     }
     
     /// Get all key-value pairs matching a wildcard pattern asynchronously
     pub async fn get_pattern(&self, pattern: &str) -> io::Result<Vec<(String, String)>> {
-        let store = self.inner.clone();
         let pattern = pattern.to_string();
-        
-        task::spawn_blocking(move || {
-            store.get_pattern(&pattern)
-        }).await
-        .map_err(|e| io::Error::new(io::ErrorKind::Other, e))?
+        self.offload(move |store| store.get_pattern(&pattern)).await
     }
     
     /// Delete all keys matching a wildcard pattern asynchronously
     pub async fn delete_pattern(&self, pattern: &str) -> io::Result<usize> {
-        let store = self.inner.clone();
         let pattern = pattern.to_string();
-        
-        task::spawn_blocking(move || {
-            store.delete_pattern(&pattern)
-        }).await
-        .map_err(|e| io::Error::new(io::ErrorKind::Other, e))?
+        self.offload(move |store| store.delete_pattern(&pattern)).await
     }
     
     /// Get a range of key-value pairs asynchronously
     pub async fn get_range(&self, start: &str, end: &str) -> io::Result<Vec<(String, String)>> {
-        let store = self.inner.clone();
         let start = start.to_string();
         let end = end.to_string();
-        
-        task::spawn_blocking(move || {
-            store.get_range(&start, &end)
-        }).await
-        .map_err(|e| io::Error::new(io::ErrorKind::Other, e))?
+        self.offload(move |store| store.get_range(&start, &end)).await
     }
     
     /// Get a limited range of key-value pairs asynchronously
     pub async fn get_range_limit(&self, start: &str, end: &str, limit: usize) -> io::Result<Vec<(String, String)>> {
-        let store = self.inner.clone();
         let start = start.to_string();
         let end = end.to_string();
-        
-        task::spawn_blocking(move || {
-            store.get_range_limit(&start, &end, limit)
-        }).await
-        .map_err(|e| io::Error::new(io::ErrorKind::Other, e))?
+        self.offload(move |store| store.get_range_limit(&start, &end, limit)).await
     }
     
     /// Scan keys with a given prefix asynchronously
     pub async fn scan_prefix(&self, prefix: &str, limit: usize) -> io::Result<Vec<(String, String)>> {
-        let store = self.inner.clone();
         let prefix = prefix.to_string();
-        
-        task::spawn_blocking(move || {
-            store.scan_prefix(&prefix, limit)
-        }).await
-        .map_err(|e| io::Error::new(io::ErrorKind::Other, e))?
+        self.offload(move |store| store.scan_prefix(&prefix, limit)).await
     }
     
     /// Get segment counts for monitoring
     pub async fn segment_counts(&self) -> (usize, usize, usize) {
-        let store = self.inner.clone();
-        
-        task::spawn_blocking(move || {
-            store.segment_counts()
-        }).await
-        .unwrap_or((0, 0, 0))
+        self.inner.segment_counts()
     }
     
-    /// Batch set operation - multiple sets in a single async call
+    /// Batch set operation - multiple sets applied atomically as one WriteBatch
     pub async fn batch_set(&self, operations: Vec<(String, String, bool)>) -> io::Result<()> {
-        let store = self.inner.clone();
-        
-        task::spawn_blocking(move || {
-            for (key, value, replace) in operations {
-                store.set(&key, &value, replace)?;
+        let mut batch = WriteBatch::new();
+        for (key, value, replace) in &operations {
+            batch.set(key, value, *replace);
+        }
+        self.write(batch).await
+    }
+    
+    /// Apply a WriteBatch atomically
+    pub async fn write(&self, batch: WriteBatch) -> io::Result<()> {
+        self.write_with(batch, Durability::Buffered).await
+    }
+    
+    /// Apply a WriteBatch with an explicit durability mode; `Sync` awaits the
+    /// commit instead of parking a thread on it
+    pub async fn write_with(&self, batch: WriteBatch, durability: Durability) -> io::Result<()> {
+        if durability != Durability::Sync {
+            if self.inner.write_is_resident(&batch) {
+                return self.inner.write_with(&batch, durability);
             }
-            Ok(())
-        }).await
-        .map_err(|e| io::Error::new(io::ErrorKind::Other, e))?
+            return self.offload(move |store| store.write_with(&batch, durability)).await;
+        }
+        
+        let durable = if self.inner.write_is_resident(&batch) {
+            self.inner.write_deferred(&batch)?
+        } else {
+            self.offload(move |store| store.write_deferred(&batch)).await?
+        };
+        durable.await
     }
     
-    /// Batch get operation - multiple gets in a single async call
+    /// Batch get operation - resident keys are answered inline, the rest by
+    /// one multi_get on the I/O pool
     pub async fn batch_get(&self, keys: Vec<String>) -> io::Result<Vec<Option<String>>> {
-        let store = self.inner.clone();
-        
-        task::spawn_blocking(move || {
-            let mut results = Vec::new();
-            for key in keys {
-                results.push(store.get(&key)?);
+        let mut results = Vec::with_capacity(keys.len());
+        let mut missing = Vec::new();
+        for (i, key) in keys.iter().enumerate() {
+            match self.inner.get_if_resident(key) {
+                Some(result) => results.push(result?),
+                None => {
+                    results.push(None);
+                    missing.push((i, key.clone()));
+                }
             }
-            Ok(results)
-        }).await
-        .map_err(|e| io::Error::new(io::ErrorKind::Other, e))?
+        }
+        if missing.is_empty() {
+            return Ok(results);
+        }
+        
+        let loaded = self.offload(move |store| {
+            let keys: Vec<&str> = missing.iter().map(|(_, key)| key.as_str()).collect();
+            let values = store.multi_get(&keys)?;
+            Ok(missing.iter().map(|(i, _)| *i).zip(values).collect::<Vec<_>>())
+        }).await?;
+        for (i, value) in loaded {
+            results[i] = value;
+        }
+        Ok(results)
     }
 }
 
@@ -320,56 +399,102 @@ mod tests {
     }
     
     #[tokio::test]
-    async fn test_async_performance() {
-        use std::time::Instant;
-        
+    async fn test_async_inline_and_durable() {
         let dir = tempdir().unwrap();
-        let store = Arc::new(AsyncStore::open(dir.path()).await.unwrap());
-        
-        // Measure concurrent write performance
-        let start = Instant::now();
-        let mut handles = vec![];
-        
-        for i in 0..10 {
-            let store = store.clone();
-            let handle = tokio::spawn(async move {
-                for j in 0..100 {
-                    let key = format!("perf_{}_{}", i, j);
-                    store.set(&key, "data", false).await.unwrap();
-                }
-            });
-            handles.push(handle);
+        {
+            let store = Arc::new(AsyncStore::open(dir.path()).await.unwrap());
+            
+            // Memtable reads and resident buffered writes never leave the task
+            store.set("hot/key", "value", false).await.unwrap();
+            assert_eq!(store.get("hot/key").await.unwrap(), Some("value".to_string()));
+            assert_eq!(store.get("hot/missing").await.unwrap(), None);
+            assert_eq!(store.offloaded_ops(), 0);
+            
+            // Sync acks are futures completed by the committer
+            let handles: Vec<_> = (0..8).map(|t| {
+                let store = store.clone();
+                tokio::spawn(async move {
+                    for i in 0..20 {
+                        store.set_with(&format!("durable/{}/{}", t, i), "v", false, Durability::Sync).await.unwrap();
+                    }
+                })
+            }).collect();
+            for handle in handles {
+                handle.await.unwrap();
+            }
+            let mut batch = WriteBatch::new();
+            batch.set("durable/batch/a", "1", false).set("durable/batch/b", "2", false);
+            store.write_with(batch, Durability::Sync).await.unwrap();
+            
+            // A flushed key comes back through the pool once, then from the cache
+            store.flush().await.unwrap();
+            let offloaded = store.offloaded_ops();
+            assert_eq!(store.get("durable/3/7").await.unwrap(), Some("v".to_string()));
+            assert_eq!(store.get("durable/3/7").await.unwrap(), Some("v".to_string()));
+            assert!(store.offloaded_ops() <= offloaded + 1);
+            
+            // A write that fills the memtable seals it on the pool
+            let offloaded = store.offloaded_ops();
+            store.set("hot/big", &"x".repeat(300 * 1024), false).await.unwrap();
+            assert_eq!(store.offloaded_ops(), offloaded + 1);
         }
         
-        for handle in handles {
-            handle.await.unwrap();
+        let store = AsyncStore::open(dir.path()).await.unwrap();
+        let keys = vec!["durable/7/19".to_string(), "durable/batch/b".to_string(), "hot/key".to_string()];
+        let values = store.batch_get(keys).await.unwrap();
+        assert_eq!(values, vec![Some("v".to_string()), Some("2".to_string()), Some("value".to_string())]);
+    }
+    
+    #[tokio::test]
+    async fn test_async_performance() {
+        use std::time::{Duration, Instant};
+        
+        // Per-op latencies from concurrent tasks, reported as percentiles
+        async fn measure<F, Fut>(label: &str, store: &Arc<AsyncStore>, op: F)
+        where
+            F: Fn(Arc<AsyncStore>, usize, usize) -> Fut + Send + Sync + Copy + 'static,
+            Fut: std::future::Future<Output = ()> + Send,
+        {
+            let handles: Vec<_> = (0..10).map(|t| {
+                let store = store.clone();
+                tokio::spawn(async move {
+                    let mut latencies = Vec::with_capacity(200);
+                    for j in 0..200 {
+                        let start = Instant::now();
+                        op(store.clone(), t, j).await;
+                        latencies.push(start.elapsed());
+                    }
+                    latencies
+                })
+            }).collect();
+            let mut latencies: Vec<Duration> = Vec::new();
+            for handle in handles {
+                latencies.extend(handle.await.unwrap());
+            }
+            latencies.sort();
+            let pct = |p: usize| latencies[(latencies.len() - 1) * p / 100];
+            println!("Async {}: {} ops, p50 {:?}, p99 {:?}, max {:?}",
+                     label, latencies.len(), pct(50), pct(99), latencies[latencies.len() - 1]);
         }
         
-        let elapsed = start.elapsed();
-        let ops_per_sec = 1000.0 / elapsed.as_secs_f64();
-        println!("Async writes: 1000 ops in {:?} = {:.0} ops/sec", elapsed, ops_per_sec);
-        
-        // Measure concurrent read performance
-        let start = Instant::now();
-        let mut handles = vec![];
-        
-        for i in 0..10 {
-            let store = store.clone();
-            let handle = tokio::spawn(async move {
-                for j in 0..100 {
-                    let key = format!("perf_{}_{}", i, j);
-                    store.get(&key).await.unwrap();
-                }
-            });
-            handles.push(handle);
-        }
+        let dir = tempdir().unwrap();
+        let store = Arc::new(AsyncStore::open(dir.path()).await.unwrap());
         
-        for handle in handles {
-            handle.await.unwrap();
-        }
+        measure("writes", &store, |store, t, j| async move {
+            store.set(&format!("perf_{}_{}", t, j), "data", false).await.unwrap();
+        }).await;
+        measure("hot reads", &store, |store, t, j| async move {
+            assert!(store.get(&format!("perf_{}_{}", t, j)).await.unwrap().is_some());
+        }).await;
+        assert_eq!(store.offloaded_ops(), 0, "Memtable reads should stay inline");
         
-        let elapsed = start.elapsed();
-        let ops_per_sec = 1000.0 / elapsed.as_secs_f64();
-        println!("Async reads: 1000 ops in {:?} = {:.0} ops/sec", elapsed, ops_per_sec);
+        store.flush().await.unwrap();
+        measure("segment reads", &store, |store, t, j| async move {
+            assert!(store.get(&format!("perf_{}_{}", t, j)).await.unwrap().is_some());
+        }).await;
+        measure("sync writes", &store, |store, t, j| async move {
+            store.set_with(&format!("sync_{}_{}", t % 2, j), "data", false, Durability::Sync).await.unwrap();
+        }).await;
+        println!("Async pool calls: {}", store.offloaded_ops());
     }
-}
\ No newline at end of file
+}
@@ -11,7 +11,7 @@ mod antler_store {
     include!("../antler.rs");
 }
 
-use antler_store::Store;
+use antler_store::{Store, WriteBatch};
 
 // Helper to create a temporary store
 fn temp_store() -> (Store, tempfile::TempDir) {
@@ -69,6 +69,22 @@ fn bench_write_large_values(b: &mut Bencher) {
     });
 }
 
+#[bench]
+fn bench_write_batch_fanout(b: &mut Bencher) {
+    let (store, _dir) = temp_store();
+    let mut i = 0;
+    
+    // One chat message: a handful of fields written as one WAL record
+    b.iter(|| {
+        let mut batch = WriteBatch::new();
+        for field in &["text", "user", "ts", "room", "reply_to"] {
+            batch.set(&format!("rooms/general/msg{:06}/{}", i, field), "value", false);
+        }
+        store.write(&batch).unwrap();
+        i += 1;
+    });
+}
+
 // ==================== READ BENCHMARKS ====================
 
 #[bench]
@@ -303,6 +319,26 @@ fn bench_write_with_compaction(b: &mut Bencher) {
     });
 }
 
+#[bench]
+fn bench_compaction_throughput(b: &mut Bencher) {
+    let (store, _dir) = temp_store();
+    let mut batch = 0;
+    
+    // Each iteration merges four overlapping L0 segments of 1000 records,
+    // about 40 bytes each
+    b.bytes = 4 * 1000 * 40;
+    b.iter(|| {
+        for _ in 0..4 {
+            for i in 0..1000 {
+                store.set(&format!("compact{:06}", i), &format!("value{:04}", batch), false).unwrap();
+            }
+            store.flush().unwrap();
+            batch += 1;
+        }
+        store.compact().unwrap();
+    });
+}
+
 // ==================== CONCURRENT BENCHMARKS ====================
 
 #[bench]
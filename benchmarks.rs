@@ -69,6 +69,35 @@ fn bench_sequential_writes() -> BenchmarkResult {
         .with_note("Keys in order (best case)")
 }
 
+// Per-write latency over enough data to force many memtable flushes. With
+// flushing off the write path, p99 and max should stay far below a segment write.
+fn bench_write_tail_latency() -> BenchmarkResult {
+    let dir = bench_dir("write_latency");
+    let store = Store::open(std::path::Path::new(&dir)).unwrap();
+    
+    let operations = 50000;
+    let value = "v".repeat(100);
+    let mut latencies = Vec::with_capacity(operations);
+    let start = Instant::now();
+    
+    for i in 0..operations {
+        let op_start = Instant::now();
+        store.set(&format!("key{:08}", i), &value, false).unwrap();
+        latencies.push(op_start.elapsed());
+    }
+    store.flush().unwrap();
+    
+    let duration = start.elapsed();
+    cleanup(&dir);
+    
+    latencies.sort();
+    let p99 = latencies[operations * 99 / 100];
+    let max = latencies[operations - 1];
+    
+    BenchmarkResult::new("Write Tail Latency", operations, duration)
+        .with_note(&format!("p99 {}us, max {}us across ~25 flushes", p99.as_micros(), max.as_micros()))
+}
+
 fn bench_random_writes() -> BenchmarkResult {
     let dir = bench_dir("rand_writes");
     let store = Store::open(std::path::Path::new(&dir)).unwrap();
@@ -113,6 +142,28 @@ fn bench_batch_writes() -> BenchmarkResult {
         .with_note("100 batches of 100 keys")
 }
 
+// Seeding a fresh store: sorted rows written straight into segments, no
+// WAL or memtable. Compare with Sequential Writes per key.
+fn bench_bulk_ingest() -> BenchmarkResult {
+    let dir = bench_dir("bulk_ingest");
+    let store = Store::open(std::path::Path::new(&dir)).unwrap();
+    
+    let operations = 1_000_000;
+    let value = "v".repeat(100);
+    let start = Instant::now();
+    
+    let rows = (0..operations).map(|i| (format!("users/{:08}/name", i), &value));
+    store.ingest_sorted(rows).unwrap();
+    
+    let duration = start.elapsed();
+    let segments = store.segment_counts();
+    assert_eq!(store.get("users/00123456/name").unwrap().as_ref(), Some(&value));
+    cleanup(&dir);
+    
+    BenchmarkResult::new("Bulk Ingest", operations, duration)
+        .with_note(&format!("{} segments, all in L2", segments.2))
+}
+
 fn bench_large_values() -> BenchmarkResult {
     let dir = bench_dir("large_values");
     let store = Store::open(std::path::Path::new(&dir)).unwrap();
@@ -182,6 +233,91 @@ fn bench_random_reads() -> BenchmarkResult {
         .with_note("Randomized access pattern")
 }
 
+fn bench_cold_reads_mmap() -> BenchmarkResult {
+    cold_reads("Cold Reads (mmap)", true)
+}
+
+fn bench_cold_reads_cached() -> BenchmarkResult {
+    cold_reads("Cold Reads (block cache)", false)
+}
+
+// Random reads right after reopening, so every block is touched for the first
+// time: slices of the mapped file vs cache misses that open, seek and copy
+fn cold_reads(name: &str, use_mmap: bool) -> BenchmarkResult {
+    let dir = bench_dir(&format!("cold_reads_{}", use_mmap));
+    let operations = 20000;
+    
+    {
+        let store = Store::open(std::path::Path::new(&dir)).unwrap();
+        for i in 0..operations {
+            store.set(&format!("key{:08}", i), &format!("value{}", i), false).unwrap();
+        }
+        store.flush().unwrap();
+    }
+    
+    let options = Options { use_mmap, ..Options::default() };
+    let store = Store::open_with_options(std::path::Path::new(&dir), options).unwrap();
+    
+    let start = Instant::now();
+    for i in 0..operations {
+        let key = format!("key{:08}", (i * 7919) % operations);
+        store.get(&key).unwrap();
+    }
+    let duration = start.elapsed();
+    
+    cleanup(&dir);
+    
+    BenchmarkResult::new(name, operations, duration)
+        .with_note("First read of every block after reopen")
+}
+
+fn bench_cold_reads_uncompressed() -> BenchmarkResult {
+    codec_cold_reads("Cold Reads (no codec)", Compression::None)
+}
+
+fn bench_cold_reads_lz4() -> BenchmarkResult {
+    codec_cold_reads("Cold Reads (LZ4)", Compression::Lz4)
+}
+
+// JSON-ish values compacted into L1 with the given codec, then read in random
+// order after reopening through the block cache, so each block is decoded once
+fn codec_cold_reads(name: &str, codec: Compression) -> BenchmarkResult {
+    let dir = bench_dir(&format!("codec_{:?}", codec));
+    let operations = 20000;
+    let options = || Options {
+        use_mmap: false,
+        compression: [codec; 3],
+        ..Options::default()
+    };
+    
+    {
+        let store = Store::open_with_options(std::path::Path::new(&dir), options()).unwrap();
+        for i in 0..operations {
+            let value = format!("{{\"id\":{},\"name\":\"user {}\",\"role\":\"member\",\"active\":true}}", i, i);
+            store.set(&format!("docs/{:08}", i), &value, false).unwrap();
+        }
+        store.flush().unwrap();
+        store.compact().unwrap();
+    }
+    let disk: u64 = std::fs::read_dir(&dir).unwrap()
+        .filter_map(|e| e.ok())
+        .filter(|e| e.path().extension().map_or(false, |ext| ext == "seg"))
+        .map(|e| e.metadata().unwrap().len())
+        .sum();
+    
+    let store = Store::open_with_options(std::path::Path::new(&dir), options()).unwrap();
+    let start = Instant::now();
+    for i in 0..operations {
+        store.get(&format!("docs/{:08}", (i * 7919) % operations)).unwrap();
+    }
+    let duration = start.elapsed();
+    
+    cleanup(&dir);
+    
+    BenchmarkResult::new(name, operations, duration)
+        .with_note(&format!("{} KB of segments", disk / 1024))
+}
+
 fn bench_cache_hit_rate() -> BenchmarkResult {
     let dir = bench_dir("cache_hits");
     let store = Store::open(std::path::Path::new(&dir)).unwrap();
@@ -236,6 +372,51 @@ fn bench_miss_reads() -> BenchmarkResult {
         .with_note("90% missing keys (bloom filter test)")
 }
 
+fn bench_multi_get() -> BenchmarkResult {
+    batch_reads("Multi Get (256 keys)", true)
+}
+
+fn bench_looped_gets() -> BenchmarkResult {
+    batch_reads("Looped Gets (256 keys)", false)
+}
+
+// Batches of 256 neighbouring keys read through the block cache after a
+// reopen: one multi_get per batch, or one get per key
+fn batch_reads(name: &str, multi: bool) -> BenchmarkResult {
+    let dir = bench_dir(&format!("batch_reads_{}", multi));
+    let options = || Options { use_mmap: false, ..Options::default() };
+    let keys = 200_000u64;
+    
+    {
+        let store = Store::open_with_options(std::path::Path::new(&dir), options()).unwrap();
+        store.ingest_sorted((0..keys).map(|i| (format!("items/{:08}", i), format!("{:x}", i.wrapping_mul(0x9E3779B97F4A7C15))))).unwrap();
+    }
+    
+    let store = Store::open_with_options(std::path::Path::new(&dir), options()).unwrap();
+    let batches: Vec<Vec<String>> = (0..200u64)
+        .map(|b| {
+            let first = (b * 7919 * 256) % (keys - 256);
+            (first..first + 256).map(|i| format!("items/{:08}", i)).collect()
+        })
+        .collect();
+    
+    let start = Instant::now();
+    for batch in &batches {
+        let paths: Vec<&str> = batch.iter().map(|p| p.as_str()).collect();
+        if multi {
+            assert!(store.multi_get(&paths).unwrap().iter().all(|v| v.is_some()));
+        } else {
+            assert!(paths.iter().all(|p| store.get(p).unwrap().is_some()));
+        }
+    }
+    let duration = start.elapsed();
+    
+    cleanup(&dir);
+    
+    BenchmarkResult::new(name, batches.len() * 256, duration)
+        .with_note("200 batches of adjacent keys, first touch after reopen")
+}
+
 // ==================== SUBTREE BENCHMARKS ====================
 
 fn bench_subtree_operations() -> BenchmarkResult {
@@ -265,6 +446,33 @@ fn bench_subtree_operations() -> BenchmarkResult {
         .with_note("100 subtrees with 10 keys each")
 }
 
+fn bench_subtree_streaming() -> BenchmarkResult {
+    let dir = bench_dir("subtree_stream");
+    let store = Store::open(std::path::Path::new(&dir)).unwrap();
+    
+    for user in 0..5000 {
+        for field in 0..4 {
+            store.set(&format!("users/{}/field{}", user, field), "data", false).unwrap();
+        }
+    }
+    store.flush().unwrap();
+    
+    // Whole-tree reads straight into a sink, then shallow ones
+    let operations = 20;
+    let start = Instant::now();
+    for op in 0..operations {
+        let depth = if op % 2 == 0 { usize::MAX } else { 1 };
+        let mut out = std::io::BufWriter::new(std::io::sink());
+        assert!(store.get_subtree_to_depth("users/", depth, &mut out).unwrap());
+    }
+    let duration = start.elapsed();
+    
+    cleanup(&dir);
+    
+    BenchmarkResult::new("Subtree Streaming", operations, duration)
+        .with_note("users/ with 20000 keys to a sink, full and depth 1 alternating")
+}
+
 fn bench_subtree_deletes() -> BenchmarkResult {
     let dir = bench_dir("subtree_del");
     let store = Store::open(std::path::Path::new(&dir)).unwrap();
@@ -296,11 +504,19 @@ fn bench_subtree_deletes() -> BenchmarkResult {
 // ==================== CONCURRENT BENCHMARKS ====================
 
 fn bench_concurrent_writes() -> BenchmarkResult {
-    let dir = bench_dir("concurrent_writes");
+    concurrent_writes("Concurrent Writes", 8, 1000)
+}
+
+fn bench_concurrent_writes_32() -> BenchmarkResult {
+    concurrent_writes("Concurrent Writes (32 threads)", 32, 1000)
+}
+
+// Every thread writes its own keys, so throughput should grow with the thread
+// count until the cores (or the group commit) run out
+fn concurrent_writes(name: &str, threads: usize, ops_per_thread: usize) -> BenchmarkResult {
+    let dir = bench_dir(&format!("concurrent_writes_{}", threads));
     let store = Arc::new(Store::open(std::path::Path::new(&dir)).unwrap());
     
-    let threads = 8;
-    let ops_per_thread = 1000;
     let total_ops = threads * ops_per_thread;
     
     let start = Instant::now();
@@ -325,14 +541,117 @@ fn bench_concurrent_writes() -> BenchmarkResult {
     let duration = start.elapsed();
     cleanup(&dir);
     
-    BenchmarkResult::new("Concurrent Writes", total_ops, duration)
-        .with_note("8 threads writing 1000 keys each")
+    BenchmarkResult::new(name, total_ops, duration)
+        .with_note(&format!("{} threads writing {} keys each", threads, ops_per_thread))
 }
 
-fn bench_concurrent_reads() -> BenchmarkResult {
-    let dir = bench_dir("concurrent_reads");
+fn bench_subscribed_writes() -> BenchmarkResult {
+    let dir = bench_dir("subscribed_writes");
+    let options = Options { subscriber_queue: 1 << 16, ..Options::default() };
+    let store = Store::open_with_options(std::path::Path::new(&dir), options).unwrap();
+    
+    // Idle subscribers elsewhere in the tree cost nothing per write
+    let _idle: Vec<_> = (1..1000).map(|room| store.subscribe(&format!("rooms/{}", room))).collect();
+    let listener = store.subscribe("rooms/0");
+    let operations = 20000;
+    let reader = thread::spawn(move || listener.take(operations).count());
+    
+    let start = Instant::now();
+    for i in 0..operations {
+        store.set(&format!("rooms/0/msgs/{}", i), "hello", false).unwrap();
+    }
+    let received = reader.join().unwrap();
+    let duration = start.elapsed();
+    assert_eq!(received, operations);
+    
+    cleanup(&dir);
+    
+    BenchmarkResult::new("Subscribed Writes", operations, duration)
+        .with_note("1 live listener + 999 idle subscribers on other rooms")
+}
+
+fn bench_server_pipelined() -> BenchmarkResult {
+    let dir = bench_dir("server");
+    let store = Store::open(std::path::Path::new(&dir)).unwrap();
+    let listener = std::net::TcpListener::bind("127.0.0.1:0").unwrap();
+    let addr = listener.local_addr().unwrap().to_string();
+    let server = store.clone();
+    thread::spawn(move || server.serve_tcp(listener));
+    let mut client = Client::connect(&addr).unwrap();
+    
+    // Round trips one at a time, for comparison
+    let single = 2000;
+    let start = Instant::now();
+    for i in 0..single {
+        client.set(&format!("single/{:06}", i), "value", false).unwrap();
+    }
+    let single_rate = single as f64 / start.elapsed().as_secs_f64();
+    
+    let operations = 100_000;
+    let depth = 100;
+    let start = Instant::now();
+    for chunk in 0..operations / depth {
+        let requests: Vec<Request> = (0..depth)
+            .map(|i| Request::Set(format!("piped/{:06}", chunk * depth + i), "value".to_string(), false))
+            .collect();
+        client.pipeline(&requests).unwrap();
+    }
+    let duration = start.elapsed();
+    assert_eq!(store.get("piped/099999").unwrap(), Some("value".to_string()));
+    
+    cleanup(&dir);
+    
+    BenchmarkResult::new("Server Pipelined Writes", operations, duration)
+        .with_note(&format!("TCP, {} per pipeline; {:.0} ops/sec one at a time", depth, single_rate))
+}
+
+fn bench_sync_writes() -> BenchmarkResult {
+    let dir = bench_dir("sync_writes");
     let store = Arc::new(Store::open(std::path::Path::new(&dir)).unwrap());
     
+    let threads = 8;
+    let ops_per_thread = 500;
+    let total_ops = threads * ops_per_thread;
+    
+    let start = Instant::now();
+    let mut handles = vec![];
+    
+    for thread_id in 0..threads {
+        let store_clone = store.clone();
+        let handle = thread::spawn(move || {
+            for i in 0..ops_per_thread {
+                let key = format!("thread{}/key{}", thread_id, i);
+                store_clone.set_with(&key, "value", false, Durability::Sync).unwrap();
+            }
+        });
+        handles.push(handle);
+    }
+    
+    for handle in handles {
+        handle.join().unwrap();
+    }
+    
+    let duration = start.elapsed();
+    cleanup(&dir);
+    
+    BenchmarkResult::new("Concurrent Sync Writes", total_ops, duration)
+        .with_note("8 threads, fdatasync per ack (group commit)")
+}
+
+fn bench_concurrent_reads() -> BenchmarkResult {
+    concurrent_reads("Concurrent Reads", true)
+}
+
+// Same workload served from the sharded block cache instead of the mapping
+fn bench_concurrent_cached_reads() -> BenchmarkResult {
+    concurrent_reads("Concurrent Reads (block cache)", false)
+}
+
+fn concurrent_reads(name: &str, use_mmap: bool) -> BenchmarkResult {
+    let dir = bench_dir(&format!("concurrent_reads_{}", use_mmap));
+    let options = Options { use_mmap, ..Options::default() };
+    let store = Arc::new(Store::open_with_options(std::path::Path::new(&dir), options).unwrap());
+    
     // Prepare data
     for i in 0..1000 {
         store.set(&format!("key{}", i), "value", false).unwrap();
@@ -363,22 +682,28 @@ fn bench_concurrent_reads() -> BenchmarkResult {
     let duration = start.elapsed();
     cleanup(&dir);
     
-    BenchmarkResult::new("Concurrent Reads", total_ops, duration)
+    BenchmarkResult::new(name, total_ops, duration)
         .with_note("8 threads reading from 1000 keys")
 }
 
 // ==================== RECOVERY BENCHMARKS ====================
 
-fn bench_wal_replay() -> BenchmarkResult {
-    let dir = bench_dir("wal_replay");
+// Reopen after `history` flushed writes plus 1000 unflushed ones. With WAL
+// checkpoints the startup cost should not depend on the history length.
+fn wal_replay_after(name: &str, history: usize) -> Duration {
+    let dir = bench_dir(name);
     
-    // Write data without flushing
     {
         let store = Store::open(std::path::Path::new(&dir)).unwrap();
+        for i in 0..history {
+            store.set(&format!("history{}", i), "value", false).unwrap();
+        }
+        store.flush().unwrap();
+        
+        // No flush - simulate crash
         for i in 0..1000 {
             store.set(&format!("wal{}", i), "value", false).unwrap();
         }
-        // No flush - simulate crash
     }
     
     // Measure recovery time
@@ -391,12 +716,25 @@ fn bench_wal_replay() -> BenchmarkResult {
         assert!(store.get(&format!("wal{}", i)).unwrap().is_some());
     }
     
+    drop(store);
     cleanup(&dir);
+    duration
+}
+
+fn bench_wal_replay() -> BenchmarkResult {
+    let duration = wal_replay_after("wal_replay", 0);
     
     BenchmarkResult::new("WAL Replay", 1000, duration)
         .with_note("Recovery of 1000 unflushed operations")
 }
 
+fn bench_wal_replay_long_uptime() -> BenchmarkResult {
+    let duration = wal_replay_after("wal_replay_uptime", 200000);
+    
+    BenchmarkResult::new("WAL Replay (Long Uptime)", 1000, duration)
+        .with_note("Same, after 200k flushed writes")
+}
+
 fn bench_segment_loading() -> BenchmarkResult {
     let dir = bench_dir("segment_load");
     
@@ -422,6 +760,30 @@ fn bench_segment_loading() -> BenchmarkResult {
         .with_note("Load 10 segments on startup")
 }
 
+fn bench_segment_loading_many() -> BenchmarkResult {
+    let dir = bench_dir("segment_load_many");
+    let options = || Options { target_segment_size: 256 * 1024, ..Options::default() };
+    
+    let segments = {
+        let store = Store::open_with_options(std::path::Path::new(&dir), options()).unwrap();
+        let rows = (0..2_000_000u64).map(|i| (format!("users/{:08}/name", i), format!("{:x}", i.wrapping_mul(0x9E3779B97F4A7C15))));
+        store.ingest_sorted(rows).unwrap();
+        let (l0, l1, l2) = store.segment_counts();
+        l0 + l1 + l2
+    };
+    
+    let start = Instant::now();
+    let store = Store::open_with_options(std::path::Path::new(&dir), options()).unwrap();
+    let duration = start.elapsed();
+    assert!(store.get("users/01234567/name").unwrap().is_some());
+    drop(store);
+    
+    cleanup(&dir);
+    
+    BenchmarkResult::new("Segment Loading (many)", segments, duration)
+        .with_note(&format!("Open {} segments holding 2M keys", segments))
+}
+
 // ==================== STRESS TESTS ====================
 
 fn bench_stress_test() -> BenchmarkResult {
@@ -518,8 +880,10 @@ fn main() {
     print_section("WRITE PERFORMANCE");
     let benchmarks = vec![
         bench_sequential_writes,
+        bench_write_tail_latency,
         bench_random_writes,
         bench_batch_writes,
+        bench_bulk_ingest,
         bench_large_values,
     ];
     
@@ -534,8 +898,14 @@ fn main() {
     let benchmarks = vec![
         bench_sequential_reads,
         bench_random_reads,
+        bench_cold_reads_mmap,
+        bench_cold_reads_cached,
+        bench_cold_reads_uncompressed,
+        bench_cold_reads_lz4,
         bench_cache_hit_rate,
         bench_miss_reads,
+        bench_multi_get,
+        bench_looped_gets,
     ];
     
     for bench in benchmarks {
@@ -548,6 +918,7 @@ fn main() {
     print_section("SUBTREE OPERATIONS");
     let benchmarks = vec![
         bench_subtree_operations,
+        bench_subtree_streaming,
         bench_subtree_deletes,
     ];
     
@@ -561,7 +932,12 @@ fn main() {
     print_section("CONCURRENT PERFORMANCE");
     let benchmarks = vec![
         bench_concurrent_writes,
+        bench_concurrent_writes_32,
+        bench_sync_writes,
+        bench_subscribed_writes,
+        bench_server_pipelined,
         bench_concurrent_reads,
+        bench_concurrent_cached_reads,
     ];
     
     for bench in benchmarks {
@@ -574,7 +950,9 @@ fn main() {
     print_section("RECOVERY & STARTUP");
     let benchmarks = vec![
         bench_wal_replay,
+        bench_wal_replay_long_uptime,
         bench_segment_loading,
+        bench_segment_loading_many,
     ];
     
     for bench in benchmarks {
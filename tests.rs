@@ -22,6 +22,17 @@ fn cleanup(dir: &str) {
     let _ = std::fs::remove_dir_all(dir);
 }
 
+// WAL segment files currently in a store directory
+fn wal_files(dir: &str) -> Vec<std::path::PathBuf> {
+    std::fs::read_dir(dir).unwrap()
+        .map(|e| e.unwrap().path())
+        .filter(|p| {
+            let name = p.file_name().unwrap().to_string_lossy().to_string();
+            name.starts_with("wal") && name.ends_with(".log")
+        })
+        .collect()
+}
+
 // ==================== BASIC OPERATIONS ====================
 
 fn test_simple_set_and_get() {
@@ -133,6 +144,48 @@ fn test_scalar_to_tree_conversion() {
     cleanup(&dir);
 }
 
+fn test_scalar_ancestor_check() {
+    let dir = test_dir("scalar_ancestor");
+    let options = Options { use_mmap: false, ..Options::default() };
+    let store = Store::open_with_options(std::path::Path::new(&dir), options).unwrap();
+    
+    // Every ancestor counts, not just the parent, wherever the scalar lives
+    store.set("rooms/x", "scalar", false).unwrap();
+    assert!(store.set("rooms/x/msgs/y/text", "hi", false).is_err());
+    store.flush().unwrap();
+    assert!(store.set("rooms/x/msgs/y/text", "hi", false).is_err());
+    let mut batch = WriteBatch::new();
+    batch.set("rooms/z/a", "1", false).set("rooms/x/msgs/y/text", "hi", false);
+    assert!(store.write(&batch).is_err());
+    
+    // A deleted or subtree-deleted ancestor no longer blocks
+    store.delete("rooms/x").unwrap();
+    store.set("rooms/x/msgs/y/text", "hi", false).unwrap();
+    store.set("lobby", "scalar", false).unwrap();
+    store.flush().unwrap();
+    store.set("top", "v", false).unwrap();
+    store.delete_subtree("top").unwrap();
+    store.set("lobby/a/b", "v", true).unwrap_err();
+    store.set("top/a/b", "v", false).unwrap_err();
+    store.delete("top").unwrap();
+    store.set("top/a/b", "v", false).unwrap();
+    
+    // Parents that hold nothing are settled without reading blocks
+    for i in 0..500 {
+        store.set(&format!("rooms/{}/msgs/{}/text", i % 20, i), "v", false).unwrap();
+    }
+    store.flush().unwrap();
+    let before = store.cache_stats();
+    for i in 500..1500 {
+        store.set(&format!("rooms/{}/msgs/{}/text", i % 20, i), "v", false).unwrap();
+    }
+    let after = store.cache_stats();
+    let reads = (after.hits + after.misses) - (before.hits + before.misses);
+    assert!(reads < 100, "Ancestor checks read {} blocks for 1000 writes", reads);
+    
+    cleanup(&dir);
+}
+
 // ==================== SUBTREE OPERATIONS ====================
 
 fn test_get_subtree_as_json() {
@@ -153,6 +206,48 @@ fn test_get_subtree_as_json() {
     cleanup(&dir);
 }
 
+fn test_subtree_streaming() {
+    let dir = test_dir("subtree_streaming");
+    let store = Store::open(std::path::Path::new(&dir)).unwrap();
+    
+    store.set("app/users/1/name", "Alice", false).unwrap();
+    store.set("app/users/1/address/city", "Oslo", false).unwrap();
+    store.set("app/users/2/name", "Bob \"the\" builder\n", false).unwrap();
+    store.flush().unwrap();
+    store.set("app/users/1/email", "alice@example.com", false).unwrap();
+    store.set("app/users/count", "2", false).unwrap();
+    store.set("app/users2/x", "other subtree", false).unwrap();
+    
+    let stream = |prefix: &str, depth: usize| {
+        let mut out = Vec::new();
+        let found = store.get_subtree_to_depth(prefix, depth, &mut out).unwrap();
+        (found, String::from_utf8(out).unwrap())
+    };
+    
+    let full = concat!(
+        r#"{"1":{"address":{"city":"Oslo"},"email":"alice@example.com","name":"Alice"},"#,
+        r#""2":{"name":"Bob \"the\" builder\n"},"count":"2"}"#);
+    let mut out = Vec::new();
+    assert!(store.get_subtree_to("app/users/", &mut out).unwrap());
+    assert_eq!(String::from_utf8(out).unwrap(), full);
+    assert_eq!(store.get("app/users/").unwrap().unwrap(), full);
+    assert_eq!(stream("app/users", usize::MAX), (true, full.to_string()));
+    
+    // Objects past the depth limit collapse to true
+    assert_eq!(stream("app/users/", 1), (true, r#"{"1":true,"2":true,"count":"2"}"#.to_string()));
+    assert_eq!(stream("app/users/", 2).1,
+               r#"{"1":{"address":true,"email":"alice@example.com","name":"Alice"},"2":{"name":"Bob \"the\" builder\n"},"count":"2"}"#);
+    assert_eq!(stream("app/", 1), (true, r#"{"users":true,"users2":true}"#.to_string()));
+    
+    // Deletes are honoured and an empty subtree writes nothing
+    store.delete_subtree("app/users/1").unwrap();
+    assert_eq!(stream("app/users/", 1).1, r#"{"2":true,"count":"2"}"#);
+    assert_eq!(stream("app/none/", usize::MAX), (false, String::new()));
+    assert_eq!(store.get("app/none/").unwrap(), None);
+    
+    cleanup(&dir);
+}
+
 fn test_delete_subtree() {
     let dir = test_dir("delete_subtree");
     let store = Store::open(std::path::Path::new(&dir)).unwrap();
@@ -258,6 +353,50 @@ fn test_wildcard_delete() {
     cleanup(&dir);
 }
 
+fn test_wildcard_planner() {
+    let dir = test_dir("wildcard_planner");
+    let store = Store::open(std::path::Path::new(&dir)).unwrap();
+    
+    // Matches come from segments and the memtable alike, newest version wins
+    for i in 0..200 {
+        store.set(&format!("users/{:03}/role", i), if i % 10 == 0 { "admin" } else { "user" }, false).unwrap();
+        store.set(&format!("users/{:03}/name", i), "n", false).unwrap();
+        store.set(&format!("groups/{:03}/role", i), "admin", false).unwrap();
+    }
+    store.flush().unwrap();
+    store.set("users/005/role", "admin", false).unwrap();
+    store.delete("users/010/role").unwrap();
+    
+    let admins: Vec<String> = store.get_pattern("users/*/role").unwrap().into_iter()
+        .filter(|(_, v)| v == "admin")
+        .map(|(k, _)| k)
+        .collect();
+    assert_eq!(admins.len(), 20);
+    assert!(admins.contains(&"users/005/role".to_string()));
+    assert!(!admins.contains(&"users/010/role".to_string()));
+    assert_eq!(store.get_pattern("users/*").unwrap().len(), 399);
+    assert_eq!(store.get_pattern("*/199/*").unwrap().len(), 3);
+    assert_eq!(store.get_pattern("users/1?9/name").unwrap().len(), 10);
+    assert_eq!(store.get_pattern("users/00").unwrap().len(), 0);
+    
+    // ? takes a whole character, * backtracks past partial matches
+    store.set("uni/日本/x", "1", false).unwrap();
+    store.set("uni/aab", "2", false).unwrap();
+    assert_eq!(store.get_pattern("uni/??/x").unwrap().len(), 1);
+    assert_eq!(store.get_pattern("uni/*ab").unwrap().len(), 1);
+    assert_eq!(store.get_pattern("uni/*a*b*").unwrap().len(), 1);
+    
+    // One batched delete, visible immediately and after reopen
+    assert_eq!(store.delete_pattern("groups/*/role").unwrap(), 200);
+    assert_eq!(store.get_pattern("groups/*").unwrap().len(), 0);
+    drop(store);
+    let store = Store::open(std::path::Path::new(&dir)).unwrap();
+    assert_eq!(store.get_pattern("groups/*").unwrap().len(), 0);
+    assert_eq!(store.get_pattern("users/*/role").unwrap().len(), 199);
+    
+    cleanup(&dir);
+}
+
 // ==================== PERSISTENCE & RECOVERY ====================
 
 fn test_persistence_across_restarts() {
@@ -317,6 +456,1142 @@ fn test_flush_to_disk() {
     cleanup(&dir);
 }
 
+fn test_background_flush() {
+    let dir = test_dir("background_flush");
+    let options = Options {
+        memtable_size: 8 * 1024,
+        max_immutable_memtables: 1,
+        ..Options::default()
+    };
+    let store = Store::open_with_options(std::path::Path::new(&dir), options).unwrap();
+    
+    // Many small memtables: writers seal them, the flush thread writes them out,
+    // and the stall limits throttle the writer when it gets ahead
+    for i in 0..4000 {
+        store.set(&format!("bg/{:04}", i), "some value", false).unwrap();
+    }
+    
+    // Every write stays readable whether it is in a memtable or a segment
+    for i in (0..4000).step_by(97) {
+        assert_eq!(store.get(&format!("bg/{:04}", i)).unwrap(), Some("some value".to_string()));
+    }
+    assert_eq!(store.scan_prefix("bg/", usize::MAX).unwrap().len(), 4000);
+    
+    let (l0, l1, l2) = store.segment_counts();
+    assert!(l0 + l1 + l2 > 0, "Flush thread should have written segments");
+    assert!(l0 <= 13, "L0 should stay within the stall limit plus one in-flight flush");
+    
+    // Sealed memtables that were still queued are recovered from the WAL
+    drop(store);
+    let store = Store::open(std::path::Path::new(&dir)).unwrap();
+    assert_eq!(store.scan_prefix("bg/", usize::MAX).unwrap().len(), 4000);
+    
+    cleanup(&dir);
+}
+
+fn test_segment_read_modes() {
+    let dir = test_dir("read_modes");
+    
+    {
+        let store = Store::open(std::path::Path::new(&dir)).unwrap();
+        for i in 0..2000 {
+            store.set(&format!("items/{:04}", i), &format!("value{}", i), false).unwrap();
+        }
+        store.delete("items/0100").unwrap();
+        store.flush().unwrap();
+    }
+    
+    // Mapped segments and block-cache reads must see exactly the same data
+    for use_mmap in [true, false] {
+        let options = Options { use_mmap, ..Options::default() };
+        let store = Store::open_with_options(std::path::Path::new(&dir), options).unwrap();
+        
+        assert_eq!(store.get("items/1999").unwrap(), Some("value1999".to_string()));
+        assert_eq!(store.get("items/0100").unwrap(), None);
+        assert_eq!(store.get("items/5000").unwrap(), None);
+        assert_eq!(store.get_range("items/0500", "items/0600").unwrap().len(), 100);
+        assert_eq!(store.get_pattern("items/00?5").unwrap().len(), 10);
+        assert_eq!(store.scan_prefix("items/", usize::MAX).unwrap().len(), 1999);
+    }
+    
+    cleanup(&dir);
+}
+
+fn test_segment_open() {
+    let dir = test_dir("segment_open");
+    let options = |use_mmap| Options {
+        target_segment_size: 16 * 1024,
+        compression: [Compression::None; 3],
+        use_mmap,
+        ..Options::default()
+    };
+    {
+        let store = Store::open_with_options(std::path::Path::new(&dir), options(false)).unwrap();
+        store.ingest_sorted((0..40000).map(|i| (format!("users/{:05}", i * 2), format!("v{}", i)))).unwrap();
+        let (_, _, l2) = store.segment_counts();
+        assert!(l2 > 16, "{}", l2);
+    }
+    
+    // Segments opened together, with the index in the mapping or copied
+    // out, find every block
+    for &use_mmap in &[true, false] {
+        let store = Store::open_with_options(std::path::Path::new(&dir), options(use_mmap)).unwrap();
+        for i in (0..40000).step_by(97) {
+            assert_eq!(store.get(&format!("users/{:05}", i * 2)).unwrap(), Some(format!("v{}", i)));
+            assert_eq!(store.get(&format!("users/{:05}", i * 2 + 1)).unwrap(), None);
+        }
+        assert!(store.get("users/").unwrap().is_some());
+        assert_eq!(store.get("a").unwrap(), None);
+        assert_eq!(store.get("users/99999").unwrap(), None);
+        assert_eq!(store.get_range("users/01001", "users/03001").unwrap().len(), 1000);
+        assert_eq!(store.scan_prefix("users/", usize::MAX).unwrap().len(), 40000);
+    }
+    
+    cleanup(&dir);
+}
+
+fn test_multi_get() {
+    let dir = test_dir("multi_get");
+    let store = Store::open_with_options(std::path::Path::new(&dir), Options {
+        target_segment_size: 16 * 1024,
+        ..Options::default()
+    }).unwrap();
+    
+    // Old data in the deep levels, newer versions in L0 and the memtable,
+    // with point and subtree deletes over both
+    store.ingest_sorted((0..5000).map(|i| (format!("users/{:04}/name", i * 2), format!("v{}", i)))).unwrap();
+    for i in (0..5000).step_by(7) {
+        store.set(&format!("users/{:04}/name", i * 2), &format!("l0-{}", i), false).unwrap();
+    }
+    store.delete("users/0004/name").unwrap();
+    store.flush().unwrap();
+    for i in (0..5000).step_by(11) {
+        store.set(&format!("users/{:04}/name", i * 2), &format!("mem-{}", i), false).unwrap();
+    }
+    store.delete("users/0006/name").unwrap();
+    store.delete_subtree("users/01").unwrap();
+    
+    let mut paths: Vec<String> = (0..10000).rev().step_by(3).map(|i| format!("users/{:04}/name", i)).collect();
+    paths.extend(["users/0022/name", "users/0022/name", "users/0002/", "", "zzz"].iter().map(|p| p.to_string()));
+    let keys: Vec<&str> = paths.iter().map(|p| p.as_str()).collect();
+    let values = store.multi_get(&keys).unwrap();
+    assert_eq!(values.len(), keys.len());
+    for (key, value) in keys.iter().zip(&values) {
+        assert_eq!(value, &store.get(key).unwrap(), "{}", key);
+    }
+    assert_eq!(values[values.len() - 5], Some("mem-11".to_string()));
+    assert_eq!(values[values.len() - 3], Some("{\"name\":\"v1\"}".to_string()));
+    assert!(store.multi_get(&[]).unwrap().is_empty());
+    
+    cleanup(&dir);
+}
+
+fn test_streaming_compaction() {
+    let dir = test_dir("streaming_compaction");
+    // Uncompressed, so output sizes follow the record count
+    let options = || Options {
+        target_segment_size: 8 * 1024,
+        compression: [Compression::None; 3],
+        ..Options::default()
+    };
+    
+    {
+        let store = Store::open_with_options(std::path::Path::new(&dir), options()).unwrap();
+        
+        // Overlapping batches so the merge has to pick the newest version
+        for batch in 0..4 {
+            for i in 0..1000 {
+                store.set(&format!("merge/{:04}", i), &format!("v{}-{}", batch, i), false).unwrap();
+            }
+            if batch == 3 {
+                for i in (0..1000).step_by(10) {
+                    store.delete(&format!("merge/{:04}", i)).unwrap();
+                }
+            }
+            store.flush().unwrap();
+        }
+        
+        store.compact().unwrap();
+        let (l0, l1, _) = store.segment_counts();
+        assert_eq!(l0, 0, "All L0 segments should be compacted");
+        assert!(l1 >= 2, "Output should be split into several segments, got {}", l1);
+    }
+    
+    let store = Store::open_with_options(std::path::Path::new(&dir), options()).unwrap();
+    assert_eq!(store.get("merge/0001").unwrap(), Some("v3-1".to_string()));
+    assert_eq!(store.get("merge/0999").unwrap(), Some("v3-999".to_string()));
+    assert_eq!(store.get("merge/0010").unwrap(), None, "Tombstone should survive compaction");
+    
+    let range = store.get_range("merge/", "merge/~").unwrap();
+    assert_eq!(range.len(), 900);
+    assert!(range.windows(2).all(|w| w[0].0 < w[1].0));
+    assert!(range.iter().all(|(_, v)| v.starts_with("v3-")));
+    
+    cleanup(&dir);
+}
+
+fn test_leveled_compaction() {
+    let dir = test_dir("leveled_compaction");
+    let options = || Options {
+        target_segment_size: 2 * 1024,
+        compression: [Compression::None; 3],
+        ..Options::default()
+    };
+    let mut expected = std::collections::BTreeMap::new();
+    
+    let counts = {
+        let store = Store::open_with_options(std::path::Path::new(&dir), options()).unwrap();
+        for round in 0..12 {
+            for i in 0..800 {
+                let key = format!("level/{:04}", (i * 7 + round * 150) % 2000);
+                let value = format!("r{}", round);
+                store.set(&key, &value, false).unwrap();
+                expected.insert(key, Some(value));
+            }
+            let key = format!("level/{:04}", round * 7);
+            store.delete(&key).unwrap();
+            expected.insert(key, None);
+            store.flush().unwrap();
+            if round % 4 == 3 {
+                store.compact().unwrap();
+            }
+        }
+        store.compact().unwrap();
+        
+        let counts = store.segment_counts();
+        assert!(counts.1 > 0 && counts.2 > 0, "Data should be spread over L1 and L2: {:?}", counts);
+        for (key, value) in &expected {
+            assert_eq!(&store.get(key).unwrap(), value, "{}", key);
+        }
+        counts
+    };
+    
+    // A torn edit at the tail of the manifest is ignored
+    {
+        use std::io::Write;
+        let mut manifest = std::fs::OpenOptions::new()
+            .append(true)
+            .open(format!("{}/manifest.log", dir))
+            .unwrap();
+        manifest.write_all(b"edit|00000000|-l1_0000000001.seg +1:0:l1_99").unwrap();
+    }
+    
+    // Removals are in the manifest, so reopening finds the same levels
+    let store = Store::open_with_options(std::path::Path::new(&dir), options()).unwrap();
+    assert_eq!(store.segment_counts(), counts);
+    for (key, value) in &expected {
+        assert_eq!(&store.get(key).unwrap(), value, "{}", key);
+    }
+    let live = expected.values().filter(|v| v.is_some()).count();
+    assert_eq!(store.get_range("level/", "level/~").unwrap().len(), live);
+    
+    // Edits logged after the torn one still count
+    store.set("level/extra", "x", false).unwrap();
+    store.flush().unwrap();
+    drop(store);
+    let store = Store::open_with_options(std::path::Path::new(&dir), options()).unwrap();
+    assert_eq!(store.segment_counts().0, counts.0 + 1);
+    assert_eq!(store.get("level/extra").unwrap(), Some("x".to_string()));
+    
+    cleanup(&dir);
+}
+
+fn test_subcompactions() {
+    let dir = test_dir("subcompactions");
+    let rate = 1024 * 1024;
+    let options = || Options {
+        target_segment_size: 8 * 1024,
+        compression: [Compression::None; 3],
+        subcompactions: 4,
+        compaction_rate_limit: rate,
+        ..Options::default()
+    };
+    let value = "x".repeat(100);
+    
+    let store = Store::open_with_options(std::path::Path::new(&dir), options()).unwrap();
+    for round in 0..4 {
+        for i in 0..1000 {
+            let n = (i * 7 + round) % 1000;
+            store.set(&format!("sub/{}/{:02}/{}", n / 100, n % 100, round), &value, false).unwrap();
+        }
+        store.flush().unwrap();
+    }
+    // Spans several of the ranges the merge is split into
+    store.delete_subtree("sub/2").unwrap();
+    
+    let started = std::time::Instant::now();
+    store.compact().unwrap();
+    let elapsed = started.elapsed();
+    
+    let l2_bytes: u64 = std::fs::read_dir(&dir).unwrap()
+        .filter_map(|e| e.ok())
+        .filter(|e| e.file_name().to_string_lossy().starts_with("l2_"))
+        .map(|e| e.metadata().unwrap().len())
+        .sum();
+    let (l0, l1, l2) = store.segment_counts();
+    assert_eq!(l0, 0);
+    assert!(l1 + l2 > 20, "Merges should cut many target-sized segments: {:?}", (l0, l1, l2));
+    // L1->L2 writes were throttled; only the bucket's burst goes unpaid
+    let floor = (l2_bytes.saturating_sub(rate / 10)) as f64 / rate as f64;
+    assert!(l2_bytes > 0 && elapsed.as_secs_f64() >= floor * 0.9, "{} bytes in {:?}", l2_bytes, elapsed);
+    
+    let check = |store: &Store| {
+        let live = store.get_range("sub/", "sub0").unwrap();
+        assert_eq!(live.len(), 3600);
+        assert!(live.iter().all(|(key, _)| !key.starts_with("sub/2/")));
+        assert_eq!(store.get("sub/2/23/1").unwrap(), None);
+        assert_eq!(store.get("sub/9/99/3").unwrap(), Some(value.clone()));
+    };
+    check(&store);
+    drop(store);
+    check(&Store::open_with_options(std::path::Path::new(&dir), options()).unwrap());
+    
+    cleanup(&dir);
+}
+
+fn test_subtree_tombstone_compaction() {
+    let dir = test_dir("subtomb_compaction");
+    let check = |store: &Store| {
+        assert_eq!(store.get("users/002/name").unwrap(), None);
+        assert_eq!(store.get("users/001/name").unwrap(), Some("new".to_string()));
+        assert_eq!(store.get("other/key").unwrap(), Some("kept".to_string()));
+        assert_eq!(store.get_range("users/", "users/~").unwrap().len(), 1);
+        assert_eq!(store.get_pattern("users/*").unwrap().len(), 1);
+    };
+    let segment_bytes = || std::fs::read_dir(&dir).unwrap()
+        .filter_map(|e| e.ok())
+        .filter(|e| e.path().extension().map_or(false, |ext| ext == "seg"))
+        .map(|e| e.metadata().unwrap().len())
+        .sum::<u64>();
+    
+    {
+        let store = Store::open(std::path::Path::new(&dir)).unwrap();
+        for i in 0..500 {
+            store.set(&format!("users/{:03}/name", i), "old", false).unwrap();
+        }
+        store.flush().unwrap();
+        
+        store.delete_subtree("users/007").unwrap();
+        store.delete_subtree("users/").unwrap();
+        store.set("users/001/name", "new", false).unwrap();
+        store.set("other/key", "kept", false).unwrap();
+        check(&store);
+        store.flush().unwrap();
+    }
+    
+    {
+        // The subtomb lives in a segment now that its WAL file is gone
+        let store = Store::open(std::path::Path::new(&dir)).unwrap();
+        check(&store);
+        
+        // Compaction drops what the subtomb covers
+        let before = segment_bytes();
+        for i in 0..2 {
+            store.set(&format!("pad/{}", i), "x", false).unwrap();
+            store.flush().unwrap();
+        }
+        store.compact().unwrap();
+        assert!(segment_bytes() < before / 2, "Covered records should be dropped: {} -> {}", before, segment_bytes());
+        check(&store);
+    }
+    
+    let store = Store::open(std::path::Path::new(&dir)).unwrap();
+    check(&store);
+    
+    cleanup(&dir);
+}
+
+fn test_range_iterator() {
+    let dir = test_dir("range_iterator");
+    let store = Store::open(std::path::Path::new(&dir)).unwrap();
+    let mut expected = std::collections::BTreeMap::new();
+    
+    // Versions spread over L1/L2, L0 and the memtable
+    for i in 0..300 {
+        store.set(&format!("page/{:03}", i), "old", false).unwrap();
+        store.set(&format!("page/sub/{:03}", i), "old", false).unwrap();
+    }
+    store.flush().unwrap();
+    store.compact().unwrap();
+    for i in (0..300).step_by(3) {
+        store.set(&format!("page/{:03}", i), "l0", false).unwrap();
+    }
+    store.flush().unwrap();
+    for i in (0..300).step_by(5) {
+        store.delete(&format!("page/{:03}", i)).unwrap();
+    }
+    store.delete_subtree("page/sub").unwrap();
+    store.set("page/250", "mem", false).unwrap();
+    for i in 0..300 {
+        let key = format!("page/{:03}", i);
+        let value = if i == 250 {
+            "mem"
+        } else if i % 5 == 0 {
+            continue;
+        } else if i % 3 == 0 {
+            "l0"
+        } else {
+            "old"
+        };
+        expected.insert(key, value.to_string());
+    }
+    let expected: Vec<(String, String)> = expected.into_iter().collect();
+    
+    // Page through, resuming after the last key each time
+    let mut pages = Vec::new();
+    let mut start = "page/".to_string();
+    loop {
+        let page = store.get_range_limit(&start, "page/~", 25).unwrap();
+        if page.is_empty() {
+            break;
+        }
+        start = format!("{}\0", page.last().unwrap().0);
+        pages.extend(page);
+    }
+    assert_eq!(pages, expected);
+    
+    // One cursor sees the same rows, and a later write does not show up
+    let mut iter = store.iter_range("page/", "page/~").unwrap();
+    let first: Vec<_> = iter.by_ref().take(10).map(|r| r.unwrap()).collect();
+    store.set("page/000", "late", false).unwrap();
+    let rest: Vec<_> = iter.map(|r| r.unwrap()).collect();
+    assert_eq!(first.len() + rest.len(), expected.len());
+    assert_eq!(&first[..], &expected[..10]);
+    assert_eq!(&rest[..], &expected[10..]);
+    
+    assert_eq!(store.scan_prefix("page/", 3).unwrap(), vec![
+        ("page/000".to_string(), "late".to_string()),
+        expected[0].clone(),
+        expected[1].clone(),
+    ]);
+    assert!(store.iter_range("page/9", "page/1").unwrap().next().is_none());
+    
+    cleanup(&dir);
+}
+
+fn test_bulk_ingest() {
+    let dir = test_dir("bulk_ingest");
+    let options = || Options { target_segment_size: 16 * 1024, ..Options::default() };
+    let seg_files = || std::fs::read_dir(&dir).unwrap()
+        .filter_map(|e| e.ok())
+        .filter(|e| e.file_name().to_string_lossy().ends_with(".seg"))
+        .count();
+    let store = Store::open_with_options(std::path::Path::new(&dir), options()).unwrap();
+    
+    // An empty store takes everything at the bottom level
+    let rows = (0..20000).map(|i| (format!("bulk/{:05}/name", i), format!("n{}", i)));
+    assert_eq!(store.ingest_sorted(rows).unwrap(), 20000);
+    let (l0, l1, l2) = store.segment_counts();
+    assert!(l0 == 0 && l1 == 0 && l2 > 1, "{:?}", (l0, l1, l2));
+    assert_eq!(store.get("bulk/01234/name").unwrap(), Some("n1234".to_string()));
+    assert_eq!(store.get_range("bulk/", "bulk0").unwrap().len(), 20000);
+    assert_eq!(store.get("bulk/00007/").unwrap(), Some(r#"{"name":"n7"}"#.to_string()));
+    
+    // Rejected loads leave nothing behind
+    let files = seg_files();
+    let unsorted = vec![("x/2", "a"), ("x/1", "b")];
+    assert_eq!(store.ingest_sorted(unsorted).unwrap_err().kind(), std::io::ErrorKind::InvalidInput);
+    let under_scalar = vec![("x/a", "1"), ("x/a/b", "2")];
+    assert!(store.ingest_sorted(under_scalar).is_err());
+    store.set("cfg", "scalar", false).unwrap();
+    assert!(store.ingest_sorted(vec![("cfg/a", "1")]).is_err());
+    assert_eq!(seg_files(), files);
+    assert_eq!(store.get("x/1").unwrap(), None);
+    // A sibling that only shares a string prefix is fine
+    assert_eq!(store.ingest_sorted(vec![("cfg-a/b", "1")]).unwrap(), 1);
+    
+    // Loads over live data win over older writes and lose to later ones
+    store.set("bulk/00005/name", "in memtable", false).unwrap();
+    store.ingest_sorted(vec![("bulk/00005/name", "ingested"), ("bulk/00006/name", "ingested")]).unwrap();
+    assert_eq!(store.get("bulk/00005/name").unwrap(), Some("ingested".to_string()));
+    store.set("bulk/00006/name", "later", false).unwrap();
+    assert_eq!(store.get("bulk/00006/name").unwrap(), Some("later".to_string()));
+    
+    store.compact().unwrap();
+    drop(store);
+    let store = Store::open_with_options(std::path::Path::new(&dir), options()).unwrap();
+    assert_eq!(store.get("bulk/00005/name").unwrap(), Some("ingested".to_string()));
+    assert_eq!(store.get("bulk/00006/name").unwrap(), Some("later".to_string()));
+    assert_eq!(store.get("cfg-a/b").unwrap(), Some("1".to_string()));
+    store.set("bulk/00005/name", "after reopen", false).unwrap();
+    assert_eq!(store.get("bulk/00005/name").unwrap(), Some("after reopen".to_string()));
+    assert_eq!(store.get_range("bulk/", "bulk0").unwrap().len(), 20000);
+    
+    cleanup(&dir);
+}
+
+fn test_secondary_indexes() {
+    let dir = test_dir("secondary_indexes");
+    let path = std::path::Path::new;
+    let store = Store::open(path(&dir)).unwrap();
+    
+    for (user, role) in [("alice", "admin"), ("bob", "member"), ("carol", "admin"), ("dave", "member")].iter() {
+        store.set(&format!("users/{}/role", user), role, false).unwrap();
+        store.set(&format!("users/{}/email", user), &format!("{}@example.com", user), false).unwrap();
+    }
+    store.set("users/carol/x/role", "admin", false).unwrap();
+    
+    // Existing records are backfilled; '*' covers direct children only
+    assert_eq!(store.create_index("role", "users/*/role").unwrap(), 4);
+    assert_eq!(store.query_index("role", "admin").unwrap(), vec!["users/alice", "users/carol"]);
+    assert_eq!(store.create_index("role", "users/*/role").unwrap_err().kind(), std::io::ErrorKind::AlreadyExists);
+    assert_eq!(store.create_index("any", "users/*").unwrap_err().kind(), std::io::ErrorKind::InvalidInput);
+    assert_eq!(store.query_index("email", "x").unwrap_err().kind(), std::io::ErrorKind::NotFound);
+    
+    // Writes, deletes and batches move entries with the record
+    store.set("users/bob/role", "admin", false).unwrap();
+    store.delete("users/alice/role").unwrap();
+    store.set("users/erin/role", "a/b%c", false).unwrap();
+    let mut batch = WriteBatch::new();
+    batch.set("users/frank/role", "admin", false)
+        .set("users/frank/role", "member", false)
+        .set("users/gina/role", "admin", false)
+        .set("users/hank/team/role", "admin", false);
+    store.write(&batch).unwrap();
+    assert_eq!(store.query_index("role", "admin").unwrap(), vec!["users/bob", "users/carol", "users/gina"]);
+    assert_eq!(store.query_index("role", "member").unwrap(), vec!["users/dave", "users/frank"]);
+    assert_eq!(store.query_index("role", "a/b%c").unwrap(), vec!["users/erin"]);
+    assert_eq!(store.query_index("role", "a").unwrap(), Vec::<String>::new());
+    
+    // Subtree deletes leave entries behind, which queries skip
+    store.delete_subtree("users/carol").unwrap();
+    assert_eq!(store.query_index("role", "admin").unwrap(), vec!["users/bob", "users/gina"]);
+    assert_eq!(store.delete_pattern("users/g*/role").unwrap(), 1);
+    assert_eq!(store.query_index("role", "admin").unwrap(), vec!["users/bob"]);
+    
+    // Entries live outside the user's key space
+    assert_eq!(store.get_pattern("users/*").unwrap().len(), 8);
+    
+    // The definition survives a reopen
+    store.flush().unwrap();
+    drop(store);
+    let store = Store::open(path(&dir)).unwrap();
+    store.set("users/dave/role", "admin", false).unwrap();
+    assert_eq!(store.query_index("role", "admin").unwrap(), vec!["users/bob", "users/dave"]);
+    
+    store.drop_index("role").unwrap();
+    assert!(store.query_index("role", "admin").is_err());
+    assert_eq!(store.scan_prefix("\0idx", usize::MAX).unwrap().len(), 0);
+    drop(store);
+    let store = Store::open(path(&dir)).unwrap();
+    assert!(store.query_index("role", "admin").is_err());
+    assert_eq!(store.create_index("role", "users/*/role").unwrap(), 4);
+    
+    cleanup(&dir);
+}
+
+fn test_checkpoint() {
+    let dir = test_dir("checkpoint");
+    let backup = test_dir("checkpoint_backup");
+    let standby = test_dir("checkpoint_standby");
+    let path = std::path::Path::new;
+    let options = || Options { memtable_size: 256 * 1024, ..Options::default() };
+    let store = Store::open_with_options(path(&dir), options()).unwrap();
+    
+    for i in 0..3000 {
+        store.set(&format!("users/{:04}/name", i), &format!("user {}", i), false).unwrap();
+    }
+    store.flush().unwrap();
+    store.set("users/0001/name", "renamed", false).unwrap();
+    store.delete_subtree("users/0002").unwrap();
+    
+    // Links and the unflushed tail make a store of their own
+    let seq = store.checkpoint(path(&backup)).unwrap();
+    assert!(seq >= 3002, "{}", seq);
+    assert_eq!(store.checkpoint(path(&backup)).unwrap_err().kind(), std::io::ErrorKind::AlreadyExists);
+    store.checkpoint(path(&standby)).unwrap();
+    store.set("users/0003/name", "after checkpoint", false).unwrap();
+    {
+        let copy = Store::open(path(&backup)).unwrap();
+        assert_eq!(copy.get("users/0001/name").unwrap(), Some("renamed".to_string()));
+        assert_eq!(copy.get("users/0002/name").unwrap(), None);
+        assert_eq!(copy.get("users/0003/name").unwrap(), Some("user 3".to_string()));
+        assert_eq!(copy.get_range("users/", "users0").unwrap().len(), 2999);
+    }
+    
+    // Shipping with nothing new copies nothing
+    assert!(store.ship_wal(path(&standby)).unwrap() > 0);
+    assert_eq!(store.ship_wal(path(&standby)).unwrap(), 0);
+    assert!(store.ship_wal(path(&test_dir("checkpoint_missing"))).is_err());
+    
+    // Churn that flushes and compacts away shipped WAL files still arrives
+    for round in 0..3 {
+        for i in 0..3000 {
+            store.set(&format!("users/{:04}/name", i), &format!("round {}", round), false).unwrap();
+        }
+        store.flush().unwrap();
+    }
+    store.compact().unwrap();
+    store.set("users/0004/name", "unflushed", false).unwrap();
+    assert!(store.ship_wal(path(&standby)).unwrap() > 0);
+    drop(store);
+    
+    let copy = Store::open(path(&standby)).unwrap();
+    assert_eq!(copy.get("users/0004/name").unwrap(), Some("unflushed".to_string()));
+    assert_eq!(copy.get("users/0005/name").unwrap(), Some("round 2".to_string()));
+    assert_eq!(copy.get_range("users/", "users0").unwrap().len(), 3000);
+    drop(copy);
+    
+    cleanup(&dir);
+    cleanup(&backup);
+    cleanup(&standby);
+}
+
+fn test_write_batch() {
+    let dir = test_dir("write_batch");
+    
+    {
+        let store = Store::open(std::path::Path::new(&dir)).unwrap();
+        store.set("rooms/a/msg0/text", "stale", false).unwrap();
+        store.set("rooms/a/closed", "yes", false).unwrap();
+        
+        // One message fans out to several keys in a single record
+        let mut batch = WriteBatch::new();
+        batch.set("rooms/a/msg1/text", "Hello!", false)
+            .set("rooms/a/msg1/user", "alice", false)
+            .set("rooms/a/msg1/ts", "1699999999", false)
+            .delete("rooms/a/closed")
+            .delete_subtree("rooms/a/msg0")
+            .set("rooms/a/last", "msg1", true);
+        assert_eq!(batch.len(), 6);
+        store.write_with(&batch, Durability::Sync).unwrap();
+        
+        assert_eq!(store.get("rooms/a/msg1/user").unwrap(), Some("alice".to_string()));
+        assert_eq!(store.get("rooms/a/msg0/text").unwrap(), None);
+        assert_eq!(store.get("rooms/a/closed").unwrap(), None);
+        
+        // Ops see earlier ops of the same batch
+        let mut bad = WriteBatch::new();
+        bad.set("rooms/b/x", "1", false).set("rooms/b/x/y", "2", false);
+        assert!(store.write(&bad).is_err());
+        assert_eq!(store.get("rooms/b/x").unwrap(), None, "A rejected batch writes nothing");
+        let mut ok = WriteBatch::new();
+        ok.delete_subtree("rooms/a/msg1").set("rooms/a/msg1", "flat", false);
+        store.write(&ok).unwrap();
+        assert_eq!(store.get("rooms/a/msg1").unwrap(), Some("flat".to_string()));
+        store.write(&WriteBatch::new()).unwrap();
+    }
+    
+    {
+        let store = Store::open(std::path::Path::new(&dir)).unwrap();
+        assert_eq!(store.get("rooms/a/msg1").unwrap(), Some("flat".to_string()));
+        assert_eq!(store.get("rooms/a/msg1/user").unwrap(), None);
+        assert_eq!(store.get("rooms/a/last").unwrap(), Some("msg1".to_string()));
+        assert_eq!(store.get("rooms/a/closed").unwrap(), None);
+        
+        let mut batch = WriteBatch::new();
+        for i in 0..10 {
+            batch.set(&format!("torn/{}", i), "v", false);
+        }
+        store.write_with(&batch, Durability::Sync).unwrap();
+    }
+    
+    // Cutting into the last record drops the whole batch, not just its tail
+    {
+        use std::io::Write;
+        let wal = wal_files(&dir).into_iter().max().unwrap();
+        let len = std::fs::metadata(&wal).unwrap().len();
+        let file = std::fs::OpenOptions::new().write(true).open(&wal).unwrap();
+        file.set_len(len - 6).unwrap();
+        drop(file);
+        let mut file = std::fs::OpenOptions::new().append(true).open(&wal).unwrap();
+        file.write_all(b"xx").unwrap();
+    }
+    let store = Store::open(std::path::Path::new(&dir)).unwrap();
+    for i in 0..10 {
+        assert_eq!(store.get(&format!("torn/{}", i)).unwrap(), None);
+    }
+    assert_eq!(store.get("rooms/a/last").unwrap(), Some("msg1".to_string()));
+    
+    cleanup(&dir);
+}
+
+fn test_segment_prefix_compression() {
+    let dir = test_dir("prefix_compression");
+    let options = || Options { use_mmap: false, ..Options::default() };
+    let store = Store::open_with_options(std::path::Path::new(&dir), options()).unwrap();
+    let segment_bytes = || std::fs::read_dir(&dir).unwrap()
+        .filter_map(|e| e.ok())
+        .filter(|e| e.path().extension().map_or(false, |ext| ext == "seg"))
+        .map(|e| e.metadata().unwrap().len())
+        .sum::<u64>();
+    
+    // Hierarchical keys share long prefixes; the old layout spent 17 bytes of
+    // header plus the whole key on every record
+    let mut raw = 0;
+    for i in 0..3000 {
+        for field in &["email", "name", "role"] {
+            let key = format!("users/{:06}/profile/{}", i, field);
+            let value = format!("{}", i);
+            raw += 17 + key.len() + value.len();
+            store.set(&key, &value, false).unwrap();
+        }
+    }
+    store.flush().unwrap();
+    assert!(segment_bytes() * 2 < raw as u64, "Segment {} bytes for {} raw", segment_bytes(), raw);
+    
+    // Seeks land on every key, and between keys, in any run of a block
+    for i in (0..3000).step_by(7) {
+        let key = format!("users/{:06}/profile/name", i);
+        assert_eq!(store.get(&key).unwrap(), Some(format!("{}", i)));
+        assert_eq!(store.get(&format!("users/{:06}/profile/nam", i)).unwrap(), None);
+        assert_eq!(store.get(&format!("users/{:06}/profile/zzz", i)).unwrap(), None);
+    }
+    assert_eq!(store.get("users/").unwrap().is_some(), true);
+    assert_eq!(store.scan_prefix("users/001234/", 10).unwrap().len(), 3);
+    assert_eq!(store.get_range("users/000100", "users/000200").unwrap().len(), 300);
+    drop(store);
+    
+    cleanup(&dir);
+    
+    // A store whose segment has the previous layout, whole keys, still reads
+    // it, and compaction rewrites it in the new one
+    std::fs::create_dir_all(&dir).unwrap();
+    {
+        let mut data = b"ELKYN04".to_vec();
+        let mut index = Vec::new();
+        for i in 0..100u64 {
+            let key = format!("old/{:03}", i);
+            let value = format!("v{}", i);
+            if i % 40 == 0 {
+                index.extend_from_slice(&(key.len() as u32).to_le_bytes());
+                index.extend_from_slice(&(data.len() as u64).to_le_bytes());
+                index.extend_from_slice(key.as_bytes());
+            }
+            data.extend_from_slice(&(i + 1).to_le_bytes());
+            data.push(1);  // Set
+            data.extend_from_slice(&(key.len() as u32).to_le_bytes());
+            data.extend_from_slice(&(value.len() as u32).to_le_bytes());
+            data.extend_from_slice(key.as_bytes());
+            data.extend_from_slice(value.as_bytes());
+        }
+        let index_len = index.len() as u32;
+        data.extend_from_slice(&index);
+        data.extend_from_slice(&1u64.to_le_bytes());
+        data.extend_from_slice(&100u64.to_le_bytes());
+        for field in &[100, index_len, 0, 0, 0] {
+            data.extend_from_slice(&field.to_le_bytes());
+        }
+        std::fs::write(format!("{}/l0_0000000001.seg", dir), &data).unwrap();
+        std::fs::write(format!("{}/manifest.log", dir), "100|0|l0_0000000001.seg\n").unwrap();
+    }
+    let store = Store::open_with_options(std::path::Path::new(&dir), options()).unwrap();
+    let check = |store: &Store| {
+        assert_eq!(store.get("old/057").unwrap(), Some("v57".to_string()));
+        assert_eq!(store.get("old/0570").unwrap(), None);
+        let range = store.get_range("old/050", "old/1").unwrap();
+        assert_eq!(range.len(), 50);
+        assert_eq!(range[0], ("old/050".to_string(), "v50".to_string()));
+    };
+    check(&store);
+    for i in 0..3 {
+        store.set(&format!("old/zzz{}", i), "new", false).unwrap();
+        store.flush().unwrap();
+    }
+    store.compact().unwrap();
+    check(&store);
+    assert!(std::fs::read_dir(&dir).unwrap()
+        .filter_map(|e| e.ok())
+        .filter(|e| e.path().extension().map_or(false, |ext| ext == "seg"))
+        .all(|e| std::fs::read(e.path()).unwrap().starts_with(b"ELKYN07")));
+    
+    cleanup(&dir);
+}
+
+fn test_block_compression() {
+    let level_bytes = |dir: &str, prefix: &str| std::fs::read_dir(dir).unwrap()
+        .filter_map(|e| e.ok())
+        .filter(|e| e.file_name().to_string_lossy().starts_with(prefix))
+        .map(|e| e.metadata().unwrap().len())
+        .sum::<u64>();
+    let value = |i: usize| format!("{{\"id\":{},\"name\":\"user {}\",\"role\":\"member\",\"active\":true,\"tags\":[\"a\",\"b\"]}}", i, i);
+    
+    let mut sizes = Vec::new();
+    for &(codec, use_mmap) in &[(Compression::None, true), (Compression::Lz4, true), (Compression::Lz4, false)] {
+        let dir = test_dir(&format!("block_compression_{:?}_{}", codec, use_mmap));
+        let options = || Options {
+            use_mmap,
+            compression: [Compression::None, codec, codec],
+            ..Options::default()
+        };
+        
+        {
+            let store = Store::open_with_options(std::path::Path::new(&dir), options()).unwrap();
+            for round in 0..4 {
+                for i in (round..4000).step_by(4) {
+                    store.set(&format!("docs/{:05}", i), &value(i), false).unwrap();
+                }
+                store.flush().unwrap();
+            }
+            store.compact().unwrap();
+            assert_eq!(store.segment_counts().0, 0);
+            
+            // Hot reads come out of the cache decoded
+            for _ in 0..2 {
+                for i in (0..4000).step_by(13) {
+                    assert_eq!(store.get(&format!("docs/{:05}", i)).unwrap(), Some(value(i)));
+                }
+            }
+        }
+        
+        let store = Store::open_with_options(std::path::Path::new(&dir), options()).unwrap();
+        assert_eq!(store.get("docs/03999").unwrap(), Some(value(3999)));
+        let docs = store.scan_prefix("docs/", usize::MAX).unwrap();
+        assert_eq!(docs.len(), 4000);
+        assert!(docs.iter().enumerate().all(|(i, (_, v))| *v == value(i)));
+        
+        sizes.push(level_bytes(&dir, "l1_"));
+        cleanup(&dir);
+    }
+    
+    assert!(sizes[1] * 2 < sizes[0], "LZ4 should at least halve L1: {:?}", sizes);
+    assert_eq!(sizes[1], sizes[2]);
+}
+
+fn test_bloom_filters() {
+    let dir = test_dir("bloom_filters");
+    let options = || Options { use_mmap: false, ..Options::default() };
+    let reads = |store: &Store, f: &dyn Fn(&Store)| {
+        let before = store.cache_stats();
+        f(store);
+        let after = store.cache_stats();
+        (after.hits + after.misses) - (before.hits + before.misses)
+    };
+    let misses = |store: &Store| {
+        for i in 0..1000 {
+            assert_eq!(store.get(&format!("users/{:05}/phone", i * 4)).unwrap(), None);
+        }
+    };
+    
+    {
+        // Four overlapping L0 segments of 1000 users each
+        let store = Store::open_with_options(std::path::Path::new(&dir), options()).unwrap();
+        for round in 0..4 {
+            for i in (round..4000).step_by(4) {
+                store.set(&format!("users/{:05}/name", i), &format!("user {}", i), false).unwrap();
+                store.set(&format!("users/{:05}/email", i), &format!("u{}@x", i), false).unwrap();
+            }
+            store.flush().unwrap();
+        }
+        assert_eq!(store.segment_counts().0, 4);
+        
+        // Sized to the keys, so misses almost never reach a block
+        let n = reads(&store, &|s| misses(s));
+        assert!(n < 200, "4000 missing-key probes read {} blocks", n);
+    }
+    
+    let store = Store::open_with_options(std::path::Path::new(&dir), options()).unwrap();
+    let n = reads(&store, &|s| misses(s));
+    assert!(n < 200, "Reopened: 4000 missing-key probes read {} blocks", n);
+    
+    // Path prefixes are in the blooms too: a subtree lives in one segment
+    let n = reads(&store, &|s| {
+        let json = s.get("users/00006/").unwrap().unwrap();
+        assert!(json.contains("u6@x") && json.contains("user 6"), "{}", json);
+    });
+    assert!(n <= 2, "Subtree read {} blocks", n);
+    let n = reads(&store, &|s| {
+        assert!(s.scan_prefix("users/00006/missing/", 10).unwrap().is_empty());
+        assert_eq!(s.get("users/00006/missing/").unwrap(), None);
+    });
+    assert!(n <= 2, "Absent prefix read {} blocks", n);
+    
+    // Prefixes that end mid-component fall back to their parent's
+    let partial = store.scan_prefix("users/0001", usize::MAX).unwrap();
+    assert_eq!(partial.len(), 20);
+    assert!(partial.iter().all(|(k, _)| k.starts_with("users/0001")));
+    
+    cleanup(&dir);
+}
+
+fn test_server() {
+    let dir = test_dir("server");
+    let store = Store::open(std::path::Path::new(&dir)).unwrap();
+    let listener = std::net::TcpListener::bind("127.0.0.1:0").unwrap();
+    let addr = listener.local_addr().unwrap().to_string();
+    let server = store.clone();
+    std::thread::spawn(move || server.serve_tcp(listener));
+    
+    let mut client = Client::connect(&addr).unwrap();
+    client.set("users/alice/name", "Alice", false).unwrap();
+    assert_eq!(client.get("users/alice/name").unwrap(), Some("Alice".to_string()));
+    assert_eq!(store.get("users/alice/name").unwrap(), Some("Alice".to_string()));
+    
+    // A pipeline is answered in order; the bad write fails alone
+    let responses = client.pipeline(&[
+        Request::Set("users/bob/name".to_string(), "Bob".to_string(), false),
+        Request::Set("users/alice/name/first".to_string(), "A".to_string(), false),
+        Request::Set("users/carol/name".to_string(), "Carol".to_string(), false),
+        Request::Get("users/bob/name".to_string()),
+        Request::Get("users/dave/name".to_string()),
+        Request::Delete("users/carol/name".to_string()),
+        Request::Scan("users/".to_string(), "users0".to_string(), 10),
+    ]).unwrap();
+    assert_eq!(responses[0], Response::Done);
+    assert!(matches!(responses[1], Response::Error(_)));
+    assert_eq!(responses[2], Response::Done);
+    assert_eq!(responses[3], Response::Value(Some("Bob".to_string())));
+    assert_eq!(responses[4], Response::Value(None));
+    assert_eq!(responses[5], Response::Done);
+    assert_eq!(responses[6], Response::Pairs(vec![
+        ("users/alice/name".to_string(), "Alice".to_string()),
+        ("users/bob/name".to_string(), "Bob".to_string()),
+    ]));
+    assert!(client.set("users/alice/name/first", "A", false).is_err());
+    
+    // Other connections share the same store; subscriptions stream over one
+    #[cfg(unix)]
+    {
+        let socket = format!("{}.sock", dir);
+        let server = store.clone();
+        let path = format!("unix:{}", socket);
+        std::thread::spawn(move || server.serve(&path));
+        let mut other = loop {
+            match Client::connect(&format!("unix:{}", socket)) {
+                Ok(client) => break client,
+                Err(_) => std::thread::sleep(std::time::Duration::from_millis(5)),
+            }
+        };
+        assert_eq!(other.get("users/bob/").unwrap(), Some(r#"{"name":"Bob"}"#.to_string()));
+        
+        let mut events = Client::connect(&addr).unwrap().subscribe("users/bob", None).unwrap();
+        other.set_durability(Durability::Sync);
+        other.set("users/bob/email", "bob@example.com", false).unwrap();
+        other.delete("users/bob/name").unwrap();
+        let event = events.next().unwrap();
+        assert_eq!((event.key.as_str(), event.value.as_deref()), ("users/bob/email", Some("bob@example.com")));
+        let event = events.next().unwrap();
+        assert_eq!((event.key.as_str(), event.value), ("users/bob/name", None));
+        let _ = std::fs::remove_file(&socket);
+    }
+    
+    // Remote subtree deletes reach the WAL with the client's durability
+    client.set("rooms/1/msg", "hi", false).unwrap();
+    client.delete_subtree("rooms/").unwrap();
+    client.set("b", "1", false).unwrap();
+    drop(client);
+    drop(store);
+    let store = Store::open(std::path::Path::new(&dir)).unwrap();
+    assert_eq!(store.get("rooms/1/msg").unwrap(), None);
+    assert_eq!(store.get("b").unwrap(), Some("1".to_string()));
+    
+    cleanup(&dir);
+}
+
+fn test_change_feed() {
+    let dir = test_dir("change_feed");
+    let store = Store::open(std::path::Path::new(&dir)).unwrap();
+    let drain = |sub: &mut Subscription| {
+        let mut events = Vec::new();
+        while let Some(event) = sub.try_next() {
+            events.push((event.key, event.value));
+        }
+        events
+    };
+    let ev = |key: &str, value: Option<&str>| (key.to_string(), value.map(|v| v.to_string()));
+    
+    let mut user = store.subscribe("users/1");
+    let mut all = store.subscribe("");
+    let mut rooms = store.subscribe("rooms/");
+    store.set("users/1/name", "Alice", false).unwrap();
+    store.set("users/10/name", "Not a child of users/1", false).unwrap();
+    store.set("users/1/email", "a@x", false).unwrap();
+    store.delete("users/1/email").unwrap();
+    store.delete_subtree("users/").unwrap();
+    let mut batch = WriteBatch::new();
+    batch.set("rooms/a/topic", "hi", false).set("users/1/name", "Alicia", false);
+    store.write(&batch).unwrap();
+    
+    assert_eq!(drain(&mut user), vec![
+        ev("users/1/name", Some("Alice")),
+        ev("users/1/email", Some("a@x")),
+        ev("users/1/email", None),
+        ev("users/", None),
+        ev("users/1/name", Some("Alicia")),
+    ]);
+    assert_eq!(drain(&mut rooms), vec![ev("rooms/a/topic", Some("hi"))]);
+    let seqs: Vec<u64> = std::iter::from_fn(|| all.try_next()).map(|e| e.seq).collect();
+    assert_eq!(seqs.len(), 7);
+    assert!(seqs.windows(2).all(|w| w[0] < w[1]), "Events out of order: {:?}", seqs);
+    
+    // A subscriber that stops reading is dropped instead of stalling writers
+    let mut slow = store.subscribe("bulk");
+    for i in 0..3000 {
+        store.set(&format!("bulk/{}", i), "v", false).unwrap();
+    }
+    let queued = std::iter::from_fn(|| slow.try_next()).count();
+    assert!(queued > 0 && queued < 3000, "{} events queued", queued);
+    assert_eq!(slow.next(), None);
+    
+    // Resuming replays what was missed from the WAL, then goes live
+    let resume_at = seqs[2];
+    drop(user);
+    store.set("users/1/bio", "missed", false).unwrap();
+    let mut user = store.subscribe_from("users/1", resume_at).unwrap();
+    store.set("users/1/city", "live", false).unwrap();
+    assert_eq!(drain(&mut user), vec![
+        ev("users/1/email", None),
+        ev("users/", None),
+        ev("users/1/name", Some("Alicia")),
+        ev("users/1/bio", Some("missed")),
+        ev("users/1/city", Some("live")),
+    ]);
+    assert_eq!(user.next_timeout(Duration::from_millis(10)), None);
+    
+    // Once a flush retires the WAL the history is gone
+    store.flush().unwrap();
+    let err = store.subscribe_from("users/1", resume_at).err().unwrap();
+    assert_eq!(err.kind(), std::io::ErrorKind::NotFound);
+    
+    cleanup(&dir);
+}
+
+fn test_snapshots() {
+    let dir = test_dir("snapshots");
+    let store = Store::open(std::path::Path::new(&dir)).unwrap();
+    let owned = |pairs: &[(&str, &str)]| -> Vec<(String, String)> {
+        pairs.iter().map(|&(k, v)| (k.to_string(), v.to_string())).collect()
+    };
+    
+    store.set("users/1/name", "Alice", false).unwrap();
+    store.set("users/2/name", "Bob", false).unwrap();
+    store.flush().unwrap();
+    store.set("users/3/name", "Carol", false).unwrap();
+    store.set("rooms/a/topic", "hi", false).unwrap();
+    
+    let snap = store.snapshot();
+    let before = store.get("users/").unwrap();
+    
+    // Overwrites, deletes and subtree deletes after the snapshot, some of
+    // them flushed and compacted while it is held
+    store.set("users/1/name", "Alicia", false).unwrap();
+    store.delete("users/2/name").unwrap();
+    store.set("users/4/name", "Dan", false).unwrap();
+    store.flush().unwrap();
+    store.compact().unwrap();
+    store.delete_subtree("rooms/").unwrap();
+    store.set("rooms/b/topic", "new", false).unwrap();
+    
+    assert_eq!(snap.get("users/1/name").unwrap(), Some("Alice".to_string()));
+    assert_eq!(snap.get("users/2/name").unwrap(), Some("Bob".to_string()));
+    assert_eq!(snap.get("users/4/name").unwrap(), None);
+    assert_eq!(snap.get("rooms/a/topic").unwrap(), Some("hi".to_string()));
+    assert_eq!(snap.get("users/").unwrap(), before);
+    assert_eq!(snap.get_range("rooms/", "rooms0").unwrap(), owned(&[("rooms/a/topic", "hi")]));
+    assert_eq!(snap.get_pattern("users/*/name").unwrap(), owned(&[
+        ("users/1/name", "Alice"), ("users/2/name", "Bob"), ("users/3/name", "Carol"),
+    ]));
+    assert_eq!(snap.scan_prefix("users/", 2).unwrap().len(), 2);
+    let mut json = Vec::new();
+    assert!(snap.get_subtree_to_depth("users", 1, &mut json).unwrap());
+    assert_eq!(String::from_utf8(json).unwrap(), r#"{"1":true,"2":true,"3":true}"#);
+    
+    // The live store moved on
+    assert_eq!(store.get("users/1/name").unwrap(), Some("Alicia".to_string()));
+    assert_eq!(store.get("users/2/name").unwrap(), None);
+    assert_eq!(store.get_range("rooms/", "rooms0").unwrap(), owned(&[("rooms/b/topic", "new")]));
+    assert!(store.snapshot().seq() > snap.seq());
+    
+    // Concurrent writers: a snapshot never sees part of a batch
+    std::thread::scope(|scope| {
+        let writer = scope.spawn(|| {
+            for i in 0..500 {
+                let v = i.to_string();
+                let mut batch = WriteBatch::new();
+                batch.set("pair/a", &v, false).set("pair/b", &v, false);
+                store.write(&batch).unwrap();
+            }
+        });
+        while !writer.is_finished() {
+            let snap = store.snapshot();
+            assert_eq!(snap.get("pair/a").unwrap(), snap.get("pair/b").unwrap());
+        }
+    });
+    
+    cleanup(&dir);
+}
+
+fn test_durability_modes() {
+    let dir = test_dir("durability");
+    let wal_len = || wal_files(&dir).iter()
+        .map(|p| std::fs::metadata(p).map(|m| m.len()).unwrap_or(0))
+        .sum::<u64>();
+    
+    {
+        let store = Store::open(std::path::Path::new(&dir)).unwrap();
+        
+        // Sync acks only after the record reached the file
+        let before = wal_len();
+        store.set_with("sync/key", "v1", false, Durability::Sync).unwrap();
+        assert!(wal_len() > before, "Sync write should be in the WAL on return");
+        
+        // Concurrent sync writers share commits and all survive
+        let store = Arc::new(store);
+        let handles: Vec<_> = (0..4).map(|t| {
+            let store = store.clone();
+            thread::spawn(move || {
+                for i in 0..50 {
+                    store.set_with(&format!("sync/t{}/{}", t, i), "v", false, Durability::Sync).unwrap();
+                }
+            })
+        }).collect();
+        for handle in handles {
+            handle.join().unwrap();
+        }
+        
+        store.delete_with("sync/key", Durability::Sync).unwrap();
+        
+        // None skips the WAL, so it only survives a flush
+        store.set_with("unlogged", "gone", false, Durability::None).unwrap();
+        assert_eq!(store.get("unlogged").unwrap(), Some("gone".to_string()));
+    }
+    
+    {
+        let store = Store::open(std::path::Path::new(&dir)).unwrap();
+        assert_eq!(store.get("sync/key").unwrap(), None);
+        assert_eq!(store.get("sync/t3/49").unwrap(), Some("v".to_string()));
+        assert_eq!(store.get("unlogged").unwrap(), None);
+    }
+    
+    cleanup(&dir);
+}
+
+fn test_wal_checkpoint() {
+    let dir = test_dir("wal_checkpoint");
+    
+    {
+        let store = Store::open(std::path::Path::new(&dir)).unwrap();
+        for i in 0..100 {
+            store.set(&format!("old/{}", i), "flushed", false).unwrap();
+        }
+        store.set("gone/a", "1", false).unwrap();
+        store.delete_subtree("gone/").unwrap();
+        store.flush().unwrap();
+        
+        // The flush checkpoint retires every rotated WAL file
+        assert_eq!(wal_files(&dir).len(), 1, "Covered WAL files should be deleted");
+        
+        store.set("new/key", "unflushed", false).unwrap();
+    }
+    
+    {
+        let store = Store::open(std::path::Path::new(&dir)).unwrap();
+        assert_eq!(store.get("old/42").unwrap(), Some("flushed".to_string()));
+        assert_eq!(store.get("new/key").unwrap(), Some("unflushed".to_string()));
+        // Subtombs are carried across rotations
+        assert_eq!(store.get("gone/a").unwrap(), None);
+        store.flush().unwrap();
+    }
+    
+    {
+        let store = Store::open(std::path::Path::new(&dir)).unwrap();
+        assert_eq!(store.get("new/key").unwrap(), Some("unflushed".to_string()));
+        assert_eq!(store.get("gone/a").unwrap(), None);
+    }
+    
+    cleanup(&dir);
+}
+
 // ==================== BATCH OPERATIONS ====================
 
 fn test_bulk_insert() {
@@ -485,6 +1760,164 @@ fn test_cache_effectiveness() {
 
 // ==================== CONCURRENT ACCESS ====================
 
+fn test_block_cache_stats() {
+    let dir = test_dir("cache_stats");
+    
+    {
+        let store = Store::open(std::path::Path::new(&dir)).unwrap();
+        for i in 0..5000 {
+            store.set(&format!("key{:05}", i), &format!("value{}", i), false).unwrap();
+        }
+        store.flush().unwrap();
+    }
+    
+    // Unmapped segments with a cache far smaller than the data
+    let options = Options {
+        use_mmap: false,
+        cache_capacity: 64 * 1024,
+        ..Options::default()
+    };
+    let store = Store::open_with_options(std::path::Path::new(&dir), options).unwrap();
+    
+    for i in 0..5000 {
+        store.get(&format!("key{:05}", i)).unwrap();
+    }
+    let cold = store.cache_stats();
+    assert!(cold.misses > 0, "First pass should miss");
+    assert!(cold.evictions > 0, "Cache should have had to evict");
+    assert!(cold.size_bytes <= cold.capacity_bytes, "Cache over capacity: {:?}", cold);
+    
+    // A hot key keeps hitting
+    for _ in 0..100 {
+        store.get("key00042").unwrap();
+    }
+    let warm = store.cache_stats();
+    assert!(warm.hits >= cold.hits + 99, "Hot block should stay cached: {:?}", warm);
+    
+    cleanup(&dir);
+}
+
+// Minimal executor for the store's futures: park until woken
+fn block_on<F: std::future::Future>(future: F) -> F::Output {
+    use std::task::{Context, Poll, Wake, Waker};
+    
+    struct Unpark(thread::Thread);
+    impl Wake for Unpark {
+        fn wake(self: Arc<Self>) {
+            self.0.unpark();
+        }
+    }
+    
+    let waker = Waker::from(Arc::new(Unpark(thread::current())));
+    let mut cx = Context::from_waker(&waker);
+    let mut future = Box::pin(future);
+    loop {
+        if let Poll::Ready(output) = future.as_mut().poll(&mut cx) {
+            return output;
+        }
+        thread::park();
+    }
+}
+
+fn test_store_stats() {
+    let dir = test_dir("store_stats");
+    let options = Options { use_mmap: false, ..Options::default() };
+    let store = Store::open_with_options(std::path::Path::new(&dir), options).unwrap();
+    
+    for i in 0..2000 {
+        store.set(&format!("key{:05}", i), "value", false).unwrap();
+    }
+    store.set_with("synced", "yes", false, Durability::Sync).unwrap();
+    store.flush().unwrap();
+    for i in 0..2000 {
+        assert!(store.get(&format!("key{:05}", i)).unwrap().is_some());
+    }
+    for i in 0..1000 {
+        assert!(store.get(&format!("absent{:05}", i)).unwrap().is_none());
+    }
+    
+    let stats = store.stats();
+    assert_eq!(stats.writes.count, 2001);
+    assert_eq!(stats.gets.count, 3000);
+    assert!(stats.gets.p50_ns <= stats.gets.p99_ns && stats.gets.p99_ns <= stats.gets.max_ns, "{:?}", stats.gets);
+    assert!(stats.writes.sum_ns >= stats.writes.max_ns);
+    assert!(stats.flushes.count >= 1 && stats.wal_syncs.count >= 1);
+    assert!(stats.cache_loads.count > 0 && stats.cache_loads.count == stats.cache.misses);
+    assert_eq!(stats.segments[0] + stats.segments[1] + stats.segments[2], 1);
+    
+    // Every read reached the one segment; blooms turned away nearly all misses
+    assert_eq!(stats.segment_gets, 3000);
+    assert_eq!(stats.read_amplification(), (2000 + stats.bloom_false_positives) as f64 / 3000.0);
+    assert!(stats.bloom_negatives > 950, "{:?}", stats);
+    assert_eq!(stats.bloom_negatives + stats.bloom_false_positives, 1000);
+    assert_eq!((stats.flush_errors, stats.compaction_errors, stats.last_background_error), (0, 0, None));
+    
+    let text = store.stats().to_prometheus();
+    assert!(text.contains("# TYPE antler_get_seconds summary\n"));
+    assert!(text.contains("antler_get_seconds_count 3000\n"));
+    assert!(text.contains("antler_segment_gets_total 3000\n"));
+    assert!(text.contains("antler_segments{level=\"0\"} 1\n") || text.contains("antler_segments{level=\"1\"} 1\n"));
+    assert!(text.lines().all(|l| l.starts_with('#') || l.split(' ').count() == 2), "{}", text);
+    
+    // Batches count as one write each, deferred or not
+    let mut batch = WriteBatch::new();
+    batch.set("batch/a", "1", false).set("batch/b", "2", false);
+    store.write(&batch).unwrap();
+    store.write_deferred(&batch).unwrap();
+    assert_eq!(store.stats().writes.count, 2003);
+    
+    // Reads answered inline count as gets too
+    assert!(store.get_if_resident("batch/a").is_some());
+    assert_eq!(store.stats().gets.count, 3001);
+    
+    // multi_get counts every path it answers
+    store.multi_get(&["batch/a", "batch/b", "batch/a", "key00001", "batch/"]).unwrap();
+    assert_eq!(store.stats().gets.count, 3006);
+    
+    cleanup(&dir);
+}
+
+fn test_resident_reads() {
+    let dir = test_dir("resident_reads");
+    let options = || Options { use_mmap: false, ..Options::default() };
+    
+    {
+        let store = Store::open_with_options(std::path::Path::new(&dir), options()).unwrap();
+        for i in 0..2000 {
+            store.set(&format!("k/{:05}", i), &format!("v{}", i), false).unwrap();
+        }
+    }
+    
+    let store = Store::open_with_options(std::path::Path::new(&dir), options()).unwrap();
+    store.flush().unwrap();
+    
+    // Segment blocks count only once they are cached
+    assert!(store.get_if_resident("k/00010").is_none());
+    assert_eq!(store.get("k/00010").unwrap(), Some("v10".to_string()));
+    assert_eq!(store.get_if_resident("k/00011").unwrap().unwrap(), Some("v11".to_string()));
+    assert_eq!(store.get_if_resident("zzz").unwrap().unwrap(), None);
+    assert!(store.get_if_resident("k/").is_none());
+    
+    store.set("k/00011", "new", false).unwrap();
+    assert_eq!(store.get_if_resident("k/00011").unwrap().unwrap(), Some("new".to_string()));
+    
+    // Deferred writes are visible at once and durable when the future completes
+    let wal_len = || wal_files(&dir).iter()
+        .map(|p| std::fs::metadata(p).map(|m| m.len()).unwrap_or(0))
+        .sum::<u64>();
+    let before = wal_len();
+    let mut batch = WriteBatch::new();
+    batch.set("deferred/a", "1", false).set("deferred/b", "2", false);
+    let durable = store.write_deferred(&batch).unwrap();
+    assert_eq!(store.get("deferred/b").unwrap(), Some("2".to_string()));
+    block_on(durable).unwrap();
+    assert!(wal_len() > before, "Deferred write should be in the WAL once acked");
+    block_on(store.write_deferred(&WriteBatch::new()).unwrap()).unwrap();
+    assert!(!store.write_would_stall());
+    
+    cleanup(&dir);
+}
+
 fn test_concurrent_reads() {
     let dir = test_dir("concurrent_reads");
     let store = Arc::new(Store::open(std::path::Path::new(&dir)).unwrap());
@@ -515,6 +1948,43 @@ fn test_concurrent_reads() {
     cleanup(&dir);
 }
 
+fn test_concurrent_positional_reads() {
+    let dir = test_dir("concurrent_pread");
+    
+    {
+        let store = Store::open(std::path::Path::new(&dir)).unwrap();
+        for i in 0..5000 {
+            store.set(&format!("key{:05}", i), &format!("value{}", i), false).unwrap();
+        }
+        store.flush().unwrap();
+    }
+    
+    // Every thread misses the tiny cache constantly, so they all read blocks
+    // through the segment's shared file handle at once
+    let options = Options {
+        use_mmap: false,
+        cache_capacity: 16 * 1024,
+        ..Options::default()
+    };
+    let store = Arc::new(Store::open_with_options(std::path::Path::new(&dir), options).unwrap());
+    
+    let mut handles = vec![];
+    for t in 0..8 {
+        let store = store.clone();
+        handles.push(thread::spawn(move || {
+            for i in 0..2000 {
+                let n = (i * 7919 + t * 613) % 5000;
+                assert_eq!(store.get(&format!("key{:05}", n)).unwrap(), Some(format!("value{}", n)));
+            }
+        }));
+    }
+    for handle in handles {
+        handle.join().unwrap();
+    }
+    
+    cleanup(&dir);
+}
+
 fn test_concurrent_read_write() {
     let dir = test_dir("concurrent_rw");
     let store = Arc::new(Store::open(std::path::Path::new(&dir)).unwrap());
@@ -550,6 +2020,43 @@ fn test_concurrent_read_write() {
     cleanup(&dir);
 }
 
+fn test_concurrent_writes_across_flushes() {
+    let dir = test_dir("concurrent_flush");
+    let store = Arc::new(Store::open(std::path::Path::new(&dir)).unwrap());
+    let value = "x".repeat(100);
+    
+    // Enough data to seal and flush the memtable several times mid-write
+    let mut handles = vec![];
+    for t in 0..8 {
+        let store = store.clone();
+        let value = value.clone();
+        handles.push(thread::spawn(move || {
+            for i in 0..500 {
+                let key = format!("w{}/{}", t, i);
+                store.set(&key, &value, false).unwrap();
+                assert_eq!(store.get(&key).unwrap().as_deref(), Some(value.as_str()), "Write not visible to its writer");
+            }
+        }));
+    }
+    for handle in handles {
+        handle.join().unwrap();
+    }
+    
+    assert_eq!(store.scan_prefix("w3/", usize::MAX).unwrap().len(), 500);
+    
+    // At least one memtable was sealed mid-write, plus the final one
+    store.flush().unwrap();
+    assert!(store.segment_counts().0 >= 2, "Memtable should have been flushed while writing");
+    drop(store);
+    
+    let store = Store::open(std::path::Path::new(&dir)).unwrap();
+    for t in 0..8 {
+        assert_eq!(store.get(&format!("w{}/499", t)).unwrap().as_deref(), Some(value.as_str()));
+    }
+    
+    cleanup(&dir);
+}
+
 // ==================== ERROR HANDLING ====================
 
 fn test_invalid_operations() {
@@ -705,30 +2212,59 @@ fn main() {
         ("Deep Nesting", test_deep_nesting as fn()),
         ("Parent Scalar Violation", test_parent_scalar_violation as fn()),
         ("Scalar to Tree", test_scalar_to_tree_conversion as fn()),
+        ("Scalar Ancestor Check", test_scalar_ancestor_check as fn()),
         ("Subtree JSON", test_get_subtree_as_json as fn()),
+        ("Subtree Streaming", test_subtree_streaming as fn()),
         ("Delete Subtree", test_delete_subtree as fn()),
         ("Replace Subtree", test_replace_subtree as fn()),
+        ("Subtree Tombstone Compaction", test_subtree_tombstone_compaction as fn()),
         ("Persistence", test_persistence_across_restarts as fn()),
         ("WAL Recovery", test_wal_recovery as fn()),
         ("Flush to Disk", test_flush_to_disk as fn()),
+        ("Background Flush", test_background_flush as fn()),
+        ("Segment Read Modes", test_segment_read_modes as fn()),
+        ("Segment Open", test_segment_open as fn()),
+        ("Multi Get", test_multi_get as fn()),
+        ("Segment Prefix Compression", test_segment_prefix_compression as fn()),
+        ("Block Compression", test_block_compression as fn()),
+        ("Bloom Filters", test_bloom_filters as fn()),
+        ("Durability Modes", test_durability_modes as fn()),
+        ("Write Batch", test_write_batch as fn()),
+        ("Bulk Ingest", test_bulk_ingest as fn()),
+        ("Checkpoint", test_checkpoint as fn()),
+        ("Secondary Indexes", test_secondary_indexes as fn()),
+        ("Change Feed", test_change_feed as fn()),
+        ("Server", test_server as fn()),
+        ("Snapshots", test_snapshots as fn()),
+        ("WAL Checkpoint", test_wal_checkpoint as fn()),
         ("Bulk Insert", test_bulk_insert as fn()),
         ("Prefix Operations", test_prefix_operations as fn()),
+        ("Range Iterator", test_range_iterator as fn()),
         ("Unicode Support", test_unicode_support as fn()),
         ("Empty Values", test_empty_values as fn()),
         ("Special Paths", test_special_paths as fn()),
         ("Write Performance", test_write_performance as fn()),
         ("Read Performance", test_read_performance as fn()),
         ("Cache Effectiveness", test_cache_effectiveness as fn()),
+        ("Block Cache Stats", test_block_cache_stats as fn()),
+        ("Store Stats", test_store_stats as fn()),
+        ("Resident Reads", test_resident_reads as fn()),
         ("Concurrent Reads", test_concurrent_reads as fn()),
+        ("Concurrent Positional Reads", test_concurrent_positional_reads as fn()),
         ("Concurrent Read/Write", test_concurrent_read_write as fn()),
+        ("Concurrent Writes Across Flushes", test_concurrent_writes_across_flushes as fn()),
         ("Invalid Operations", test_invalid_operations as fn()),
         ("Compaction", test_compaction as fn()),
+        ("Streaming Compaction", test_streaming_compaction as fn()),
+        ("Leveled Compaction", test_leveled_compaction as fn()),
+        ("Subcompactions", test_subcompactions as fn()),
         ("Group Commit", test_group_commit_behavior as fn()),
         ("Range Queries", test_range_queries as fn()),
         ("Tombstones", test_tombstone_behavior as fn()),
         ("Wildcard Star Match", test_wildcard_star_match as fn()),
         ("Wildcard Question Match", test_wildcard_question_match as fn()),
         ("Wildcard Delete", test_wildcard_delete as fn()),
+        ("Wildcard Planner", test_wildcard_planner as fn()),
     ];
     
     let mut passed = 0;
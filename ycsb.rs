@@ -0,0 +1,547 @@
+// YCSB-style workload harness for Antler
+// Loads a data set larger than the block cache, then runs workloads A-F with
+// Zipfian keys across N threads and reports p50/p99/p999 per operation type.
+//
+//   rustc -O ycsb.rs -o /tmp/antler_ycsb
+//   /tmp/antler_ycsb --workloads abcfde --records 200000 --ops 400000 --threads 8 --json ycsb.json
+//
+// Runs are reproducible for a given --seed and thread count: every thread
+// draws from its own seeded generator.
+
+mod antler_store {
+    include!("antler.rs");
+}
+
+use antler_store::*;
+use std::collections::BTreeMap;
+use std::sync::atomic::{AtomicU64, Ordering};
+use std::sync::Arc;
+use std::thread;
+use std::time::{Duration, Instant};
+
+#[derive(Debug, Clone)]
+struct Config {
+    workloads: String,
+    records: u64,
+    ops: u64,
+    threads: usize,
+    value_size: usize,
+    theta: f64,
+    scan_max: usize,
+    cache_mb: usize,
+    mmap: bool,
+    seed: u64,
+    dir: String,
+    json: Option<String>,
+}
+
+impl Default for Config {
+    fn default() -> Self {
+        Config {
+            workloads: "abcfde".to_string(),
+            records: 200_000,
+            ops: 200_000,
+            threads: 4,
+            value_size: 1000,
+            theta: 0.99,
+            scan_max: 100,
+            cache_mb: 32,
+            mmap: false,
+            seed: 42,
+            dir: format!("/tmp/antler_ycsb_{}", std::process::id()),
+            json: None,
+        }
+    }
+}
+
+fn usage() -> ! {
+    eprintln!("usage: ycsb [--workloads abcdef] [--records N] [--ops N] [--threads N]");
+    eprintln!("            [--value-size BYTES] [--theta 0.99] [--scan-max N] [--cache-mb MB]");
+    eprintln!("            [--mmap] [--seed N] [--dir PATH] [--json PATH]");
+    std::process::exit(2);
+}
+
+fn parse_args() -> Config {
+    let mut config = Config::default();
+    let mut args = std::env::args().skip(1);
+    while let Some(flag) = args.next() {
+        if flag == "--mmap" {
+            config.mmap = true;
+            continue;
+        }
+        let value = args.next().unwrap_or_else(|| usage());
+        let number = || value.parse::<u64>().unwrap_or_else(|_| usage());
+        match flag.as_str() {
+            "--workloads" => config.workloads = value.to_lowercase(),
+            "--records" => config.records = number().max(1),
+            "--ops" => config.ops = number(),
+            "--threads" => config.threads = number().max(1) as usize,
+            "--value-size" => config.value_size = number() as usize,
+            "--theta" => config.theta = value.parse().unwrap_or_else(|_| usage()),
+            "--scan-max" => config.scan_max = number().max(1) as usize,
+            "--cache-mb" => config.cache_mb = number() as usize,
+            "--seed" => config.seed = number(),
+            "--dir" => config.dir = value,
+            "--json" => config.json = Some(value),
+            _ => usage(),
+        }
+    }
+    if config.workloads.chars().any(|c| !"abcdef".contains(c)) {
+        usage();
+    }
+    config
+}
+
+// ==================== WORKLOADS ====================
+
+#[derive(Debug, Clone, Copy, PartialEq, Eq, PartialOrd, Ord)]
+enum Op {
+    Read,
+    Update,
+    Insert,
+    Scan,
+    ReadModifyWrite,
+}
+
+impl Op {
+    fn name(self) -> &'static str {
+        match self {
+            Op::Read => "read",
+            Op::Update => "update",
+            Op::Insert => "insert",
+            Op::Scan => "scan",
+            Op::ReadModifyWrite => "read_modify_write",
+        }
+    }
+}
+
+#[derive(Debug, Clone, Copy, PartialEq, Eq)]
+enum KeyChoice {
+    Zipfian,
+    Latest,  // Skewed towards the most recent inserts
+}
+
+// Operation mix in percent, and how keys are picked
+struct Workload {
+    name: char,
+    description: &'static str,
+    mix: &'static [(Op, u32)],
+    keys: KeyChoice,
+}
+
+fn workload(name: char) -> Workload {
+    let (description, mix, keys): (_, &'static [(Op, u32)], _) = match name {
+        'a' => ("update heavy", &[(Op::Read, 50), (Op::Update, 50)], KeyChoice::Zipfian),
+        'b' => ("read mostly", &[(Op::Read, 95), (Op::Update, 5)], KeyChoice::Zipfian),
+        'c' => ("read only", &[(Op::Read, 100)], KeyChoice::Zipfian),
+        'd' => ("read latest", &[(Op::Read, 95), (Op::Insert, 5)], KeyChoice::Latest),
+        'e' => ("short ranges", &[(Op::Scan, 95), (Op::Insert, 5)], KeyChoice::Zipfian),
+        'f' => ("read-modify-write", &[(Op::Read, 50), (Op::ReadModifyWrite, 50)], KeyChoice::Zipfian),
+        _ => unreachable!(),
+    };
+    Workload { name, description, mix, keys }
+}
+
+fn pick_op(mix: &[(Op, u32)], roll: u32) -> Op {
+    let mut acc = 0;
+    for &(op, pct) in mix {
+        acc += pct;
+        if roll < acc {
+            return op;
+        }
+    }
+    mix[mix.len() - 1].0
+}
+
+// Record numbers are hashed into keys so inserts land all over the key space,
+// as YCSB's hashed insert order does
+fn record_key(n: u64) -> String {
+    format!("usertable/user{:020}", fnv64(n))
+}
+
+fn fnv64(n: u64) -> u64 {
+    let mut hash: u64 = 0xCBF2_9CE4_8422_2325;
+    for byte in n.to_le_bytes().iter() {
+        hash ^= *byte as u64;
+        hash = hash.wrapping_mul(0x0000_0100_0000_01B3);
+    }
+    hash
+}
+
+// ==================== GENERATORS ====================
+
+// SplitMix64: small, fast and seedable
+struct Rng(u64);
+
+impl Rng {
+    fn next(&mut self) -> u64 {
+        self.0 = self.0.wrapping_add(0x9E37_79B9_7F4A_7C15);
+        let mut z = self.0;
+        z = (z ^ (z >> 30)).wrapping_mul(0xBF58_476D_1CE4_E5B9);
+        z = (z ^ (z >> 27)).wrapping_mul(0x94D0_49BB_1331_11EB);
+        z ^ (z >> 31)
+    }
+
+    fn unit(&mut self) -> f64 {
+        (self.next() >> 11) as f64 / (1u64 << 53) as f64
+    }
+
+    fn below(&mut self, n: u64) -> u64 {
+        ((self.next() as u128 * n as u128) >> 64) as u64
+    }
+}
+
+// Zipfian ranks over [0, n) after Gray et al., "Quickly Generating
+// Billion-Record Synthetic Databases", as YCSB's ZipfianGenerator. Rank 0 is
+// the hottest; callers scramble ranks so hot keys are spread out.
+#[derive(Debug, Clone)]
+struct Zipfian {
+    n: u64,
+    theta: f64,
+    alpha: f64,
+    zetan: f64,
+    eta: f64,
+}
+
+impl Zipfian {
+    fn new(n: u64, theta: f64) -> Self {
+        let zeta = |n: u64| (1..=n).map(|i| 1.0 / (i as f64).powf(theta)).sum::<f64>();
+        let zetan = zeta(n);
+        let zeta2 = zeta(2.min(n));
+        Zipfian {
+            n,
+            theta,
+            alpha: 1.0 / (1.0 - theta),
+            zetan,
+            eta: (1.0 - (2.0 / n as f64).powf(1.0 - theta)) / (1.0 - zeta2 / zetan),
+        }
+    }
+
+    fn next(&self, rng: &mut Rng) -> u64 {
+        let u = rng.unit();
+        let uz = u * self.zetan;
+        if uz < 1.0 {
+            return 0;
+        }
+        if uz < 1.0 + 0.5f64.powf(self.theta) {
+            return 1.min(self.n - 1);
+        }
+        let rank = (self.n as f64 * (self.eta * u - self.eta + 1.0).powf(self.alpha)) as u64;
+        rank.min(self.n - 1)
+    }
+}
+
+// ==================== HISTOGRAM ====================
+
+// HDR-style histogram in nanoseconds: 128 linear sub-buckets per power of two,
+// so recorded values are kept to within 1%. Each thread fills its own and
+// they are merged once the run ends.
+const SUB_BUCKET_BITS: u32 = 7;
+const SUB_BUCKETS: usize = 1 << SUB_BUCKET_BITS;
+
+#[derive(Clone)]
+struct Histogram {
+    counts: Vec<u64>,
+    total: u64,
+    sum: u128,
+    max: u64,
+}
+
+impl Histogram {
+    fn new() -> Self {
+        Histogram { counts: vec![0; (64 - SUB_BUCKET_BITS as usize + 1) * SUB_BUCKETS], total: 0, sum: 0, max: 0 }
+    }
+
+    fn index(ns: u64) -> usize {
+        if ns < SUB_BUCKETS as u64 {
+            return ns as usize;
+        }
+        let shift = 63 - ns.leading_zeros() - SUB_BUCKET_BITS;
+        (shift as usize + 1) * SUB_BUCKETS + ((ns >> shift) as usize - SUB_BUCKETS)
+    }
+
+    // Highest value that lands in bucket `idx`
+    fn value_at(idx: usize) -> u64 {
+        if idx < SUB_BUCKETS {
+            return idx as u64;
+        }
+        let shift = (idx / SUB_BUCKETS - 1) as u32;
+        let low = ((SUB_BUCKETS + idx % SUB_BUCKETS) as u64) << shift;
+        low + ((1u64 << shift) - 1)
+    }
+
+    fn record(&mut self, elapsed: Duration) {
+        let ns = elapsed.as_nanos().min(u64::MAX as u128) as u64;
+        self.counts[Self::index(ns)] += 1;
+        self.total += 1;
+        self.sum += ns as u128;
+        self.max = self.max.max(ns);
+    }
+
+    fn merge(&mut self, other: &Histogram) {
+        for (a, b) in self.counts.iter_mut().zip(other.counts.iter()) {
+            *a += b;
+        }
+        self.total += other.total;
+        self.sum += other.sum;
+        self.max = self.max.max(other.max);
+    }
+
+    fn percentile(&self, q: f64) -> u64 {
+        if self.total == 0 {
+            return 0;
+        }
+        let rank = ((self.total as f64 * q).ceil() as u64).max(1);
+        let mut seen = 0;
+        for (idx, &count) in self.counts.iter().enumerate() {
+            seen += count;
+            if seen >= rank {
+                return Self::value_at(idx).min(self.max);
+            }
+        }
+        self.max
+    }
+
+    fn mean(&self) -> f64 {
+        if self.total == 0 { 0.0 } else { self.sum as f64 / self.total as f64 }
+    }
+}
+
+// ==================== RUNNER ====================
+
+struct RunResult {
+    name: String,
+    description: String,
+    ops: u64,
+    duration: Duration,
+    latencies: BTreeMap<Op, Histogram>,
+    stats: Stats,
+}
+
+// Insert the initial records, split over the configured threads
+fn load(store: &Store, config: &Config) -> RunResult {
+    let value = "v".repeat(config.value_size);
+    let per_thread = (config.records + config.threads as u64 - 1) / config.threads as u64;
+    let before = store.stats();
+    let start = Instant::now();
+    let histograms: Vec<Histogram> = thread::scope(|scope| {
+        let handles: Vec<_> = (0..config.threads as u64).map(|t| {
+            let value = &value;
+            scope.spawn(move || {
+                let mut histogram = Histogram::new();
+                let end = ((t + 1) * per_thread).min(config.records);
+                for n in t * per_thread..end {
+                    let op_start = Instant::now();
+                    store.set(&record_key(n), value, false).unwrap();
+                    histogram.record(op_start.elapsed());
+                }
+                histogram
+            })
+        }).collect();
+        handles.into_iter().map(|h| h.join().unwrap()).collect()
+    });
+    // Settle flushes and compaction so the workloads start from a steady tree
+    store.flush().unwrap();
+    store.compact().unwrap();
+    let duration = start.elapsed();
+
+    let mut merged = Histogram::new();
+    for histogram in &histograms {
+        merged.merge(histogram);
+    }
+    let mut latencies = BTreeMap::new();
+    latencies.insert(Op::Insert, merged);
+    RunResult {
+        name: "load".to_string(),
+        description: format!("{} records of {} bytes", config.records, config.value_size),
+        ops: config.records,
+        duration,
+        latencies,
+        stats: stats_since(&before, store.stats()),
+    }
+}
+
+fn run(store: &Store, config: &Config, workload: &Workload, inserted: &AtomicU64) -> RunResult {
+    // Sized for the keys that exist now; inserts during the run fall outside
+    // the Zipfian range until the next workload
+    let zipf = Arc::new(Zipfian::new(inserted.load(Ordering::SeqCst), config.theta));
+    let value = "w".repeat(config.value_size);
+    let per_thread = config.ops / config.threads as u64;
+
+    let before = store.stats();
+    let start = Instant::now();
+    let results: Vec<BTreeMap<Op, Histogram>> = thread::scope(|scope| {
+        let handles: Vec<_> = (0..config.threads as u64).map(|t| {
+            let zipf = zipf.clone();
+            let value = &value;
+            scope.spawn(move || {
+                let mut rng = Rng(config.seed ^ ((workload.name as u64) << 32) ^ t);
+                let mut latencies: BTreeMap<Op, Histogram> = BTreeMap::new();
+                for _ in 0..per_thread {
+                    let op = pick_op(workload.mix, rng.below(100) as u32);
+                    let rank = zipf.next(&mut rng);
+                    let key = match workload.keys {
+                        KeyChoice::Zipfian => record_key(fnv64(rank) % zipf.n),
+                        KeyChoice::Latest => record_key(inserted.load(Ordering::Relaxed).saturating_sub(rank + 1)),
+                    };
+
+                    let op_start = Instant::now();
+                    match op {
+                        Op::Read => {
+                            store.get(&key).unwrap();
+                        }
+                        Op::Update => store.set(&key, value, false).unwrap(),
+                        Op::Insert => {
+                            let n = inserted.fetch_add(1, Ordering::Relaxed);
+                            store.set(&record_key(n), value, false).unwrap();
+                        }
+                        Op::Scan => {
+                            let len = 1 + rng.below(config.scan_max as u64) as usize;
+                            for item in store.iter_range(&key, "usertable0").unwrap().take(len) {
+                                item.unwrap();
+                            }
+                        }
+                        Op::ReadModifyWrite => {
+                            let old = store.get(&key).unwrap().unwrap_or_default();
+                            let mut new = value[..value.len().saturating_sub(1)].to_string();
+                            new.push(old.chars().next().unwrap_or('w'));
+                            store.set(&key, &new, false).unwrap();
+                        }
+                    }
+                    latencies.entry(op).or_insert_with(Histogram::new).record(op_start.elapsed());
+                }
+                latencies
+            })
+        }).collect();
+        handles.into_iter().map(|h| h.join().unwrap()).collect()
+    });
+    let duration = start.elapsed();
+
+    let mut latencies: BTreeMap<Op, Histogram> = BTreeMap::new();
+    for thread_latencies in &results {
+        for (op, histogram) in thread_latencies {
+            latencies.entry(*op).or_insert_with(Histogram::new).merge(histogram);
+        }
+    }
+    RunResult {
+        name: workload.name.to_string(),
+        description: workload.description.to_string(),
+        ops: per_thread * config.threads as u64,
+        duration,
+        latencies,
+        stats: stats_since(&before, store.stats()),
+    }
+}
+
+// The counters of `after` less those of `before`, so a run reports only
+// its own cache, bloom and stall activity. Gauges keep their `after` value.
+fn stats_since(before: &Stats, mut after: Stats) -> Stats {
+    after.cache.hits -= before.cache.hits;
+    after.cache.misses -= before.cache.misses;
+    after.cache.evictions -= before.cache.evictions;
+    after.write_stalls -= before.write_stalls;
+    after.write_stall_ns -= before.write_stall_ns;
+    after.segment_gets -= before.segment_gets;
+    after.segment_probes -= before.segment_probes;
+    after.bloom_negatives -= before.bloom_negatives;
+    after.bloom_false_positives -= before.bloom_false_positives;
+    after
+}
+
+// ==================== REPORT ====================
+
+fn micros(ns: u64) -> f64 {
+    ns as f64 / 1000.0
+}
+
+fn print_result(result: &RunResult) {
+    println!("\n  [{}] {} - {} ops in {:.2}s = {:.0} ops/sec",
+        result.name.to_uppercase(), result.description, result.ops,
+        result.duration.as_secs_f64(), result.ops as f64 / result.duration.as_secs_f64());
+    println!("    {:18} {:>10} {:>10} {:>10} {:>10} {:>10} {:>10}", "op", "count", "mean_us", "p50_us", "p99_us", "p999_us", "max_us");
+    for (op, h) in &result.latencies {
+        println!("    {:18} {:>10} {:>10.1} {:>10.1} {:>10.1} {:>10.1} {:>10.1}", op.name(), h.total,
+            h.mean() / 1000.0, micros(h.percentile(0.50)), micros(h.percentile(0.99)),
+            micros(h.percentile(0.999)), micros(h.max));
+    }
+    let cache = &result.stats.cache;
+    println!("    cache hit rate {:.1}%, {:.2} segments per read, {} write stalls, segments {:?}",
+        cache.hits as f64 * 100.0 / (cache.hits + cache.misses).max(1) as f64,
+        result.stats.read_amplification(), result.stats.write_stalls, result.stats.segments);
+}
+
+fn json_string(s: &str) -> String {
+    format!("\"{}\"", s.replace('\\', "\\\\").replace('"', "\\\""))
+}
+
+// One object per run, stable keys, for diffing between commits
+fn to_json(config: &Config, results: &[RunResult]) -> String {
+    let mut out = String::from("{\n  \"config\": {");
+    out.push_str(&format!(
+        "\"workloads\": {}, \"records\": {}, \"ops\": {}, \"threads\": {}, \"value_size\": {}, \
+         \"theta\": {}, \"scan_max\": {}, \"cache_mb\": {}, \"mmap\": {}, \"seed\": {}",
+        json_string(&config.workloads), config.records, config.ops, config.threads, config.value_size,
+        config.theta, config.scan_max, config.cache_mb, config.mmap, config.seed));
+    out.push_str("},\n  \"runs\": [");
+    for (i, result) in results.iter().enumerate() {
+        if i > 0 {
+            out.push(',');
+        }
+        out.push_str(&format!(
+            "\n    {{\"workload\": {}, \"ops\": {}, \"duration_s\": {:.6}, \"ops_per_sec\": {:.1}, \
+             \"cache_hits\": {}, \"cache_misses\": {}, \"read_amplification\": {:.3}, \"write_stalls\": {}, \"latency_us\": {{",
+            json_string(&result.name), result.ops, result.duration.as_secs_f64(),
+            result.ops as f64 / result.duration.as_secs_f64(), result.stats.cache.hits,
+            result.stats.cache.misses, result.stats.read_amplification(), result.stats.write_stalls));
+        for (j, (op, h)) in result.latencies.iter().enumerate() {
+            if j > 0 {
+                out.push_str(", ");
+            }
+            out.push_str(&format!(
+                "{}: {{\"count\": {}, \"mean\": {:.3}, \"p50\": {:.3}, \"p99\": {:.3}, \"p999\": {:.3}, \"max\": {:.3}}}",
+                json_string(op.name()), h.total, h.mean() / 1000.0, micros(h.percentile(0.50)),
+                micros(h.percentile(0.99)), micros(h.percentile(0.999)), micros(h.max)));
+        }
+        out.push_str("}}");
+    }
+    out.push_str("\n  ]\n}\n");
+    out
+}
+
+fn main() {
+    let config = parse_args();
+    let _ = std::fs::remove_dir_all(&config.dir);
+
+    let options = Options {
+        use_mmap: config.mmap,
+        cache_capacity: config.cache_mb * 1024 * 1024,
+        ..Options::default()
+    };
+    let store = Store::open_with_options(std::path::Path::new(&config.dir), options).unwrap();
+
+    println!("\n{:^80}", "ANTLER YCSB WORKLOADS");
+    println!("{}", "=".repeat(80));
+    println!("  {} records x {} bytes ({} MB) against a {} MB block cache{}, {} threads, theta {}",
+        config.records, config.value_size, config.records * config.value_size as u64 / (1024 * 1024),
+        config.cache_mb, if config.mmap { " (segments mapped)" } else { "" }, config.threads, config.theta);
+
+    let mut results = Vec::new();
+    let loaded = load(&store, &config);
+    print_result(&loaded);
+    results.push(loaded);
+
+    let inserted = AtomicU64::new(config.records);
+    for name in config.workloads.chars() {
+        let result = run(&store, &config, &workload(name), &inserted);
+        print_result(&result);
+        results.push(result);
+    }
+
+    if let Some(path) = &config.json {
+        std::fs::write(path, to_json(&config, &results)).unwrap();
+        println!("\n  Wrote {}", path);
+    }
+
+    drop(store);
+    let _ = std::fs::remove_dir_all(&config.dir);
+}